@@ -16,5 +16,4 @@
 # limitations under the License.
 
 $(info gralloc for juno)
-GRALLOC_FB_SWAP_RED_BLUE := 1
 GRALLOC_FB_BPP := 32
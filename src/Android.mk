@@ -46,6 +46,18 @@ MALI_GPU_SUPPORT_AFBC_WIDEBLK?=0
 MALI_GPU_SUPPORT_AFBC_TILED_HEADERS?=0
 # GPU support YUV AFBC formats in wide block
 MALI_GPU_USE_YUV_AFBC_WIDEBLK?=0
+# GPU support for uncompressed block-linear (16x16 block) layouts
+MALI_GPU_SUPPORT_BLOCK_LINEAR?=0
+# VPU support for uncompressed block-linear (16x16 block) layouts
+MALI_VIDEO_SUPPORT_BLOCK_LINEAR?=0
+# Camera (ISP) support for AFBC 1.0
+MALI_CAMERA_SUPPORT_AFBC_BASIC?=0
+# Camera (ISP) support for writing YUV AFBC formats
+MALI_CAMERA_SUPPORT_AFBC_YUV?=0
+# Camera (ISP) support for AFBC 1.2 tiled headers
+MALI_CAMERA_SUPPORT_AFBC_TILED_HEADERS?=0
+# Rows the camera (ISP) writes below the last superblock row of AFBC buffers
+MALI_CAMERA_AFBC_EXTRA_ROWS?=0
 
 # VPU version we support
 MALI_VIDEO_VERSION?=0
@@ -75,8 +87,8 @@ GRALLOC_USE_ION_COMPOUND_PAGE_HEAP?=0
 GRALLOC_INIT_AFBC?=0
 # fbdev bitdepth to use
 GRALLOC_FB_BPP?=32
-# When enabled, forces display framebuffer format to BGRA_8888
-GRALLOC_FB_SWAP_RED_BLUE?=1
+# When enabled, posts copied to a 16bpp framebuffer are dithered
+GRALLOC_FB_DITHER?=1
 # Disables the framebuffer HAL device. When a hwc impl is available.
 GRALLOC_DISABLE_FRAMEBUFFER_HAL?=0
 # When enabled, buffers will never be allocated with AFBC
@@ -84,8 +96,59 @@ GRALLOC_ARM_NO_EXTERNAL_AFBC?=0
 # Minimum buffer dimensions in pixels when buffer will use AFBC
 GRALLOC_DISP_W?=0
 GRALLOC_DISP_H?=0
-# Vsync backend(not used)
+# Number of framebuffer ring buffers used for page flipping (2-4)
+GRALLOC_FB_NUM_BUFFERS?=2
+# Number of framebuffer displays (fb0..fbN-1) driven by the framebuffer HAL (1-4)
+GRALLOC_FB_NUM_DISPLAYS?=1
+# Scan out of fbdev memory exported per slot with FBIOGET_DMABUF, instead of copying ION buffers on post
+GRALLOC_FB_SCANOUT_DMABUF?=0
+# fbdev device used by the framebuffer HAL: hw, or virtual (in-process emulated display, see framebuffer_fbdev_virtual.cpp)
+GRALLOC_FB_DEVICE?=hw
+# Display backend of the framebuffer HAL: fbdev or kms (DRM atomic modesetting, needs libdrm)
+GRALLOC_FB_DISPLAY_BACKEND?=fbdev
+# Vsync backend: default, s3cfb or soft (timer based, for displays without FBIO_WAITFORVSYNC)
+ifeq ($(GRALLOC_FB_DISPLAY_BACKEND), kms)
+GRALLOC_VSYNC_BACKEND := kms
+else
 GRALLOC_VSYNC_BACKEND?=default
+endif
+# Maximum swap interval reported by the framebuffer HAL
+ifneq ($(filter soft kms, $(GRALLOC_VSYNC_BACKEND)),)
+GRALLOC_FB_MAX_SWAP_INTERVAL?=4
+else
+GRALLOC_FB_MAX_SWAP_INTERVAL?=1
+endif
+# Default backing store allocator: ion, or memfd (emulated heaps for running off-device, see
+# mali_gralloc_backend_memfd.cpp). Can be overridden at run time with the GRALLOC_ALLOC_BACKEND environment variable.
+GRALLOC_ALLOC_BACKEND?=ion
+# Build the ION backend, and link libion. Without it the default is the first backend built.
+GRALLOC_ION_BACKEND?=1
+# Back CPU-only buffers with sealed memfds instead of the allocation backend
+GRALLOC_CPU_BUFFERS_SHMEM?=1
+# Use huge pages (hugetlb, else transparent) for CPU-only buffers of 2MB or more
+GRALLOC_SHMEM_HUGE_PAGES?=1
+# Pick cached or uncached memory from observed CPU access, not only usage
+GRALLOC_ADAPTIVE_CACHE?=0
+# Publish the buffers each process holds for the gralloc_buffers tool
+GRALLOC_BUFFER_REGISTRY?=0
+GRALLOC_BUFFER_REGISTRY_DIR?=/data/vendor/gralloc/buffers
+# Record allocations, references and CPU accesses of each process for gralloc_replay
+GRALLOC_ALLOC_TRACE?=0
+GRALLOC_ALLOC_TRACE_DIR?=/data/vendor/gralloc/trace
+# Forward allocations to the gralloc_allocd daemon when it runs, allocating in-process otherwise
+GRALLOC_ALLOC_DAEMON?=0
+GRALLOC_ALLOC_DAEMON_SOCKET?=/dev/socket/gralloc_allocd
+# Send handles without their process-local and deprecated members. Only for DDKs which
+# read plane_info and alloc_format, and without the legacy calculations.
+GRALLOC_COMPACT_HANDLE?=0
+# Allocate descriptors and private handles from per-thread free lists instead of the heap
+GRALLOC_OBJECT_SLAB?=1
+# DMA-BUF heaps (/dev/dma_heap) backend, used in place of ION on kernels without it. Needs <linux/dma-heap.h>.
+ifeq ($(shell expr $(PLATFORM_SDK_VERSION) \> 30), 1)
+GRALLOC_DMA_HEAP_BACKEND?=1
+else
+GRALLOC_DMA_HEAP_BACKEND?=0
+endif
 
 ifdef GRALLOC_USE_LEGACY_ION_API
     $(warning Setting of 'GRALLOC_USE_LEGACY_ION_API' is ignored. It is derived from SDK version)
@@ -111,14 +174,12 @@ ifeq ($(MALI_VIDEO_VERSION), 0)
 MALI_VIDEO_VERSION = 550
 endif
 
-GRALLOC_FB_SWAP_RED_BLUE = 0
 GRALLOC_USE_ION_DMA_HEAP = 1
 endif
 endif
 
 ifeq ($(TARGET_BOARD_PLATFORM), armboard_v7a)
 ifeq ($(GRALLOC_MALI_DP),true)
-	GRALLOC_FB_SWAP_RED_BLUE = 0
 	GRALLOC_DISABLE_FRAMEBUFFER_HAL=1
 	MALI_DISPLAY_VERSION = 550
 	GRALLOC_USE_ION_DMA_HEAP=1
@@ -138,6 +199,12 @@ $(error GRALLOC_USE_ION_DMA_HEAP and GRALLOC_USE_ION_COMPOUND_PAGE_HEAP can't be
 endif
 endif
 
+ifeq ($(GRALLOC_COMPACT_HANDLE), 1)
+ifeq ($(GRALLOC_USE_LEGACY_CALCS_LOCK), 1)
+$(error GRALLOC_COMPACT_HANDLE needs GRALLOC_USE_LEGACY_CALCS_LOCK=0, the legacy strides aren't sent)
+endif
+endif
+
 LOCAL_C_INCLUDES := $(MALI_LOCAL_PATH) $(MALI_DDK_INCLUDES)
 LOCAL_C_INCLUDES += system/core/libion
 
@@ -150,6 +217,12 @@ LOCAL_CFLAGS += -DMALI_GPU_SUPPORT_AFBC_SPLITBLK=$(MALI_GPU_SUPPORT_AFBC_SPLITBL
 LOCAL_CFLAGS += -DMALI_GPU_SUPPORT_AFBC_WIDEBLK=$(MALI_GPU_SUPPORT_AFBC_WIDEBLK)
 LOCAL_CFLAGS += -DMALI_GPU_USE_YUV_AFBC_WIDEBLK=$(MALI_GPU_USE_YUV_AFBC_WIDEBLK)
 LOCAL_CFLAGS += -DMALI_GPU_SUPPORT_AFBC_TILED_HEADERS=$(MALI_GPU_SUPPORT_AFBC_TILED_HEADERS)
+LOCAL_CFLAGS += -DMALI_GPU_SUPPORT_BLOCK_LINEAR=$(MALI_GPU_SUPPORT_BLOCK_LINEAR)
+LOCAL_CFLAGS += -DMALI_VIDEO_SUPPORT_BLOCK_LINEAR=$(MALI_VIDEO_SUPPORT_BLOCK_LINEAR)
+LOCAL_CFLAGS += -DMALI_CAMERA_SUPPORT_AFBC_BASIC=$(MALI_CAMERA_SUPPORT_AFBC_BASIC)
+LOCAL_CFLAGS += -DMALI_CAMERA_SUPPORT_AFBC_YUV=$(MALI_CAMERA_SUPPORT_AFBC_YUV)
+LOCAL_CFLAGS += -DMALI_CAMERA_SUPPORT_AFBC_TILED_HEADERS=$(MALI_CAMERA_SUPPORT_AFBC_TILED_HEADERS)
+LOCAL_CFLAGS += -DMALI_CAMERA_AFBC_EXTRA_ROWS=$(MALI_CAMERA_AFBC_EXTRA_ROWS)
 
 LOCAL_CFLAGS += -DMALI_DISPLAY_VERSION=$(MALI_DISPLAY_VERSION)
 LOCAL_CFLAGS += -DMALI_VIDEO_VERSION=$(MALI_VIDEO_VERSION)
@@ -163,14 +236,45 @@ LOCAL_CFLAGS += -DGRALLOC_USE_ION_DMA_HEAP=$(GRALLOC_USE_ION_DMA_HEAP)
 LOCAL_CFLAGS += -DGRALLOC_USE_ION_COMPOUND_PAGE_HEAP=$(GRALLOC_USE_ION_COMPOUND_PAGE_HEAP)
 LOCAL_CFLAGS += -DGRALLOC_INIT_AFBC=$(GRALLOC_INIT_AFBC)
 LOCAL_CFLAGS += -DGRALLOC_FB_BPP=$(GRALLOC_FB_BPP)
-LOCAL_CFLAGS += -DGRALLOC_FB_SWAP_RED_BLUE=$(GRALLOC_FB_SWAP_RED_BLUE)
+LOCAL_CFLAGS += -DGRALLOC_FB_DITHER=$(GRALLOC_FB_DITHER)
+LOCAL_CFLAGS += -DGRALLOC_FB_MAX_SWAP_INTERVAL=$(GRALLOC_FB_MAX_SWAP_INTERVAL)
+LOCAL_CFLAGS += -DGRALLOC_FB_NUM_BUFFERS=$(GRALLOC_FB_NUM_BUFFERS)
+LOCAL_CFLAGS += -DGRALLOC_FB_NUM_DISPLAYS=$(GRALLOC_FB_NUM_DISPLAYS)
+LOCAL_CFLAGS += -DGRALLOC_FB_SCANOUT_DMABUF=$(GRALLOC_FB_SCANOUT_DMABUF)
+ifeq ($(GRALLOC_FB_DISPLAY_BACKEND), kms)
+LOCAL_CFLAGS += -DGRALLOC_FB_USE_KMS=1
+else
+LOCAL_CFLAGS += -DGRALLOC_FB_USE_KMS=0
+endif
+LOCAL_CFLAGS += -DGRALLOC_ALLOC_BACKEND=\"$(GRALLOC_ALLOC_BACKEND)\"
+LOCAL_CFLAGS += -DGRALLOC_ION_BACKEND=$(GRALLOC_ION_BACKEND)
+LOCAL_CFLAGS += -DGRALLOC_CPU_BUFFERS_SHMEM=$(GRALLOC_CPU_BUFFERS_SHMEM)
+LOCAL_CFLAGS += -DGRALLOC_SHMEM_HUGE_PAGES=$(GRALLOC_SHMEM_HUGE_PAGES)
+LOCAL_CFLAGS += -DGRALLOC_ADAPTIVE_CACHE=$(GRALLOC_ADAPTIVE_CACHE)
+LOCAL_CFLAGS += -DGRALLOC_BUFFER_REGISTRY=$(GRALLOC_BUFFER_REGISTRY)
+LOCAL_CFLAGS += -DGRALLOC_BUFFER_REGISTRY_DIR=\"$(GRALLOC_BUFFER_REGISTRY_DIR)\"
+LOCAL_CFLAGS += -DGRALLOC_ALLOC_TRACE=$(GRALLOC_ALLOC_TRACE)
+LOCAL_CFLAGS += -DGRALLOC_ALLOC_TRACE_DIR=\"$(GRALLOC_ALLOC_TRACE_DIR)\"
+LOCAL_CFLAGS += -DGRALLOC_ALLOC_DAEMON=$(GRALLOC_ALLOC_DAEMON)
+LOCAL_CFLAGS += -DGRALLOC_ALLOC_DAEMON_SOCKET=\"$(GRALLOC_ALLOC_DAEMON_SOCKET)\"
+LOCAL_CFLAGS += -DGRALLOC_COMPACT_HANDLE=$(GRALLOC_COMPACT_HANDLE)
+LOCAL_CFLAGS += -DGRALLOC_OBJECT_SLAB=$(GRALLOC_OBJECT_SLAB)
+LOCAL_CFLAGS += -DGRALLOC_DMA_HEAP_BACKEND=$(GRALLOC_DMA_HEAP_BACKEND)
 LOCAL_CFLAGS += -DGRALLOC_ARM_NO_EXTERNAL_AFBC=$(GRALLOC_ARM_NO_EXTERNAL_AFBC)
 LOCAL_CFLAGS += -DGRALLOC_LIBRARY_BUILD=1
 LOCAL_CFLAGS += -DGRALLOC_USE_LEGACY_ION_API=$(GRALLOC_USE_LEGACY_ION_API)
 LOCAL_CFLAGS += -DGRALLOC_USE_LEGACY_CALCS=$(GRALLOC_USE_LEGACY_CALCS_LOCK)
 LOCAL_CFLAGS += -DGRALLOC_USE_LEGACY_LOCK=$(GRALLOC_USE_LEGACY_CALCS_LOCK)
 
-LOCAL_SHARED_LIBRARIES := libhardware liblog libcutils libGLESv1_CM libion libsync libutils
+LOCAL_SHARED_LIBRARIES := libhardware liblog libcutils libGLESv1_CM libsync libutils
+
+ifeq ($(GRALLOC_ION_BACKEND), 1)
+LOCAL_SHARED_LIBRARIES += libion
+endif
+
+ifeq ($(GRALLOC_FB_DISPLAY_BACKEND), kms)
+LOCAL_SHARED_LIBRARIES += libdrm
+endif
 
 PLATFORM_SDK_GREATER_THAN_26 := $(shell expr $(PLATFORM_SDK_VERSION) \> 26)
 ifeq ($(PLATFORM_SDK_GREATER_THAN_26), 1)
@@ -197,14 +301,27 @@ LOCAL_MULTILIB := both
 LOCAL_SRC_FILES := \
 	mali_gralloc_module.cpp \
 	framebuffer_device.cpp \
+	framebuffer_stats.cpp \
+	framebuffer_convert.cpp \
+	framebuffer_fbdev_${GRALLOC_FB_DEVICE}.cpp \
 	gralloc_buffer_priv.cpp \
 	gralloc_vsync_${GRALLOC_VSYNC_BACKEND}.cpp \
 	mali_gralloc_bufferaccess.cpp \
 	mali_gralloc_bufferallocation.cpp \
+	mali_gralloc_bufferlayout.cpp \
 	mali_gralloc_bufferdescriptor.cpp \
-	mali_gralloc_ion.cpp \
+	mali_gralloc_backend.cpp \
+	mali_gralloc_backend_memfd.cpp \
+	mali_gralloc_cache_policy.cpp \
+	mali_gralloc_shmem.cpp \
 	mali_gralloc_formats.cpp \
+	format_stats.cpp \
+	mali_gralloc_drm_format.cpp \
 	mali_gralloc_reference.cpp \
+	mali_gralloc_registry.cpp \
+	mali_gralloc_trace.cpp \
+	mali_gralloc_daemon.cpp \
+	mali_gralloc_slab.cpp \
 	mali_gralloc_debug.cpp \
 	format_info.cpp
 
@@ -214,6 +331,18 @@ LOCAL_SRC_FILES += \
 	legacy/buffer_access.cpp
 endif
 
+ifeq ($(GRALLOC_FB_DISPLAY_BACKEND), kms)
+LOCAL_SRC_FILES += framebuffer_kms.cpp
+endif
+
+ifeq ($(GRALLOC_ION_BACKEND), 1)
+LOCAL_SRC_FILES += mali_gralloc_ion.cpp
+endif
+
+ifeq ($(GRALLOC_DMA_HEAP_BACKEND), 1)
+LOCAL_SRC_FILES += mali_gralloc_backend_dma_heap.cpp
+endif
+
 ifeq ($(GRALLOC_USE_GRALLOC1_API), 1)
 LOCAL_SRC_FILES += \
 	mali_gralloc_public_interface.cpp \
@@ -222,4 +351,108 @@ else
 LOCAL_SRC_FILES += legacy/alloc_device.cpp
 endif
 
+# The tools below build parts of the module with the same configuration.
+GRALLOC_MODULE_C_INCLUDES := $(LOCAL_C_INCLUDES)
+GRALLOC_MODULE_CFLAGS := $(LOCAL_CFLAGS)
+GRALLOC_MODULE_SRC_FILES := $(LOCAL_SRC_FILES)
+
 include $(BUILD_SHARED_LIBRARY)
+
+# Models the DRAM traffic of a composition scene under different format capabilities.
+include $(CLEAR_VARS)
+LOCAL_MODULE := gralloc_bwsim
+LOCAL_MODULE_TAGS := optional
+LOCAL_C_INCLUDES := $(GRALLOC_MODULE_C_INCLUDES)
+LOCAL_CFLAGS := $(GRALLOC_MODULE_CFLAGS)
+LOCAL_SRC_FILES := \
+	tools/gralloc_bwsim.cpp \
+	mali_gralloc_bufferlayout.cpp \
+	mali_gralloc_formats.cpp \
+	format_stats.cpp \
+	format_info.cpp
+ifeq ($(GRALLOC_USE_LEGACY_CALCS_LOCK), 1)
+LOCAL_SRC_FILES += legacy/buffer_alloc.cpp
+endif
+LOCAL_SHARED_LIBRARIES := liblog libcutils libutils
+LOCAL_HEADER_LIBRARIES := libhardware_headers
+include $(BUILD_HOST_EXECUTABLE)
+
+# Runs the allocation path on the build host: on memfd with failure injection, or on
+# /dev/dma_heap with -b dma_heap when GRALLOC_DMA_HEAP_BACKEND is set.
+include $(CLEAR_VARS)
+LOCAL_MODULE := gralloc_hostalloc
+LOCAL_MODULE_TAGS := optional
+LOCAL_C_INCLUDES := $(GRALLOC_MODULE_C_INCLUDES) system/core/libsync/include
+LOCAL_CFLAGS := $(filter-out -DGRALLOC_ALLOC_BACKEND=% -DGRALLOC_ION_BACKEND=% -DDISABLE_FRAMEBUFFER_HAL=% \
+                             -DGRALLOC_FB_USE_KMS=% -DGRALLOC_ALLOC_DAEMON=%,$(GRALLOC_MODULE_CFLAGS))
+LOCAL_CFLAGS += -DGRALLOC_ALLOC_BACKEND=\"memfd\" -DGRALLOC_ION_BACKEND=0 -DDISABLE_FRAMEBUFFER_HAL=1
+LOCAL_CFLAGS += -DGRALLOC_FB_USE_KMS=0 -DGRALLOC_ALLOC_DAEMON=0
+LOCAL_SRC_FILES := tools/gralloc_hostalloc.cpp \
+	$(filter-out mali_gralloc_ion.cpp framebuffer_kms.cpp,$(GRALLOC_MODULE_SRC_FILES))
+LOCAL_SHARED_LIBRARIES := liblog libcutils libutils
+LOCAL_HEADER_LIBRARIES := libhardware_headers libnativebase_headers gl_headers
+include $(BUILD_HOST_EXECUTABLE)
+
+ifeq ($(GRALLOC_BUFFER_REGISTRY), 1)
+# Reports who holds which buffers, from the registry files.
+include $(CLEAR_VARS)
+LOCAL_MODULE := gralloc_buffers
+LOCAL_MODULE_OWNER := arm
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_MODULE_TAGS := optional
+LOCAL_SRC_FILES := tools/gralloc_buffers.cpp
+LOCAL_CFLAGS := -Werror -DGRALLOC_BUFFER_REGISTRY_DIR=\"$(GRALLOC_BUFFER_REGISTRY_DIR)\"
+include $(BUILD_EXECUTABLE)
+endif
+
+ifeq ($(GRALLOC_USE_GRALLOC1_API), 1)
+# Replays allocation traces through the gralloc1 device, on the memfd backend by default.
+include $(CLEAR_VARS)
+LOCAL_MODULE := gralloc_replay
+LOCAL_MODULE_OWNER := arm
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_MODULE_TAGS := optional
+LOCAL_C_INCLUDES := $(GRALLOC_MODULE_C_INCLUDES)
+LOCAL_CFLAGS := $(GRALLOC_MODULE_CFLAGS)
+LOCAL_SRC_FILES := tools/gralloc_replay.cpp
+LOCAL_SHARED_LIBRARIES := libhardware libcutils
+include $(BUILD_EXECUTABLE)
+
+# Times descriptor and handle churn through the gralloc1 device.
+include $(CLEAR_VARS)
+LOCAL_MODULE := gralloc_objbench
+LOCAL_MODULE_OWNER := arm
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_MODULE_TAGS := optional
+LOCAL_C_INCLUDES := $(GRALLOC_MODULE_C_INCLUDES)
+LOCAL_CFLAGS := $(GRALLOC_MODULE_CFLAGS)
+LOCAL_SRC_FILES := tools/gralloc_objbench.cpp
+LOCAL_SHARED_LIBRARIES := libhardware libcutils
+include $(BUILD_EXECUTABLE)
+
+# Times lock_flex with stored CPU access layouts against describing them on every lock.
+include $(CLEAR_VARS)
+LOCAL_MODULE := gralloc_lockbench
+LOCAL_MODULE_OWNER := arm
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_MODULE_TAGS := optional
+LOCAL_C_INCLUDES := $(GRALLOC_MODULE_C_INCLUDES)
+LOCAL_CFLAGS := $(GRALLOC_MODULE_CFLAGS)
+LOCAL_SRC_FILES := tools/gralloc_lockbench.cpp
+LOCAL_SHARED_LIBRARIES := libhardware
+include $(BUILD_EXECUTABLE)
+endif
+
+ifeq ($(GRALLOC_ALLOC_DAEMON), 1)
+# Allocates buffers for every process using the module, see mali_gralloc_daemon.h.
+include $(CLEAR_VARS)
+LOCAL_MODULE := gralloc_allocd
+LOCAL_MODULE_OWNER := arm
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_MODULE_TAGS := optional
+LOCAL_C_INCLUDES := $(GRALLOC_MODULE_C_INCLUDES)
+LOCAL_CFLAGS := $(GRALLOC_MODULE_CFLAGS)
+LOCAL_SRC_FILES := tools/gralloc_allocd.cpp
+LOCAL_SHARED_LIBRARIES := libhardware liblog
+include $(BUILD_EXECUTABLE)
+endif
@@ -16,5 +16,4 @@
 # limitations under the License.
 
 $(info gralloc for vexpress)
-GRALLOC_FB_SWAP_RED_BLUE := 0
 GRALLOC_FB_BPP := 16
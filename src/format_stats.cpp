@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2018 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <string.h>
+#include <algorithm>
+
+#include "format_stats.h"
+
+/*
+ * Format selection runs once per allocation, so a mutex and a linear search
+ * of a small table are cheap enough. Once the table is full new
+ * combinations are only counted as dropped.
+ */
+static pthread_mutex_t format_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static mali_gralloc_format_stats format_stats;
+
+static const char *const format_reason_names[MALI_GRALLOC_FORMAT_REASON_LAST] = {
+	"private format",
+	"cpu usage",
+	"unknown ip",
+	"no afbc usage",
+	"no afbc usage yuv",
+	"format no afbc",
+	"gpu producer limit",
+	"video consumer limit",
+	"display consumer limit",
+	"afbc caps",
+	"no shared afbc",
+	"pixfmt unsupported",
+	"raw ip",
+	"depth/stencil ip",
+	"frontbuffer afbc",
+	"frontbuffer linear",
+	"block linear",
+	"afbc single plane",
+	"camera producer limit",
+};
+
+static const char *const format_outcome_names[MALI_GRALLOC_FORMAT_OUTCOME_LAST] = {
+	"afbc",
+	"block",
+	"linear",
+	"rejected",
+};
+
+const char *format_stats_reason_name(mali_gralloc_format_reason reason)
+{
+	if (reason < 0 || reason >= MALI_GRALLOC_FORMAT_REASON_LAST)
+	{
+		return "unknown";
+	}
+
+	return format_reason_names[reason];
+}
+
+void format_stats_record(int producer, int consumer, uint32_t req_format, mali_gralloc_format_outcome outcome,
+                         mali_gralloc_format_reason reason)
+{
+	pthread_mutex_lock(&format_stats_lock);
+
+	uint32_t i;
+	for (i = 0; i < format_stats.num_entries; i++)
+	{
+		const mali_gralloc_format_stat * const entry = &format_stats.entries[i];
+
+		if (entry->producer == producer && entry->consumer == consumer && entry->req_format == req_format &&
+		    entry->outcome == (uint32_t)outcome && entry->reason == (uint32_t)reason)
+		{
+			break;
+		}
+	}
+
+	if (i < format_stats.num_entries)
+	{
+		format_stats.entries[i].count++;
+	}
+	else if (i < MALI_GRALLOC_FORMAT_STATS_MAX_ENTRIES)
+	{
+		mali_gralloc_format_stat * const entry = &format_stats.entries[i];
+
+		entry->producer = producer;
+		entry->consumer = consumer;
+		entry->req_format = req_format;
+		entry->outcome = outcome;
+		entry->reason = reason;
+		entry->count = 1;
+		format_stats.num_entries++;
+	}
+	else
+	{
+		format_stats.dropped++;
+	}
+
+	pthread_mutex_unlock(&format_stats_lock);
+}
+
+void format_stats_get(mali_gralloc_format_stats *stats)
+{
+	pthread_mutex_lock(&format_stats_lock);
+	memcpy(stats, &format_stats, sizeof(*stats));
+	pthread_mutex_unlock(&format_stats_lock);
+}
+
+static bool format_stat_more_frequent(const mali_gralloc_format_stat &a, const mali_gralloc_format_stat &b)
+{
+	return a.count > b.count;
+}
+
+void format_stats_dump(android::String8 &buf)
+{
+	mali_gralloc_format_stats stats;
+
+	format_stats_get(&stats);
+
+	if (stats.num_entries == 0)
+	{
+		return;
+	}
+
+	std::sort(stats.entries, stats.entries + stats.num_entries, format_stat_more_frequent);
+
+	buf.appendFormat("-------------------------Format selection------------------------\n");
+	buf.appendFormat(" producer | consumer | req_format | outcome  | reason                 | count\n");
+
+	for (uint32_t i = 0; i < stats.num_entries; i++)
+	{
+		const mali_gralloc_format_stat * const entry = &stats.entries[i];
+
+		buf.appendFormat(" %8d | %8d | 0x%08" PRIx32 " | %-8s | %-22s | %" PRIu64 "\n", entry->producer,
+		                 entry->consumer, entry->req_format, format_outcome_names[entry->outcome],
+		                 format_stats_reason_name((mali_gralloc_format_reason)entry->reason), entry->count);
+	}
+
+	if (stats.dropped != 0)
+	{
+		buf.appendFormat(" dropped: %" PRIu64 "\n", stats.dropped);
+	}
+}
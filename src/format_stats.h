@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2018 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FORMAT_STATS_H_
+#define FORMAT_STATS_H_
+
+#include <stdint.h>
+#include <utils/String8.h>
+
+#include "mali_gralloc_private_interface_types.h"
+
+/* Returns a short name for a format selection reason. */
+const char *format_stats_reason_name(mali_gralloc_format_reason reason);
+
+/* Counts one format selection step against its final outcome. */
+void format_stats_record(int producer, int consumer, uint32_t req_format, mali_gralloc_format_outcome outcome,
+                         mali_gralloc_format_reason reason);
+
+/* Takes a snapshot of all counters. */
+void format_stats_get(mali_gralloc_format_stats *stats);
+
+/* Appends the counters to a dump, most frequent first. */
+void format_stats_dump(android::String8 &buf);
+
+#endif /* FORMAT_STATS_H_ */
@@ -0,0 +1,294 @@
+/*
+ * Copyright (C) 2018 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <system/graphics.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define FB_CONVERT_NEON 1
+#else
+#define FB_CONVERT_NEON 0
+#endif
+
+#include "framebuffer_convert.h"
+
+/* Pixel layout of a format the post path can read or write. */
+struct fb_pixel_layout
+{
+	uint64_t format;
+	uint32_t bpp;
+
+	/* Red is in the lowest byte (RGBA) rather than the third (BGRA). */
+	bool red_first;
+	bool has_alpha;
+};
+
+static const fb_pixel_layout s_layouts[] = {
+	{ HAL_PIXEL_FORMAT_RGBA_8888, 4, true, true },
+	{ HAL_PIXEL_FORMAT_RGBX_8888, 4, true, false },
+	{ HAL_PIXEL_FORMAT_BGRA_8888, 4, false, true },
+	{ HAL_PIXEL_FORMAT_RGB_565, 2, false, false },
+};
+
+/*
+ * 4x4 ordered dither thresholds, repeated to 16 columns so a row can be
+ * loaded into one vector. Red and blue lose three bits, green two.
+ */
+static const uint8_t s_dither_rb[4][16] = {
+	{ 0, 4, 1, 5, 0, 4, 1, 5, 0, 4, 1, 5, 0, 4, 1, 5 },
+	{ 6, 2, 7, 3, 6, 2, 7, 3, 6, 2, 7, 3, 6, 2, 7, 3 },
+	{ 1, 5, 0, 4, 1, 5, 0, 4, 1, 5, 0, 4, 1, 5, 0, 4 },
+	{ 7, 3, 6, 2, 7, 3, 6, 2, 7, 3, 6, 2, 7, 3, 6, 2 },
+};
+
+static const uint8_t s_dither_g[4][16] = {
+	{ 0, 2, 0, 2, 0, 2, 0, 2, 0, 2, 0, 2, 0, 2, 0, 2 },
+	{ 3, 1, 3, 1, 3, 1, 3, 1, 3, 1, 3, 1, 3, 1, 3, 1 },
+	{ 0, 2, 0, 2, 0, 2, 0, 2, 0, 2, 0, 2, 0, 2, 0, 2 },
+	{ 3, 1, 3, 1, 3, 1, 3, 1, 3, 1, 3, 1, 3, 1, 3, 1 },
+};
+
+static const uint8_t s_dither_none[16] = { 0 };
+
+static const fb_pixel_layout *fb_pixel_layout_of(uint64_t format)
+{
+	for (size_t i = 0; i < sizeof(s_layouts) / sizeof(s_layouts[0]); i++)
+	{
+		if (s_layouts[i].format == format)
+		{
+			return &s_layouts[i];
+		}
+	}
+
+	return NULL;
+}
+
+static inline uint8_t fb_add_sat(uint8_t value, uint8_t bias)
+{
+	const uint32_t sum = (uint32_t)value + bias;
+
+	return (sum > 255) ? 255 : (uint8_t)sum;
+}
+
+/* 32bpp to 32bpp, swapping red and blue and/or forcing alpha opaque. */
+static void fb_row_8888_to_8888(uint8_t *dst, const uint8_t *src, uint32_t width, bool swap, bool opaque)
+{
+	uint32_t x = 0;
+
+#if FB_CONVERT_NEON
+	for (; x + 16 <= width; x += 16)
+	{
+		uint8x16x4_t px = vld4q_u8(src + x * 4);
+
+		if (swap)
+		{
+			const uint8x16_t tmp = px.val[0];
+			px.val[0] = px.val[2];
+			px.val[2] = tmp;
+		}
+
+		if (opaque)
+		{
+			px.val[3] = vdupq_n_u8(0xff);
+		}
+
+		vst4q_u8(dst + x * 4, px);
+	}
+#endif
+
+	const uint32_t r = swap ? 2 : 0;
+	const uint32_t b = swap ? 0 : 2;
+
+	for (; x < width; x++)
+	{
+		const uint8_t *s = src + x * 4;
+		uint8_t *d = dst + x * 4;
+
+		d[0] = s[r];
+		d[1] = s[1];
+		d[2] = s[b];
+		d[3] = opaque ? 0xff : s[3];
+	}
+}
+
+static void fb_row_8888_to_565(uint16_t *dst, const uint8_t *src, uint32_t width, bool red_first,
+                               const uint8_t *dither_rb, const uint8_t *dither_g)
+{
+	const uint32_t r = red_first ? 0 : 2;
+	const uint32_t b = red_first ? 2 : 0;
+	uint32_t x = 0;
+
+#if FB_CONVERT_NEON
+	const uint8x16_t drb = vld1q_u8(dither_rb);
+	const uint8x16_t dg = vld1q_u8(dither_g);
+
+	for (; x + 16 <= width; x += 16)
+	{
+		const uint8x16x4_t px = vld4q_u8(src + x * 4);
+		const uint8x16_t r8 = vqaddq_u8(px.val[r], drb);
+		const uint8x16_t g8 = vqaddq_u8(px.val[1], dg);
+		const uint8x16_t b8 = vqaddq_u8(px.val[b], drb);
+
+		/* Keep the top bits of each channel and shift the next one in below them. */
+		uint16x8_t lo = vshll_n_u8(vget_low_u8(r8), 8);
+		lo = vsriq_n_u16(lo, vshll_n_u8(vget_low_u8(g8), 8), 5);
+		lo = vsriq_n_u16(lo, vshll_n_u8(vget_low_u8(b8), 8), 11);
+
+		uint16x8_t hi = vshll_n_u8(vget_high_u8(r8), 8);
+		hi = vsriq_n_u16(hi, vshll_n_u8(vget_high_u8(g8), 8), 5);
+		hi = vsriq_n_u16(hi, vshll_n_u8(vget_high_u8(b8), 8), 11);
+
+		vst1q_u16(dst + x, lo);
+		vst1q_u16(dst + x + 8, hi);
+	}
+#endif
+
+	for (; x < width; x++)
+	{
+		const uint8_t *s = src + x * 4;
+		const uint8_t r8 = fb_add_sat(s[r], dither_rb[x & 15]);
+		const uint8_t g8 = fb_add_sat(s[1], dither_g[x & 15]);
+		const uint8_t b8 = fb_add_sat(s[b], dither_rb[x & 15]);
+
+		dst[x] = (uint16_t)(((r8 >> 3) << 11) | ((g8 >> 2) << 5) | (b8 >> 3));
+	}
+}
+
+static void fb_row_565_to_8888(uint8_t *dst, const uint16_t *src, uint32_t width, bool red_first)
+{
+	const uint32_t r = red_first ? 0 : 2;
+	const uint32_t b = red_first ? 2 : 0;
+	uint32_t x = 0;
+
+#if FB_CONVERT_NEON
+	for (; x + 8 <= width; x += 8)
+	{
+		const uint16x8_t px = vld1q_u16(src + x);
+
+		/* Widen each channel by replicating its top bits into the bottom. */
+		uint8x8_t r8 = vand_u8(vshrn_n_u16(px, 8), vdup_n_u8(0xf8));
+		r8 = vorr_u8(r8, vshr_n_u8(r8, 5));
+		uint8x8_t g8 = vand_u8(vshrn_n_u16(px, 3), vdup_n_u8(0xfc));
+		g8 = vorr_u8(g8, vshr_n_u8(g8, 6));
+		uint8x8_t b8 = vshl_n_u8(vmovn_u16(px), 3);
+		b8 = vorr_u8(b8, vshr_n_u8(b8, 5));
+
+		uint8x8x4_t out;
+		out.val[r] = r8;
+		out.val[1] = g8;
+		out.val[b] = b8;
+		out.val[3] = vdup_n_u8(0xff);
+
+		vst4_u8(dst + x * 4, out);
+	}
+#endif
+
+	for (; x < width; x++)
+	{
+		const uint16_t px = src[x];
+		const uint8_t r5 = px >> 11;
+		const uint8_t g6 = (px >> 5) & 0x3f;
+		const uint8_t b5 = px & 0x1f;
+		uint8_t *d = dst + x * 4;
+
+		d[r] = (r5 << 3) | (r5 >> 2);
+		d[1] = (g6 << 2) | (g6 >> 4);
+		d[b] = (b5 << 3) | (b5 >> 2);
+		d[3] = 0xff;
+	}
+}
+
+uint64_t fb_format_from_screeninfo(const struct fb_var_screeninfo *info)
+{
+	if (info->bits_per_pixel == 16 && info->red.offset == 11 && info->red.length == 5 && info->green.offset == 5 &&
+	    info->green.length == 6 && info->blue.offset == 0 && info->blue.length == 5)
+	{
+		return HAL_PIXEL_FORMAT_RGB_565;
+	}
+
+	if (info->bits_per_pixel != 32 || info->red.length != 8 || info->green.offset != 8 || info->green.length != 8 ||
+	    info->blue.length != 8)
+	{
+		return 0;
+	}
+
+	if (info->red.offset == 0 && info->blue.offset == 16)
+	{
+		return (info->transp.length != 0) ? HAL_PIXEL_FORMAT_RGBA_8888 : HAL_PIXEL_FORMAT_RGBX_8888;
+	}
+
+	if (info->red.offset == 16 && info->blue.offset == 0)
+	{
+		return HAL_PIXEL_FORMAT_BGRA_8888;
+	}
+
+	return 0;
+}
+
+uint32_t fb_convert_bytes_per_pixel(uint64_t format)
+{
+	const fb_pixel_layout *layout = fb_pixel_layout_of(format);
+
+	return (layout != NULL) ? layout->bpp : 0;
+}
+
+bool fb_convert_supported(uint64_t src_format, uint64_t dst_format)
+{
+	return fb_pixel_layout_of(src_format) != NULL && fb_pixel_layout_of(dst_format) != NULL;
+}
+
+void fb_convert(void *dst, size_t dst_stride, uint64_t dst_format, const void *src, size_t src_stride,
+                uint64_t src_format, uint32_t width, uint32_t height, bool dither)
+{
+	const fb_pixel_layout *in = fb_pixel_layout_of(src_format);
+	const fb_pixel_layout *out = fb_pixel_layout_of(dst_format);
+
+	if (in == NULL || out == NULL)
+	{
+		return;
+	}
+
+	/* Alpha only has to be made up when the source has none. */
+	const bool copy = (in->format == out->format) || (in->bpp == 4 && out->bpp == 4 && in->red_first == out->red_first &&
+	                                                  (in->has_alpha || !out->has_alpha));
+
+	for (uint32_t y = 0; y < height; y++)
+	{
+		uint8_t *d = (uint8_t *)dst + y * dst_stride;
+		const uint8_t *s = (const uint8_t *)src + y * src_stride;
+
+		if (copy)
+		{
+			memcpy(d, s, (size_t)width * out->bpp);
+		}
+		else if (in->bpp == 4 && out->bpp == 4)
+		{
+			fb_row_8888_to_8888(d, s, width, in->red_first != out->red_first, !in->has_alpha && out->has_alpha);
+		}
+		else if (in->bpp == 4)
+		{
+			fb_row_8888_to_565((uint16_t *)d, s, width, in->red_first, dither ? s_dither_rb[y & 3] : s_dither_none,
+			                   dither ? s_dither_g[y & 3] : s_dither_none);
+		}
+		else
+		{
+			fb_row_565_to_8888(d, (const uint16_t *)s, width, out->red_first);
+		}
+	}
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2018 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FRAMEBUFFER_CONVERT_H_
+#define FRAMEBUFFER_CONVERT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/fb.h>
+
+/*
+ * Returns the HAL format matching the pixel layout of a screen, or 0 if the
+ * layout is not one the framebuffer HAL can post to.
+ */
+uint64_t fb_format_from_screeninfo(const struct fb_var_screeninfo *info);
+
+/* Returns the bytes per pixel of a format fb_convert() handles, or 0. */
+uint32_t fb_convert_bytes_per_pixel(uint64_t format);
+
+/* Returns true if fb_convert() can copy pixels of src_format into a dst_format screen. */
+bool fb_convert_supported(uint64_t src_format, uint64_t dst_format);
+
+/*
+ * Copies a width x height rectangle into the framebuffer, converting each
+ * pixel from src_format to dst_format on the way. Conversions to RGB_565
+ * use an ordered dither when 'dither' is set.
+ */
+void fb_convert(void *dst, size_t dst_stride, uint64_t dst_format, const void *src, size_t src_stride,
+                uint64_t src_format, uint32_t width, uint32_t height, bool dither);
+
+#endif /* FRAMEBUFFER_CONVERT_H_ */
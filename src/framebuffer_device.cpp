@@ -16,8 +16,11 @@
  * limitations under the License.
  */
 
+#include <stdio.h>
+#include <inttypes.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <sys/ioctl.h>
@@ -42,19 +45,111 @@
 #include "mali_gralloc_buffer.h"
 #include "gralloc_helper.h"
 #include "gralloc_vsync.h"
+#include "framebuffer_stats.h"
 #include "mali_gralloc_bufferaccess.h"
-#include "mali_gralloc_ion.h"
+#include "mali_gralloc_backend.h"
+#include "mali_gralloc_reference.h"
+#include "framebuffer_fbdev.h"
+#include "framebuffer_convert.h"
+#if GRALLOC_FB_USE_KMS == 1
+#include "framebuffer_kms.h"
+#endif
 
 #define STANDARD_LINUX_SCREEN
 
+#if GRALLOC_FB_USE_KMS == 1 && GRALLOC_FB_SCANOUT_DMABUF == 1
+#error "GRALLOC_FB_SCANOUT_DMABUF is an fbdev option and can't be used with the KMS backend"
+#endif
+
 // numbers of buffers for page flipping
 #define NUM_BUFFERS NUM_FB_BUFFERS
 
+// format requested from panels whose pixel layout can be changed, or isn't known
+#if GRALLOC_FB_BPP == 16
+#define FB_DEFAULT_FORMAT HAL_PIXEL_FORMAT_RGB_565
+#elif GRALLOC_FB_BPP == 32
+#define FB_DEFAULT_FORMAT HAL_PIXEL_FORMAT_BGRA_8888
+#else
+#error "Invalid framebuffer bit depth"
+#endif
+
 enum
 {
 	PAGE_FLIP = 0x00000001,
 };
 
+/*
+ * Page-flip queue.
+ *
+ * fb_post() only queues the buffer; the pan and vsync ioctls are issued by a
+ * dedicated flip thread. fb_post() returns once no more than
+ * (numBuffers - 2) posted frames are waiting to reach the screen, so with
+ * double buffering posting stays synchronous and with three or more buffers
+ * the compositor no longer blocks on vsync. The buffer displayed before the
+ * last completed flip is therefore never still being scanned out when the
+ * compositor dequeues it again.
+ */
+struct fb_flip_queue
+{
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+	bool running;
+
+	/* Device which started the flip thread. */
+	framebuffer_device_t *dev;
+	mali_gralloc_display *dpy;
+
+	buffer_handle_t entries[NUM_BUFFERS];
+	int64_t post_ns[NUM_BUFFERS];
+	uint32_t head;
+	uint32_t count;
+
+	/* Buffer dequeued by the flip thread and not yet on screen. */
+	buffer_handle_t flipping;
+
+	/* Previously displayed buffer which the flip thread is unlocking. */
+	buffer_handle_t retiring;
+
+	/* First error reported by the flip thread since the last post. */
+	int error;
+
+	fb_flip_queue()
+	    : thread(0)
+	    , running(false)
+	    , dev(NULL)
+	    , dpy(NULL)
+	    , head(0)
+	    , count(0)
+	    , flipping(NULL)
+	    , retiring(NULL)
+	    , error(0)
+	{
+		pthread_mutex_init(&lock, NULL);
+		pthread_cond_init(&cond, NULL);
+		memset(entries, 0, sizeof(entries));
+		memset(post_ns, 0, sizeof(post_ns));
+	}
+};
+
+/* Framebuffer HAL device of one display. */
+struct fb_device
+{
+	framebuffer_device_t base;
+	mali_gralloc_display *dpy;
+};
+
+/* One flip queue per display, so posts to different displays proceed in parallel. */
+static fb_flip_queue s_flip_queues[MALI_GRALLOC_MAX_DISPLAYS];
+
+/* Framebuffer ring slots currently handed out by fb_alloc_framebuffer(). Protected by the display lock. */
+static buffer_handle_t s_fb_slots[MALI_GRALLOC_MAX_DISPLAYS][NUM_BUFFERS];
+
+static mali_gralloc_display *fb_device_display(struct framebuffer_device_t *dev)
+{
+	return reinterpret_cast<fb_device *>(dev)->dpy;
+}
+
 static int fb_set_swap_interval(struct framebuffer_device_t *dev, int interval)
 {
 	if (interval < dev->minSwapInterval)
@@ -66,37 +161,86 @@ static int fb_set_swap_interval(struct framebuffer_device_t *dev, int interval)
 		interval = dev->maxSwapInterval;
 	}
 
-	private_module_t *m = reinterpret_cast<private_module_t *>(dev->common.module);
-	m->swapInterval = interval;
+	mali_gralloc_display *dpy = fb_device_display(dev);
+	dpy->swapInterval = interval;
 
 	if (0 == interval)
 	{
-		gralloc_vsync_disable(dev);
+		gralloc_vsync_disable(dpy);
 	}
 	else
 	{
-		gralloc_vsync_enable(dev);
+		gralloc_vsync_enable(dpy);
 	}
 
 	return 0;
 }
 
-static int fb_post(struct framebuffer_device_t *dev, buffer_handle_t buffer)
+#if GRALLOC_FB_USE_KMS != 1
+/* Shows the screen at dpy->info.yoffset. */
+static int fb_pan_display(mali_gralloc_display *dpy)
 {
-	if (private_handle_t::validate(buffer) < 0)
+#ifdef STANDARD_LINUX_SCREEN
+
+	if (fbdev_ioctl(dpy->framebuffer->fd, FBIOPAN_DISPLAY, &dpy->info) == -1)
+	{
+		AERR("FBIOPAN_DISPLAY failed for fd: %d", dpy->framebuffer->fd);
+		return -errno;
+	}
+
+#else /*Standard Android way*/
+
+	if (fbdev_ioctl(dpy->framebuffer->fd, FBIOPUT_VSCREENINFO, &dpy->info) == -1)
+	{
+		AERR("FBIOPUT_VSCREENINFO failed for fd: %d", dpy->framebuffer->fd);
+		return -errno;
+	}
+
+#endif
+
+	return 0;
+}
+#endif
+
+/*
+ * Puts a posted buffer on screen. Only called from the flip thread.
+ * On success *scanout tells whether the buffer itself is now displayed,
+ * and stays locked until the next flip, rather than copied. post_ns is when
+ * the buffer was posted, start_ns when it was taken off the queue.
+ */
+static int fb_flip(mali_gralloc_display *dpy, buffer_handle_t buffer, int64_t post_ns, int64_t start_ns,
+                   bool *scanout)
+{
+	private_handle_t const *hnd = mali_gralloc_reference_get(buffer);
+	private_module_t *m = dpy->module;
+
+	if (hnd == NULL)
 	{
+		AERR("Posting buffer %p which isn't retained", buffer);
 		return -EINVAL;
 	}
 
-	private_handle_t const *hnd = reinterpret_cast<private_handle_t const *>(buffer);
-	private_module_t *m = reinterpret_cast<private_module_t *>(dev->common.module);
+	*scanout = false;
 
-	if (m->currentBuffer)
+#if GRALLOC_FB_USE_KMS == 1
+	/* Any buffer with a dma-buf can be scanned out, there is never a copy. */
+#if GRALLOC_USE_LEGACY_LOCK != 1
+	mali_gralloc_lock(m, buffer, private_module_t::PRIV_USAGE_LOCKED_FOR_POST, 0, 0, 0, 0, NULL);
+#else
+	mali_gralloc_lock(m, buffer, private_module_t::PRIV_USAGE_LOCKED_FOR_POST, -1, -1, -1, -1, NULL);
+#endif
+
+	const int64_t wait_ns = fb_stats_now_ns();
+	const int err = fb_kms_post(hnd, dpy->swapInterval);
+	if (err != 0)
 	{
-		mali_gralloc_unlock(m, m->currentBuffer);
-		m->currentBuffer = 0;
+		mali_gralloc_unlock(m, buffer);
+		return err;
 	}
+	fb_stats_record(dpy->index, MALI_GRALLOC_FB_STAT_VSYNC_WAIT, fb_stats_now_ns() - wait_ns);
 
+	*scanout = true;
+#else
 	if (hnd->flags & private_handle_t::PRIV_FLAGS_FRAMEBUFFER)
 	{
 #if GRALLOC_USE_LEGACY_LOCK != 1
@@ -107,114 +251,342 @@ static int fb_post(struct framebuffer_device_t *dev, buffer_handle_t buffer)
 		mali_gralloc_lock(m, buffer, private_module_t::PRIV_USAGE_LOCKED_FOR_POST, -1, -1, -1, -1, NULL);
 #endif
 		int interrupt;
-		m->info.activate = FB_ACTIVATE_VBL;
-		m->info.yoffset = hnd->offset / m->finfo.line_length;
-
-#ifdef STANDARD_LINUX_SCREEN
+		dpy->info.activate = FB_ACTIVATE_VBL;
+		dpy->info.yoffset = hnd->offset / dpy->finfo.line_length;
 
-		if (ioctl(m->framebuffer->fd, FBIOPAN_DISPLAY, &m->info) == -1)
+		const int pan_err = fb_pan_display(dpy);
+		if (pan_err != 0)
 		{
-			AERR("FBIOPAN_DISPLAY failed for fd: %d", m->framebuffer->fd);
 			mali_gralloc_unlock(m, buffer);
-			return -errno;
+			return pan_err;
 		}
 
-#else /*Standard Android way*/
-
-		if (ioctl(m->framebuffer->fd, FBIOPUT_VSCREENINFO, &m->info) == -1)
-		{
-			AERR("FBIOPUT_VSCREENINFO failed for fd: %d", m->framebuffer->fd);
-			mali_gralloc_unlock(m, buffer);
-			return -errno;
-		}
-
-#endif
-
-		if (0 != gralloc_wait_for_vsync(dev))
+		const int64_t wait_ns = fb_stats_now_ns();
+		const int vsync_err = gralloc_wait_for_vsync(dpy);
+		if (0 != vsync_err)
 		{
-			AERR("Gralloc wait for vsync failed for fd: %d", m->framebuffer->fd);
+			AERR("Gralloc wait for vsync failed for fd: %d", dpy->framebuffer->fd);
 			mali_gralloc_unlock(m, buffer);
-			return -errno;
+			return vsync_err < 0 ? vsync_err : -EIO;
 		}
+		fb_stats_record(dpy->index, MALI_GRALLOC_FB_STAT_VSYNC_WAIT, fb_stats_now_ns() - wait_ns);
 
-		m->currentBuffer = buffer;
+		*scanout = true;
 	}
 	else
 	{
 		void *fb_vaddr;
 		void *buffer_vaddr;
+		bool pan = false;
+
+		if (!fb_convert_supported(hnd->alloc_format, dpy->fbdev_format))
+		{
+			AERR("Can't post format 0x%" PRIx64 " to framebuffer %u (format 0x%" PRIx64 ")", hnd->alloc_format,
+			     dpy->index, dpy->fbdev_format);
+			return -EINVAL;
+		}
+
+		fb_stats_copy_fallback(dpy->index);
 
 #if GRALLOC_USE_LEGACY_LOCK != 1
-		mali_gralloc_lock(m, m->framebuffer, GRALLOC_USAGE_SW_WRITE_RARELY, 0, 0, 0, 0, &fb_vaddr);
+		mali_gralloc_lock(m, dpy->framebuffer, GRALLOC_USAGE_SW_WRITE_RARELY, 0, 0, 0, 0, &fb_vaddr);
 		mali_gralloc_lock(m, buffer, GRALLOC_USAGE_SW_READ_RARELY, 0, 0, 0, 0, &buffer_vaddr);
 #else
-		mali_gralloc_lock(m, m->framebuffer, GRALLOC_USAGE_SW_WRITE_RARELY, -1, -1, -1, -1, &fb_vaddr);
+		mali_gralloc_lock(m, dpy->framebuffer, GRALLOC_USAGE_SW_WRITE_RARELY, -1, -1, -1, -1, &fb_vaddr);
 		mali_gralloc_lock(m, buffer, GRALLOC_USAGE_SW_READ_RARELY, -1, -1, -1, -1, &buffer_vaddr);
 #endif
-		// If buffer's alignment match framebuffer alignment we can do a direct copy.
-		// If not we must fallback to do an aligned copy of each line.
-		if (hnd->byte_stride == (int)m->finfo.line_length)
+		// Copy into the screen currently panned to, which is not necessarily the first one. If that screen
+		// isn't framebuffer memory (a flipped buffer outside of it), copy into the first screen and show it.
+		const size_t screen_size = dpy->finfo.line_length * dpy->info.yres;
+		if ((size_t)dpy->info.yoffset * dpy->finfo.line_length + screen_size <= (size_t)dpy->framebuffer->size)
 		{
-			memcpy(fb_vaddr, buffer_vaddr, m->finfo.line_length * m->info.yres);
+			fb_vaddr = (void *)((uintptr_t)fb_vaddr + dpy->info.yoffset * dpy->finfo.line_length);
 		}
 		else
 		{
-			uintptr_t fb_offset = 0;
-			uintptr_t buffer_offset = 0;
-			unsigned int i;
-
-			for (i = 0; i < m->info.yres; i++)
-			{
-				memcpy((void *)((uintptr_t)fb_vaddr + fb_offset), (void *)((uintptr_t)buffer_vaddr + buffer_offset),
-				       m->finfo.line_length);
+			dpy->info.yoffset = 0;
+			pan = true;
+		}
 
-				fb_offset += m->finfo.line_length;
-				buffer_offset += hnd->byte_stride;
-			}
+		// If buffer's format and alignment match the framebuffer we can do a direct copy.
+		// If not each line is converted to the framebuffer format as it is copied.
+		if (hnd->alloc_format == dpy->fbdev_format && hnd->byte_stride == (int)dpy->finfo.line_length)
+		{
+			memcpy(fb_vaddr, buffer_vaddr, dpy->finfo.line_length * dpy->info.yres);
+		}
+		else
+		{
+			fb_convert(fb_vaddr, dpy->finfo.line_length, dpy->fbdev_format, buffer_vaddr, hnd->byte_stride,
+			           hnd->alloc_format, GRALLOC_MIN((uint32_t)hnd->width, dpy->info.xres),
+			           GRALLOC_MIN((uint32_t)hnd->height, dpy->info.yres), GRALLOC_FB_DITHER == 1);
 		}
 
 		mali_gralloc_unlock(m, buffer);
-		mali_gralloc_unlock(m, m->framebuffer);
+		mali_gralloc_unlock(m, dpy->framebuffer);
+
+		if (pan)
+		{
+			dpy->info.activate = FB_ACTIVATE_VBL;
+
+			const int pan_err = fb_pan_display(dpy);
+			if (pan_err != 0)
+			{
+				return pan_err;
+			}
+		}
 	}
+#endif /* GRALLOC_FB_USE_KMS == 1 */
+
+	const int64_t flip_ns = fb_stats_now_ns();
+	fb_stats_record(dpy->index, MALI_GRALLOC_FB_STAT_POST_TO_FLIP, flip_ns - post_ns);
+	fb_stats_flip(dpy->index, start_ns, flip_ns, (dpy->fps > 0.0f) ? (int64_t)(1000000000.0f / dpy->fps) : 0,
+	              dpy->swapInterval);
 
 	return 0;
 }
 
-static int init_frame_buffer_locked(struct private_module_t *module)
+/*
+ * Flips a buffer taken off the queue. Called with q->lock held, which is
+ * dropped during the flip. The display's currentBuffer is only touched with
+ * q->lock held; while the previous buffer is being unlocked it is recorded as
+ * retiring, so fb_release_buffer() waits for it as for the flipping one.
+ */
+static int fb_flip_queued(fb_flip_queue *q, mali_gralloc_display *dpy, buffer_handle_t buffer, int64_t post_ns,
+                          int64_t start_ns)
 {
-	if (module->framebuffer)
+	buffer_handle_t const retiring = dpy->currentBuffer;
+
+	q->flipping = buffer;
+	q->retiring = retiring;
+	dpy->currentBuffer = 0;
+
+	pthread_mutex_unlock(&q->lock);
+
+	if (retiring)
 	{
-		return 0; // Nothing to do, already initialized
+		mali_gralloc_unlock(dpy->module, retiring);
 	}
 
-	char const *const device_template[] = { "/dev/graphics/fb%u", "/dev/fb%u", NULL };
+	bool scanout = false;
+	const int err = fb_flip(dpy, buffer, post_ns, start_ns, &scanout);
 
-	int fd = -1;
-	int i = 0;
-	char name[64];
+	pthread_mutex_lock(&q->lock);
 
-	while ((fd == -1) && device_template[i])
+	if (err == 0 && scanout)
 	{
-		snprintf(name, 64, device_template[i], 0);
-		fd = open(name, O_RDWR, 0);
-		i++;
+		dpy->currentBuffer = buffer;
 	}
 
-	if (fd < 0)
+	q->flipping = NULL;
+	q->retiring = NULL;
+	pthread_cond_broadcast(&q->cond);
+
+	return err;
+}
+
+static void *fb_flip_thread(void *arg)
+{
+	fb_flip_queue *q = static_cast<fb_flip_queue *>(arg);
+
+	pthread_mutex_lock(&q->lock);
+
+	for (;;)
 	{
-		return -errno;
+		while (q->running && q->count == 0)
+		{
+			pthread_cond_wait(&q->cond, &q->lock);
+		}
+
+		if (q->count == 0)
+		{
+			/* Stopped and drained. */
+			break;
+		}
+
+		const uint32_t idx = q->head;
+		buffer_handle_t buffer = q->entries[idx];
+		const int64_t post_ns = q->post_ns[idx];
+
+		/* Frames waiting behind others aren't late yet: pacing counts from here. */
+		const int64_t start_ns = fb_stats_now_ns();
+
+		q->head = (idx + 1) % NUM_BUFFERS;
+		q->count--;
+
+		const int err = fb_flip_queued(q, q->dpy, buffer, post_ns, start_ns);
+
+		if (err != 0 && q->error == 0)
+		{
+			q->error = err;
+		}
+	}
+
+	pthread_mutex_unlock(&q->lock);
+
+	return NULL;
+}
+
+static int fb_flip_queue_start(framebuffer_device_t *dev, mali_gralloc_display *dpy)
+{
+	fb_flip_queue *q = &s_flip_queues[dpy->index];
+
+	pthread_mutex_lock(&q->lock);
+
+	if (q->running)
+	{
+		q->dev = dev;
+		pthread_mutex_unlock(&q->lock);
+		return 0;
+	}
+
+	q->dev = dev;
+	q->dpy = dpy;
+	q->head = 0;
+	q->count = 0;
+	q->flipping = NULL;
+	q->retiring = NULL;
+	q->error = 0;
+	q->running = true;
+
+	const int ret = pthread_create(&q->thread, NULL, fb_flip_thread, q);
+	if (ret != 0)
+	{
+		AERR("Failed to start framebuffer flip thread: %d", ret);
+		q->running = false;
+	}
+
+	pthread_mutex_unlock(&q->lock);
+
+	return -ret;
+}
+
+static void fb_flip_queue_stop(framebuffer_device_t *dev)
+{
+	fb_flip_queue *q = &s_flip_queues[fb_device_display(dev)->index];
+
+	pthread_mutex_lock(&q->lock);
+
+	if (!q->running || q->dev != dev)
+	{
+		pthread_mutex_unlock(&q->lock);
+		return;
+	}
+
+	/* The thread drains any queued frames before exiting. */
+	q->running = false;
+	pthread_cond_broadcast(&q->cond);
+
+	const pthread_t thread = q->thread;
+	pthread_mutex_unlock(&q->lock);
+
+	pthread_join(thread, NULL);
+}
+
+/* Must be called with q->lock held. */
+static bool fb_flip_queue_contains_locked(const fb_flip_queue *q, buffer_handle_t buffer)
+{
+	if (q->flipping == buffer || q->retiring == buffer)
+	{
+		return true;
+	}
+
+	for (uint32_t i = 0; i < q->count; i++)
+	{
+		if (q->entries[(q->head + i) % NUM_BUFFERS] == buffer)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static int fb_post(struct framebuffer_device_t *dev, buffer_handle_t buffer)
+{
+	if (private_handle_t::validate(buffer) < 0)
+	{
+		return -EINVAL;
+	}
+
+	mali_gralloc_display *dpy = fb_device_display(dev);
+	fb_flip_queue *q = &s_flip_queues[dpy->index];
+	const int64_t post_ns = fb_stats_now_ns();
+
+	pthread_mutex_lock(&q->lock);
+
+	if (!q->running)
+	{
+		const int err = fb_flip_queued(q, dpy, buffer, post_ns, post_ns);
+		pthread_mutex_unlock(&q->lock);
+		return err;
+	}
+
+	/* The ring can't hold more frames than there are buffers. */
+	while (q->running && q->count >= NUM_BUFFERS)
+	{
+		pthread_cond_wait(&q->cond, &q->lock);
+	}
+
+	const uint32_t tail = (q->head + q->count) % NUM_BUFFERS;
+	q->entries[tail] = buffer;
+	q->post_ns[tail] = post_ns;
+	q->count++;
+	pthread_cond_broadcast(&q->cond);
+
+	/* Allow at most (numBuffers - 2) frames in flight when returning. */
+	const int32_t max_pending = (int32_t)dpy->numBuffers - 2;
+	while (q->running &&
+	       (int32_t)(q->count + (q->flipping ? 1 : 0)) > GRALLOC_MAX(max_pending, 0))
+	{
+		pthread_cond_wait(&q->cond, &q->lock);
+	}
+
+	const int err = q->error;
+	q->error = 0;
+
+	pthread_mutex_unlock(&q->lock);
+
+	return err;
+}
+
+int init_frame_buffer_locked(mali_gralloc_display *dpy)
+{
+	if (dpy->framebuffer)
+	{
+		return 0; // Nothing to do, already initialized
 	}
 
 	struct fb_fix_screeninfo finfo;
+	struct fb_var_screeninfo info;
+	uint32_t flags = PAGE_FLIP;
+
+#if GRALLOC_FB_USE_KMS == 1
+	/* The KMS backend drives a single display. */
+	if (dpy->index != 0)
+	{
+		return -ENODEV;
+	}
+
+	int fd = fb_kms_init(&info, &finfo);
 
-	if (ioctl(fd, FBIOGET_FSCREENINFO, &finfo) == -1)
+	if (fd < 0)
+	{
+		return fd;
+	}
+#else
+	int fd = fbdev_open(dpy->index);
+
+	if (fd < 0)
 	{
 		return -errno;
 	}
 
-	struct fb_var_screeninfo info;
+	if (fbdev_ioctl(fd, FBIOGET_FSCREENINFO, &finfo) == -1)
+	{
+		return -errno;
+	}
 
-	if (ioctl(fd, FBIOGET_VSCREENINFO, &info) == -1)
+	if (fbdev_ioctl(fd, FBIOGET_VSCREENINFO, &info) == -1)
 	{
 		return -errno;
 	}
@@ -226,56 +598,62 @@ static int init_frame_buffer_locked(struct private_module_t *module)
 	info.yoffset = 0;
 	info.activate = FB_ACTIVATE_NOW;
 
-#if GRALLOC_FB_BPP == 16
 	/*
-	 * Explicitly request 5/6/5
+	 * A panel which can't be reprogrammed keeps its own pixel layout when
+	 * posts can be converted to it.
 	 */
-	info.bits_per_pixel = 16;
-	info.red.offset = 11;
-	info.red.length = 5;
-	info.green.offset = 5;
-	info.green.length = 6;
-	info.blue.offset = 0;
-	info.blue.length = 5;
-	info.transp.offset = 0;
-	info.transp.length = 0;
+	if (GRALLOC_FB_SCANOUT_DMABUF == 1 || fb_format_from_screeninfo(&info) == 0)
+	{
+#if GRALLOC_FB_BPP == 16
+		/*
+		 * Explicitly request 5/6/5
+		 */
+		info.bits_per_pixel = 16;
+		info.red.offset = 11;
+		info.red.length = 5;
+		info.green.offset = 5;
+		info.green.length = 6;
+		info.blue.offset = 0;
+		info.blue.length = 5;
+		info.transp.offset = 0;
+		info.transp.length = 0;
 #elif GRALLOC_FB_BPP == 32
-	/*
-	 * Explicitly request 8/8/8
-	 */
-	info.bits_per_pixel = 32;
-	info.red.offset = 16;
-	info.red.length = 8;
-	info.green.offset = 8;
-	info.green.length = 8;
-	info.blue.offset = 0;
-	info.blue.length = 8;
-	info.transp.offset = 0;
-	info.transp.length = 0;
+		/*
+		 * Explicitly request 8/8/8
+		 */
+		info.bits_per_pixel = 32;
+		info.red.offset = 16;
+		info.red.length = 8;
+		info.green.offset = 8;
+		info.green.length = 8;
+		info.blue.offset = 0;
+		info.blue.length = 8;
+		info.transp.offset = 0;
+		info.transp.length = 0;
 #else
 #error "Invalid framebuffer bit depth"
 #endif
+	}
 
 	/*
 	 * Request NUM_BUFFERS screens (at lest 2 for page flipping)
 	 */
 	info.yres_virtual = info.yres * NUM_BUFFERS;
-#if 1
+#if GRALLOC_FB_SCANOUT_DMABUF != 1
 	finfo.line_length = (info.xres * (info.bits_per_pixel/8));
-#endif /* 1 */
-
-	uint32_t flags = PAGE_FLIP;
+#endif
 
-#if 0
-	/* SimpleFB is not support page flipping, but we have NUM_BUFFERS screens */
-	/* so I force enabled page flipping */
-	if (ioctl(fd, FBIOPUT_VSCREENINFO, &info) == -1)
+#if GRALLOC_FB_SCANOUT_DMABUF == 1
+	if (fbdev_ioctl(fd, FBIOPUT_VSCREENINFO, &info) == -1)
 	{
 		info.yres_virtual = info.yres;
 		flags &= ~PAGE_FLIP;
 		AWAR("FBIOPUT_VSCREENINFO failed, page flipping not supported fd: %d", fd);
 	}
-#endif /* 0 */
+#else
+	/* SimpleFB is not support page flipping, but we have NUM_BUFFERS screens */
+	/* so I force enabled page flipping */
+#endif
 
 	if (info.yres_virtual < info.yres * 2)
 	{
@@ -285,12 +663,13 @@ static int init_frame_buffer_locked(struct private_module_t *module)
 		AWAR("page flipping not supported (yres_virtual=%d, requested=%d)", info.yres_virtual, info.yres * 2);
 	}
 
-#if 0
-	if (ioctl(fd, FBIOGET_VSCREENINFO, &info) == -1)
+#if GRALLOC_FB_SCANOUT_DMABUF == 1
+	if (fbdev_ioctl(fd, FBIOGET_VSCREENINFO, &info) == -1)
 	{
 		return -errno;
 	}
-#endif /* 0 */
+#endif
+#endif /* GRALLOC_FB_USE_KMS == 1 */
 
 	int refreshRate = 0;
 
@@ -342,49 +721,76 @@ static int init_frame_buffer_locked(struct private_module_t *module)
 
 	if (0 == strncmp(finfo.id, "CLCD FB", 7))
 	{
-		module->dpy_type = MALI_DPY_TYPE_CLCD;
+		dpy->dpy_type = MALI_DPY_TYPE_CLCD;
 	}
 	else if (0 == strncmp(finfo.id, "ARM Mali HDLCD", 14))
 	{
-		module->dpy_type = MALI_DPY_TYPE_HDLCD;
+		dpy->dpy_type = MALI_DPY_TYPE_HDLCD;
 	}
 	else if (0 == strncmp(finfo.id, "ARM HDLCD Control", 16))
 	{
-		module->dpy_type = MALI_DPY_TYPE_HDLCD;
+		dpy->dpy_type = MALI_DPY_TYPE_HDLCD;
 	}
 	else
 	{
-		module->dpy_type = MALI_DPY_TYPE_UNKNOWN;
+		dpy->dpy_type = MALI_DPY_TYPE_UNKNOWN;
 	}
 
-#if 0
-	if (ioctl(fd, FBIOGET_FSCREENINFO, &finfo) == -1)
+#if GRALLOC_FB_SCANOUT_DMABUF == 1
+	/* The line length may have changed with the new mode. */
+	if (fbdev_ioctl(fd, FBIOGET_FSCREENINFO, &finfo) == -1)
 	{
 		return -errno;
 	}
-#endif /* 0 */
+#endif
 
 	if (finfo.smem_len <= 0)
 	{
 		return -errno;
 	}
 
-	module->flags = flags;
-	module->info = info;
-	module->finfo = finfo;
-	module->xdpi = xdpi;
-	module->ydpi = ydpi;
-	module->fps = fps;
-	module->swapInterval = 1;
+#if GRALLOC_FB_SCANOUT_DMABUF == 1
+	/* Only expose the screens which are backed by framebuffer memory. */
+	const uint32_t smemScreens = finfo.smem_len / (finfo.line_length * info.yres);
+	if (info.yres_virtual > info.yres * smemScreens)
+	{
+		AWAR("framebuffer memory only holds %u screens (yres_virtual=%d)", smemScreens, info.yres_virtual);
+		info.yres_virtual = info.yres * GRALLOC_MAX(smemScreens, 1U);
+	}
+#endif
 
+	dpy->fbdev_format = fb_format_from_screeninfo(&info);
+	if (dpy->fbdev_format == 0)
+	{
+		dpy->fbdev_format = FB_DEFAULT_FORMAT;
+	}
+
+	AINF("framebuffer %u format 0x%" PRIx64, dpy->index, dpy->fbdev_format);
+
+	dpy->flags = flags;
+	dpy->info = info;
+	dpy->finfo = finfo;
+	dpy->xdpi = xdpi;
+	dpy->ydpi = ydpi;
+	dpy->fps = fps;
+	dpy->swapInterval = 1;
+
+#if GRALLOC_FB_USE_KMS == 1
+	/* There is no framebuffer memory to map, posted buffers are scanned out directly. */
+	dpy->framebuffer = new private_handle_t(private_handle_t::PRIV_FLAGS_FRAMEBUFFER, 0, NULL,
+	                                           GRALLOC_USAGE_HW_FB, GRALLOC_USAGE_HW_FB, fd, 0,
+	                                           finfo.line_length, info.xres_virtual, info.yres_virtual,
+	                                           dpy->fbdev_format);
+#else
 	/*
 	 * map the framebuffer
 	 */
-#if 1
-	size_t fbSize = round_up_to_page_size(finfo.line_length * info.yres);
-#else /* 1 */
+#if GRALLOC_FB_SCANOUT_DMABUF == 1
 	size_t fbSize = round_up_to_page_size(finfo.line_length * info.yres_virtual);
-#endif /* 1 */
+#else
+	/* All of the framebuffer memory, so that posts can be copied into whichever screen is displayed. */
+	size_t fbSize = round_up_to_page_size(finfo.smem_len);
+#endif
 	void *vaddr = mmap(0, fbSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
 
 	if (vaddr == MAP_FAILED)
@@ -396,22 +802,27 @@ static int init_frame_buffer_locked(struct private_module_t *module)
 	memset(vaddr, 0, fbSize);
 
 	// Create a "fake" buffer object for the entire frame buffer memory, and store it in the module
-	module->framebuffer = new private_handle_t(private_handle_t::PRIV_FLAGS_FRAMEBUFFER, fbSize, vaddr,
+	dpy->framebuffer = new private_handle_t(private_handle_t::PRIV_FLAGS_FRAMEBUFFER, fbSize, vaddr,
 	                                           GRALLOC_USAGE_HW_FB, GRALLOC_USAGE_HW_FB, dup(fd), 0,
 	                                           finfo.line_length, info.xres_virtual, info.yres_virtual,
-	                                           module->fbdev_format);
+	                                           dpy->fbdev_format);
+#endif
 
-	module->numBuffers = info.yres_virtual / info.yres;
-	module->bufferMask = 0;
+#if GRALLOC_COMPACT_HANDLE == 1
+	mali_gralloc_reference_add_local(dpy->framebuffer);
+#endif
+
+	dpy->numBuffers = GRALLOC_MIN(info.yres_virtual / info.yres, (uint32_t)NUM_BUFFERS);
+	dpy->bufferMask = 0;
 
 	return 0;
 }
 
-static int init_frame_buffer(struct private_module_t *module)
+static int init_frame_buffer(mali_gralloc_display *dpy)
 {
-	pthread_mutex_lock(&module->lock);
-	int err = init_frame_buffer_locked(module);
-	pthread_mutex_unlock(&module->lock);
+	pthread_mutex_lock(&dpy->lock);
+	int err = init_frame_buffer_locked(dpy);
+	pthread_mutex_unlock(&dpy->lock);
 	return err;
 }
 
@@ -421,17 +832,25 @@ static int fb_close(struct hw_device_t *device)
 
 	if (dev)
 	{
+		fb_flip_queue_stop(dev);
 		free(dev);
 	}
 
 	return 0;
 }
 
-static int fb_alloc_framebuffer_dmabuf(private_module_t *m, private_handle_t *hnd)
+/*
+ * Exports the framebuffer memory as a dma-buf for one ring slot. Every slot
+ * handle owns its own export of the whole framebuffer; the slot is selected
+ * by the handle offset, so the GPU renders straight into scanout memory.
+ */
+static int fb_alloc_framebuffer_dmabuf(mali_gralloc_display *dpy, private_handle_t *hnd)
 {
 	struct fb_dmabuf_export fb_dma_buf;
 	int res;
-	res = ioctl(m->framebuffer->fd, FBIOGET_DMABUF, &fb_dma_buf);
+
+	memset(&fb_dma_buf, 0, sizeof(fb_dma_buf));
+	res = fbdev_ioctl(dpy->framebuffer->fd, FBIOGET_DMABUF, &fb_dma_buf);
 
 	if (res == 0)
 	{
@@ -447,8 +866,9 @@ static int fb_alloc_framebuffer_dmabuf(private_module_t *m, private_handle_t *hn
 	}
 }
 
-static int fb_alloc_from_ion_module(mali_gralloc_module *m, int width, int height, int byte_stride, size_t buffer_size,
-                                    uint64_t consumer_usage, uint64_t producer_usage, buffer_handle_t *pHandle)
+static int fb_alloc_from_ion_module(mali_gralloc_module *m, int width, int height, uint64_t format, int byte_stride,
+                                    size_t buffer_size, uint64_t consumer_usage, uint64_t producer_usage,
+                                    buffer_handle_t *pHandle)
 {
 	buffer_descriptor_t fb_buffer_descriptor;
 	gralloc_buffer_descriptor_t gralloc_buffer_descriptor[1];
@@ -469,27 +889,29 @@ static int fb_alloc_from_ion_module(mali_gralloc_module *m, int width, int heigh
 	fb_buffer_descriptor.plane_info[0].byte_stride = byte_stride;
 	fb_buffer_descriptor.plane_info[0].offset = 0;
 
-	fb_buffer_descriptor.internal_format = m->fbdev_format;
-	fb_buffer_descriptor.alloc_format = m->fbdev_format;
+	fb_buffer_descriptor.internal_format = format;
+	fb_buffer_descriptor.alloc_format = format;
 	fb_buffer_descriptor.consumer_usage = consumer_usage;
 	fb_buffer_descriptor.producer_usage = producer_usage;
 	fb_buffer_descriptor.layer_count = 1;
 
 	gralloc_buffer_descriptor[0] = (gralloc_buffer_descriptor_t)(&fb_buffer_descriptor);
 
-	err = mali_gralloc_ion_allocate(m, gralloc_buffer_descriptor, 1, pHandle, &shared);
+	err = mali_gralloc_backend_allocate(m, gralloc_buffer_descriptor, 1, pHandle, &shared);
 
 	return err;
 }
 
-static int fb_alloc_framebuffer_locked(mali_gralloc_module *m, uint64_t consumer_usage, uint64_t producer_usage,
-                                       buffer_handle_t *pHandle, int *stride, int *byte_stride)
+static int fb_alloc_framebuffer_locked(mali_gralloc_display *dpy, uint64_t consumer_usage, uint64_t producer_usage,
+                                       uint64_t format, buffer_handle_t *pHandle, int *stride, int *byte_stride)
 {
+	mali_gralloc_module *m = dpy->module;
+
 	// allocate the framebuffer
-	if (m->framebuffer == NULL)
+	if (dpy->framebuffer == NULL)
 	{
 		// initialize the framebuffer, the framebuffer is mapped once and forever.
-		int err = init_frame_buffer_locked(m);
+		int err = init_frame_buffer_locked(dpy);
 
 		if (err < 0)
 		{
@@ -497,16 +919,24 @@ static int fb_alloc_framebuffer_locked(mali_gralloc_module *m, uint64_t consumer
 		}
 	}
 
-	uint32_t bufferMask = m->bufferMask;
-	const uint32_t numBuffers = m->numBuffers;
+	const uint32_t numBuffers = dpy->numBuffers;
 	/* framebufferSize is used for allocating the handle to the framebuffer and refers
 	 *                 to the size of the actual framebuffer.
 	 * alignedFramebufferSize is used for allocating a possible internal buffer and
 	 *                        thus need to consider internal alignment requirements. */
-	const size_t framebufferSize = m->finfo.line_length * m->info.yres;
-	const size_t alignedFramebufferSize = GRALLOC_ALIGN(m->finfo.line_length, 64) * m->info.yres;
+	const size_t framebufferSize = dpy->finfo.line_length * dpy->info.yres;
 
-	*stride = m->info.xres;
+#if GRALLOC_FB_USE_KMS == 1
+	/* Ring buffers are scanned out as they are. */
+	const uint64_t ionFormat = dpy->fbdev_format;
+#else
+	/* Buffers which are copied on post may be in any format the copy converts from. */
+	const uint64_t ionFormat = fb_convert_supported(format, dpy->fbdev_format) ? format : dpy->fbdev_format;
+#endif
+	const int ionByteStride = GRALLOC_ALIGN(dpy->info.xres * fb_convert_bytes_per_pixel(ionFormat), 64);
+	const size_t alignedFramebufferSize = ionByteStride * dpy->info.yres;
+
+	*stride = dpy->info.xres;
 
 	if (numBuffers == 1)
 	{
@@ -515,113 +945,235 @@ static int fb_alloc_framebuffer_locked(mali_gralloc_module *m, uint64_t consumer
 		// screen when post is called.
 		uint64_t newConsumerUsage = (consumer_usage & ~GRALLOC_USAGE_HW_FB);
 		uint64_t newProducerUsage = (producer_usage & ~GRALLOC_USAGE_HW_FB) | GRALLOC_USAGE_HW_2D;
-		AWAR("fallback to single buffering. Virtual Y-res too small %d", m->info.yres);
-		*byte_stride = GRALLOC_ALIGN(m->finfo.line_length, 64);
-		return fb_alloc_from_ion_module(m, m->info.xres, m->info.yres, *byte_stride,
+		AWAR("fallback to single buffering. Virtual Y-res too small %d", dpy->info.yres);
+		*byte_stride = ionByteStride;
+		return fb_alloc_from_ion_module(m, dpy->info.xres, dpy->info.yres, ionFormat, *byte_stride,
 		                                alignedFramebufferSize, newConsumerUsage, newProducerUsage, pHandle);
 	}
 
-	if (bufferMask >= ((1LU << numBuffers) - 1))
-	{
-		// We ran out of buffers, reset bufferMask
-		bufferMask = 0;
-		m->bufferMask = 0;
-	}
-
-#if 1
-	/*
-	 * FIXME: Since simplefb can't treat as CMA buffer, use other CMA buffer
-	 *        instead of simplefb buffer.
-	 */
-	uintptr_t framebufferPaddr = (uintptr_t)m->finfo.smem_start + 0x02000000;
 	// find a free slot
-	for (uint32_t i=0 ; i<numBuffers ; i++)
+	uint32_t slot;
+	for (slot = 0; slot < numBuffers; slot++)
 	{
-		if ((bufferMask & (1LU<<i)) == 0)
+		if ((dpy->bufferMask & (1U << slot)) == 0)
 		{
-			m->bufferMask |= (1LU<<i);
 			break;
 		}
-		/*
-		 * FIXME: Since android use ION-FB buffer with 23bit alignment,
-		 *        start address must be 23bit aligned.
-		 */
-		framebufferPaddr += (framebufferSize + 0x007fffff) & 0xff800000;
 	}
 
-	*byte_stride = GRALLOC_ALIGN(m->finfo.line_length, 64);
-	int ret = fb_alloc_from_ion_module(m, m->info.xres, m->info.yres, *byte_stride,
-										alignedFramebufferSize, consumer_usage, producer_usage, pHandle);
+	if (slot == numBuffers)
+	{
+		AERR("All %u framebuffer slots are in use", numBuffers);
+		return -ENOMEM;
+	}
 
-	if (pHandle) {
-		private_handle_t*hnd = (private_handle_t *)*pHandle;
-		hnd->pbase = (void *)framebufferPaddr; // Set Physical Address
-		// ret = gralloc_buffer_attr_allocate( hnd );
-		// if( ret < 0 )
-		// {
-		// 	mali_gralloc_ion_free( hnd );
-		// 	return ret;
-		// }
+#if GRALLOC_FB_USE_KMS == 1
+	/* Ring buffers are ordinary ION buffers, imported into KMS when first posted. */
+	*byte_stride = ionByteStride;
+	int ret = fb_alloc_from_ion_module(m, dpy->info.xres, dpy->info.yres, ionFormat, *byte_stride,
+	                                   alignedFramebufferSize, consumer_usage, producer_usage, pHandle);
+
+	if (ret >= 0)
+	{
+		dpy->bufferMask |= (1U << slot);
+		s_fb_slots[dpy->index][slot] = *pHandle;
 	}
 	return ret;
 
-#else /* 1 */
-	uintptr_t framebufferVaddr = (uintptr_t)m->framebuffer->base;
+#elif GRALLOC_FB_SCANOUT_DMABUF != 1
+	/*
+	 * FIXME: Since simplefb can't treat as CMA buffer, use other CMA buffer
+	 *        instead of simplefb buffer.
+	 *
+	 * FIXME: Since android use ION-FB buffer with 23bit alignment,
+	 *        start address must be 23bit aligned.
+	 */
+	const uintptr_t framebufferPaddr = (uintptr_t)dpy->finfo.smem_start + 0x02000000 +
+	                                   slot * ((framebufferSize + 0x007fffff) & 0xff800000);
 
-	// find a free slot
-	for (uint32_t i = 0; i < numBuffers; i++)
+	*byte_stride = ionByteStride;
+	int ret = fb_alloc_from_ion_module(m, dpy->info.xres, dpy->info.yres, ionFormat, *byte_stride,
+										alignedFramebufferSize, consumer_usage, producer_usage, pHandle);
+
+	if (ret >= 0)
 	{
-		if ((bufferMask & (1LU << i)) == 0)
-		{
-			m->bufferMask |= (1LU << i);
-			break;
-		}
+		private_handle_t*hnd = (private_handle_t *)*pHandle;
+		hnd->pbase = (void *)framebufferPaddr; // Set Physical Address
 
-		framebufferVaddr += framebufferSize;
+		dpy->bufferMask |= (1U << slot);
+		s_fb_slots[dpy->index][slot] = *pHandle;
 	}
+	return ret;
+
+#else
+	const uintptr_t framebufferVaddr = (uintptr_t)dpy->framebuffer->base + slot * framebufferSize;
 
 	// The entire framebuffer memory is already mapped, now create a buffer object for parts of this memory
 	private_handle_t *hnd = new private_handle_t(
 	    private_handle_t::PRIV_FLAGS_FRAMEBUFFER, framebufferSize, (void *)framebufferVaddr, consumer_usage,
-	    producer_usage, dup(m->framebuffer->fd), (framebufferVaddr - (uintptr_t)m->framebuffer->base),
-	    m->finfo.line_length, m->info.xres, m->info.yres, m->fbdev_format);
+	    producer_usage, dup(dpy->framebuffer->fd), (framebufferVaddr - (uintptr_t)dpy->framebuffer->base),
+	    dpy->finfo.line_length, dpy->info.xres, dpy->info.yres, dpy->fbdev_format);
 
 	/*
 	 * Perform allocator specific actions. If these fail we fall back to a regular buffer
 	 * which will be memcpy'ed to the main screen when fb_post is called.
 	 */
-	if (fb_alloc_framebuffer_dmabuf(m, hnd) == -1)
+	if (fb_alloc_framebuffer_dmabuf(dpy, hnd) == -1)
 	{
+		close(hnd->fd);
 		delete hnd;
 		uint64_t newConsumerUsage = (consumer_usage & ~GRALLOC_USAGE_HW_FB);
 		uint64_t newProducerUsage = (producer_usage & ~GRALLOC_USAGE_HW_FB) | GRALLOC_USAGE_HW_2D;
-		AERR("Fallback to single buffering. Unable to map framebuffer memory to handle:%p", hnd);
-		*byte_stride = GRALLOC_ALIGN(m->finfo.line_length, 64);
-		return fb_alloc_from_ion_module(m, m->info.xres, m->info.yres, *byte_stride,
+		AERR("Fallback to copying posts. Unable to export framebuffer slot %u as a dma-buf", slot);
+		*byte_stride = ionByteStride;
+		return fb_alloc_from_ion_module(m, dpy->info.xres, dpy->info.yres, ionFormat, *byte_stride,
 		                                alignedFramebufferSize, newConsumerUsage, newProducerUsage, pHandle);
 	}
 
+	dpy->bufferMask |= (1U << slot);
+	s_fb_slots[dpy->index][slot] = hnd;
+
 	*pHandle = hnd;
-	*byte_stride = m->finfo.line_length;
+	*byte_stride = dpy->finfo.line_length;
 
 	return 0;
-#endif /* 1 */
+#endif
 }
 
-int fb_alloc_framebuffer(mali_gralloc_module *m, uint64_t consumer_usage, uint64_t producer_usage,
+/*
+ * Selects the display a framebuffer allocation is for. Display 0 is used
+ * unless the producer usage names another one, or the consumer is an
+ * external display. Consumer usage has its own private bits where the
+ * display ones are, so only the producer usage is looked at for those.
+ */
+static mali_gralloc_display *fb_display_from_usage(mali_gralloc_module *m, uint64_t consumer_usage,
+                                                   uint64_t producer_usage)
+{
+	uint32_t index = 0;
+
+#if GRALLOC_USE_GRALLOC1_API == 1
+	switch (producer_usage & MALI_GRALLOC_USAGE_FB_DISPLAY_MASK)
+	{
+	case MALI_GRALLOC_USAGE_FB_DISPLAY_1:
+		index = 1;
+		break;
+
+	case MALI_GRALLOC_USAGE_FB_DISPLAY_2:
+		index = 2;
+		break;
+
+	case MALI_GRALLOC_USAGE_FB_DISPLAY_3:
+		index = 3;
+		break;
+
+	default:
+		break;
+	}
+#endif
+
+	if (index == 0 && (consumer_usage & GRALLOC_USAGE_EXTERNAL_DISP))
+	{
+		index = 1;
+	}
+
+	if (index >= MALI_GRALLOC_MAX_DISPLAYS)
+	{
+		AERR("Framebuffer display %u requested, only %d supported", index, MALI_GRALLOC_MAX_DISPLAYS);
+		return NULL;
+	}
+
+	return &m->displays[index];
+}
+
+int fb_alloc_framebuffer(mali_gralloc_module *m, uint64_t consumer_usage, uint64_t producer_usage, uint64_t format,
                          buffer_handle_t *pHandle, int *stride, int *byte_stride)
 {
-	pthread_mutex_lock(&m->lock);
-	int err = fb_alloc_framebuffer_locked(m, consumer_usage, producer_usage, pHandle, stride, byte_stride);
-	pthread_mutex_unlock(&m->lock);
+	mali_gralloc_display *dpy = fb_display_from_usage(m, consumer_usage, producer_usage);
+
+	if (dpy == NULL)
+	{
+		return -EINVAL;
+	}
+
+	pthread_mutex_lock(&dpy->lock);
+	int err = fb_alloc_framebuffer_locked(dpy, consumer_usage, producer_usage, format, pHandle, stride, byte_stride);
+	pthread_mutex_unlock(&dpy->lock);
+
+#if GRALLOC_COMPACT_HANDLE == 1
+	if (err >= 0)
+	{
+		mali_gralloc_reference_add_local((private_handle_t *)*pHandle);
+	}
+#endif
+
 	return err;
 }
 
+void fb_release_buffer(mali_gralloc_module *m, buffer_handle_t handle)
+{
+	for (uint32_t d = 0; d < MALI_GRALLOC_MAX_DISPLAYS; d++)
+	{
+		mali_gralloc_display *dpy = &m->displays[d];
+		fb_flip_queue *q = &s_flip_queues[d];
+
+		/* Wait for any pending flip of this buffer and make sure it is no longer referenced as on screen. */
+		pthread_mutex_lock(&q->lock);
+
+		while (fb_flip_queue_contains_locked(q, handle))
+		{
+			pthread_cond_wait(&q->cond, &q->lock);
+		}
+
+		if (dpy->currentBuffer == handle)
+		{
+			dpy->currentBuffer = 0;
+		}
+
+		pthread_mutex_unlock(&q->lock);
+
+		pthread_mutex_lock(&dpy->lock);
+
+		for (uint32_t i = 0; i < NUM_BUFFERS; i++)
+		{
+			if (s_fb_slots[d][i] == handle)
+			{
+				s_fb_slots[d][i] = NULL;
+				dpy->bufferMask &= ~(1U << i);
+				break;
+			}
+		}
+
+		pthread_mutex_unlock(&dpy->lock);
+	}
+
+#if GRALLOC_FB_USE_KMS == 1
+	fb_kms_release_buffer(reinterpret_cast<private_handle_t const *>(handle));
+#endif
+}
+
+int framebuffer_device_index(const char *name)
+{
+	unsigned int index;
+	char trailing;
+
+	/* GRALLOC_HARDWARE_FB0 is display 0, "fb1" display 1 and so on. */
+	if (name == NULL || sscanf(name, "fb%u%c", &index, &trailing) != 1 || index >= MALI_GRALLOC_MAX_DISPLAYS)
+	{
+		return -1;
+	}
+
+	return (int)index;
+}
+
 int framebuffer_device_open(hw_module_t const *module, const char *name, hw_device_t **device)
 {
 	int status = -EINVAL;
+	const int index = framebuffer_device_index(name);
 
-	GRALLOC_UNUSED(name);
+	if (index < 0)
+	{
+		return -EINVAL;
+	}
 
 #if GRALLOC_USE_GRALLOC1_API == 1
 	gralloc1_device_t *gralloc_device;
@@ -652,16 +1204,8 @@ int framebuffer_device_open(hw_module_t const *module, const char *name, hw_devi
 
 	private_module_t *m = (private_module_t *)module;
 
-	/* Populate frame buffer pixel format */
-#if GRALLOC_FB_BPP == 16
-	m->fbdev_format = HAL_PIXEL_FORMAT_RGB_565;
-#elif GRALLOC_FB_BPP == 32
-	m->fbdev_format = HAL_PIXEL_FORMAT_BGRA_8888;
-#else
-#error "Invalid framebuffer bit depth"
-#endif
-
-	status = init_frame_buffer(m);
+	mali_gralloc_display *dpy = &m->displays[index];
+	status = init_frame_buffer(dpy);
 
 	/* malloc is used instead of 'new' to instantiate the struct framebuffer_device_t
 	 * C++11 spec specifies that if a class/struct has a const member,default constructor
@@ -677,7 +1221,8 @@ int framebuffer_device_open(hw_module_t const *module, const char *name, hw_devi
 	 * This is the only maintainable option available.
 	 */
 
-	framebuffer_device_t *dev = reinterpret_cast<framebuffer_device_t *>(malloc(sizeof(framebuffer_device_t)));
+	fb_device *fbdev = reinterpret_cast<fb_device *>(malloc(sizeof(fb_device)));
+	framebuffer_device_t *dev = reinterpret_cast<framebuffer_device_t *>(fbdev);
 
 	/* if either or both of init_frame_buffer() and malloc failed */
 	if ((status < 0) || (!dev))
@@ -691,7 +1236,8 @@ int framebuffer_device_open(hw_module_t const *module, const char *name, hw_devi
 		return status;
 	}
 
-	memset(dev, 0, sizeof(*dev));
+	memset((void *)fbdev, 0, sizeof(*fbdev));
+	fbdev->dpy = dpy;
 
 	/* initialize the procs */
 	dev->common.tag = HARDWARE_DEVICE_TAG;
@@ -702,20 +1248,25 @@ int framebuffer_device_open(hw_module_t const *module, const char *name, hw_devi
 	dev->post = fb_post;
 	dev->setUpdateRect = 0;
 
-	int stride = m->finfo.line_length / (m->info.bits_per_pixel >> 3);
+	int stride = dpy->finfo.line_length / (dpy->info.bits_per_pixel >> 3);
 	const_cast<uint32_t &>(dev->flags) = 0;
-	const_cast<uint32_t &>(dev->width) = m->info.xres;
-	const_cast<uint32_t &>(dev->height) = m->info.yres;
+	const_cast<uint32_t &>(dev->width) = dpy->info.xres;
+	const_cast<uint32_t &>(dev->height) = dpy->info.yres;
 	const_cast<int &>(dev->stride) = stride;
-	const_cast<int &>(dev->format) = m->fbdev_format;
-	const_cast<float &>(dev->xdpi) = m->xdpi;
-	const_cast<float &>(dev->ydpi) = m->ydpi;
-	const_cast<float &>(dev->fps) = m->fps;
+	const_cast<int &>(dev->format) = dpy->fbdev_format;
+	const_cast<float &>(dev->xdpi) = dpy->xdpi;
+	const_cast<float &>(dev->ydpi) = dpy->ydpi;
+	const_cast<float &>(dev->fps) = dpy->fps;
 	const_cast<int &>(dev->minSwapInterval) = 0;
-	const_cast<int &>(dev->maxSwapInterval) = 1;
+	const_cast<int &>(dev->maxSwapInterval) = GRALLOC_FB_MAX_SWAP_INTERVAL;
 	*device = &dev->common;
 
-	gralloc_vsync_enable(dev);
+	gralloc_vsync_enable(dpy);
+
+	if (fb_flip_queue_start(dev, dpy) != 0)
+	{
+		AWAR("Posting synchronously, flip thread unavailable");
+	}
 
 	return status;
 }
@@ -22,9 +22,18 @@
 // Create a framebuffer device
 int framebuffer_device_open(hw_module_t const *module, const char *name, hw_device_t **device);
 
-// Initialize the framebuffer (must keep module lock before calling
-int init_frame_buffer_locked(struct private_module_t *module);
+// Display index of a framebuffer device name ("fb0", "fb1", ...), or -1 if the name is not one
+int framebuffer_device_index(const char *name);
 
-// Allocate framebuffer buffer
-int fb_alloc_framebuffer(mali_gralloc_module *m, uint64_t consumer_usage, uint64_t producer_usage,
+// Initialize the framebuffer of a display (must keep display lock before calling
+int init_frame_buffer_locked(struct mali_gralloc_display *dpy);
+
+// Allocate framebuffer buffer. The buffer is in the requested format when posts of it can be converted
+// to the display format, and in the display format otherwise
+int fb_alloc_framebuffer(mali_gralloc_module *m, uint64_t consumer_usage, uint64_t producer_usage, uint64_t format,
                          buffer_handle_t *pHandle, int *stride, int *byte_stride);
+
+// Forget a buffer which is about to be freed or unmapped: waits for any pending post
+// of it and releases its framebuffer ring slot and display resources, if any. This can
+// take a vsync, so it must not be called with the reference lock held
+void fb_release_buffer(mali_gralloc_module *m, buffer_handle_t handle);
@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2018 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FRAMEBUFFER_FBDEV_H_
+#define FRAMEBUFFER_FBDEV_H_
+
+/*
+ * Access to the fbdev device used by the framebuffer HAL. The hardware
+ * implementation (framebuffer_fbdev_hw.cpp) opens the device node and
+ * forwards to ioctl(). The virtual implementation
+ * (framebuffer_fbdev_virtual.cpp) emulates a display in-process so that the
+ * post path can be run and measured without display hardware.
+ */
+
+/* Opens framebuffer device 'index'. Returns a file descriptor which can be mmap()ed, or -1 with errno set. */
+int fbdev_open(unsigned int index);
+
+/* Issues an fbdev request. Same contract as ioctl(). */
+int fbdev_ioctl(int fd, unsigned long request, void *arg);
+
+#endif /* FRAMEBUFFER_FBDEV_H_ */
@@ -0,0 +1,434 @@
+/*
+ * Copyright (C) 2018 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Virtual fbdev device.
+ *
+ * Emulates the fbdev requests the framebuffer HAL issues (screen info
+ * queries and updates, panning, FBIO_WAITFORVSYNC and FBIOGET_DMABUF) for
+ * a display which only exists in this process. The framebuffer memory is a
+ * memfd, so it can be mapped and exported like real framebuffer memory.
+ *
+ * Vsync edges are generated from the configured refresh rate on a fixed
+ * CLOCK_MONOTONIC timeline. Pans requested with FB_ACTIVATE_VBL latch on the
+ * next edge, like on hardware.
+ *
+ * One device is emulated per framebuffer display (fb0, fb1, ...). Every
+ * display is configured the same way, through the environment when it is
+ * first opened:
+ *   GRALLOC_VFB_MODE    <width>x<height>@<hz>, default 1920x1080@60
+ *   GRALLOC_VFB_STRIDE  line length in bytes, default width * 4
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/fb.h>
+#include <linux/memfd.h>
+
+#include <log/log.h>
+
+#include "gralloc_priv.h"
+#include "gralloc_helper.h"
+#include "mali_gralloc_buffer.h"
+#include "mali_gralloc_module.h"
+#include "framebuffer_fbdev.h"
+
+#ifndef FBIO_WAITFORVSYNC
+#define FBIO_WAITFORVSYNC _IOW('F', 0x20, __u32)
+#endif
+
+#define VFB_DEFAULT_XRES 1920
+#define VFB_DEFAULT_YRES 1080
+#define VFB_DEFAULT_REFRESH_HZ 60
+#define VFB_BYTES_PER_PIXEL 4
+
+struct vfb_state
+{
+	pthread_mutex_t lock;
+
+	/* memfd backing the framebuffer memory, -1 until the device is first opened. */
+	int fd;
+	dev_t st_dev;
+	ino_t st_ino;
+	size_t size;
+
+	struct fb_var_screeninfo info;
+	struct fb_fix_screeninfo finfo;
+
+	/* Vsync edge n occurs at anchor_ns + n * period_ns. */
+	int64_t anchor_ns;
+	int64_t period_ns;
+
+	/* Pan offset which takes effect on the next vsync edge. */
+	bool pan_pending;
+	uint32_t pending_yoffset;
+
+	vfb_state()
+	    : fd(-1)
+	    , st_dev(0)
+	    , st_ino(0)
+	    , size(0)
+	    , anchor_ns(0)
+	    , period_ns(0)
+	    , pan_pending(false)
+	    , pending_yoffset(0)
+	{
+		pthread_mutex_init(&lock, NULL);
+		memset(&info, 0, sizeof(info));
+		memset(&finfo, 0, sizeof(finfo));
+	}
+};
+
+static vfb_state s_vfb[MALI_GRALLOC_MAX_DISPLAYS];
+
+static int64_t vfb_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Must be called with vfb->lock held. */
+static int vfb_resize_locked(vfb_state *vfb, size_t size)
+{
+	if (size <= vfb->size)
+	{
+		return 0;
+	}
+
+	if (ftruncate(vfb->fd, size) != 0)
+	{
+		return -1;
+	}
+
+	vfb->size = size;
+	vfb->finfo.smem_len = size;
+
+	return 0;
+}
+
+/* Must be called with vfb->lock held. */
+static int vfb_create_locked(vfb_state *vfb)
+{
+	unsigned int xres = VFB_DEFAULT_XRES;
+	unsigned int yres = VFB_DEFAULT_YRES;
+	unsigned int hz = VFB_DEFAULT_REFRESH_HZ;
+
+	const char *mode = getenv("GRALLOC_VFB_MODE");
+	if (mode != NULL && (sscanf(mode, "%ux%u@%u", &xres, &yres, &hz) != 3 || xres == 0 || yres == 0 || hz == 0))
+	{
+		AWAR("Ignoring invalid GRALLOC_VFB_MODE '%s'", mode);
+		xres = VFB_DEFAULT_XRES;
+		yres = VFB_DEFAULT_YRES;
+		hz = VFB_DEFAULT_REFRESH_HZ;
+	}
+
+	uint32_t line_length = xres * VFB_BYTES_PER_PIXEL;
+	const char *stride = getenv("GRALLOC_VFB_STRIDE");
+	if (stride != NULL)
+	{
+		const unsigned long value = strtoul(stride, NULL, 0);
+
+		if (value >= line_length)
+		{
+			line_length = value;
+		}
+		else
+		{
+			AWAR("Ignoring GRALLOC_VFB_STRIDE %lu smaller than a line (%u)", value, line_length);
+		}
+	}
+
+	const int fd = syscall(__NR_memfd_create, "gralloc-vfb", MFD_CLOEXEC);
+	if (fd < 0)
+	{
+		AERR("Failed to create virtual framebuffer memory: %d", errno);
+		return -1;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+
+	struct fb_var_screeninfo *info = &vfb->info;
+	struct fb_fix_screeninfo *finfo = &vfb->finfo;
+
+	memset(info, 0, sizeof(*info));
+	memset(finfo, 0, sizeof(*finfo));
+
+	info->xres = xres;
+	info->yres = yres;
+	info->xres_virtual = xres;
+	info->yres_virtual = yres;
+	info->bits_per_pixel = VFB_BYTES_PER_PIXEL * 8;
+	info->red.offset = 16;
+	info->red.length = 8;
+	info->green.offset = 8;
+	info->green.length = 8;
+	info->blue.offset = 0;
+	info->blue.length = 8;
+
+	/* No blanking, so the pixel clock alone yields the refresh rate. */
+	info->pixclock = (uint32_t)(1000000000000ULL / ((uint64_t)xres * yres * hz));
+
+	strncpy(finfo->id, "Virtual FB", sizeof(finfo->id) - 1);
+	finfo->type = FB_TYPE_PACKED_PIXELS;
+	finfo->visual = FB_VISUAL_TRUECOLOR;
+	finfo->ypanstep = 1;
+	finfo->line_length = line_length;
+
+	vfb->fd = fd;
+	vfb->st_dev = st.st_dev;
+	vfb->st_ino = st.st_ino;
+	vfb->size = 0;
+	vfb->period_ns = 1000000000LL / hz;
+	vfb->anchor_ns = vfb_now_ns();
+	vfb->pan_pending = false;
+
+	/* Start with as many screens as the HAL may ask for. */
+	if (vfb_resize_locked(vfb, (size_t)line_length * yres * NUM_FB_BUFFERS) != 0)
+	{
+		AERR("Failed to size virtual framebuffer memory: %d", errno);
+		close(fd);
+		vfb->fd = -1;
+		return -1;
+	}
+
+	AINF("Virtual framebuffer %u: %ux%u@%u, line length %u", (unsigned int)(vfb - s_vfb), xres, yres, hz,
+	     line_length);
+
+	return 0;
+}
+
+/* Must be called with vfb->lock held. */
+static bool vfb_is_device_locked(const vfb_state *vfb, int fd)
+{
+	struct stat st;
+
+	if (vfb->fd < 0 || fstat(fd, &st) != 0)
+	{
+		return false;
+	}
+
+	return st.st_dev == vfb->st_dev && st.st_ino == vfb->st_ino;
+}
+
+/* Must be called with vfb->lock held. */
+static int vfb_put_vscreeninfo_locked(vfb_state *vfb, const struct fb_var_screeninfo *req)
+{
+	if (req->xres != vfb->info.xres || req->yres != vfb->info.yres || req->bits_per_pixel != vfb->info.bits_per_pixel ||
+	    req->xres_virtual < req->xres || req->yres_virtual < req->yres)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (vfb_resize_locked(vfb, (size_t)vfb->finfo.line_length * req->yres_virtual) != 0)
+	{
+		return -1;
+	}
+
+	const uint32_t pixclock = vfb->info.pixclock;
+
+	vfb->info = *req;
+	vfb->info.pixclock = pixclock;
+	vfb->info.xoffset = 0;
+	vfb->info.yoffset = 0;
+	vfb->pan_pending = false;
+
+	return 0;
+}
+
+/* Must be called with vfb->lock held. */
+static int vfb_pan_locked(vfb_state *vfb, const struct fb_var_screeninfo *req)
+{
+	if (req->xoffset != 0 || req->yoffset + vfb->info.yres > vfb->info.yres_virtual)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ((req->activate & FB_ACTIVATE_MASK) == FB_ACTIVATE_VBL)
+	{
+		vfb->pending_yoffset = req->yoffset;
+		vfb->pan_pending = true;
+	}
+	else
+	{
+		vfb->info.yoffset = req->yoffset;
+		vfb->pan_pending = false;
+	}
+
+	return 0;
+}
+
+/* Sleeps until the next vsync edge and latches any pending pan. */
+static int vfb_wait_for_vsync(vfb_state *vfb)
+{
+	pthread_mutex_lock(&vfb->lock);
+	const int64_t anchor_ns = vfb->anchor_ns;
+	const int64_t period_ns = vfb->period_ns;
+	pthread_mutex_unlock(&vfb->lock);
+
+	const int64_t now_ns = vfb_now_ns();
+	const int64_t next_ns = anchor_ns + ((now_ns - anchor_ns) / period_ns + 1) * period_ns;
+
+	struct timespec ts;
+	ts.tv_sec = next_ns / 1000000000LL;
+	ts.tv_nsec = next_ns % 1000000000LL;
+
+	int ret;
+	do
+	{
+		ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+	} while (ret == EINTR);
+
+	if (ret != 0)
+	{
+		errno = ret;
+		return -1;
+	}
+
+	pthread_mutex_lock(&vfb->lock);
+	if (vfb->pan_pending)
+	{
+		vfb->info.yoffset = vfb->pending_yoffset;
+		vfb->pan_pending = false;
+	}
+	pthread_mutex_unlock(&vfb->lock);
+
+	return 0;
+}
+
+/* Returns the emulated device an fd was opened on, or NULL. */
+static vfb_state *vfb_lookup(int fd)
+{
+	for (uint32_t i = 0; i < MALI_GRALLOC_MAX_DISPLAYS; i++)
+	{
+		vfb_state *vfb = &s_vfb[i];
+
+		pthread_mutex_lock(&vfb->lock);
+		const bool is_device = vfb_is_device_locked(vfb, fd);
+		pthread_mutex_unlock(&vfb->lock);
+
+		if (is_device)
+		{
+			return vfb;
+		}
+	}
+
+	return NULL;
+}
+
+int fbdev_open(unsigned int index)
+{
+	if (index >= MALI_GRALLOC_MAX_DISPLAYS)
+	{
+		errno = ENOENT;
+		return -1;
+	}
+
+	vfb_state *vfb = &s_vfb[index];
+
+	pthread_mutex_lock(&vfb->lock);
+
+	int fd = -1;
+	if (vfb->fd >= 0 || vfb_create_locked(vfb) == 0)
+	{
+		fd = dup(vfb->fd);
+	}
+
+	pthread_mutex_unlock(&vfb->lock);
+
+	return fd;
+}
+
+int fbdev_ioctl(int fd, unsigned long request, void *arg)
+{
+	int ret = 0;
+	vfb_state *vfb = vfb_lookup(fd);
+
+	if (vfb == NULL)
+	{
+		errno = ENOTTY;
+		return -1;
+	}
+
+	if (request == FBIO_WAITFORVSYNC)
+	{
+		return vfb_wait_for_vsync(vfb);
+	}
+
+	pthread_mutex_lock(&vfb->lock);
+
+	if (request == FBIOGET_FSCREENINFO)
+	{
+		memcpy(arg, &vfb->finfo, sizeof(vfb->finfo));
+	}
+	else if (request == FBIOGET_VSCREENINFO)
+	{
+		memcpy(arg, &vfb->info, sizeof(vfb->info));
+	}
+	else if (request == FBIOPUT_VSCREENINFO)
+	{
+		ret = vfb_put_vscreeninfo_locked(vfb, (const struct fb_var_screeninfo *)arg);
+	}
+	else if (request == FBIOPAN_DISPLAY)
+	{
+		ret = vfb_pan_locked(vfb, (const struct fb_var_screeninfo *)arg);
+	}
+	else if (request == FBIOGET_DMABUF)
+	{
+		/* The memfd stands in for the dma-buf; it can be mapped the same way. */
+		struct fb_dmabuf_export *export_info = (struct fb_dmabuf_export *)arg;
+		const int export_fd = dup(vfb->fd);
+
+		if (export_fd < 0)
+		{
+			ret = -1;
+		}
+		else
+		{
+			export_info->fd = export_fd;
+			export_info->flags = 0;
+		}
+	}
+	else
+	{
+		errno = ENOTTY;
+		ret = -1;
+	}
+
+	pthread_mutex_unlock(&vfb->lock);
+
+	return ret;
+}
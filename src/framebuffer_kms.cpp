@@ -0,0 +1,787 @@
+/*
+ * Copyright (C) 2018 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * DRM/KMS display backend for the framebuffer HAL.
+ *
+ * Instead of panning through fbdev memory, posted buffers are imported as
+ * DRM framebuffers from their dma-buf and shown on the primary plane of the
+ * selected CRTC with atomic commits. Flip completion is signalled by the
+ * DRM page flip event, which is delivered on the vblank the commit latched
+ * on.
+ *
+ * The backend only relies on generic atomic KMS, so it can be exercised on
+ * a Linux host with the vkms virtual driver loaded.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm_fourcc.h>
+
+#include <hardware/hardware.h>
+
+#if GRALLOC_USE_GRALLOC1_API == 1
+#include <hardware/gralloc1.h>
+#else
+#include <hardware/gralloc.h>
+#endif
+
+#include "mali_gralloc_module.h"
+#include "mali_gralloc_private_interface_types.h"
+#include "mali_gralloc_buffer.h"
+#include "mali_gralloc_formats.h"
+#include "gralloc_helper.h"
+#include "framebuffer_kms.h"
+#include "mali_gralloc_drm_format.h"
+
+/* Number of DRM framebuffers kept imported. */
+#define FB_KMS_CACHE_SIZE 16
+
+/* Number of /dev/dri/card* nodes probed for a connected display. */
+#define FB_KMS_MAX_CARDS 8
+
+enum fb_kms_prop
+{
+	FB_KMS_PROP_PLANE_FB_ID = 0,
+	FB_KMS_PROP_PLANE_CRTC_ID,
+	FB_KMS_PROP_PLANE_SRC_X,
+	FB_KMS_PROP_PLANE_SRC_Y,
+	FB_KMS_PROP_PLANE_SRC_W,
+	FB_KMS_PROP_PLANE_SRC_H,
+	FB_KMS_PROP_PLANE_CRTC_X,
+	FB_KMS_PROP_PLANE_CRTC_Y,
+	FB_KMS_PROP_PLANE_CRTC_W,
+	FB_KMS_PROP_PLANE_CRTC_H,
+	FB_KMS_PROP_CRTC_MODE_ID,
+	FB_KMS_PROP_CRTC_ACTIVE,
+	FB_KMS_PROP_CONNECTOR_CRTC_ID,
+	FB_KMS_PROP_COUNT
+};
+
+struct fb_kms_prop_desc
+{
+	uint32_t object_type;
+	const char *name;
+};
+
+static const fb_kms_prop_desc fb_kms_props[FB_KMS_PROP_COUNT] = {
+	{ DRM_MODE_OBJECT_PLANE, "FB_ID" },
+	{ DRM_MODE_OBJECT_PLANE, "CRTC_ID" },
+	{ DRM_MODE_OBJECT_PLANE, "SRC_X" },
+	{ DRM_MODE_OBJECT_PLANE, "SRC_Y" },
+	{ DRM_MODE_OBJECT_PLANE, "SRC_W" },
+	{ DRM_MODE_OBJECT_PLANE, "SRC_H" },
+	{ DRM_MODE_OBJECT_PLANE, "CRTC_X" },
+	{ DRM_MODE_OBJECT_PLANE, "CRTC_Y" },
+	{ DRM_MODE_OBJECT_PLANE, "CRTC_W" },
+	{ DRM_MODE_OBJECT_PLANE, "CRTC_H" },
+	{ DRM_MODE_OBJECT_CRTC, "MODE_ID" },
+	{ DRM_MODE_OBJECT_CRTC, "ACTIVE" },
+	{ DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID" },
+};
+
+struct fb_kms_fb
+{
+	/* backing_store_id of the imported buffer, 0 if the entry is free. */
+	uint64_t key;
+
+	/* Views share the backing store of their parent, so also tell apart what is scanned out. */
+	uint64_t offset;
+	int width;
+	int height;
+	uint64_t format;
+
+	uint32_t fb_id;
+	uint64_t last_use;
+};
+
+struct fb_kms_state
+{
+	pthread_mutex_t lock;
+	int fd;
+
+	uint32_t connector_id;
+	uint32_t crtc_id;
+	uint32_t crtc_index;
+	uint32_t plane_id;
+	uint32_t mode_blob_id;
+	drmModeModeInfo mode;
+	uint32_t prop_ids[FB_KMS_PROP_COUNT];
+	bool has_modifiers;
+
+	/* Set once the first commit has enabled the CRTC with the selected mode. */
+	bool modeset_done;
+
+	/* A committed flip whose page flip event has not been received yet. */
+	bool flip_pending;
+
+	/* Framebuffers currently latched and waiting to be latched. */
+	uint32_t on_screen_fb_id;
+	uint32_t pending_fb_id;
+
+	fb_kms_fb cache[FB_KMS_CACHE_SIZE];
+	uint64_t use_counter;
+};
+
+static fb_kms_state s_kms = {
+	PTHREAD_MUTEX_INITIALIZER,
+	-1,
+	0,
+	0,
+	0,
+	0,
+	0,
+	{},
+	{},
+	false,
+	false,
+	false,
+	0,
+	0,
+	{},
+	0,
+};
+
+static uint32_t fb_kms_find_prop(int fd, uint32_t object_id, uint32_t object_type, const char *name)
+{
+	uint32_t prop_id = 0;
+	drmModeObjectPropertiesPtr props = drmModeObjectGetProperties(fd, object_id, object_type);
+
+	if (props == NULL)
+	{
+		return 0;
+	}
+
+	for (uint32_t i = 0; i < props->count_props && prop_id == 0; i++)
+	{
+		drmModePropertyPtr prop = drmModeGetProperty(fd, props->props[i]);
+
+		if (prop != NULL)
+		{
+			if (strcmp(prop->name, name) == 0)
+			{
+				prop_id = prop->prop_id;
+			}
+
+			drmModeFreeProperty(prop);
+		}
+	}
+
+	drmModeFreeObjectProperties(props);
+
+	return prop_id;
+}
+
+static bool fb_kms_plane_is_primary(int fd, uint32_t plane_id)
+{
+	bool primary = false;
+	drmModeObjectPropertiesPtr props = drmModeObjectGetProperties(fd, plane_id, DRM_MODE_OBJECT_PLANE);
+
+	if (props == NULL)
+	{
+		return false;
+	}
+
+	for (uint32_t i = 0; i < props->count_props; i++)
+	{
+		drmModePropertyPtr prop = drmModeGetProperty(fd, props->props[i]);
+
+		if (prop != NULL)
+		{
+			if (strcmp(prop->name, "type") == 0)
+			{
+				primary = (props->prop_values[i] == DRM_PLANE_TYPE_PRIMARY);
+			}
+
+			drmModeFreeProperty(prop);
+		}
+	}
+
+	drmModeFreeObjectProperties(props);
+
+	return primary;
+}
+
+/*
+ * Selects a connected connector, a CRTC which can drive it and the primary
+ * plane of that CRTC. Must be called with s_kms.lock held.
+ */
+static int fb_kms_select_pipe_locked(int fd)
+{
+	int ret = -ENODEV;
+	drmModeResPtr res = drmModeGetResources(fd);
+
+	if (res == NULL)
+	{
+		return -errno;
+	}
+
+	for (int i = 0; i < res->count_connectors && ret != 0; i++)
+	{
+		drmModeConnectorPtr conn = drmModeGetConnector(fd, res->connectors[i]);
+
+		if (conn == NULL)
+		{
+			continue;
+		}
+
+		if (conn->connection != DRM_MODE_CONNECTED || conn->count_modes == 0)
+		{
+			drmModeFreeConnector(conn);
+			continue;
+		}
+
+		/* Any CRTC reachable through one of the connector's encoders will do. */
+		uint32_t possible_crtcs = 0;
+		for (int e = 0; e < conn->count_encoders; e++)
+		{
+			drmModeEncoderPtr enc = drmModeGetEncoder(fd, conn->encoders[e]);
+
+			if (enc != NULL)
+			{
+				possible_crtcs |= enc->possible_crtcs;
+				drmModeFreeEncoder(enc);
+			}
+		}
+
+		for (int c = 0; c < res->count_crtcs && ret != 0; c++)
+		{
+			if ((possible_crtcs & (1U << c)) == 0)
+			{
+				continue;
+			}
+
+			drmModePlaneResPtr planes = drmModeGetPlaneResources(fd);
+			if (planes == NULL)
+			{
+				break;
+			}
+
+			for (uint32_t p = 0; p < planes->count_planes && ret != 0; p++)
+			{
+				drmModePlanePtr plane = drmModeGetPlane(fd, planes->planes[p]);
+
+				if (plane == NULL)
+				{
+					continue;
+				}
+
+				if ((plane->possible_crtcs & (1U << c)) && fb_kms_plane_is_primary(fd, plane->plane_id))
+				{
+					s_kms.connector_id = conn->connector_id;
+					s_kms.crtc_id = res->crtcs[c];
+					s_kms.crtc_index = c;
+					s_kms.plane_id = plane->plane_id;
+					ret = 0;
+				}
+
+				drmModeFreePlane(plane);
+			}
+
+			drmModeFreePlaneResources(planes);
+		}
+
+		if (ret == 0)
+		{
+			/* Use the preferred mode, or the first one listed. */
+			s_kms.mode = conn->modes[0];
+			for (int m = 0; m < conn->count_modes; m++)
+			{
+				if (conn->modes[m].type & DRM_MODE_TYPE_PREFERRED)
+				{
+					s_kms.mode = conn->modes[m];
+					break;
+				}
+			}
+		}
+
+		drmModeFreeConnector(conn);
+	}
+
+	drmModeFreeResources(res);
+
+	return ret;
+}
+
+/* Must be called with s_kms.lock held. */
+static int fb_kms_open_locked(void)
+{
+	for (int card = 0; card < FB_KMS_MAX_CARDS; card++)
+	{
+		char name[32];
+
+		snprintf(name, sizeof(name), "%s/card%d", DRM_DIR_NAME, card);
+
+		const int fd = open(name, O_RDWR | O_CLOEXEC);
+		if (fd < 0)
+		{
+			continue;
+		}
+
+		if (drmSetClientCap(fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1) != 0 ||
+		    drmSetClientCap(fd, DRM_CLIENT_CAP_ATOMIC, 1) != 0)
+		{
+			AINF("%s does not support atomic modesetting", name);
+			close(fd);
+			continue;
+		}
+
+		if (fb_kms_select_pipe_locked(fd) != 0)
+		{
+			close(fd);
+			continue;
+		}
+
+		bool found = true;
+		for (int i = 0; i < FB_KMS_PROP_COUNT && found; i++)
+		{
+			uint32_t object_id;
+
+			switch (fb_kms_props[i].object_type)
+			{
+			case DRM_MODE_OBJECT_PLANE:
+				object_id = s_kms.plane_id;
+				break;
+			case DRM_MODE_OBJECT_CRTC:
+				object_id = s_kms.crtc_id;
+				break;
+			default:
+				object_id = s_kms.connector_id;
+				break;
+			}
+
+			s_kms.prop_ids[i] = fb_kms_find_prop(fd, object_id, fb_kms_props[i].object_type, fb_kms_props[i].name);
+			found = (s_kms.prop_ids[i] != 0);
+		}
+
+		if (!found || drmModeCreatePropertyBlob(fd, &s_kms.mode, sizeof(s_kms.mode), &s_kms.mode_blob_id) != 0)
+		{
+			AWAR("%s is missing atomic properties", name);
+			close(fd);
+			continue;
+		}
+
+		uint64_t cap = 0;
+		s_kms.has_modifiers = (drmGetCap(fd, DRM_CAP_ADDFB2_MODIFIERS, &cap) == 0 && cap != 0);
+		s_kms.fd = fd;
+
+		AINF("Using %s: connector %u, crtc %u, plane %u, mode %s", name, s_kms.connector_id, s_kms.crtc_id,
+		     s_kms.plane_id, s_kms.mode.name);
+
+		return 0;
+	}
+
+	AERR("No DRM device with a connected display found");
+
+	return -ENODEV;
+}
+
+int fb_kms_init(struct fb_var_screeninfo *info, struct fb_fix_screeninfo *finfo)
+{
+	pthread_mutex_lock(&s_kms.lock);
+
+	int ret = (s_kms.fd < 0) ? fb_kms_open_locked() : 0;
+	if (ret != 0)
+	{
+		pthread_mutex_unlock(&s_kms.lock);
+		return ret;
+	}
+
+	const drmModeModeInfo *mode = &s_kms.mode;
+
+	memset(info, 0, sizeof(*info));
+	memset(finfo, 0, sizeof(*finfo));
+
+	info->xres = mode->hdisplay;
+	info->yres = mode->vdisplay;
+	info->xres_virtual = mode->hdisplay;
+	info->yres_virtual = mode->vdisplay * NUM_FB_BUFFERS;
+	info->bits_per_pixel = GRALLOC_FB_BPP;
+
+	/* Mode clock is in kHz, pixclock in picoseconds. */
+	info->pixclock = (mode->clock > 0) ? (1000000000U / mode->clock) : 0;
+	info->left_margin = mode->htotal - mode->hsync_end;
+	info->right_margin = mode->hsync_start - mode->hdisplay;
+	info->hsync_len = mode->hsync_end - mode->hsync_start;
+	info->upper_margin = mode->vtotal - mode->vsync_end;
+	info->lower_margin = mode->vsync_start - mode->vdisplay;
+	info->vsync_len = mode->vsync_end - mode->vsync_start;
+
+	drmModeConnectorPtr conn = drmModeGetConnector(s_kms.fd, s_kms.connector_id);
+	if (conn != NULL)
+	{
+		info->width = conn->mmWidth;
+		info->height = conn->mmHeight;
+		drmModeFreeConnector(conn);
+	}
+
+	strncpy(finfo->id, "DRM KMS", sizeof(finfo->id) - 1);
+	finfo->line_length = GRALLOC_ALIGN(mode->hdisplay * (GRALLOC_FB_BPP / 8), 64);
+	finfo->smem_len = finfo->line_length * info->yres_virtual;
+
+	ret = dup(s_kms.fd);
+	if (ret < 0)
+	{
+		ret = -errno;
+	}
+
+	pthread_mutex_unlock(&s_kms.lock);
+
+	return ret;
+}
+
+static void fb_kms_page_flip_handler(int fd, unsigned int sequence, unsigned int tv_sec, unsigned int tv_usec,
+                                     void *user_data)
+{
+	GRALLOC_UNUSED(fd);
+	GRALLOC_UNUSED(sequence);
+	GRALLOC_UNUSED(tv_sec);
+	GRALLOC_UNUSED(tv_usec);
+	GRALLOC_UNUSED(user_data);
+
+	s_kms.flip_pending = false;
+	s_kms.on_screen_fb_id = s_kms.pending_fb_id;
+	s_kms.pending_fb_id = 0;
+}
+
+/* Waits for the page flip event of the last commit. Must be called with s_kms.lock held. */
+static int fb_kms_wait_flip_locked(void)
+{
+	drmEventContext ctx;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.version = 2;
+	ctx.page_flip_handler = fb_kms_page_flip_handler;
+
+	while (s_kms.flip_pending)
+	{
+		struct pollfd pfd = { s_kms.fd, POLLIN, 0 };
+
+		const int ret = poll(&pfd, 1, -1);
+		if (ret < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			return -errno;
+		}
+
+		if (drmHandleEvent(s_kms.fd, &ctx) != 0)
+		{
+			return -EIO;
+		}
+	}
+
+	return 0;
+}
+
+/* Must be called with s_kms.lock held. */
+static void fb_kms_evict_locked(fb_kms_fb *entry)
+{
+	if (entry->key != 0)
+	{
+		drmModeRmFB(s_kms.fd, entry->fb_id);
+	}
+
+	entry->key = 0;
+	entry->fb_id = 0;
+}
+
+/*
+ * Buffers which do not come from the regular allocation path (framebuffer
+ * ring slots) have no backing store ID, the handle address identifies them
+ * instead.
+ */
+static uint64_t fb_kms_key(const private_handle_t *hnd)
+{
+	return (hnd->backing_store_id != 0) ? hnd->backing_store_id : (uint64_t)(uintptr_t)hnd;
+}
+
+static bool fb_kms_fb_matches(const fb_kms_fb *entry, const private_handle_t *hnd)
+{
+	return entry->key == fb_kms_key(hnd) && entry->offset == (uint64_t)hnd->offset && entry->width == hnd->width &&
+	       entry->height == hnd->height && entry->format == hnd->alloc_format;
+}
+
+/*
+ * Returns the DRM framebuffer for a buffer, importing it if needed. The GEM
+ * handle is closed straight away as the framebuffer keeps its own reference.
+ * Must be called with s_kms.lock held.
+ */
+static int fb_kms_get_fb_locked(const private_handle_t *hnd, uint32_t *fb_id)
+{
+	fb_kms_fb *victim = NULL;
+
+	for (int i = 0; i < FB_KMS_CACHE_SIZE; i++)
+	{
+		fb_kms_fb *entry = &s_kms.cache[i];
+
+		if (fb_kms_fb_matches(entry, hnd))
+		{
+			entry->last_use = ++s_kms.use_counter;
+			*fb_id = entry->fb_id;
+			return 0;
+		}
+
+		/* Never evict what is on screen or about to be. */
+		if (entry->key != 0 && (entry->fb_id == s_kms.on_screen_fb_id || entry->fb_id == s_kms.pending_fb_id))
+		{
+			continue;
+		}
+
+		if (victim == NULL || entry->key == 0 || (victim->key != 0 && entry->last_use < victim->last_use))
+		{
+			victim = entry;
+		}
+	}
+
+	mali_gralloc_drm_info info;
+
+	if (mali_gralloc_drm_buffer_info(hnd, &info) != 0)
+	{
+		AERR("Format 0x%" PRIx64 " of buffer %p can't be scanned out", hnd->alloc_format, hnd);
+		return -EINVAL;
+	}
+
+	if (info.modifier != DRM_FORMAT_MOD_LINEAR && !s_kms.has_modifiers)
+	{
+		AERR("Display does not accept format modifiers, can't scan out AFBC buffer %p", hnd);
+		return -EINVAL;
+	}
+
+	if (hnd->share_fd < 0 || victim == NULL)
+	{
+		return -EINVAL;
+	}
+
+	uint32_t gem_handle = 0;
+	if (drmPrimeFDToHandle(s_kms.fd, hnd->share_fd, &gem_handle) != 0)
+	{
+		AERR("Failed to import buffer %p into DRM: %d", hnd, errno);
+		return -errno;
+	}
+
+	uint32_t handles[4] = { 0, 0, 0, 0 };
+	uint32_t pitches[4] = { 0, 0, 0, 0 };
+	uint32_t offsets[4] = { 0, 0, 0, 0 };
+	uint64_t modifiers[4] = { 0, 0, 0, 0 };
+	uint32_t new_fb_id = 0;
+
+	for (uint32_t p = 0; p < info.num_planes; p++)
+	{
+		handles[p] = gem_handle;
+		pitches[p] = info.pitches[p];
+		offsets[p] = info.offsets[p];
+		modifiers[p] = info.modifier;
+	}
+
+	int ret = drmModeAddFB2WithModifiers(s_kms.fd, hnd->width, hnd->height, info.fourcc, handles, pitches, offsets,
+	                                     modifiers, &new_fb_id, s_kms.has_modifiers ? DRM_MODE_FB_MODIFIERS : 0);
+	if (ret != 0)
+	{
+		ret = -errno;
+		AERR("Failed to create DRM framebuffer for buffer %p: %d", hnd, ret);
+	}
+
+	struct drm_gem_close gem_close;
+	memset(&gem_close, 0, sizeof(gem_close));
+	gem_close.handle = gem_handle;
+	drmIoctl(s_kms.fd, DRM_IOCTL_GEM_CLOSE, &gem_close);
+
+	if (ret != 0)
+	{
+		return ret;
+	}
+
+	fb_kms_evict_locked(victim);
+	victim->key = fb_kms_key(hnd);
+	victim->offset = hnd->offset;
+	victim->width = hnd->width;
+	victim->height = hnd->height;
+	victim->format = hnd->alloc_format;
+	victim->fb_id = new_fb_id;
+	victim->last_use = ++s_kms.use_counter;
+	*fb_id = new_fb_id;
+
+	return 0;
+}
+
+/* Must be called with s_kms.lock held. */
+static int fb_kms_wait_vblank_locked(uint32_t count)
+{
+	drmVBlank vbl;
+
+	memset(&vbl, 0, sizeof(vbl));
+	vbl.request.type = DRM_VBLANK_RELATIVE;
+	vbl.request.sequence = count;
+
+	if (s_kms.crtc_index == 1)
+	{
+		vbl.request.type = (drmVBlankSeqType)(vbl.request.type | DRM_VBLANK_SECONDARY);
+	}
+	else if (s_kms.crtc_index > 1)
+	{
+		vbl.request.type = (drmVBlankSeqType)(vbl.request.type |
+		                   ((s_kms.crtc_index << DRM_VBLANK_HIGH_CRTC_SHIFT) & DRM_VBLANK_HIGH_CRTC_MASK));
+	}
+
+	if (drmWaitVBlank(s_kms.fd, &vbl) != 0)
+	{
+		return -errno;
+	}
+
+	return 0;
+}
+
+int fb_kms_post(const private_handle_t *hnd, int interval)
+{
+	pthread_mutex_lock(&s_kms.lock);
+
+	if (s_kms.fd < 0)
+	{
+		pthread_mutex_unlock(&s_kms.lock);
+		return -ENODEV;
+	}
+
+	uint32_t fb_id = 0;
+	int ret = fb_kms_get_fb_locked(hnd, &fb_id);
+
+	/* Only one commit may be outstanding. */
+	if (ret == 0)
+	{
+		ret = fb_kms_wait_flip_locked();
+	}
+
+	/* The commit latches on the next vblank, wait for the remaining ones. */
+	if (ret == 0 && interval > 1)
+	{
+		ret = fb_kms_wait_vblank_locked(interval - 1);
+	}
+
+	drmModeAtomicReqPtr req = (ret == 0) ? drmModeAtomicAlloc() : NULL;
+	if (ret == 0 && req == NULL)
+	{
+		ret = -ENOMEM;
+	}
+
+	if (ret == 0)
+	{
+		const uint32_t *ids = s_kms.prop_ids;
+		uint32_t flags = DRM_MODE_PAGE_FLIP_EVENT;
+
+		if (!s_kms.modeset_done)
+		{
+			drmModeAtomicAddProperty(req, s_kms.connector_id, ids[FB_KMS_PROP_CONNECTOR_CRTC_ID], s_kms.crtc_id);
+			drmModeAtomicAddProperty(req, s_kms.crtc_id, ids[FB_KMS_PROP_CRTC_MODE_ID], s_kms.mode_blob_id);
+			drmModeAtomicAddProperty(req, s_kms.crtc_id, ids[FB_KMS_PROP_CRTC_ACTIVE], 1);
+			flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+		}
+		else
+		{
+			flags |= DRM_MODE_ATOMIC_NONBLOCK;
+		}
+
+		/* Source coordinates are 16.16 fixed point. */
+		drmModeAtomicAddProperty(req, s_kms.plane_id, ids[FB_KMS_PROP_PLANE_FB_ID], fb_id);
+		drmModeAtomicAddProperty(req, s_kms.plane_id, ids[FB_KMS_PROP_PLANE_CRTC_ID], s_kms.crtc_id);
+		drmModeAtomicAddProperty(req, s_kms.plane_id, ids[FB_KMS_PROP_PLANE_SRC_X], 0);
+		drmModeAtomicAddProperty(req, s_kms.plane_id, ids[FB_KMS_PROP_PLANE_SRC_Y], 0);
+		drmModeAtomicAddProperty(req, s_kms.plane_id, ids[FB_KMS_PROP_PLANE_SRC_W], (uint64_t)hnd->width << 16);
+		drmModeAtomicAddProperty(req, s_kms.plane_id, ids[FB_KMS_PROP_PLANE_SRC_H], (uint64_t)hnd->height << 16);
+		drmModeAtomicAddProperty(req, s_kms.plane_id, ids[FB_KMS_PROP_PLANE_CRTC_X], 0);
+		drmModeAtomicAddProperty(req, s_kms.plane_id, ids[FB_KMS_PROP_PLANE_CRTC_Y], 0);
+		drmModeAtomicAddProperty(req, s_kms.plane_id, ids[FB_KMS_PROP_PLANE_CRTC_W], s_kms.mode.hdisplay);
+		drmModeAtomicAddProperty(req, s_kms.plane_id, ids[FB_KMS_PROP_PLANE_CRTC_H], s_kms.mode.vdisplay);
+
+		if (drmModeAtomicCommit(s_kms.fd, req, flags, NULL) != 0)
+		{
+			ret = -errno;
+			AERR("Atomic commit of buffer %p failed: %d", hnd, ret);
+		}
+		else
+		{
+			s_kms.modeset_done = true;
+			s_kms.flip_pending = true;
+			s_kms.pending_fb_id = fb_id;
+		}
+
+		drmModeAtomicFree(req);
+	}
+
+	/* With vsync enabled, return once the buffer is on screen. */
+	if (ret == 0 && interval > 0)
+	{
+		ret = fb_kms_wait_flip_locked();
+	}
+
+	pthread_mutex_unlock(&s_kms.lock);
+
+	return ret;
+}
+
+int fb_kms_wait_vblank(void)
+{
+	pthread_mutex_lock(&s_kms.lock);
+
+	const int ret = (s_kms.fd < 0) ? -ENODEV : fb_kms_wait_vblank_locked(1);
+
+	pthread_mutex_unlock(&s_kms.lock);
+
+	return ret;
+}
+
+void fb_kms_release_buffer(const private_handle_t *hnd)
+{
+	pthread_mutex_lock(&s_kms.lock);
+
+	if (s_kms.fd >= 0)
+	{
+		for (int i = 0; i < FB_KMS_CACHE_SIZE; i++)
+		{
+			if (fb_kms_fb_matches(&s_kms.cache[i], hnd))
+			{
+				/* Removing a framebuffer which is on screen disables the plane. */
+				if (s_kms.cache[i].fb_id == s_kms.pending_fb_id)
+				{
+					fb_kms_wait_flip_locked();
+				}
+
+				if (s_kms.cache[i].fb_id == s_kms.on_screen_fb_id)
+				{
+					s_kms.on_screen_fb_id = 0;
+				}
+
+				fb_kms_evict_locked(&s_kms.cache[i]);
+				break;
+			}
+		}
+	}
+
+	pthread_mutex_unlock(&s_kms.lock);
+}
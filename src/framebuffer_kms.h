@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2018 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FRAMEBUFFER_KMS_H_
+#define FRAMEBUFFER_KMS_H_
+
+#include <linux/fb.h>
+
+struct private_handle_t;
+
+/*
+ * Opens the first DRM device with a connected display and selects its CRTC,
+ * primary plane and preferred mode. The display geometry and timings are
+ * reported in fbdev form so that the rest of the framebuffer HAL is
+ * unchanged.
+ *
+ * Returns a duplicate of the DRM file descriptor on success, or a negative
+ * errno.
+ */
+int fb_kms_init(struct fb_var_screeninfo *info, struct fb_fix_screeninfo *finfo);
+
+/*
+ * Shows a buffer on the primary plane with a non-blocking atomic commit.
+ * The buffer is imported as a DRM framebuffer on first use. When
+ * 'interval' is non-zero the call returns once the flip has completed,
+ * no earlier than 'interval' vblanks after the previous flip.
+ */
+int fb_kms_post(const private_handle_t *hnd, int interval);
+
+/* Waits for the next vblank of the display CRTC. */
+int fb_kms_wait_vblank(void);
+
+/* Drops the DRM framebuffer cached for a buffer which is about to be freed. */
+void fb_kms_release_buffer(const private_handle_t *hnd);
+
+#endif /* FRAMEBUFFER_KMS_H_ */
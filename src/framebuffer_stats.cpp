@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2018 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+
+#include "framebuffer_stats.h"
+#include "mali_gralloc_debug.h"
+
+/*
+ * All counters are updated with relaxed atomics so that recording never
+ * blocks the display path. A snapshot may therefore be slightly
+ * inconsistent between fields, which is acceptable for telemetry.
+ */
+struct fb_histogram
+{
+	std::atomic<uint64_t> count;
+	std::atomic<uint64_t> sum_us;
+	std::atomic<uint64_t> max_us;
+	std::atomic<uint64_t> buckets[MALI_GRALLOC_FB_STATS_BUCKETS];
+};
+
+/* Statistics of one display, so that flips of different displays don't mix. */
+struct fb_display_stats
+{
+	fb_histogram hist[MALI_GRALLOC_FB_STAT_LAST];
+	std::atomic<uint64_t> posts;
+	std::atomic<uint64_t> missed_vsyncs;
+	std::atomic<uint64_t> copy_fallbacks;
+	std::atomic<int64_t> last_flip_ns;
+};
+
+static fb_display_stats fb_stats[MALI_GRALLOC_MAX_DISPLAYS];
+
+static const char *const fb_stat_names[MALI_GRALLOC_FB_STAT_LAST] = {
+	"post to flip",
+	"vsync wait",
+	"flip interval",
+};
+
+static uint32_t fb_stats_bucket(uint64_t us)
+{
+	uint32_t bucket = 0;
+
+	/* floor(log2(us + 1)) */
+	for (uint64_t v = us + 1; v > 1; v >>= 1)
+	{
+		bucket++;
+	}
+
+	return (bucket < MALI_GRALLOC_FB_STATS_BUCKETS) ? bucket : MALI_GRALLOC_FB_STATS_BUCKETS - 1;
+}
+
+int64_t fb_stats_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void fb_stats_record(uint32_t display, mali_gralloc_fb_stat stat, int64_t duration_ns)
+{
+	if (display >= MALI_GRALLOC_MAX_DISPLAYS || stat >= MALI_GRALLOC_FB_STAT_LAST || duration_ns < 0)
+	{
+		return;
+	}
+
+	fb_histogram * const hist = &fb_stats[display].hist[stat];
+	const uint64_t us = duration_ns / 1000;
+
+	hist->count.fetch_add(1, std::memory_order_relaxed);
+	hist->sum_us.fetch_add(us, std::memory_order_relaxed);
+	hist->buckets[fb_stats_bucket(us)].fetch_add(1, std::memory_order_relaxed);
+
+	uint64_t max = hist->max_us.load(std::memory_order_relaxed);
+	while (us > max && !hist->max_us.compare_exchange_weak(max, us, std::memory_order_relaxed))
+	{
+	}
+}
+
+void fb_stats_flip(uint32_t display, int64_t start_ns, int64_t flip_ns, int64_t period_ns, int swap_interval)
+{
+	if (display >= MALI_GRALLOC_MAX_DISPLAYS)
+	{
+		return;
+	}
+
+	fb_display_stats * const st = &fb_stats[display];
+	const int64_t last_ns = st->last_flip_ns.exchange(flip_ns, std::memory_order_relaxed);
+
+	st->posts.fetch_add(1, std::memory_order_relaxed);
+
+	if (last_ns != 0 && flip_ns > last_ns)
+	{
+		fb_stats_record(display, MALI_GRALLOC_FB_STAT_FLIP_INTERVAL, flip_ns - last_ns);
+	}
+
+	if (period_ns <= 0 || swap_interval <= 0)
+	{
+		return;
+	}
+
+	/*
+	 * A frame is due on screen swap_interval periods after the flip thread
+	 * takes it. Time queued behind earlier frames, or without posts, says
+	 * nothing about pacing, so only lateness against that deadline counts,
+	 * rounded to the nearest number of periods.
+	 */
+	const int64_t late_ns = flip_ns - (start_ns + swap_interval * period_ns);
+	if (late_ns > 0)
+	{
+		const int64_t periods = (late_ns + period_ns / 2) / period_ns;
+		st->missed_vsyncs.fetch_add(periods, std::memory_order_relaxed);
+	}
+}
+
+void fb_stats_copy_fallback(uint32_t display)
+{
+	if (display < MALI_GRALLOC_MAX_DISPLAYS)
+	{
+		fb_stats[display].copy_fallbacks.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+int fb_stats_get(uint32_t display, mali_gralloc_fb_stats *stats)
+{
+	if (display >= MALI_GRALLOC_MAX_DISPLAYS)
+	{
+		return -EINVAL;
+	}
+
+	const fb_display_stats * const st = &fb_stats[display];
+
+	memset(stats, 0, sizeof(*stats));
+
+	for (int i = 0; i < MALI_GRALLOC_FB_STAT_LAST; i++)
+	{
+		stats->hist[i].count = st->hist[i].count.load(std::memory_order_relaxed);
+		stats->hist[i].sum_us = st->hist[i].sum_us.load(std::memory_order_relaxed);
+		stats->hist[i].max_us = st->hist[i].max_us.load(std::memory_order_relaxed);
+
+		for (int b = 0; b < MALI_GRALLOC_FB_STATS_BUCKETS; b++)
+		{
+			stats->hist[i].buckets[b] = st->hist[i].buckets[b].load(std::memory_order_relaxed);
+		}
+	}
+
+	stats->posts = st->posts.load(std::memory_order_relaxed);
+	stats->missed_vsyncs = st->missed_vsyncs.load(std::memory_order_relaxed);
+	stats->copy_fallbacks = st->copy_fallbacks.load(std::memory_order_relaxed);
+
+	return 0;
+}
+
+static void fb_stats_dump_display(android::String8 &buf, uint32_t display)
+{
+	mali_gralloc_fb_stats stats;
+
+	fb_stats_get(display, &stats);
+
+	if (stats.posts == 0)
+	{
+		return;
+	}
+
+	mali_gralloc_dump_string(buf, "-------------------------Framebuffer %u frame pacing----------------------\n", display);
+	mali_gralloc_dump_string(buf, " posts: %" PRIu64 " missed vsyncs: %" PRIu64 " copy fallbacks: %" PRIu64 "\n",
+	                         stats.posts, stats.missed_vsyncs, stats.copy_fallbacks);
+
+	for (int i = 0; i < MALI_GRALLOC_FB_STAT_LAST; i++)
+	{
+		const mali_gralloc_fb_histogram * const hist = &stats.hist[i];
+
+		if (hist->count == 0)
+		{
+			continue;
+		}
+
+		mali_gralloc_dump_string(buf, " %-13s: count %" PRIu64 " avg %" PRIu64 "us max %" PRIu64 "us\n",
+		                         fb_stat_names[i], hist->count, hist->sum_us / hist->count, hist->max_us);
+		mali_gralloc_dump_string(buf, "   <us:");
+
+		for (int b = 0; b < MALI_GRALLOC_FB_STATS_BUCKETS; b++)
+		{
+			if (hist->buckets[b] == 0)
+			{
+				continue;
+			}
+
+			if (b == MALI_GRALLOC_FB_STATS_BUCKETS - 1)
+			{
+				mali_gralloc_dump_string(buf, " inf:%" PRIu64, hist->buckets[b]);
+			}
+			else
+			{
+				mali_gralloc_dump_string(buf, " %u:%" PRIu64, (1u << (b + 1)) - 1, hist->buckets[b]);
+			}
+		}
+
+		mali_gralloc_dump_string(buf, "\n");
+	}
+}
+
+void fb_stats_dump(android::String8 &buf)
+{
+	for (uint32_t d = 0; d < MALI_GRALLOC_MAX_DISPLAYS; d++)
+	{
+		fb_stats_dump_display(buf, d);
+	}
+}
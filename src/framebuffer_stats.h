@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2018 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FRAMEBUFFER_STATS_H_
+#define FRAMEBUFFER_STATS_H_
+
+#include <stdint.h>
+#include <utils/String8.h>
+
+#include "mali_gralloc_private_interface_types.h"
+
+/* Returns CLOCK_MONOTONIC time in nanoseconds. */
+int64_t fb_stats_now_ns(void);
+
+/* Records a duration (in nanoseconds) against the given statistic of a display. */
+void fb_stats_record(uint32_t display, mali_gralloc_fb_stat stat, int64_t duration_ns);
+
+/*
+ * Records a completed flip of a frame whose flip started at 'start_ns', when
+ * it was taken off the flip queue. Updates the inter-flip histogram and
+ * counts the vsync edges the frame missed after its deadline of
+ * swap_interval periods from the start. Time spent queued behind other
+ * frames is only in the POST_TO_FLIP histogram.
+ */
+void fb_stats_flip(uint32_t display, int64_t start_ns, int64_t flip_ns, int64_t period_ns, int swap_interval);
+
+/* Counts a post which had to be copied into the framebuffer. */
+void fb_stats_copy_fallback(uint32_t display);
+
+/* Takes a snapshot of the statistics of a display. Returns -EINVAL if there is no such display. */
+int fb_stats_get(uint32_t display, mali_gralloc_fb_stats *stats);
+
+/* Appends a human readable summary of each display to a dump. */
+void fb_stats_dump(android::String8 &buf);
+
+#endif /* FRAMEBUFFER_STATS_H_ */
@@ -30,6 +30,7 @@
 #include "mali_gralloc_private_interface_types.h"
 #include "mali_gralloc_buffer.h"
 #include "gralloc_buffer_priv.h"
+#include "mali_gralloc_cache_policy.h"
 
 /*
  * Allocate shared memory for attribute storage. Only to be
@@ -84,6 +85,9 @@ int gralloc_buffer_attr_allocate(private_handle_t *hnd)
 		attr_region *region = (attr_region *)hnd->attr_base;
 
 		memset(hnd->attr_base, 0xff, PAGE_SIZE);
+
+		/* Counters start from zero. */
+		memset(gralloc_buffer_attr_cpu_access(hnd->attr_base), 0, sizeof(attr_cpu_access));
 		munmap(hnd->attr_base, PAGE_SIZE);
 		hnd->attr_base = MAP_FAILED;
 	}
@@ -129,6 +133,8 @@ int gralloc_buffer_attr_free(private_handle_t *hnd)
 		goto out;
 	}
 
+	mali_gralloc_cache_policy_release(hnd);
+
 	if (hnd->attr_base != MAP_FAILED)
 	{
 		ALOGW("Warning shared attribute region mapped at free. Unmapping");
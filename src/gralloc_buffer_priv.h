@@ -40,6 +40,32 @@ struct attr_region
 
 typedef struct attr_region attr_region;
 
+/*
+ * CPU access counters of a buffer. They follow the attributes in the shared
+ * attribute region, at a fixed offset so they stay naturally aligned, and
+ * every process locking the buffer adds to them.
+ */
+typedef struct
+{
+	uint32_t locks;
+	uint32_t read_locks;
+	uint32_t write_locks;
+	uint32_t reserved;
+	uint64_t bytes;
+} attr_cpu_access;
+
+#define GRALLOC_ATTR_CPU_ACCESS_OFFSET 512
+
+static_assert(sizeof(attr_region) <= GRALLOC_ATTR_CPU_ACCESS_OFFSET,
+              "Attributes overlap the CPU access counters");
+static_assert(GRALLOC_ATTR_CPU_ACCESS_OFFSET + sizeof(attr_cpu_access) <= 4096,
+              "CPU access counters don't fit in the attribute region");
+
+static inline attr_cpu_access *gralloc_buffer_attr_cpu_access(void *attr_base)
+{
+	return (attr_cpu_access *)((char *)attr_base + GRALLOC_ATTR_CPU_ACCESS_OFFSET);
+}
+
 /*
  * Allocate shared memory for attribute storage. Only to be
  * used by gralloc internally.
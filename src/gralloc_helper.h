@@ -43,6 +43,8 @@
 
 #define GRALLOC_MAX(a, b) (((a)>(b))?(a):(b))
 
+#define GRALLOC_MIN(a, b) (((a)<(b))?(a):(b))
+
 #define GRALLOC_UNUSED(x) ((void)x)
 
 static inline size_t round_up_to_page_size(size_t x)
@@ -19,13 +19,13 @@
 #ifndef _GRALLOC_VSYNC_H_
 #define _GRALLOC_VSYNC_H_
 
-struct framebuffer_device_t;
+struct mali_gralloc_display;
 
-/* Enables vsync interrupt. */
-int gralloc_vsync_enable(struct framebuffer_device_t *dev);
-/* Disables vsync interrupt. */
-int gralloc_vsync_disable(struct framebuffer_device_t *dev);
-/* Waits for the vsync interrupt. */
-int gralloc_wait_for_vsync(struct framebuffer_device_t *dev);
+/* Enables vsync interrupt of a display. */
+int gralloc_vsync_enable(struct mali_gralloc_display *dpy);
+/* Disables vsync interrupt of a display. */
+int gralloc_vsync_disable(struct mali_gralloc_display *dpy);
+/* Waits for the vsync interrupt of a display. */
+int gralloc_wait_for_vsync(struct mali_gralloc_display *dpy);
 
 #endif /* _GRALLOC_VSYNC_H_ */
@@ -34,37 +34,36 @@
 #include "mali_gralloc_buffer.h"
 #include "gralloc_vsync.h"
 #include "gralloc_vsync_report.h"
+#include "framebuffer_fbdev.h"
 
 #define FBIO_WAITFORVSYNC _IOW('F', 0x20, __u32)
 
-int gralloc_vsync_enable(framebuffer_device_t *dev)
+int gralloc_vsync_enable(mali_gralloc_display *dpy)
 {
-	GRALLOC_UNUSED(dev);
+	GRALLOC_UNUSED(dpy);
 	return 0;
 }
 
-int gralloc_vsync_disable(framebuffer_device_t *dev)
+int gralloc_vsync_disable(mali_gralloc_display *dpy)
 {
-	GRALLOC_UNUSED(dev);
+	GRALLOC_UNUSED(dpy);
 	return 0;
 }
 
-int gralloc_wait_for_vsync(framebuffer_device_t *dev)
+int gralloc_wait_for_vsync(mali_gralloc_display *dpy)
 {
-	private_module_t *m = reinterpret_cast<private_module_t *>(dev->common.module);
-
-	if (MALI_DPY_TYPE_CLCD == m->dpy_type || MALI_DPY_TYPE_HDLCD == m->dpy_type)
+	if (MALI_DPY_TYPE_CLCD == dpy->dpy_type || MALI_DPY_TYPE_HDLCD == dpy->dpy_type)
 	{
 		/* Silently ignore wait for vsync as neither PL111 nor HDLCD implement this IOCTL. */
 		return 0;
 	}
 
-	if (m->swapInterval)
+	if (dpy->swapInterval)
 	{
 		int crtc = 0;
 		gralloc_mali_vsync_report(MALI_VSYNC_EVENT_BEGIN_WAIT);
 
-		if (ioctl(m->framebuffer->fd, FBIO_WAITFORVSYNC, &crtc) < 0)
+		if (fbdev_ioctl(dpy->framebuffer->fd, FBIO_WAITFORVSYNC, &crtc) < 0)
 		{
 			gralloc_mali_vsync_report(MALI_VSYNC_EVENT_END_WAIT);
 			return -errno;
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2018 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Vsync backend for the KMS display backend (framebuffer_kms.cpp). Flips
+ * already complete on the DRM page flip event, this is only used when a
+ * vsync wait is requested on its own.
+ */
+
+#include <errno.h>
+
+#include <hardware/hardware.h>
+#include <hardware/fb.h>
+
+#if GRALLOC_USE_GRALLOC1_API == 1
+#include <hardware/gralloc1.h>
+#else
+#include <hardware/gralloc.h>
+#endif
+
+#include "mali_gralloc_module.h"
+#include "mali_gralloc_private_interface_types.h"
+#include "mali_gralloc_buffer.h"
+#include "gralloc_vsync.h"
+#include "gralloc_vsync_report.h"
+#include "framebuffer_kms.h"
+
+int gralloc_vsync_enable(mali_gralloc_display *dpy)
+{
+	GRALLOC_UNUSED(dpy);
+	return 0;
+}
+
+int gralloc_vsync_disable(mali_gralloc_display *dpy)
+{
+	GRALLOC_UNUSED(dpy);
+	return 0;
+}
+
+int gralloc_wait_for_vsync(mali_gralloc_display *dpy)
+{
+	if (dpy->swapInterval)
+	{
+		gralloc_mali_vsync_report(MALI_VSYNC_EVENT_BEGIN_WAIT);
+
+		const int ret = fb_kms_wait_vblank();
+
+		gralloc_mali_vsync_report(MALI_VSYNC_EVENT_END_WAIT);
+
+		return ret;
+	}
+
+	return 0;
+}
@@ -17,6 +17,7 @@
  */
 
 #include "gralloc_priv.h"
+#include "mali_gralloc_module.h"
 #include "gralloc_vsync.h"
 #include "gralloc_vsync_report.h"
 #include <sys/ioctl.h>
@@ -25,12 +26,11 @@
 #define FBIO_WAITFORVSYNC _IOW('F', 0x20, __u32)
 #define S3CFB_SET_VSYNC_INT _IOW('F', 206, unsigned int)
 
-int gralloc_vsync_enable(framebuffer_device_t *dev)
+int gralloc_vsync_enable(mali_gralloc_display *dpy)
 {
-	private_module_t *m = reinterpret_cast<private_module_t *>(dev->common.module);
 	int interrupt = 1;
 
-	if (ioctl(m->framebuffer->fd, S3CFB_SET_VSYNC_INT, &interrupt) < 0)
+	if (ioctl(dpy->framebuffer->fd, S3CFB_SET_VSYNC_INT, &interrupt) < 0)
 	{
 		return -errno;
 	}
@@ -38,12 +38,11 @@ int gralloc_vsync_enable(framebuffer_device_t *dev)
 	return 0;
 }
 
-int gralloc_vsync_disable(framebuffer_device_t *dev)
+int gralloc_vsync_disable(mali_gralloc_display *dpy)
 {
-	private_module_t *m = reinterpret_cast<private_module_t *>(dev->common.module);
 	int interrupt = 0;
 
-	if (ioctl(m->framebuffer->fd, S3CFB_SET_VSYNC_INT, &interrupt) < 0)
+	if (ioctl(dpy->framebuffer->fd, S3CFB_SET_VSYNC_INT, &interrupt) < 0)
 	{
 		return -errno;
 	}
@@ -51,16 +50,14 @@ int gralloc_vsync_disable(framebuffer_device_t *dev)
 	return 0;
 }
 
-int gralloc_wait_for_vsync(framebuffer_device_t *dev)
+int gralloc_wait_for_vsync(mali_gralloc_display *dpy)
 {
-	private_module_t *m = reinterpret_cast<private_module_t *>(dev->common.module);
-
-	if (m->swapInterval)
+	if (dpy->swapInterval)
 	{
 		int crtc = 0;
 		gralloc_mali_vsync_report(MALI_VSYNC_EVENT_BEGIN_WAIT);
 
-		if (ioctl(m->framebuffer->fd, FBIO_WAITFORVSYNC, &crtc) < 0)
+		if (ioctl(dpy->framebuffer->fd, FBIO_WAITFORVSYNC, &crtc) < 0)
 		{
 			gralloc_mali_vsync_report(MALI_VSYNC_EVENT_END_WAIT);
 			return -errno;
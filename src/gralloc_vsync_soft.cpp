@@ -0,0 +1,381 @@
+/*
+ * Copyright (C) 2018 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Software vsync backend.
+ *
+ * For displays which do not implement FBIO_WAITFORVSYNC (e.g. PL111/CLCD and
+ * HDLCD) the vsync edges are predicted from the display timings. A dedicated
+ * thread sleeps on a timerfd until each predicted edge and wakes any thread
+ * blocked in gralloc_wait_for_vsync().
+ *
+ * The edge timeline is kept in picoseconds relative to an anchor so that a
+ * refresh period which is not a whole number of nanoseconds does not drift.
+ * Edges missed through scheduling latency are accounted for without
+ * changing the phase of the timeline.
+ *
+ * Only POSIX timers and threads are used, so the backend can also be
+ * exercised on a host without a display.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include <hardware/hardware.h>
+#include <hardware/fb.h>
+
+#if GRALLOC_USE_GRALLOC1_API == 1
+#include <hardware/gralloc1.h>
+#else
+#include <hardware/gralloc.h>
+#endif
+
+#include "mali_gralloc_module.h"
+#include "mali_gralloc_private_interface_types.h"
+#include "mali_gralloc_buffer.h"
+#include "gralloc_helper.h"
+#include "gralloc_vsync.h"
+#include "gralloc_vsync_report.h"
+
+/* Refresh period used when the display timings are unknown (60Hz). */
+#define SOFT_VSYNC_DEFAULT_PERIOD_PS (1000000000000LL / 60)
+
+/*
+ * Number of edges after which the timeline anchor is advanced. Must be a
+ * multiple of 1000 so that the anchor moves by a whole number of nanoseconds.
+ */
+#define SOFT_VSYNC_REANCHOR_EDGES 1000
+
+struct soft_vsync_state
+{
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+	int timer_fd;
+	bool running;
+
+	/* The thread has been started and not joined, it may have stopped on an error. */
+	bool joinable;
+
+	/* Error which stopped the thread, reported to waiters until it is restarted. */
+	int error;
+
+	/* Refresh period (in picoseconds). */
+	int64_t period_ps;
+
+	/* Timeline: edge n occurs at anchor_ns + (n * period_ps) / 1000. */
+	int64_t anchor_ns;
+	uint64_t edge_idx;
+
+	/* Total number of edges since the timeline was started. */
+	uint64_t count;
+
+	/* Value of 'count' when the last posted frame was released. */
+	uint64_t last_flip;
+
+	/* Number of edges which passed without the thread observing them. */
+	uint64_t missed;
+
+	soft_vsync_state()
+	    : thread(0)
+	    , timer_fd(-1)
+	    , running(false)
+	    , joinable(false)
+	    , error(0)
+	    , period_ps(SOFT_VSYNC_DEFAULT_PERIOD_PS)
+	    , anchor_ns(0)
+	    , edge_idx(0)
+	    , count(0)
+	    , last_flip(0)
+	    , missed(0)
+	{
+		pthread_mutex_init(&lock, NULL);
+		pthread_cond_init(&cond, NULL);
+	}
+};
+
+/* Each display has its own timeline. */
+static soft_vsync_state s_vsync[MALI_GRALLOC_MAX_DISPLAYS];
+
+static int64_t monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * Derives the refresh period from the fbdev timings. pixclock is the pixel
+ * period in picoseconds, so a frame lasts htotal * vtotal * pixclock ps.
+ * Falls back to the module refresh rate, then 60Hz.
+ */
+static int64_t soft_vsync_period_ps(const mali_gralloc_display *dpy)
+{
+	const struct fb_var_screeninfo *info = &dpy->info;
+
+	if (info->pixclock > 0)
+	{
+		const uint64_t htotal = info->left_margin + info->right_margin + info->xres + info->hsync_len;
+		const uint64_t vtotal = info->upper_margin + info->lower_margin + info->yres + info->vsync_len;
+		const uint64_t period = htotal * vtotal * info->pixclock;
+
+		if (period > 0)
+		{
+			return (int64_t)period;
+		}
+	}
+
+	if (dpy->fps > 0.0f)
+	{
+		return (int64_t)(1000000000000.0 / dpy->fps);
+	}
+
+	return SOFT_VSYNC_DEFAULT_PERIOD_PS;
+}
+
+/* Must be called with vs->lock held. */
+static int64_t soft_vsync_edge_ns(const soft_vsync_state *vs, uint64_t idx)
+{
+	return vs->anchor_ns + (int64_t)((idx * (uint64_t)vs->period_ps) / 1000);
+}
+
+static void *soft_vsync_thread(void *arg)
+{
+	soft_vsync_state *vs = static_cast<soft_vsync_state *>(arg);
+
+	pthread_mutex_lock(&vs->lock);
+
+	while (vs->running)
+	{
+		struct itimerspec spec = {};
+		const int64_t next_ns = soft_vsync_edge_ns(vs, vs->edge_idx + 1);
+		const int timer_fd = vs->timer_fd;
+
+		spec.it_value.tv_sec = next_ns / 1000000000LL;
+		spec.it_value.tv_nsec = next_ns % 1000000000LL;
+
+		pthread_mutex_unlock(&vs->lock);
+
+		uint64_t expirations = 0;
+		int ret = timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+		if (ret == 0)
+		{
+			ret = read(timer_fd, &expirations, sizeof(expirations));
+		}
+
+		const int err = (ret < 0) ? errno : 0;
+		const int64_t now_ns = monotonic_ns();
+
+		pthread_mutex_lock(&vs->lock);
+
+		if (ret < 0)
+		{
+			if (err == EINTR)
+			{
+				continue;
+			}
+
+			/* Waiters fail with the error, and the next one restarts the thread. */
+			AERR("Software vsync timer failed: %d", err);
+			vs->error = -err;
+			vs->running = false;
+			break;
+		}
+
+		/* Account for every edge which elapsed, keeping the timeline phase. */
+		uint64_t idx = vs->edge_idx + 1;
+		if (now_ns > vs->anchor_ns)
+		{
+			const uint64_t elapsed = ((uint64_t)(now_ns - vs->anchor_ns) * 1000) / vs->period_ps;
+			if (elapsed > idx)
+			{
+				vs->missed += elapsed - idx;
+				idx = elapsed;
+			}
+		}
+
+		vs->count += idx - vs->edge_idx;
+		vs->edge_idx = idx;
+
+		/* Advance the anchor by a whole number of nanoseconds to bound the arithmetic. */
+		if (vs->edge_idx >= SOFT_VSYNC_REANCHOR_EDGES)
+		{
+			const uint64_t blocks = vs->edge_idx / SOFT_VSYNC_REANCHOR_EDGES;
+
+			vs->anchor_ns += (int64_t)(blocks * (SOFT_VSYNC_REANCHOR_EDGES / 1000)) * vs->period_ps;
+			vs->edge_idx -= blocks * SOFT_VSYNC_REANCHOR_EDGES;
+		}
+
+		pthread_cond_broadcast(&vs->cond);
+	}
+
+	pthread_cond_broadcast(&vs->cond);
+	pthread_mutex_unlock(&vs->lock);
+
+	return NULL;
+}
+
+/* Must be called with vs->lock held. */
+static int soft_vsync_start_locked(soft_vsync_state *vs, const mali_gralloc_display *dpy)
+{
+	const int64_t period_ps = soft_vsync_period_ps(dpy);
+
+	if (vs->running)
+	{
+		if (period_ps != vs->period_ps)
+		{
+			/* Re-phase the timeline on the last observed edge. */
+			vs->anchor_ns = soft_vsync_edge_ns(vs, vs->edge_idx);
+			vs->edge_idx = 0;
+			vs->period_ps = period_ps;
+		}
+
+		return 0;
+	}
+
+	/* A thread which stopped on an error has released the lock for good, so it can be joined here. */
+	if (vs->joinable)
+	{
+		pthread_join(vs->thread, NULL);
+		vs->joinable = false;
+	}
+
+	if (vs->timer_fd < 0)
+	{
+		vs->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+		if (vs->timer_fd < 0)
+		{
+			AERR("Failed to create software vsync timer: %d", errno);
+			return -errno;
+		}
+	}
+
+	vs->period_ps = period_ps;
+	vs->anchor_ns = monotonic_ns();
+	vs->edge_idx = 0;
+	vs->error = 0;
+	vs->running = true;
+
+	const int ret = pthread_create(&vs->thread, NULL, soft_vsync_thread, vs);
+	if (ret != 0)
+	{
+		AERR("Failed to start software vsync thread: %d", ret);
+		vs->running = false;
+		return -ret;
+	}
+
+	vs->joinable = true;
+
+	AINF("Software vsync started, period %" PRId64 " ps", period_ps);
+
+	return 0;
+}
+
+int gralloc_vsync_enable(mali_gralloc_display *dpy)
+{
+	soft_vsync_state *vs = &s_vsync[dpy->index];
+
+	pthread_mutex_lock(&vs->lock);
+	const int ret = soft_vsync_start_locked(vs, dpy);
+	pthread_mutex_unlock(&vs->lock);
+
+	return ret;
+}
+
+int gralloc_vsync_disable(mali_gralloc_display *dpy)
+{
+	soft_vsync_state *vs = &s_vsync[dpy->index];
+
+	pthread_mutex_lock(&vs->lock);
+
+	if (!vs->running)
+	{
+		pthread_mutex_unlock(&vs->lock);
+		return 0;
+	}
+
+	vs->running = false;
+
+	/* Fire the timer immediately so the thread observes the request. */
+	struct itimerspec spec = {};
+	spec.it_value.tv_nsec = 1;
+	timerfd_settime(vs->timer_fd, 0, &spec, NULL);
+
+	const pthread_t thread = vs->thread;
+	vs->joinable = false;
+	pthread_mutex_unlock(&vs->lock);
+
+	pthread_join(thread, NULL);
+
+	return 0;
+}
+
+int gralloc_wait_for_vsync(mali_gralloc_display *dpy)
+{
+	soft_vsync_state *vs = &s_vsync[dpy->index];
+	const int interval = dpy->swapInterval;
+
+	if (interval <= 0)
+	{
+		return 0;
+	}
+
+	gralloc_mali_vsync_report(MALI_VSYNC_EVENT_BEGIN_WAIT);
+
+	pthread_mutex_lock(&vs->lock);
+
+	int ret = soft_vsync_start_locked(vs, dpy);
+	if (ret == 0)
+	{
+		/*
+		 * Release the frame on the first edge which is at least 'interval'
+		 * edges after the previous release, and never on an edge which has
+		 * already passed.
+		 */
+		uint64_t target = vs->last_flip + interval;
+		if (target <= vs->count)
+		{
+			target = vs->count + 1;
+		}
+
+		while (vs->running && vs->count < target)
+		{
+			pthread_cond_wait(&vs->cond, &vs->lock);
+		}
+
+		vs->last_flip = vs->count;
+
+		if (!vs->running)
+		{
+			ret = vs->error;
+		}
+	}
+
+	pthread_mutex_unlock(&vs->lock);
+
+	gralloc_mali_vsync_report(MALI_VSYNC_EVENT_END_WAIT);
+
+	return ret;
+}
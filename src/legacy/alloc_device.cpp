@@ -33,12 +33,13 @@
 #include "gralloc_priv.h"
 #include "gralloc_helper.h"
 #include "framebuffer_device.h"
-#include "mali_gralloc_ion.h"
+#include "mali_gralloc_backend.h"
 #include "gralloc_buffer_priv.h"
 #include "mali_gralloc_bufferdescriptor.h"
 #include "mali_gralloc_bufferallocation.h"
 #include "mali_gralloc_formats.h"
 #include "mali_gralloc_usages.h"
+#include "mali_gralloc_trace.h"
 
 static int alloc_device_alloc(alloc_device_t *dev, int w, int h, int format, int _usage, buffer_handle_t *pHandle,
                               int *pStride)
@@ -58,22 +59,6 @@ static int alloc_device_alloc(alloc_device_t *dev, int w, int h, int format, int
 
 	m = reinterpret_cast<private_module_t *>(dev->common.module);
 
-#if GRALLOC_FB_SWAP_RED_BLUE == 1
-
-	/* match the framebuffer format */
-	if (usage & GRALLOC_USAGE_HW_FB)
-	{
-#if GRALLOC_FB_BPP == 16
-		format = HAL_PIXEL_FORMAT_RGB_565;
-#elif GRALLOC_FB_BPP == 32
-		format = HAL_PIXEL_FORMAT_BGRA_8888;
-#else
-#error "Invalid framebuffer bit depth"
-#endif
-	}
-
-#endif
-
 #if DISABLE_FRAMEBUFFER_HAL != 1
 
 	if (usage & GRALLOC_USAGE_HW_FB)
@@ -81,7 +66,7 @@ static int alloc_device_alloc(alloc_device_t *dev, int w, int h, int format, int
 		int byte_stride;
 		int pixel_stride;
 
-		err = fb_alloc_framebuffer(m, usage, usage, pHandle, &pixel_stride, &byte_stride);
+		err = fb_alloc_framebuffer(m, usage, usage, format, pHandle, &pixel_stride, &byte_stride);
 
 		if (err >= 0)
 		{
@@ -97,8 +82,7 @@ static int alloc_device_alloc(alloc_device_t *dev, int w, int h, int format, int
 
 			hnd->req_format = format;
 			hnd->yuv_info = MALI_YUV_BT601_NARROW;
-			hnd->internal_format = format;
-			hnd->alloc_format = format;
+			hnd->internal_format = hnd->alloc_format;
 			hnd->byte_stride = byte_stride;
 			hnd->width = w;
 			hnd->height = h;
@@ -152,10 +136,23 @@ static int alloc_device_free(alloc_device_t *dev, buffer_handle_t handle)
 	private_handle_t const *hnd = reinterpret_cast<private_handle_t const *>(handle);
 	private_module_t *m = reinterpret_cast<private_module_t *>(dev->common.module);
 
+#if GRALLOC_ALLOC_TRACE == 1
+	mali_gralloc_trace_free(hnd);
+#endif
+
+#if DISABLE_FRAMEBUFFER_HAL != 1
+	fb_release_buffer(m, handle);
+#endif
+
 	if (hnd->flags & private_handle_t::PRIV_FLAGS_FRAMEBUFFER)
 	{
 		// free this buffer
 		close(hnd->fd);
+
+		if (hnd->share_fd >= 0)
+		{
+			close(hnd->share_fd);
+		}
 	}
 	else
 	{
@@ -187,7 +184,7 @@ int alloc_device_open(hw_module_t const *module, const char *name, hw_device_t *
 	dev->common.tag = HARDWARE_DEVICE_TAG;
 	dev->common.version = 0;
 	dev->common.module = const_cast<hw_module_t *>(module);
-	dev->common.close = mali_gralloc_ion_device_close;
+	dev->common.close = mali_gralloc_backend_device_close;
 	dev->alloc = alloc_device_alloc;
 	dev->free = alloc_device_free;
 
@@ -29,7 +29,7 @@
 #include "mali_gralloc_buffer.h"
 #include "mali_gralloc_formats.h"
 #include "mali_gralloc_usages.h"
-#include "mali_gralloc_ion.h"
+#include "mali_gralloc_backend.h"
 #include "gralloc_helper.h"
 #include <sync/sync.h>
 
@@ -59,9 +59,10 @@ int mali_gralloc_lock(const mali_gralloc_module *m, buffer_handle_t buffer, uint
 		return -EINVAL;
 	}
 
-	if (hnd->flags & private_handle_t::PRIV_FLAGS_USES_ION)
+	if (hnd->flags & (private_handle_t::PRIV_FLAGS_USES_ION | private_handle_t::PRIV_FLAGS_IMPORTED))
 	{
 		hnd->writeOwner = usage & GRALLOC_USAGE_SW_WRITE_MASK;
+		mali_gralloc_backend_sync_begin(m, hnd);
 	}
 
 	if (usage & (GRALLOC_USAGE_SW_READ_MASK | GRALLOC_USAGE_SW_WRITE_MASK))
@@ -94,9 +95,10 @@ int mali_gralloc_lock_ycbcr(const mali_gralloc_module *m, buffer_handle_t buffer
 
 	private_handle_t *hnd = (private_handle_t *)buffer;
 
-	if (hnd->flags & private_handle_t::PRIV_FLAGS_USES_ION)
+	if (hnd->flags & (private_handle_t::PRIV_FLAGS_USES_ION | private_handle_t::PRIV_FLAGS_IMPORTED))
 	{
 		hnd->writeOwner = usage & GRALLOC_USAGE_SW_WRITE_MASK;
+		mali_gralloc_backend_sync_begin(m, hnd);
 	}
 
 	if (usage & (GRALLOC_USAGE_SW_READ_MASK | GRALLOC_USAGE_SW_WRITE_MASK) &&
@@ -178,9 +180,9 @@ int mali_gralloc_unlock(const mali_gralloc_module *m, buffer_handle_t buffer)
 
 	private_handle_t *hnd = (private_handle_t *)buffer;
 
-	if (hnd->flags & private_handle_t::PRIV_FLAGS_USES_ION && hnd->writeOwner)
+	if ((hnd->flags & (private_handle_t::PRIV_FLAGS_USES_ION | private_handle_t::PRIV_FLAGS_IMPORTED)) && hnd->writeOwner)
 	{
-		mali_gralloc_ion_sync(m, hnd);
+		mali_gralloc_backend_sync_end(m, hnd);
 	}
 
 	return 0;
@@ -276,9 +278,10 @@ int mali_gralloc_lock_flex_async(const mali_gralloc_module *m, buffer_handle_t b
 
 	private_handle_t *hnd = (private_handle_t *)buffer;
 
-	if (hnd->flags & private_handle_t::PRIV_FLAGS_USES_ION)
+	if (hnd->flags & (private_handle_t::PRIV_FLAGS_USES_ION | private_handle_t::PRIV_FLAGS_IMPORTED))
 	{
 		hnd->writeOwner = usage & GRALLOC_USAGE_SW_WRITE_MASK;
+		mali_gralloc_backend_sync_begin(m, hnd);
 	}
 
 	if (usage & (GRALLOC_USAGE_SW_READ_MASK | GRALLOC_USAGE_SW_WRITE_MASK) &&
@@ -28,7 +28,7 @@
 
 #include "mali_gralloc_module.h"
 #include "mali_gralloc_bufferallocation.h"
-#include "mali_gralloc_ion.h"
+#include "mali_gralloc_backend.h"
 #include "mali_gralloc_private_interface_types.h"
 #include "mali_gralloc_buffer.h"
 #include "gralloc_buffer_priv.h"
@@ -0,0 +1,844 @@
+/*
+ * Copyright (C) 2018 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include <linux/types.h>
+
+#include <log/log.h>
+#include <cutils/atomic.h>
+#include <hardware/hardware.h>
+
+#if GRALLOC_USE_GRALLOC1_API == 1
+#include <hardware/gralloc1.h>
+#else
+#include <hardware/gralloc.h>
+#endif
+
+#include "mali_gralloc_module.h"
+#include "mali_gralloc_private_interface_types.h"
+#include "mali_gralloc_buffer.h"
+#include "gralloc_helper.h"
+#include "mali_gralloc_formats.h"
+#include "mali_gralloc_usages.h"
+#include "mali_gralloc_bufferdescriptor.h"
+#include "mali_gralloc_bufferallocation.h"
+#include "mali_gralloc_backend.h"
+#include "mali_gralloc_shmem.h"
+#include "mali_gralloc_cache_policy.h"
+
+#ifndef GRALLOC_ALLOC_BACKEND
+#define GRALLOC_ALLOC_BACKEND "ion"
+#endif
+
+/* From linux/dma-buf.h, which older platform headers don't have. */
+struct gralloc_dma_buf_sync
+{
+	__u64 flags;
+};
+
+#define GRALLOC_DMA_BUF_SYNC_READ (1 << 0)
+#define GRALLOC_DMA_BUF_SYNC_WRITE (2 << 0)
+#define GRALLOC_DMA_BUF_SYNC_START (0 << 2)
+#define GRALLOC_DMA_BUF_SYNC_END (1 << 2)
+#define GRALLOC_DMA_BUF_IOCTL_SYNC _IOW('b', 0, struct gralloc_dma_buf_sync)
+
+/* The first one is used when the default isn't built. */
+static const struct mali_gralloc_backend *const s_backends[] = {
+#if GRALLOC_ION_BACKEND == 1
+	&mali_gralloc_backend_ion,
+#endif
+	&mali_gralloc_backend_memfd,
+#if GRALLOC_DMA_HEAP_BACKEND == 1
+	&mali_gralloc_backend_dma_heap,
+#endif
+};
+
+static void mali_gralloc_backend_free_internal(buffer_handle_t *pHandle, uint32_t num_hnds);
+
+static const struct mali_gralloc_backend *find_backend(const char *name)
+{
+	for (size_t i = 0; i < sizeof(s_backends) / sizeof(s_backends[0]); i++)
+	{
+		if (strcmp(s_backends[i]->name, name) == 0)
+		{
+			return s_backends[i];
+		}
+	}
+
+	return NULL;
+}
+
+const struct mali_gralloc_backend *mali_gralloc_backend_select(void)
+{
+	const char *name = getenv("GRALLOC_ALLOC_BACKEND");
+	const struct mali_gralloc_backend *backend = NULL;
+
+	if (name != NULL)
+	{
+		backend = find_backend(name);
+
+		if (backend == NULL)
+		{
+			AWAR("Unknown allocation backend '%s', using '%s'", name, GRALLOC_ALLOC_BACKEND);
+		}
+	}
+
+	if (backend == NULL)
+	{
+		backend = find_backend(GRALLOC_ALLOC_BACKEND);
+
+#if GRALLOC_DMA_HEAP_BACKEND == 1
+		/* Kernels with DMA-BUF heaps no longer have ION. */
+		if ((backend == NULL || strcmp(backend->name, "ion") == 0) && access("/dev/ion", F_OK) != 0 &&
+		    access("/dev/dma_heap", F_OK) == 0)
+		{
+			backend = &mali_gralloc_backend_dma_heap;
+		}
+#endif
+	}
+
+	return (backend != NULL) ? backend : s_backends[0];
+}
+
+/*
+ * Returns the module of the running process, for entry points which are only
+ * given a handle.
+ */
+static mali_gralloc_module *get_module(void)
+{
+	hw_module_t *pmodule = NULL;
+
+	if (hw_get_module(GRALLOC_HARDWARE_MODULE_ID, (const hw_module_t **)&pmodule) != 0)
+	{
+		return NULL;
+	}
+
+	return reinterpret_cast<mali_gralloc_module *>(pmodule);
+}
+
+static mali_gralloc_heap pick_heap(uint32_t heaps, uint64_t usage)
+{
+	mali_gralloc_heap heap = MALI_GRALLOC_HEAP_INVALID;
+
+	if (usage & GRALLOC_USAGE_PROTECTED)
+	{
+		if (heaps & MALI_GRALLOC_HEAP_MASK(MALI_GRALLOC_HEAP_SECURE))
+		{
+			heap = MALI_GRALLOC_HEAP_SECURE;
+		}
+		else
+		{
+			AERR("Protected memory is not supported on this platform.");
+		}
+	}
+	else if (usage & GRALLOC_USAGE_HW_FB)
+	{
+		heap = MALI_GRALLOC_HEAP_FRAMEBUFFER;
+	}
+	else if (!(usage & GRALLOC_USAGE_HW_VIDEO_ENCODER) && (usage & (GRALLOC_USAGE_HW_FB | GRALLOC_USAGE_HW_COMPOSER)))
+	{
+#if GRALLOC_USE_ION_COMPOUND_PAGE_HEAP
+		heap = MALI_GRALLOC_HEAP_COMPOUND_PAGE;
+#elif GRALLOC_USE_ION_DMA_HEAP
+		heap = MALI_GRALLOC_HEAP_DMA;
+#else
+		heap = MALI_GRALLOC_HEAP_SYSTEM;
+#endif
+	}
+	else
+	{
+		heap = MALI_GRALLOC_HEAP_SYSTEM;
+	}
+
+	return heap;
+}
+
+static uint32_t usage_heap_flags(mali_gralloc_heap heap, uint64_t usage)
+{
+	/* DMA heap memory is always mapped uncached. */
+	if (heap == MALI_GRALLOC_HEAP_DMA)
+	{
+		return 0;
+	}
+
+	if ((usage & GRALLOC_USAGE_SW_READ_MASK) == GRALLOC_USAGE_SW_READ_OFTEN)
+	{
+		return MALI_GRALLOC_HEAP_FLAG_CACHED;
+	}
+
+	return 0;
+}
+
+static uint32_t heap_flags(mali_gralloc_heap heap, const buffer_descriptor_t *desc)
+{
+	const uint32_t flags = usage_heap_flags(heap, desc->consumer_usage | desc->producer_usage);
+
+#if GRALLOC_ADAPTIVE_CACHE == 1
+	/* Only system heap memory can be either. */
+	if (heap == MALI_GRALLOC_HEAP_SYSTEM)
+	{
+		return mali_gralloc_cache_policy_flags(desc, flags);
+	}
+#endif
+
+	return flags;
+}
+
+static int heap_min_pgsz(mali_gralloc_heap heap, size_t size)
+{
+	switch (heap)
+	{
+	case MALI_GRALLOC_HEAP_DMA:
+		return size;
+
+	case MALI_GRALLOC_HEAP_COMPOUND_PAGE:
+		return SZ_2M;
+
+	default:
+		return SZ_4K;
+	}
+}
+
+/*
+ *  Allocates from the picked heap, falling back to the system heap if that fails
+ *
+ * @param m         [in]    Gralloc module.
+ * @param desc      [in]    Descriptor of the buffer (usage and size).
+ * @param heap      [inout] Requested heap; the heap allocated from on return.
+ * @param min_pgsz  [out]   Minimum page size (in bytes).
+ *
+ * @return File handle of the new buffer, on success
+ *         -1, otherwise.
+ */
+static int alloc_from_heap(mali_gralloc_module *m, const buffer_descriptor_t *desc, mali_gralloc_heap *heap,
+                           int *min_pgsz)
+{
+	const struct mali_gralloc_backend *backend = m->backend;
+	const size_t size = desc->size;
+	uint32_t flags;
+	int shared_fd;
+
+	if (size <= 0 || *heap == MALI_GRALLOC_HEAP_INVALID)
+	{
+		return -1;
+	}
+
+	flags = heap_flags(*heap, desc);
+	shared_fd = backend->allocate(m, *heap, flags, size);
+
+	if (shared_fd < 0)
+	{
+		/* Don't allow falling back to sytem heap if secure was requested. */
+		if (*heap == MALI_GRALLOC_HEAP_SECURE)
+		{
+			return -1;
+		}
+
+		if (*heap == MALI_GRALLOC_HEAP_SYSTEM)
+		{
+			AERR("%s: Allocation failed on on system heap. Cannot fallback.", __func__);
+			return -1;
+		}
+
+		*heap = MALI_GRALLOC_HEAP_SYSTEM;
+		flags = heap_flags(*heap, desc);
+		shared_fd = backend->allocate(m, *heap, flags, size);
+
+		if (shared_fd < 0)
+		{
+			AERR("Fallback allocation of %zd bytes from %s system heap failed", size, backend->name);
+			return -1;
+		}
+	}
+
+	*min_pgsz = heap_min_pgsz(*heap, size);
+
+#if GRALLOC_ADAPTIVE_CACHE == 1
+	mali_gralloc_cache_policy_override(desc, usage_heap_flags(*heap, desc->consumer_usage | desc->producer_usage),
+	                                   flags);
+#endif
+
+	return shared_fd;
+}
+
+static bool check_buffers_sharable(uint32_t heaps, const gralloc_buffer_descriptor_t *descriptors,
+                                   uint32_t numDescriptors)
+{
+	mali_gralloc_heap shared_heap = MALI_GRALLOC_HEAP_INVALID;
+	uint32_t shared_flags = 0;
+	uint64_t usage;
+	uint32_t i;
+
+	if (numDescriptors <= 1)
+	{
+		return false;
+	}
+
+	for (i = 0; i < numDescriptors; i++)
+	{
+		buffer_descriptor_t *bufDescriptor = (buffer_descriptor_t *)descriptors[i];
+
+		usage = bufDescriptor->consumer_usage | bufDescriptor->producer_usage;
+
+		if (mali_gralloc_shmem_usage(usage))
+		{
+			return false;
+		}
+
+		const mali_gralloc_heap heap = pick_heap(heaps, usage);
+		if (heap == MALI_GRALLOC_HEAP_INVALID)
+		{
+			return false;
+		}
+
+		const uint32_t flags = heap_flags(heap, bufDescriptor);
+
+		if (shared_heap != MALI_GRALLOC_HEAP_INVALID)
+		{
+			if (shared_heap != heap || shared_flags != flags)
+			{
+				return false;
+			}
+		}
+		else
+		{
+			shared_heap = heap;
+			shared_flags = flags;
+		}
+	}
+
+	return true;
+}
+
+static int get_max_buffer_descriptor_index(const gralloc_buffer_descriptor_t *descriptors, uint32_t numDescriptors)
+{
+	uint32_t i, max_buffer_index = 0;
+	size_t max_buffer_size = 0;
+
+	for (i = 0; i < numDescriptors; i++)
+	{
+		buffer_descriptor_t *bufDescriptor = (buffer_descriptor_t *)descriptors[i];
+
+		if (max_buffer_size < bufDescriptor->size)
+		{
+			max_buffer_index = i;
+			max_buffer_size = bufDescriptor->size;
+		}
+	}
+
+	return max_buffer_index;
+}
+
+/*
+ * A handle maps its memory from the start of the buffer and 'base' points
+ * 'offset' bytes in, so that views of a buffer can map the part they use.
+ * Shared memory is always mapped whole, as huge pages can't be split.
+ */
+static size_t mapping_size(const private_handle_t *hnd)
+{
+	if (hnd->flags & private_handle_t::PRIV_FLAGS_USES_SHMEM)
+	{
+		return hnd->backing_store_size;
+	}
+
+	return hnd->offset + hnd->size;
+}
+
+static void *mapping_base(const private_handle_t *hnd)
+{
+	return (void *)(uintptr_t(hnd->base) - hnd->offset);
+}
+
+static unsigned int heap_priv_flags(mali_gralloc_heap heap)
+{
+	return (heap == MALI_GRALLOC_HEAP_DMA) ? private_handle_t::PRIV_FLAGS_USES_ION_DMA_HEAP : 0;
+}
+
+/*
+ *  Allocates backing store for buffers
+ *
+ * @param m               [in]    Gralloc module.
+ * @param descriptors     [in]    Buffer request descriptors
+ * @param numDescriptors  [in]    Number of descriptors
+ * @param pHandle         [out]   Handle for each allocated buffer
+ * @param shared_backend  [out]   Shared buffers flag
+ *
+ * @return 0, on success
+ *         negative value, otherwise.
+ */
+int mali_gralloc_backend_allocate(mali_gralloc_module *m, const gralloc_buffer_descriptor_t *descriptors,
+                                  uint32_t numDescriptors, buffer_handle_t *pHandle, bool *shared_backend)
+{
+	const struct mali_gralloc_backend *backend = m->backend;
+	mali_gralloc_heap heap;
+	unsigned char *cpu_ptr = NULL;
+	uint64_t usage;
+	uint32_t i, max_buffer_index = 0;
+	int shared_fd;
+	int min_pgsz = 0;
+	int status;
+
+	status = backend->open(m);
+	if (status < 0)
+	{
+		return status;
+	}
+
+	const uint32_t heaps = backend->query_heaps(m);
+
+	*shared_backend = check_buffers_sharable(heaps, descriptors, numDescriptors);
+
+	if (*shared_backend)
+	{
+		buffer_descriptor_t *max_bufDescriptor;
+
+		max_buffer_index = get_max_buffer_descriptor_index(descriptors, numDescriptors);
+		max_bufDescriptor = (buffer_descriptor_t *)(descriptors[max_buffer_index]);
+		usage = max_bufDescriptor->consumer_usage | max_bufDescriptor->producer_usage;
+
+		heap = pick_heap(heaps, usage);
+		if (heap == MALI_GRALLOC_HEAP_INVALID)
+		{
+			AERR("Failed to find an appropriate heap");
+			return -1;
+		}
+
+		shared_fd = alloc_from_heap(m, max_bufDescriptor, &heap, &min_pgsz);
+
+		if (shared_fd < 0)
+		{
+			AERR("%s allocation of %zu bytes failed", backend->name, max_bufDescriptor->size);
+			return -1;
+		}
+
+		for (i = 0; i < numDescriptors; i++)
+		{
+			buffer_descriptor_t *bufDescriptor = (buffer_descriptor_t *)(descriptors[i]);
+			int tmp_fd;
+
+			if (i != max_buffer_index)
+			{
+				tmp_fd = backend->dup(m, shared_fd);
+
+				if (tmp_fd < 0)
+				{
+					AERR("Shared fd:%d of index:%d could not be duplicated for descriptor:%d",
+					      shared_fd, max_buffer_index, i);
+
+					/* It is possible that already opened shared_fd for the
+					 * max_bufDescriptor is also not closed */
+					if (i < max_buffer_index)
+					{
+						backend->free(m, shared_fd);
+					}
+
+					/* Need to free already allocated memory. */
+					mali_gralloc_backend_free_internal(pHandle, i);
+					return -1;
+				}
+			}
+			else
+			{
+				tmp_fd = shared_fd;
+			}
+
+			private_handle_t *hnd = new private_handle_t(
+			    private_handle_t::PRIV_FLAGS_USES_ION | heap_priv_flags(heap), bufDescriptor->size, min_pgsz,
+			    bufDescriptor->consumer_usage, bufDescriptor->producer_usage, tmp_fd, bufDescriptor->hal_format,
+			    bufDescriptor->internal_format, bufDescriptor->alloc_format,
+			    bufDescriptor->width, bufDescriptor->height, bufDescriptor->pixel_stride,
+			    bufDescriptor->old_alloc_width, bufDescriptor->old_alloc_height, bufDescriptor->old_byte_stride,
+			    max_bufDescriptor->size, bufDescriptor->layer_count, bufDescriptor->plane_info);
+
+			if (NULL == hnd)
+			{
+				AERR("Private handle could not be created for descriptor:%d of shared usecase", i);
+
+				/* Close the obtained shared file descriptor for the current handle */
+				backend->free(m, tmp_fd);
+
+				/* It is possible that already opened shared_fd for the
+				 * max_bufDescriptor is also not closed */
+				if (i < max_buffer_index)
+				{
+					backend->free(m, shared_fd);
+				}
+
+				/* Free the resources allocated for the previous handles */
+				mali_gralloc_backend_free_internal(pHandle, i);
+				return -1;
+			}
+
+			pHandle[i] = hnd;
+		}
+	}
+	else
+	{
+		for (i = 0; i < numDescriptors; i++)
+		{
+			buffer_descriptor_t *bufDescriptor = (buffer_descriptor_t *)(descriptors[i]);
+			usage = bufDescriptor->consumer_usage | bufDescriptor->producer_usage;
+
+			if (mali_gralloc_shmem_usage(usage))
+			{
+				size_t alloc_size = 0;
+
+				shared_fd = mali_gralloc_shmem_allocate(bufDescriptor->size, &alloc_size, &min_pgsz);
+
+				if (shared_fd >= 0)
+				{
+					private_handle_t *hnd = new private_handle_t(
+					    private_handle_t::PRIV_FLAGS_USES_SHMEM, bufDescriptor->size, min_pgsz,
+					    bufDescriptor->consumer_usage, bufDescriptor->producer_usage, shared_fd,
+					    bufDescriptor->hal_format, bufDescriptor->internal_format, bufDescriptor->alloc_format,
+					    bufDescriptor->width, bufDescriptor->height, bufDescriptor->pixel_stride,
+					    bufDescriptor->old_alloc_width, bufDescriptor->old_alloc_height,
+					    bufDescriptor->old_byte_stride, alloc_size, bufDescriptor->layer_count,
+					    bufDescriptor->plane_info);
+
+					if (NULL == hnd)
+					{
+						AERR("Private handle could not be created for descriptor:%d in shmem usecase", i);
+						close(shared_fd);
+						mali_gralloc_backend_free_internal(pHandle, i);
+						return -1;
+					}
+
+					pHandle[i] = hnd;
+					continue;
+				}
+
+				AWAR("Shared memory allocation failed, using %s backend", backend->name);
+			}
+
+			heap = pick_heap(heaps, usage);
+			if (heap == MALI_GRALLOC_HEAP_INVALID)
+			{
+				AERR("Failed to find an appropriate heap");
+				mali_gralloc_backend_free_internal(pHandle, i);
+				return -1;
+			}
+
+			shared_fd = alloc_from_heap(m, bufDescriptor, &heap, &min_pgsz);
+
+			if (shared_fd < 0)
+			{
+				AERR("%s allocation of %zu bytes failed", backend->name, bufDescriptor->size);
+
+				/* need to free already allocated memory. not just this one */
+				mali_gralloc_backend_free_internal(pHandle, i);
+
+				return -1;
+			}
+
+			private_handle_t *hnd = new private_handle_t(
+			    private_handle_t::PRIV_FLAGS_USES_ION | heap_priv_flags(heap), bufDescriptor->size, min_pgsz,
+			    bufDescriptor->consumer_usage, bufDescriptor->producer_usage, shared_fd, bufDescriptor->hal_format,
+			    bufDescriptor->internal_format, bufDescriptor->alloc_format,
+			    bufDescriptor->width, bufDescriptor->height, bufDescriptor->pixel_stride,
+			    bufDescriptor->old_alloc_width, bufDescriptor->old_alloc_height, bufDescriptor->old_byte_stride,
+			    bufDescriptor->size, bufDescriptor->layer_count, bufDescriptor->plane_info);
+
+			if (NULL == hnd)
+			{
+				AERR("Private handle could not be created for descriptor:%d in non-shared usecase", i);
+
+				/* Close the obtained shared file descriptor for the current handle */
+				backend->free(m, shared_fd);
+				mali_gralloc_backend_free_internal(pHandle, i);
+				return -1;
+			}
+
+			pHandle[i] = hnd;
+		}
+	}
+
+	for (i = 0; i < numDescriptors; i++)
+	{
+		buffer_descriptor_t *bufDescriptor = (buffer_descriptor_t *)(descriptors[i]);
+		private_handle_t *hnd = (private_handle_t *)(pHandle[i]);
+
+		usage = bufDescriptor->consumer_usage | bufDescriptor->producer_usage;
+
+		if (!(usage & GRALLOC_USAGE_PROTECTED))
+		{
+			if (hnd->flags & private_handle_t::PRIV_FLAGS_USES_SHMEM)
+			{
+				cpu_ptr = (unsigned char *)mali_gralloc_shmem_map(hnd->share_fd, mapping_size(hnd));
+			}
+			else
+			{
+				cpu_ptr = (unsigned char *)backend->map(m, hnd->share_fd, mapping_size(hnd));
+			}
+
+			if (MAP_FAILED == cpu_ptr)
+			{
+				AERR("%s mmap failed, fd ( %d )", backend->name, hnd->share_fd);
+				mali_gralloc_backend_free_internal(pHandle, numDescriptors);
+				return -1;
+			}
+
+#if GRALLOC_INIT_AFBC == 1
+			if ((bufDescriptor->internal_format & MALI_GRALLOC_INTFMT_AFBCENABLE_MASK) && (!(*shared_backend)))
+			{
+				/* For separated plane YUV, there is a header to initialise per plane. */
+				const plane_info_t *plane_info = bufDescriptor->plane_info;
+				const bool is_multi_plane = hnd->is_multi_plane();
+				for (int i = 0; i < MAX_PLANES && (i == 0 || plane_info[i].byte_stride != 0); i++)
+				{
+					init_afbc(cpu_ptr + plane_info[i].offset,
+					          bufDescriptor->internal_format,
+					          is_multi_plane,
+					          plane_info[i].alloc_width,
+					          plane_info[i].alloc_height);
+				}
+			}
+#endif
+			hnd->base = cpu_ptr;
+		}
+	}
+
+	return 0;
+}
+
+void mali_gralloc_backend_free(private_handle_t const *hnd)
+{
+	if (hnd->flags & private_handle_t::PRIV_FLAGS_FRAMEBUFFER)
+	{
+		return;
+	}
+	else if (hnd->flags & (private_handle_t::PRIV_FLAGS_USES_SHMEM | private_handle_t::PRIV_FLAGS_IMPORTED))
+	{
+		if (0 != hnd->base && 0 != munmap(mapping_base(hnd), mapping_size(hnd)))
+		{
+			AERR("Failed to munmap handle %p", hnd);
+		}
+
+		close(hnd->share_fd);
+		memset((void *)hnd, 0, sizeof(*hnd));
+	}
+	else if (hnd->flags & private_handle_t::PRIV_FLAGS_USES_ION)
+	{
+		mali_gralloc_module *m = get_module();
+
+		if (m == NULL)
+		{
+			AERR("Could not get gralloc module for handle: %p", hnd);
+			return;
+		}
+
+		/* Buffer might be unregistered already so we need to assure we have a valid handle*/
+		if (0 != hnd->base)
+		{
+			m->backend->unmap(m, mapping_base(hnd), mapping_size(hnd));
+		}
+
+		m->backend->free(m, hnd->share_fd);
+		memset((void *)hnd, 0, sizeof(*hnd));
+	}
+}
+
+/* Frees the first num_hnds handles of a failed allocation, which nothing else references yet. */
+static void mali_gralloc_backend_free_internal(buffer_handle_t *pHandle, uint32_t num_hnds)
+{
+	uint32_t i = 0;
+
+	for (i = 0; i < num_hnds; i++)
+	{
+		if (NULL != pHandle[i])
+		{
+			private_handle_t *hnd = (private_handle_t *)(pHandle[i]);
+
+			mali_gralloc_backend_free(hnd);
+			delete hnd;
+			pHandle[i] = NULL;
+		}
+	}
+
+	return;
+}
+
+int mali_gralloc_backend_dup(const private_handle_t *hnd)
+{
+	if (hnd->flags & private_handle_t::PRIV_FLAGS_USES_ION)
+	{
+		mali_gralloc_module *m = get_module();
+
+		if (m == NULL)
+		{
+			AERR("Could not get gralloc module for handle: %p", hnd);
+			return -1;
+		}
+
+		/* Some backends account for every fd of a buffer. */
+		return m->backend->dup(m, hnd->share_fd);
+	}
+
+	return fcntl(hnd->share_fd, F_DUPFD_CLOEXEC, 0);
+}
+
+void mali_gralloc_dmabuf_sync(const private_handle_t *hnd, bool start)
+{
+	struct gralloc_dma_buf_sync sync;
+
+	sync.flags = (start ? GRALLOC_DMA_BUF_SYNC_START : GRALLOC_DMA_BUF_SYNC_END) | GRALLOC_DMA_BUF_SYNC_READ |
+	             (hnd->writeOwner ? GRALLOC_DMA_BUF_SYNC_WRITE : 0);
+
+	/* Imported buffers needn't be dma-bufs (e.g. memfds), which have nothing to sync. */
+	if (ioctl(hnd->share_fd, GRALLOC_DMA_BUF_IOCTL_SYNC, &sync) < 0 && errno != ENOTTY)
+	{
+		AERR("DMA_BUF_IOCTL_SYNC on fd %d failed: %s", hnd->share_fd, strerror(errno));
+	}
+}
+
+void mali_gralloc_backend_sync_begin(const mali_gralloc_module *m, private_handle_t *hnd)
+{
+	if (hnd != NULL && (hnd->flags & private_handle_t::PRIV_FLAGS_IMPORTED))
+	{
+		mali_gralloc_dmabuf_sync(hnd, true);
+	}
+	else if (m != NULL && hnd != NULL && (hnd->flags & private_handle_t::PRIV_FLAGS_USES_ION))
+	{
+		m->backend->sync_begin(m, hnd);
+	}
+}
+
+void mali_gralloc_backend_sync_end(const mali_gralloc_module *m, private_handle_t *hnd)
+{
+	if (hnd != NULL && (hnd->flags & private_handle_t::PRIV_FLAGS_IMPORTED))
+	{
+		mali_gralloc_dmabuf_sync(hnd, false);
+	}
+	else if (m != NULL && hnd != NULL && (hnd->flags & private_handle_t::PRIV_FLAGS_USES_ION))
+	{
+		m->backend->sync_end(m, hnd);
+	}
+}
+
+int mali_gralloc_backend_map(private_handle_t *hnd)
+{
+	if (hnd->flags & (private_handle_t::PRIV_FLAGS_USES_SHMEM | private_handle_t::PRIV_FLAGS_IMPORTED))
+	{
+		void *mappedAddress;
+
+		if (hnd->flags & private_handle_t::PRIV_FLAGS_USES_SHMEM)
+		{
+			mappedAddress = mali_gralloc_shmem_map(hnd->share_fd, mapping_size(hnd));
+		}
+		else
+		{
+			mappedAddress = mmap(NULL, mapping_size(hnd), PROT_READ | PROT_WRITE, MAP_SHARED, hnd->share_fd, 0);
+		}
+
+		if (MAP_FAILED == mappedAddress)
+		{
+			AERR("mmap( share_fd:%d ) failed with %s", hnd->share_fd, strerror(errno));
+			return -errno;
+		}
+
+		hnd->base = (void *)(uintptr_t(mappedAddress) + hnd->offset);
+		return 0;
+	}
+
+	if (!(hnd->flags & private_handle_t::PRIV_FLAGS_USES_ION))
+	{
+		return -EINVAL;
+	}
+
+	mali_gralloc_module *m = get_module();
+
+	if (m == NULL)
+	{
+		AERR("Could not get gralloc module for handle: %p", hnd);
+		return -errno;
+	}
+
+	/* A second user process must open the backend before it can map the shared buffer. */
+	int status = m->backend->open(m);
+	if (status < 0)
+	{
+		return status;
+	}
+
+	unsigned char *mappedAddress = (unsigned char *)m->backend->map(m, hnd->share_fd, mapping_size(hnd));
+
+	if (MAP_FAILED == mappedAddress)
+	{
+		AERR("mmap( share_fd:%d ) failed with %s", hnd->share_fd, strerror(errno));
+		return -errno;
+	}
+
+	hnd->base = (void *)(uintptr_t(mappedAddress) + hnd->offset);
+
+	return 0;
+}
+
+void mali_gralloc_backend_unmap(private_handle_t *hnd)
+{
+	if (hnd->flags & (private_handle_t::PRIV_FLAGS_USES_SHMEM | private_handle_t::PRIV_FLAGS_IMPORTED))
+	{
+		if (munmap(mapping_base(hnd), mapping_size(hnd)) < 0)
+		{
+			AERR("Could not munmap base:%p size:%zd '%s'", mapping_base(hnd), mapping_size(hnd), strerror(errno));
+		}
+
+		return;
+	}
+
+	if (!(hnd->flags & private_handle_t::PRIV_FLAGS_USES_ION))
+	{
+		return;
+	}
+
+	mali_gralloc_module *m = get_module();
+
+	if (m == NULL)
+	{
+		AERR("Could not get gralloc module for handle: %p", hnd);
+		return;
+	}
+
+	m->backend->unmap(m, mapping_base(hnd), mapping_size(hnd));
+}
+
+int mali_gralloc_backend_device_close(struct hw_device_t *device)
+{
+#if GRALLOC_USE_GRALLOC1_API == 1
+	gralloc1_device_t *dev = reinterpret_cast<gralloc1_device_t *>(device);
+#else
+	alloc_device_t *dev = reinterpret_cast<alloc_device_t *>(device);
+#endif
+
+	if (dev)
+	{
+		private_module_t *m = reinterpret_cast<private_module_t *>(dev->common.module);
+
+		m->backend->close(m);
+
+		delete dev;
+	}
+
+	return 0;
+}
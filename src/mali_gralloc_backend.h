@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2018 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MALI_GRALLOC_BACKEND_H_
+#define MALI_GRALLOC_BACKEND_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mali_gralloc_module.h"
+#include "mali_gralloc_bufferdescriptor.h"
+
+struct private_handle_t;
+
+/* Heaps a backend can be asked to allocate from. */
+typedef enum
+{
+	MALI_GRALLOC_HEAP_INVALID = -1,
+	MALI_GRALLOC_HEAP_SYSTEM = 0,
+	MALI_GRALLOC_HEAP_DMA,
+	MALI_GRALLOC_HEAP_COMPOUND_PAGE,
+	MALI_GRALLOC_HEAP_SECURE,
+	MALI_GRALLOC_HEAP_FRAMEBUFFER,
+	MALI_GRALLOC_HEAP_COUNT
+} mali_gralloc_heap;
+
+#define MALI_GRALLOC_HEAP_MASK(heap) (1U << (heap))
+
+/* Allocation attributes */
+#define MALI_GRALLOC_HEAP_FLAG_CACHED (1U << 0)
+
+/*
+ * Backing store allocator. Exactly one backend is used by a module; it is
+ * picked when the module is constructed (see mali_gralloc_backend_select()).
+ *
+ * Backends only deal with file descriptors and mappings. Heap selection,
+ * fallback to the system heap and private handle creation are common and
+ * live in mali_gralloc_backend.cpp.
+ */
+struct mali_gralloc_backend
+{
+	const char *name;
+
+	/* Opens the backend and queries its heaps. Called before each use, so it must return 0 early once open. */
+	int (*open)(mali_gralloc_module *m);
+	void (*close)(mali_gralloc_module *m);
+
+	/* Returns a mask of MALI_GRALLOC_HEAP_MASK() bits for the heaps that exist. */
+	uint32_t (*query_heaps)(const mali_gralloc_module *m);
+
+	/* Allocates 'size' bytes from 'heap' without falling back. Returns a dma-buf style fd or -1. */
+	int (*allocate)(mali_gralloc_module *m, mali_gralloc_heap heap, uint32_t flags, size_t size);
+
+	/* Returns another fd to the same buffer, for handles sharing one allocation, or -1. */
+	int (*dup)(mali_gralloc_module *m, int fd);
+
+	/* Releases one fd returned by allocate() or dup(). */
+	void (*free)(mali_gralloc_module *m, int fd);
+
+	/* Maps the whole buffer. Returns MAP_FAILED and sets errno on failure. */
+	void *(*map)(mali_gralloc_module *m, int fd, size_t size);
+	void (*unmap)(mali_gralloc_module *m, void *addr, size_t size);
+
+	/* Cache maintenance around CPU access. */
+	void (*sync_begin)(const mali_gralloc_module *m, const private_handle_t *hnd);
+	void (*sync_end)(const mali_gralloc_module *m, const private_handle_t *hnd);
+};
+
+#if GRALLOC_ION_BACKEND == 1
+extern const struct mali_gralloc_backend mali_gralloc_backend_ion;
+#endif
+extern const struct mali_gralloc_backend mali_gralloc_backend_memfd;
+#if GRALLOC_DMA_HEAP_BACKEND == 1
+extern const struct mali_gralloc_backend mali_gralloc_backend_dma_heap;
+#endif
+
+/*
+ * Returns the backend named by the GRALLOC_ALLOC_BACKEND environment
+ * variable, or the build time default when it is unset or unknown. An ion
+ * default is replaced by dma_heap on kernels that have no ION device, and
+ * by the first backend built when ION isn't (GRALLOC_ION_BACKEND=0).
+ */
+const struct mali_gralloc_backend *mali_gralloc_backend_select(void);
+
+int mali_gralloc_backend_allocate(mali_gralloc_module *m, const gralloc_buffer_descriptor_t *descriptors,
+                                  uint32_t numDescriptors, buffer_handle_t *pHandle, bool *shared_backend);
+void mali_gralloc_backend_free(private_handle_t const *hnd);
+void mali_gralloc_backend_sync_begin(const mali_gralloc_module *m, private_handle_t *hnd);
+void mali_gralloc_backend_sync_end(const mali_gralloc_module *m, private_handle_t *hnd);
+int mali_gralloc_backend_map(private_handle_t *hnd);
+void mali_gralloc_backend_unmap(private_handle_t *hnd);
+
+/* Returns a new fd for the memory of a handle, or -1. */
+int mali_gralloc_backend_dup(const private_handle_t *hnd);
+int mali_gralloc_backend_device_close(struct hw_device_t *device);
+
+/* DMA_BUF_IOCTL_SYNC for CPU access to any dma-buf, reading and also writing when hnd->writeOwner is set. */
+void mali_gralloc_dmabuf_sync(const private_handle_t *hnd, bool start);
+
+#endif /* MALI_GRALLOC_BACKEND_H_ */
@@ -0,0 +1,323 @@
+/*
+ * Copyright (C) 2018 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Allocation backend for kernels which expose DMA-BUF heaps (/dev/dma_heap)
+ * instead of ION. Each gralloc heap is backed by the first device node found
+ * from a list of well known names. The name can be overridden with the
+ * GRALLOC_DMA_HEAP_<HEAP> environment variable, e.g. GRALLOC_DMA_HEAP_DMA=my_cma.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include <linux/dma-heap.h>
+
+#include <log/log.h>
+#include <cutils/atomic.h>
+#include <hardware/hardware.h>
+
+#if GRALLOC_USE_GRALLOC1_API == 1
+#include <hardware/gralloc1.h>
+#else
+#include <hardware/gralloc.h>
+#endif
+
+#include "mali_gralloc_module.h"
+#include "mali_gralloc_private_interface_types.h"
+#include "mali_gralloc_buffer.h"
+#include "gralloc_helper.h"
+#include "mali_gralloc_backend.h"
+
+#define DMA_HEAP_DEV_DIR "/dev/dma_heap"
+#define DMA_HEAP_MAX_NAMES 4
+
+struct dma_heap_names
+{
+	const char *env;
+	const char *names[DMA_HEAP_MAX_NAMES];
+};
+
+/*
+ * Candidate heap names, most preferred first. The uncached system heap is
+ * only used for allocations which don't ask for cached memory.
+ */
+static const dma_heap_names s_heap_names[MALI_GRALLOC_HEAP_COUNT] = {
+	{ "GRALLOC_DMA_HEAP_SYSTEM", { "system" } },
+	{ "GRALLOC_DMA_HEAP_DMA", { "reserved", "linux,cma", "default_cma_region" } },
+	{ "GRALLOC_DMA_HEAP_COMPOUND_PAGE", { NULL } },
+	{ "GRALLOC_DMA_HEAP_SECURE", { "protected", "secure" } },
+	{ "GRALLOC_DMA_HEAP_FRAMEBUFFER", { "framebuffer" } },
+};
+
+static const char *const s_uncached_heap_name = "system-uncached";
+
+struct dma_heap_state
+{
+	pthread_mutex_t lock;
+	bool opened;
+
+	/* Device fd for each gralloc heap, or -1 when it doesn't exist. */
+	int heap_fds[MALI_GRALLOC_HEAP_COUNT];
+	int uncached_fd;
+
+	dma_heap_state()
+	{
+		pthread_mutex_init(&lock, NULL);
+		opened = false;
+
+		for (int i = 0; i < MALI_GRALLOC_HEAP_COUNT; i++)
+		{
+			heap_fds[i] = -1;
+		}
+
+		uncached_fd = -1;
+	}
+};
+
+static dma_heap_state s_dma_heap;
+
+static int open_heap_dev(const char *name)
+{
+	char path[128];
+
+	snprintf(path, sizeof(path), DMA_HEAP_DEV_DIR "/%s", name);
+
+	return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+static int open_heap(mali_gralloc_heap heap)
+{
+	const dma_heap_names *candidates = &s_heap_names[heap];
+	const char *name = getenv(candidates->env);
+
+	if (name != NULL)
+	{
+		const int fd = open_heap_dev(name);
+
+		if (fd < 0)
+		{
+			AERR("Could not open DMA-BUF heap '%s' from %s: %s", name, candidates->env, strerror(errno));
+		}
+
+		return fd;
+	}
+
+	for (int i = 0; i < DMA_HEAP_MAX_NAMES && candidates->names[i] != NULL; i++)
+	{
+		const int fd = open_heap_dev(candidates->names[i]);
+
+		if (fd >= 0)
+		{
+			return fd;
+		}
+	}
+
+	return -1;
+}
+
+static void close_heaps_locked(void)
+{
+	for (int heap = 0; heap < MALI_GRALLOC_HEAP_COUNT; heap++)
+	{
+		if (s_dma_heap.heap_fds[heap] >= 0)
+		{
+			close(s_dma_heap.heap_fds[heap]);
+			s_dma_heap.heap_fds[heap] = -1;
+		}
+	}
+
+	if (s_dma_heap.uncached_fd >= 0)
+	{
+		close(s_dma_heap.uncached_fd);
+		s_dma_heap.uncached_fd = -1;
+	}
+
+	s_dma_heap.opened = false;
+}
+
+static int dma_heap_backend_open(mali_gralloc_module *m)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&s_dma_heap.lock);
+
+	if (!s_dma_heap.opened)
+	{
+		for (int heap = 0; heap < MALI_GRALLOC_HEAP_COUNT; heap++)
+		{
+			s_dma_heap.heap_fds[heap] = open_heap((mali_gralloc_heap)heap);
+		}
+
+		s_dma_heap.uncached_fd = open_heap_dev(s_uncached_heap_name);
+
+		if (s_dma_heap.heap_fds[MALI_GRALLOC_HEAP_SYSTEM] < 0)
+		{
+			AERR("No DMA-BUF system heap in " DMA_HEAP_DEV_DIR);
+			close_heaps_locked();
+			ret = -ENODEV;
+		}
+		else
+		{
+			s_dma_heap.opened = true;
+		}
+	}
+
+	m->secure_heap_exists = (s_dma_heap.heap_fds[MALI_GRALLOC_HEAP_SECURE] >= 0);
+
+	pthread_mutex_unlock(&s_dma_heap.lock);
+
+	return ret;
+}
+
+static void dma_heap_backend_close(mali_gralloc_module *m)
+{
+	GRALLOC_UNUSED(m);
+
+	pthread_mutex_lock(&s_dma_heap.lock);
+	close_heaps_locked();
+	pthread_mutex_unlock(&s_dma_heap.lock);
+}
+
+static uint32_t dma_heap_backend_query_heaps(const mali_gralloc_module *m)
+{
+	uint32_t heaps = 0;
+
+	GRALLOC_UNUSED(m);
+
+	pthread_mutex_lock(&s_dma_heap.lock);
+
+	for (int heap = 0; heap < MALI_GRALLOC_HEAP_COUNT; heap++)
+	{
+		if (s_dma_heap.heap_fds[heap] >= 0)
+		{
+			heaps |= MALI_GRALLOC_HEAP_MASK(heap);
+		}
+	}
+
+	pthread_mutex_unlock(&s_dma_heap.lock);
+
+	return heaps;
+}
+
+static int dma_heap_backend_allocate(mali_gralloc_module *m, mali_gralloc_heap heap, uint32_t flags, size_t size)
+{
+	GRALLOC_UNUSED(m);
+
+	if (heap < 0 || heap >= MALI_GRALLOC_HEAP_COUNT)
+	{
+		return -1;
+	}
+
+	pthread_mutex_lock(&s_dma_heap.lock);
+
+	int heap_fd = s_dma_heap.heap_fds[heap];
+
+	/* DMA-BUF heaps have no cache flags; uncached memory is a heap of its own. */
+	if (heap == MALI_GRALLOC_HEAP_SYSTEM && !(flags & MALI_GRALLOC_HEAP_FLAG_CACHED) && s_dma_heap.uncached_fd >= 0)
+	{
+		heap_fd = s_dma_heap.uncached_fd;
+	}
+
+	pthread_mutex_unlock(&s_dma_heap.lock);
+
+	if (heap_fd < 0)
+	{
+		return -1;
+	}
+
+	struct dma_heap_allocation_data data;
+	memset(&data, 0, sizeof(data));
+	data.len = size;
+	data.fd_flags = O_RDWR | O_CLOEXEC;
+	data.heap_flags = 0;
+
+	if (ioctl(heap_fd, DMA_HEAP_IOCTL_ALLOC, &data) < 0)
+	{
+		AERR("DMA_HEAP_IOCTL_ALLOC of %zu bytes from heap %d failed: %s", size, heap, strerror(errno));
+		return -1;
+	}
+
+	return (int)data.fd;
+}
+
+static int dma_heap_backend_dup(mali_gralloc_module *m, int fd)
+{
+	GRALLOC_UNUSED(m);
+
+	return dup(fd);
+}
+
+static void dma_heap_backend_free(mali_gralloc_module *m, int fd)
+{
+	GRALLOC_UNUSED(m);
+
+	close(fd);
+}
+
+static void *dma_heap_backend_map(mali_gralloc_module *m, int fd, size_t size)
+{
+	GRALLOC_UNUSED(m);
+
+	return mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+}
+
+static void dma_heap_backend_unmap(mali_gralloc_module *m, void *addr, size_t size)
+{
+	GRALLOC_UNUSED(m);
+
+	if (munmap(addr, size) < 0)
+	{
+		AERR("Could not munmap base:%p size:%zd '%s'", addr, size, strerror(errno));
+	}
+}
+
+static void dma_heap_backend_sync_begin(const mali_gralloc_module *m, const private_handle_t *hnd)
+{
+	GRALLOC_UNUSED(m);
+
+	mali_gralloc_dmabuf_sync(hnd, true);
+}
+
+static void dma_heap_backend_sync_end(const mali_gralloc_module *m, const private_handle_t *hnd)
+{
+	GRALLOC_UNUSED(m);
+
+	mali_gralloc_dmabuf_sync(hnd, false);
+}
+
+const struct mali_gralloc_backend mali_gralloc_backend_dma_heap = {
+	"dma_heap",
+	dma_heap_backend_open,
+	dma_heap_backend_close,
+	dma_heap_backend_query_heaps,
+	dma_heap_backend_allocate,
+	dma_heap_backend_dup,
+	dma_heap_backend_free,
+	dma_heap_backend_map,
+	dma_heap_backend_unmap,
+	dma_heap_backend_sync_begin,
+	dma_heap_backend_sync_end,
+};
@@ -0,0 +1,370 @@
+/*
+ * Copyright (C) 2018 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Allocation backend built on memfd, for running the allocation path on
+ * machines without ION (e.g. a Linux build host). It emulates the heaps of
+ * a device, including their capacity, and can inject failures. It is
+ * configured from the environment when first opened:
+ *
+ * GRALLOC_MEMFD_<HEAP>_SIZE   Capacity in bytes of a heap, where <HEAP> is
+ *                             SYSTEM, DMA, COMPOUND_PAGE, SECURE or
+ *                             FRAMEBUFFER. The system heap is unlimited
+ *                             by default; the other heaps don't exist
+ *                             unless given a size.
+ * GRALLOC_MEMFD_FAIL_ALLOC    Fail every Nth allocation.
+ * GRALLOC_MEMFD_FAIL_MAP      Fail every Nth mapping.
+ *
+ * Secure heap buffers can't be mapped, like protected memory on a device.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include <map>
+
+#include <log/log.h>
+#include <cutils/atomic.h>
+#include <hardware/hardware.h>
+
+#if GRALLOC_USE_GRALLOC1_API == 1
+#include <hardware/gralloc1.h>
+#else
+#include <hardware/gralloc.h>
+#endif
+
+#include "mali_gralloc_module.h"
+#include "mali_gralloc_private_interface_types.h"
+#include "mali_gralloc_buffer.h"
+#include "gralloc_helper.h"
+#include "mali_gralloc_backend.h"
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+struct memfd_heap
+{
+	const char *name;
+
+	/* 0 when the heap doesn't exist, SIZE_MAX when unlimited. */
+	size_t capacity;
+	size_t used;
+};
+
+/* One allocation, shared by every fd dup()ed from it. */
+struct memfd_buffer
+{
+	mali_gralloc_heap heap;
+	size_t size;
+	uint32_t refs;
+};
+
+struct memfd_state
+{
+	pthread_mutex_t lock;
+	bool opened;
+
+	memfd_heap heaps[MALI_GRALLOC_HEAP_COUNT];
+	uint32_t fail_alloc_interval;
+	uint32_t fail_map_interval;
+	uint32_t num_allocs;
+	uint32_t num_maps;
+
+	/* Keyed by inode, since fds of a buffer differ. */
+	std::map<ino_t, memfd_buffer> buffers;
+
+	memfd_state()
+	{
+		pthread_mutex_init(&lock, NULL);
+		opened = false;
+		memset(heaps, 0, sizeof(heaps));
+		fail_alloc_interval = 0;
+		fail_map_interval = 0;
+		num_allocs = 0;
+		num_maps = 0;
+	}
+};
+
+static memfd_state s_memfd;
+
+static const char *const s_heap_names[MALI_GRALLOC_HEAP_COUNT] = {
+	"SYSTEM", "DMA", "COMPOUND_PAGE", "SECURE", "FRAMEBUFFER",
+};
+
+static unsigned long long env_ull(const char *name, unsigned long long def)
+{
+	const char *value = getenv(name);
+
+	if (value == NULL || *value == '\0')
+	{
+		return def;
+	}
+
+	return strtoull(value, NULL, 0);
+}
+
+static ino_t memfd_inode(int fd)
+{
+	struct stat st;
+
+	if (fstat(fd, &st) != 0)
+	{
+		return 0;
+	}
+
+	return st.st_ino;
+}
+
+static int memfd_backend_open(mali_gralloc_module *m)
+{
+	pthread_mutex_lock(&s_memfd.lock);
+
+	if (!s_memfd.opened)
+	{
+		for (int heap = 0; heap < MALI_GRALLOC_HEAP_COUNT; heap++)
+		{
+			char name[64];
+
+			snprintf(name, sizeof(name), "GRALLOC_MEMFD_%s_SIZE", s_heap_names[heap]);
+
+			s_memfd.heaps[heap].name = s_heap_names[heap];
+			s_memfd.heaps[heap].capacity = (size_t)env_ull(name, (heap == MALI_GRALLOC_HEAP_SYSTEM) ? SIZE_MAX : 0);
+			s_memfd.heaps[heap].used = 0;
+		}
+
+		s_memfd.fail_alloc_interval = (uint32_t)env_ull("GRALLOC_MEMFD_FAIL_ALLOC", 0);
+		s_memfd.fail_map_interval = (uint32_t)env_ull("GRALLOC_MEMFD_FAIL_MAP", 0);
+		s_memfd.opened = true;
+
+		AINF("memfd backend: secure heap %zu bytes, failing every %u allocations and %u maps",
+		     s_memfd.heaps[MALI_GRALLOC_HEAP_SECURE].capacity, s_memfd.fail_alloc_interval,
+		     s_memfd.fail_map_interval);
+	}
+
+	m->secure_heap_exists = (s_memfd.heaps[MALI_GRALLOC_HEAP_SECURE].capacity != 0);
+
+	pthread_mutex_unlock(&s_memfd.lock);
+
+	return 0;
+}
+
+static void memfd_backend_close(mali_gralloc_module *m)
+{
+	GRALLOC_UNUSED(m);
+
+	pthread_mutex_lock(&s_memfd.lock);
+
+	if (!s_memfd.buffers.empty())
+	{
+		AWAR("memfd backend closed with %zu buffers outstanding", s_memfd.buffers.size());
+	}
+
+	pthread_mutex_unlock(&s_memfd.lock);
+}
+
+static uint32_t memfd_backend_query_heaps(const mali_gralloc_module *m)
+{
+	uint32_t heaps = 0;
+
+	GRALLOC_UNUSED(m);
+
+	pthread_mutex_lock(&s_memfd.lock);
+
+	for (int heap = 0; heap < MALI_GRALLOC_HEAP_COUNT; heap++)
+	{
+		if (s_memfd.heaps[heap].capacity != 0)
+		{
+			heaps |= MALI_GRALLOC_HEAP_MASK(heap);
+		}
+	}
+
+	pthread_mutex_unlock(&s_memfd.lock);
+
+	return heaps;
+}
+
+static int memfd_backend_allocate(mali_gralloc_module *m, mali_gralloc_heap heap, uint32_t flags, size_t size)
+{
+	GRALLOC_UNUSED(m);
+
+	if (heap < 0 || heap >= MALI_GRALLOC_HEAP_COUNT || (flags & ~MALI_GRALLOC_HEAP_FLAG_CACHED) != 0)
+	{
+		return -1;
+	}
+
+	pthread_mutex_lock(&s_memfd.lock);
+
+	memfd_heap *h = &s_memfd.heaps[heap];
+	s_memfd.num_allocs++;
+
+	if (s_memfd.fail_alloc_interval != 0 && (s_memfd.num_allocs % s_memfd.fail_alloc_interval) == 0)
+	{
+		AWAR("memfd backend: injected failure of allocation %u", s_memfd.num_allocs);
+		pthread_mutex_unlock(&s_memfd.lock);
+		return -1;
+	}
+
+	if (size > h->capacity - h->used)
+	{
+		ALOGV("memfd backend: %s heap can't fit %zu bytes (%zu of %zu used)", h->name, size, h->used, h->capacity);
+		pthread_mutex_unlock(&s_memfd.lock);
+		return -1;
+	}
+
+	char name[32];
+	snprintf(name, sizeof(name), "gralloc-%s", h->name);
+
+	int fd = syscall(__NR_memfd_create, name, MFD_CLOEXEC);
+	if (fd < 0)
+	{
+		AERR("memfd_create failed with %s", strerror(errno));
+		pthread_mutex_unlock(&s_memfd.lock);
+		return -1;
+	}
+
+	if (ftruncate(fd, size) != 0)
+	{
+		AERR("Could not size memfd to %zu bytes: %s", size, strerror(errno));
+		close(fd);
+		pthread_mutex_unlock(&s_memfd.lock);
+		return -1;
+	}
+
+	memfd_buffer buffer;
+	buffer.heap = heap;
+	buffer.size = size;
+	buffer.refs = 1;
+
+	s_memfd.buffers[memfd_inode(fd)] = buffer;
+	h->used += size;
+
+	pthread_mutex_unlock(&s_memfd.lock);
+
+	return fd;
+}
+
+static int memfd_backend_dup(mali_gralloc_module *m, int fd)
+{
+	GRALLOC_UNUSED(m);
+
+	const int new_fd = dup(fd);
+
+	if (new_fd >= 0)
+	{
+		pthread_mutex_lock(&s_memfd.lock);
+
+		std::map<ino_t, memfd_buffer>::iterator it = s_memfd.buffers.find(memfd_inode(fd));
+		if (it != s_memfd.buffers.end())
+		{
+			it->second.refs++;
+		}
+
+		pthread_mutex_unlock(&s_memfd.lock);
+	}
+
+	return new_fd;
+}
+
+static void memfd_backend_free(mali_gralloc_module *m, int fd)
+{
+	GRALLOC_UNUSED(m);
+
+	pthread_mutex_lock(&s_memfd.lock);
+
+	std::map<ino_t, memfd_buffer>::iterator it = s_memfd.buffers.find(memfd_inode(fd));
+	if (it != s_memfd.buffers.end() && --it->second.refs == 0)
+	{
+		s_memfd.heaps[it->second.heap].used -= it->second.size;
+		s_memfd.buffers.erase(it);
+	}
+
+	pthread_mutex_unlock(&s_memfd.lock);
+
+	close(fd);
+}
+
+static void *memfd_backend_map(mali_gralloc_module *m, int fd, size_t size)
+{
+	GRALLOC_UNUSED(m);
+
+	pthread_mutex_lock(&s_memfd.lock);
+
+	s_memfd.num_maps++;
+
+	if (s_memfd.fail_map_interval != 0 && (s_memfd.num_maps % s_memfd.fail_map_interval) == 0)
+	{
+		AWAR("memfd backend: injected failure of map %u", s_memfd.num_maps);
+		pthread_mutex_unlock(&s_memfd.lock);
+		errno = ENOMEM;
+		return MAP_FAILED;
+	}
+
+	/* Buffers imported from another process aren't in the table, so they are mappable. */
+	std::map<ino_t, memfd_buffer>::iterator it = s_memfd.buffers.find(memfd_inode(fd));
+	if (it != s_memfd.buffers.end() && it->second.heap == MALI_GRALLOC_HEAP_SECURE)
+	{
+		pthread_mutex_unlock(&s_memfd.lock);
+		errno = EPERM;
+		return MAP_FAILED;
+	}
+
+	pthread_mutex_unlock(&s_memfd.lock);
+
+	return mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+}
+
+static void memfd_backend_unmap(mali_gralloc_module *m, void *addr, size_t size)
+{
+	GRALLOC_UNUSED(m);
+
+	if (munmap(addr, size) < 0)
+	{
+		AERR("Could not munmap base:%p size:%zd '%s'", addr, size, strerror(errno));
+	}
+}
+
+/* memfd memory is coherent, there are no caches to maintain. */
+static void memfd_backend_sync(const mali_gralloc_module *m, const private_handle_t *hnd)
+{
+	GRALLOC_UNUSED(m);
+	GRALLOC_UNUSED(hnd);
+}
+
+const struct mali_gralloc_backend mali_gralloc_backend_memfd = {
+	"memfd",
+	memfd_backend_open,
+	memfd_backend_close,
+	memfd_backend_query_heaps,
+	memfd_backend_allocate,
+	memfd_backend_dup,
+	memfd_backend_free,
+	memfd_backend_map,
+	memfd_backend_unmap,
+	memfd_backend_sync,
+	memfd_backend_sync,
+};
@@ -18,6 +18,7 @@
 #ifndef MALI_GRALLOC_BUFFER_H_
 #define MALI_GRALLOC_BUFFER_H_
 
+#include <stddef.h>
 #include <stdint.h>
 #include <unistd.h>
 #include <errno.h>
@@ -46,13 +47,33 @@ struct fb_dmabuf_export
  * 8 is big enough for "gpu0" & "fb0" currently
  */
 #define MALI_GRALLOC_HARDWARE_MAX_STR_LEN 8
+
+/* Number of framebuffer ring buffers (2 for double, 3 or 4 for deeper flip queues) */
+#if defined(GRALLOC_FB_NUM_BUFFERS) && GRALLOC_FB_NUM_BUFFERS >= 2 && GRALLOC_FB_NUM_BUFFERS <= 4
+#define NUM_FB_BUFFERS GRALLOC_FB_NUM_BUFFERS
+#else
 #define NUM_FB_BUFFERS 2
+#endif
 
 /* Define number of shared file descriptors */
 #define GRALLOC_ARM_NUM_FDS 2
 
 #define NUM_INTS_IN_PRIVATE_HANDLE ((sizeof(struct private_handle_t) - sizeof(native_handle)) / sizeof(int) - sNumFds)
 
+/*
+ * With GRALLOC_COMPACT_HANDLE=1 the members which only mean something in the
+ * process holding the handle come last, and the handles gralloc creates end
+ * before them: binder and parcels only copy numInts ints. See
+ * mali_gralloc_reference_get() for where an importing process keeps them.
+ *
+ * The compact layout is fixed at compile time. Nothing in the handle records
+ * it beyond numInts, so every process sharing handles must be built with the
+ * same GRALLOC_COMPACT_HANDLE and private_handle_t.
+ */
+#if GRALLOC_COMPACT_HANDLE == 1
+#define NUM_INTS_IN_PRIVATE_HANDLE_COMPACT (private_handle_t::compactNumInts())
+#endif
+
 #define SZ_4K 0x00001000
 #define SZ_2M 0x00200000
 
@@ -111,8 +132,68 @@ typedef struct plane_info {
 	uint32_t alloc_height;
 } plane_info_t;
 
+/*
+ * Maximum number of CPU access planes (flex components).
+ * RGBA formats describe four components, YUV formats three.
+ */
+#define MAX_CPU_ACCESS_PLANES 4
+
+/*
+ * Per-component CPU access layout. Offsets are relative to the start of
+ * the allocation so that the description remains valid across processes
+ * and only needs rebasing onto the locally mapped address at lock time.
+ */
+typedef struct cpu_access_plane {
+
+	/* Offset (in bytes) to the first sample of the component. */
+	uint32_t offset;
+
+	/* Flex component (android_flex_component_t). */
+	uint32_t component;
+
+	/* Index into plane_info[] providing the vertical increment (byte stride). */
+	uint8_t plane;
+	uint8_t bits_per_component;
+	uint8_t bits_used;
+	uint8_t h_increment;
+	uint8_t h_subsampling;
+	uint8_t v_subsampling;
+	uint8_t reserved[2];
+} cpu_access_plane_t;
+
+/*
+ * CPU access description, precomputed once per buffer from alloc_format and
+ * plane_info. Planes are stored in flex component order (Y/Cb/Cr or R/G/B/A).
+ *
+ * valid:       Description has been computed for this buffer.
+ * ycbcr:       Buffer can be described by android_ycbcr.
+ * num_planes:  Number of flex planes. Zero when not representable as flex.
+ * flex_format: Flex format (android_flex_format_t).
+ */
+typedef struct cpu_access_info {
+	uint8_t valid;
+	uint8_t ycbcr;
+	uint8_t num_planes;
+	uint8_t reserved;
+	uint32_t flex_format;
+	cpu_access_plane_t planes[MAX_CPU_ACCESS_PLANES];
+} cpu_access_info_t;
+
 struct private_handle_t;
 
+#if GRALLOC_COMPACT_HANDLE == 1 && defined(GRALLOC_LIBRARY_BUILD)
+/*
+ * Handles this process creates, see mali_gralloc_reference.cpp. Whoever
+ * creates a handle to hand out adds it; the destructor removes it.
+ */
+void mali_gralloc_reference_add_local(struct private_handle_t *hnd);
+void mali_gralloc_reference_remove_local(const struct private_handle_t *hnd);
+#endif
+
+#if GRALLOC_OBJECT_SLAB == 1 && defined(GRALLOC_LIBRARY_BUILD)
+#include "mali_gralloc_slab.h"
+#endif
+
 #ifndef __cplusplus
 /* C99 with pedantic don't allow anonymous unions which is used in below struct
  * Disable pedantic for C for this struct only.
@@ -136,8 +217,15 @@ struct private_handle_t
 	{
 		PRIV_FLAGS_FRAMEBUFFER = 0x00000001,
 		PRIV_FLAGS_USES_ION_COMPOUND_HEAP = 0x00000002,
+		/* Backing store comes from the allocation backend, whichever it is. */
 		PRIV_FLAGS_USES_ION = 0x00000004,
-		PRIV_FLAGS_USES_ION_DMA_HEAP = 0x00000008
+		PRIV_FLAGS_USES_ION_DMA_HEAP = 0x00000008,
+		/* CPU-only buffer backed by a sealed memfd, see mali_gralloc_shmem.h. */
+		PRIV_FLAGS_USES_SHMEM = 0x00000010,
+		/* dma-buf allocated outside gralloc and wrapped without copying. */
+		PRIV_FLAGS_IMPORTED = 0x00000020,
+		/* Layer or rectangle of another buffer, starting 'offset' bytes into its memory. */
+		PRIV_FLAGS_VIEW = 0x00000040
 	};
 
 	enum
@@ -188,12 +276,16 @@ struct private_handle_t
 	 * incorrectly populated by gralloc or the meaning has slightly changed.
 	 *
 	 * NOTE: 'stride' values sometimes vary significantly from plane_info[0].alloc_width.
+	 *
+	 * Compact handles only keep 'stride', see the end of the structure.
 	 */
+#if GRALLOC_COMPACT_HANDLE == 0
 	uint64_t internal_format;
 	int stride;
 	int byte_stride;
 	int internalWidth;
 	int internalHeight;
+#endif
 
 	/*
 	 * Allocation properties.
@@ -215,6 +307,7 @@ struct private_handle_t
 	uint32_t layer_count;
 
 
+#if GRALLOC_COMPACT_HANDLE == 0
 	union
 	{
 		void *base;
@@ -224,10 +317,14 @@ struct private_handle_t
 		void*    pbase;
 		uint64_t padding_pbase;
 	};
+#endif
 	uint64_t backing_store_id;
 	int backing_store_size;
+#if GRALLOC_COMPACT_HANDLE == 0
 	int writeOwner;
+#endif
 	int allocating_pid;
+#if GRALLOC_COMPACT_HANDLE == 0
 	int remote_pid;
 	int ref_count;
 	// locally mapped shared attribute area
@@ -236,11 +333,17 @@ struct private_handle_t
 		void *attr_base;
 		uint64_t padding3;
 	};
+#endif
 
 	mali_gralloc_yuv_info yuv_info;
 
-	// Following members is for framebuffer only
+#if GRALLOC_COMPACT_HANDLE == 0
+	// Following members is for framebuffer only, except 'offset' which views also use
 	int fd;
+#else
+	/* The pixel stride clients were given, which plane_info doesn't always have. */
+	int stride;
+#endif
 	union
 	{
 		off_t offset;
@@ -253,6 +356,32 @@ struct private_handle_t
 	 * if not sure buff's real phys_page size, you can use SZ_4K for safe.
 	 */
 	int min_pgsz;
+
+#if GRALLOC_COMPACT_HANDLE == 1
+	/*
+	 * Process-local members, past the end of compact handles. A process
+	 * retaining a compact handle of another process keeps them in a local
+	 * copy, where the deprecated members are derived from plane_info.
+	 */
+	int writeOwner;
+	int remote_pid;
+	int ref_count;
+	int fd;
+	void *base;
+	void *pbase;
+	void *attr_base;
+	uint64_t internal_format;
+	int byte_stride;
+	int internalWidth;
+	int internalHeight;
+#endif
+
+	/*
+	 * CPU access layout used by lock_ycbcr()/lock_flex(). See cpu_access_info_t.
+	 * Process-local: each process computes it when it creates or retains the
+	 * handle, and never uses one received from another process.
+	 */
+	cpu_access_info_t cpu_access;
 #ifdef __cplusplus
 	/*
 	 * We track the number of integers in the structure. There are 16 unconditional
@@ -275,26 +404,27 @@ struct private_handle_t
 	    , height(0)
 	    , producer_usage(_producer_usage)
 	    , consumer_usage(_consumer_usage)
-	    , stride(0)
 	    , alloc_format(_alloc_format)
 	    , size(_size)
 	    , layer_count(0)
-	    , base(_base)
 	    , backing_store_id(0x0)
 	    , backing_store_size(0)
-	    , writeOwner(0)
 	    , allocating_pid(getpid())
-	    , remote_pid(-1)
-	    , ref_count(1)
-	    , attr_base(MAP_FAILED)
 	    , yuv_info(MALI_YUV_NO_INFO)
-	    , fd(fb_file)
 	    , offset(fb_offset)
 	{
 		version = sizeof(native_handle);
 		numFds = sNumFds;
-		numInts = NUM_INTS_IN_PRIVATE_HANDLE;
+		stride = 0;
+		base = _base;
+		writeOwner = 0;
+		remote_pid = -1;
+		ref_count = 1;
+		attr_base = MAP_FAILED;
+		fd = fb_file;
+		initNumInts();
 		memset(plane_info, 0, sizeof(plane_info_t) * MAX_PLANES);
+		memset(&cpu_access, 0, sizeof(cpu_access));
 
 		plane_info[0].offset = fb_offset;
 		plane_info[0].byte_stride = _byte_stride;
@@ -315,38 +445,75 @@ struct private_handle_t
 	    , req_format(_req_format)
 	    , producer_usage(_producer_usage)
 	    , consumer_usage(_consumer_usage)
-	    , internal_format(_internal_format)
-	    , stride(_stride)
-	    , byte_stride(_byte_stride)
-	    , internalWidth(_internal_width)
-	    , internalHeight(_internal_height)
 	    , alloc_format(_alloc_format)
 	    , size(_size)
 	    , layer_count(_layer_count)
-	    , base(NULL)
 	    , backing_store_id(0x0)
 	    , backing_store_size(_backing_store_size)
-	    , writeOwner(0)
 	    , allocating_pid(getpid())
-	    , remote_pid(-1)
-	    , ref_count(1)
-	    , attr_base(MAP_FAILED)
 	    , yuv_info(MALI_YUV_NO_INFO)
-	    , fd(-1)
 	    , offset(0)
 	    , min_pgsz(_min_pgsz)
 	{
 		version = sizeof(native_handle);
 		numFds = sNumFds;
-		numInts = NUM_INTS_IN_PRIVATE_HANDLE;
+		internal_format = _internal_format;
+		stride = _stride;
+		byte_stride = _byte_stride;
+		internalWidth = _internal_width;
+		internalHeight = _internal_height;
+		base = NULL;
+		writeOwner = 0;
+		remote_pid = -1;
+		ref_count = 1;
+		attr_base = MAP_FAILED;
+		fd = -1;
+		initNumInts();
 		memcpy(plane_info, _plane_info, sizeof(plane_info_t) * MAX_PLANES);
+		memset(&cpu_access, 0, sizeof(cpu_access));
 	}
 
 	~private_handle_t()
 	{
+#if GRALLOC_COMPACT_HANDLE == 1 && defined(GRALLOC_LIBRARY_BUILD)
+		mali_gralloc_reference_remove_local(this);
+#endif
 		magic = 0;
 	}
 
+#if GRALLOC_OBJECT_SLAB == 1 && defined(GRALLOC_LIBRARY_BUILD)
+	/* A handle is created for every allocation, and import of a compact handle. */
+	static void *operator new(size_t size) noexcept
+	{
+		return mali_gralloc_slab_alloc(MALI_GRALLOC_SLAB_HANDLE, size);
+	}
+
+	static void operator delete(void *ptr)
+	{
+		mali_gralloc_slab_free(ptr);
+	}
+#endif
+
+#if GRALLOC_COMPACT_HANDLE == 1
+	/* Ints up to the process-local members, after the fds. */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Winvalid-offsetof"
+	static int compactNumInts()
+	{
+		return (int)((offsetof(private_handle_t, writeOwner) - sizeof(native_handle)) / sizeof(int)) - sNumFds;
+	}
+#pragma GCC diagnostic pop
+#endif
+
+	void initNumInts()
+	{
+#if GRALLOC_COMPACT_HANDLE == 1
+		numInts = NUM_INTS_IN_PRIVATE_HANDLE_COMPACT;
+#else
+		numInts = NUM_INTS_IN_PRIVATE_HANDLE;
+#endif
+	}
+
 	bool usesPhysicallyContiguousMemory()
 	{
 		return (flags & PRIV_FLAGS_FRAMEBUFFER) ? true : false;
@@ -356,8 +523,22 @@ struct private_handle_t
 	{
 		const private_handle_t *hnd = (const private_handle_t *)h;
 
-		if (!h || h->version != sizeof(native_handle) || h->numInts != NUM_INTS_IN_PRIVATE_HANDLE ||
-		    h->numFds != sNumFds || hnd->magic != sMagic)
+		if (!h || h->version != sizeof(native_handle) || h->numFds != sNumFds)
+		{
+			return -EINVAL;
+		}
+
+#if GRALLOC_COMPACT_HANDLE == 1
+		/* Handles carrying their process-local members are accepted as well. */
+		if (h->numInts != NUM_INTS_IN_PRIVATE_HANDLE && h->numInts != NUM_INTS_IN_PRIVATE_HANDLE_COMPACT)
+#else
+		if (h->numInts != NUM_INTS_IN_PRIVATE_HANDLE)
+#endif
+		{
+			return -EINVAL;
+		}
+
+		if (hnd->magic != sMagic)
 		{
 			return -EINVAL;
 		}
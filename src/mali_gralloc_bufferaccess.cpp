@@ -18,8 +18,15 @@
 #include <errno.h>
 #include <inttypes.h>
 #include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sync/sync.h>
 
+#include <algorithm>
+#include <map>
+#include <vector>
+
 #if GRALLOC_USE_GRALLOC1_API == 1
 #include <hardware/gralloc1.h>
 #else
@@ -31,14 +38,565 @@
 #include "mali_gralloc_buffer.h"
 #include "mali_gralloc_formats.h"
 #include "mali_gralloc_usages.h"
-#include "mali_gralloc_ion.h"
+#include "mali_gralloc_backend.h"
+#include "mali_gralloc_reference.h"
 #include "gralloc_helper.h"
 #include "format_info.h"
+#include "mali_gralloc_cache_policy.h"
+#include "mali_gralloc_trace.h"
 
 #if GRALLOC_USE_LEGACY_LOCK == 1
 #include "legacy/buffer_access.h"
 #endif
 
+/*
+ * Static description of a single flex component.
+ *
+ * plane:       Index of the allocation plane holding the component.
+ * byte_offset: Offset (in bytes) of the first component sample within the plane.
+ */
+typedef struct
+{
+	uint32_t component;
+	uint8_t plane;
+	uint8_t byte_offset;
+	uint8_t bits_per_component;
+	uint8_t bits_used;
+	uint8_t h_increment;
+	uint8_t h_subsampling;
+	uint8_t v_subsampling;
+} cpu_access_desc_plane_t;
+
+/*
+ * Static description of CPU access layout for a base format. Components
+ * are listed in flex component order (Y/Cb/Cr or R/G/B/A).
+ */
+typedef struct
+{
+	uint64_t id;
+	uint32_t flex_format;
+	bool ycbcr;
+	cpu_access_desc_plane_t planes[MAX_CPU_ACCESS_PLANES];
+} cpu_access_desc_t;
+
+static const cpu_access_desc_t cpu_access_descs[] = {
+	/* Y only */
+	{ MALI_GRALLOC_FORMAT_INTERNAL_Y8, FLEX_FORMAT_Y, true,
+	  { { FLEX_COMPONENT_Y, 0, 0, 8, 8, 1, 1, 1 } } },
+	{ MALI_GRALLOC_FORMAT_INTERNAL_Y16, FLEX_FORMAT_Y, true,
+	  { { FLEX_COMPONENT_Y, 0, 0, 16, 16, 2, 1, 1 } } },
+
+	/* Y:UV 4:2:0 */
+	{ MALI_GRALLOC_FORMAT_INTERNAL_NV12, FLEX_FORMAT_YCbCr, true,
+	  { { FLEX_COMPONENT_Y,  0, 0, 8, 8, 1, 1, 1 },
+	    { FLEX_COMPONENT_Cb, 1, 0, 8, 8, 2, 2, 2 },
+	    { FLEX_COMPONENT_Cr, 1, 1, 8, 8, 2, 2, 2 } } },
+
+	/* Y:VU 4:2:0 */
+	{ HAL_PIXEL_FORMAT_YCrCb_420_SP, FLEX_FORMAT_YCbCr, true,
+	  { { FLEX_COMPONENT_Y,  0, 0, 8, 8, 1, 1, 1 },
+	    { FLEX_COMPONENT_Cb, 1, 1, 8, 8, 2, 2, 2 },
+	    { FLEX_COMPONENT_Cr, 1, 0, 8, 8, 2, 2, 2 } } },
+	{ MALI_GRALLOC_FORMAT_INTERNAL_NV21, FLEX_FORMAT_YCbCr, true,
+	  { { FLEX_COMPONENT_Y,  0, 0, 8, 8, 1, 1, 1 },
+	    { FLEX_COMPONENT_Cb, 1, 1, 8, 8, 2, 2, 2 },
+	    { FLEX_COMPONENT_Cr, 1, 0, 8, 8, 2, 2, 2 } } },
+
+	/* Y:V:U 4:2:0 */
+	{ MALI_GRALLOC_FORMAT_INTERNAL_YV12, FLEX_FORMAT_YCbCr, true,
+	  { { FLEX_COMPONENT_Y,  0, 0, 8, 8, 1, 1, 1 },
+	    { FLEX_COMPONENT_Cb, 2, 0, 8, 8, 1, 2, 2 },
+	    { FLEX_COMPONENT_Cr, 1, 0, 8, 8, 1, 2, 2 } } },
+
+	/* Y:UV 4:2:0, 10-bit */
+	{ MALI_GRALLOC_FORMAT_INTERNAL_P010, FLEX_FORMAT_YCbCr, false,
+	  { { FLEX_COMPONENT_Y,  0, 0, 16, 10, 2, 1, 1 },
+	    { FLEX_COMPONENT_Cb, 1, 0, 16, 10, 4, 2, 2 },
+	    { FLEX_COMPONENT_Cr, 1, 2, 16, 10, 4, 2, 2 } } },
+
+	/* Y:UV 4:2:2, 10-bit */
+	{ MALI_GRALLOC_FORMAT_INTERNAL_P210, FLEX_FORMAT_YCbCr, false,
+	  { { FLEX_COMPONENT_Y,  0, 0, 16, 10, 2, 1, 1 },
+	    { FLEX_COMPONENT_Cb, 1, 0, 16, 10, 4, 2, 1 },
+	    { FLEX_COMPONENT_Cr, 1, 2, 16, 10, 4, 2, 1 } } },
+
+	/* YUYV 4:2:2 */
+	{ HAL_PIXEL_FORMAT_YCbCr_422_I, FLEX_FORMAT_YCbCr, false,
+	  { { FLEX_COMPONENT_Y,  0, 0, 8, 8, 2, 1, 1 },
+	    { FLEX_COMPONENT_Cb, 0, 1, 8, 8, 4, 2, 1 },
+	    { FLEX_COMPONENT_Cr, 0, 3, 8, 8, 4, 2, 1 } } },
+
+	/* Y:UV 4:2:2 */
+	{ HAL_PIXEL_FORMAT_YCbCr_422_SP, FLEX_FORMAT_YCbCr, false,
+	  { { FLEX_COMPONENT_Y,  0, 0, 8, 8, 1, 1, 1 },
+	    { FLEX_COMPONENT_Cb, 1, 0, 8, 8, 2, 2, 1 },
+	    { FLEX_COMPONENT_Cr, 1, 1, 8, 8, 2, 2, 1 } } },
+
+	/* YUYV 4:2:2, 10-bit */
+	{ MALI_GRALLOC_FORMAT_INTERNAL_Y210, FLEX_FORMAT_YCbCr, false,
+	  { { FLEX_COMPONENT_Y,  0, 0, 16, 10, 4, 1, 1 },
+	    { FLEX_COMPONENT_Cb, 0, 2, 16, 10, 8, 2, 1 },
+	    { FLEX_COMPONENT_Cr, 0, 6, 16, 10, 8, 2, 1 } } },
+
+#if PLATFORM_SDK_VERSION >= 26
+	/* 64-bit format that has 16-bit R, G, B, and A components, in that order */
+	{ MALI_GRALLOC_FORMAT_INTERNAL_RGBA_16161616, FLEX_FORMAT_RGBA, false,
+	  { { FLEX_COMPONENT_R, 0, 0, 16, 16, 8, 1, 1 },
+	    { FLEX_COMPONENT_G, 0, 2, 16, 16, 8, 1, 1 },
+	    { FLEX_COMPONENT_B, 0, 4, 16, 16, 8, 1, 1 },
+	    { FLEX_COMPONENT_A, 0, 6, 16, 16, 8, 1, 1 } } },
+#endif
+
+	/* 32-bit format that has 8-bit R, G, B, and A components, in that order */
+	{ MALI_GRALLOC_FORMAT_INTERNAL_RGBA_8888, FLEX_FORMAT_RGBA, false,
+	  { { FLEX_COMPONENT_R, 0, 0, 8, 8, 4, 1, 1 },
+	    { FLEX_COMPONENT_G, 0, 1, 8, 8, 4, 1, 1 },
+	    { FLEX_COMPONENT_B, 0, 2, 8, 8, 4, 1, 1 },
+	    { FLEX_COMPONENT_A, 0, 3, 8, 8, 4, 1, 1 } } },
+
+	/* 32-bit format that has 8-bit R, G, B, and unused components, in that order */
+	{ MALI_GRALLOC_FORMAT_INTERNAL_RGBX_8888, FLEX_FORMAT_RGB, false,
+	  { { FLEX_COMPONENT_R, 0, 0, 8, 8, 4, 1, 1 },
+	    { FLEX_COMPONENT_G, 0, 1, 8, 8, 4, 1, 1 },
+	    { FLEX_COMPONENT_B, 0, 2, 8, 8, 4, 1, 1 } } },
+
+	/* 24-bit format that has 8-bit R, G, and B components, in that order */
+	{ MALI_GRALLOC_FORMAT_INTERNAL_RGB_888, FLEX_FORMAT_RGB, false,
+	  { { FLEX_COMPONENT_R, 0, 0, 8, 8, 3, 1, 1 },
+	    { FLEX_COMPONENT_G, 0, 1, 8, 8, 3, 1, 1 },
+	    { FLEX_COMPONENT_B, 0, 2, 8, 8, 3, 1, 1 } } },
+
+	/* 32-bit format that has 8-bit B, G, R, and A components, in that order.
+	 * The flex format plane order must still follow FLEX_FORMAT_RGBA order.
+	 */
+	{ MALI_GRALLOC_FORMAT_INTERNAL_BGRA_8888, FLEX_FORMAT_RGBA, false,
+	  { { FLEX_COMPONENT_R, 0, 2, 8, 8, 4, 1, 1 },
+	    { FLEX_COMPONENT_G, 0, 1, 8, 8, 4, 1, 1 },
+	    { FLEX_COMPONENT_B, 0, 0, 8, 8, 4, 1, 1 },
+	    { FLEX_COMPONENT_A, 0, 3, 8, 8, 4, 1, 1 } } },
+};
+
+/*
+ *  Computes the CPU access layout of a buffer from its allocation format and
+ *  plane information.
+ *
+ * @param hnd      [in]  Buffer handle.
+ * @param info     [out] Layout of the buffer.
+ */
+static void cpu_access_compute(const private_handle_t * const hnd, cpu_access_info_t * const info)
+{
+	const uint64_t base_format = hnd->alloc_format & MALI_GRALLOC_INTFMT_FMT_MASK;
+
+	memset(info, 0, sizeof(*info));
+	info->valid = 1;
+
+	/*
+	 * AFBC (compressed) buffers can't be accessed through CPU layouts. Block-linear
+	 * buffers are, through a linear copy with the same plane layout.
+	 */
+	if ((hnd->alloc_format & MALI_GRALLOC_INTFMT_AFBCENABLE_MASK) != 0)
+	{
+		return;
+	}
+
+	const int32_t format_idx = get_format_index(base_format);
+	if (format_idx == -1 || formats[format_idx].flex != true)
+	{
+		return;
+	}
+
+	for (size_t i = 0; i < sizeof(cpu_access_descs) / sizeof(cpu_access_descs[0]); i++)
+	{
+		const cpu_access_desc_t * const desc = &cpu_access_descs[i];
+		if (desc->id != base_format)
+		{
+			continue;
+		}
+
+		info->ycbcr = desc->ycbcr;
+		info->flex_format = desc->flex_format;
+		info->num_planes = formats[format_idx].ncmp;
+
+		for (uint8_t pl = 0; pl < info->num_planes && pl < MAX_CPU_ACCESS_PLANES; pl++)
+		{
+			cpu_access_plane_t * const plane = &info->planes[pl];
+
+			/* The first plane always starts at the mapped base address. */
+			plane->offset = desc->planes[pl].byte_offset;
+			if (desc->planes[pl].plane != 0)
+			{
+				plane->offset += hnd->plane_info[desc->planes[pl].plane].offset;
+			}
+
+			plane->component = desc->planes[pl].component;
+			plane->plane = desc->planes[pl].plane;
+			plane->bits_per_component = desc->planes[pl].bits_per_component;
+			plane->bits_used = desc->planes[pl].bits_used;
+			plane->h_increment = desc->planes[pl].h_increment;
+			plane->h_subsampling = desc->planes[pl].h_subsampling;
+			plane->v_subsampling = desc->planes[pl].v_subsampling;
+		}
+
+		return;
+	}
+}
+
+/*
+ *  Stores the CPU access layout in a handle, so that lock requests only need
+ *  to rebase it onto the mapped address. Called when a buffer is created, and
+ *  when a process retains a handle from another one, before any other thread
+ *  of the process can use it.
+ *
+ * @param hnd      [in/out] Buffer handle to populate.
+ */
+void mali_gralloc_cpu_access_init(private_handle_t * const hnd)
+{
+	cpu_access_compute(hnd, &hnd->cpu_access);
+}
+
+/*
+ * GRALLOC_CPU_ACCESS_CACHE=0 ignores the stored layouts and describes the
+ * buffer on every lock, as before layouts were stored, to compare the two.
+ */
+static pthread_once_t s_cpu_access_once = PTHREAD_ONCE_INIT;
+static bool s_cpu_access_cached = true;
+
+static void cpu_access_cache_init(void)
+{
+	const char *value = getenv("GRALLOC_CPU_ACCESS_CACHE");
+
+	if (value != NULL && strcmp(value, "0") == 0)
+	{
+		s_cpu_access_cached = false;
+	}
+}
+
+/*
+ *  Returns the CPU access layout of a buffer. Handles the allocator didn't
+ *  populate (e.g. framebuffer handles or ones from an older gralloc) are
+ *  shared, so their layout is computed into 'scratch' instead. So is a
+ *  layout which would index planes the handle doesn't have.
+ */
+static inline const cpu_access_info_t *get_cpu_access_info(const private_handle_t * const hnd,
+                                                           cpu_access_info_t * const scratch)
+{
+	const cpu_access_info_t * const info = &hnd->cpu_access;
+
+	pthread_once(&s_cpu_access_once, cpu_access_cache_init);
+
+	bool valid = s_cpu_access_cached && info->valid && info->num_planes <= MAX_CPU_ACCESS_PLANES;
+
+	for (uint8_t i = 0; valid && i < info->num_planes; i++)
+	{
+		valid = info->planes[i].plane < MAX_PLANES;
+	}
+
+	if (valid)
+	{
+		return info;
+	}
+
+	cpu_access_compute(hnd, scratch);
+	return scratch;
+}
+
+/* Region of a buffer (in pixels). */
+typedef struct
+{
+	int l;
+	int t;
+	int w;
+	int h;
+} block_linear_region_t;
+
+/*
+ * Lock of a block-linear buffer: the locking thread, which normally also
+ * unlocks, and whether the lock uses the linear copy.
+ */
+typedef struct
+{
+	pthread_t thread;
+	bool copied;
+} block_linear_lock_t;
+
+/*
+ * Locks of a block-linear buffer, and the linear copy of it which is shared
+ * by those locked for CPU usage. The copy has the plane offsets and byte
+ * strides of the buffer, so CPU access layouts describe both.
+ *
+ * linear: The copy, which only holds the blocks covering the region. NULL
+ *         while no lock uses it.
+ * region: Region copied on lock.
+ * write:  Locked for writing, so the region is copied back on unlock.
+ * locks:  Outstanding locks, with or without the copy.
+ */
+typedef struct
+{
+	uint8_t *linear;
+	block_linear_region_t region;
+	bool write;
+	std::vector<block_linear_lock_t> locks;
+} block_linear_copy_t;
+
+static pthread_mutex_t s_block_linear_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::map<const private_handle_t *, block_linear_copy_t> s_block_linear_copies;
+
+/*
+ *  Copies the blocks covering a region between a block-linear buffer and
+ *  its linear copy.
+ *
+ * @param hnd      [in]    Block-linear buffer.
+ * @param tiled    [in]    Mapped address of the buffer.
+ * @param linear   [in]    Linear copy.
+ * @param region   [in]    Region to copy.
+ * @param skip     [in]    Region whose blocks are left alone, or NULL.
+ * @param detile   [in]    Copy from the buffer to the linear copy when true,
+ *                         the other way otherwise.
+ */
+static void block_linear_copy_region(const private_handle_t * const hnd, uint8_t * const tiled,
+                                     uint8_t * const linear, const block_linear_region_t * const region,
+                                     const block_linear_region_t * const skip, const bool detile)
+{
+	const uint32_t block = MALI_GRALLOC_BLOCK_LINEAR_SIZE;
+	const format_info_t * const format = &formats[get_format_index(hnd->alloc_format & MALI_GRALLOC_INTFMT_FMT_MASK)];
+
+	for (uint8_t p = 0; p < format->npln; p++)
+	{
+		/* Chroma planes are subsampled, the first plane has every sample. */
+		const uint32_t hsub = (p == 0) ? 1 : format->hsub;
+		const uint32_t vsub = (p == 0) ? 1 : format->vsub;
+		const uint32_t stride = hnd->plane_info[p].byte_stride;
+		const uint32_t row_bytes = (block * format->bpp[p]) / 8;
+		const uint32_t block_bytes = row_bytes * block;
+
+		/* Blocks covering the region, in samples of this plane. */
+		const uint32_t x_begin = (region->l / hsub) / block;
+		const uint32_t x_end = GRALLOC_ALIGN((region->l + region->w + hsub - 1) / hsub, block) / block;
+		const uint32_t y_begin = ((region->t / vsub) / block) * block;
+		const uint32_t y_end = GRALLOC_ALIGN((region->t + region->h + vsub - 1) / vsub, block);
+
+		/* Blocks covering the skipped region, an empty range when there is none. */
+		uint32_t skip_x_begin = 0, skip_x_end = 0, skip_y_begin = 0, skip_y_end = 0;
+		if (skip != NULL)
+		{
+			skip_x_begin = (skip->l / hsub) / block;
+			skip_x_end = GRALLOC_ALIGN((skip->l + skip->w + hsub - 1) / hsub, block) / block;
+			skip_y_begin = ((skip->t / vsub) / block) * block;
+			skip_y_end = GRALLOC_ALIGN((skip->t + skip->h + vsub - 1) / vsub, block);
+		}
+
+		uint8_t * const tiled_plane = tiled + hnd->plane_info[p].offset;
+		uint8_t * const linear_plane = linear + hnd->plane_info[p].offset;
+
+		for (uint32_t y = y_begin; y < y_end; y++)
+		{
+			const bool skip_row = (y >= skip_y_begin && y < skip_y_end);
+			uint8_t *tiled_row = tiled_plane + (y / block) * stride * block + (y % block) * row_bytes +
+			                     x_begin * block_bytes;
+			uint8_t *linear_row = linear_plane + y * stride + x_begin * row_bytes;
+
+			for (uint32_t x = x_begin; x < x_end; x++)
+			{
+				if (skip_row && x >= skip_x_begin && x < skip_x_end)
+				{
+					/* Already in the copy, and possibly being written by its lockers. */
+				}
+				else if (detile)
+				{
+					memcpy(linear_row, tiled_row, row_bytes);
+				}
+				else
+				{
+					memcpy(tiled_row, linear_row, row_bytes);
+				}
+
+				tiled_row += block_bytes;
+				linear_row += row_bytes;
+			}
+		}
+	}
+}
+
+/*
+ *  Returns the address through which the CPU accesses a locked buffer, and
+ *  is called once for every successful lock, matched by unlock_cpu_address().
+ *  The address is the mapping, except for block-linear buffers locked for CPU
+ *  usage, which get a linear copy of the region. Locks of those buffers
+ *  without CPU usage take no copy but are recorded, so that their unlock
+ *  doesn't end the use of the copy by another lock. A region of zero size is
+ *  the whole buffer.
+ *
+ * @return The address, or NULL when no copy could be made.
+ */
+static uint8_t *lock_cpu_address(private_handle_t * const hnd, const uint64_t usage,
+                                 int l, int t, int w, int h)
+{
+#if GRALLOC_ADAPTIVE_CACHE == 1
+	mali_gralloc_cache_policy_lock(hnd, usage, w, h);
+#endif
+
+	if ((hnd->alloc_format & MALI_GRALLOC_INTFMT_BLOCK_LINEAR) == 0)
+	{
+		return (uint8_t *)hnd->base;
+	}
+
+	block_linear_lock_t lock;
+	lock.thread = pthread_self();
+	lock.copied = (usage & (GRALLOC_USAGE_SW_READ_MASK | GRALLOC_USAGE_SW_WRITE_MASK)) != 0;
+
+	if (w == 0 || h == 0)
+	{
+		l = t = 0;
+		w = hnd->width;
+		h = hnd->height;
+	}
+
+	const block_linear_region_t region = { l, t, w, h };
+
+	pthread_mutex_lock(&s_block_linear_lock);
+
+	block_linear_copy_t * const copy = &s_block_linear_copies[hnd];
+
+	if (!lock.copied)
+	{
+		copy->locks.push_back(lock);
+		pthread_mutex_unlock(&s_block_linear_lock);
+		return (uint8_t *)hnd->base;
+	}
+
+	if (copy->linear != NULL)
+	{
+		/*
+		 * Concurrent locks share a copy. When the region grows, only the
+		 * blocks which are new to the copy are read from the buffer; the
+		 * others may be being written by the other lockers.
+		 */
+		const block_linear_region_t old_region = copy->region;
+
+		if (l < old_region.l || t < old_region.t || l + w > old_region.l + old_region.w ||
+		    t + h > old_region.t + old_region.h)
+		{
+			const int right = std::max(l + w, old_region.l + old_region.w);
+			const int bottom = std::max(t + h, old_region.t + old_region.h);
+			copy->region.l = std::min(l, old_region.l);
+			copy->region.t = std::min(t, old_region.t);
+			copy->region.w = right - copy->region.l;
+			copy->region.h = bottom - copy->region.t;
+
+			block_linear_copy_region(hnd, (uint8_t *)hnd->base, copy->linear, &copy->region, &old_region, true);
+		}
+
+		copy->locks.push_back(lock);
+		copy->write = copy->write || (usage & GRALLOC_USAGE_SW_WRITE_MASK);
+
+		uint8_t * const linear = copy->linear;
+		pthread_mutex_unlock(&s_block_linear_lock);
+		return linear;
+	}
+
+	/* Whole rows of blocks for every plane. */
+	size_t size = 0;
+	for (uint8_t p = 0; p < MAX_PLANES && hnd->plane_info[p].byte_stride != 0; p++)
+	{
+		const size_t plane_end = hnd->plane_info[p].offset + (size_t)hnd->plane_info[p].byte_stride *
+		                         GRALLOC_ALIGN(hnd->plane_info[p].alloc_height, MALI_GRALLOC_BLOCK_LINEAR_SIZE);
+		if (plane_end > size)
+		{
+			size = plane_end;
+		}
+	}
+
+	copy->linear = (uint8_t *)malloc(size);
+
+	if (copy->linear == NULL)
+	{
+		AERR("Failed to allocate a %zu byte linear copy of block-linear buffer %p", size, hnd);
+
+		if (copy->locks.empty())
+		{
+			s_block_linear_copies.erase(hnd);
+		}
+
+		pthread_mutex_unlock(&s_block_linear_lock);
+		return NULL;
+	}
+
+	copy->region = region;
+	copy->write = usage & GRALLOC_USAGE_SW_WRITE_MASK;
+	copy->locks.push_back(lock);
+
+	block_linear_copy_region(hnd, (uint8_t *)hnd->base, copy->linear, &copy->region, NULL, true);
+
+	uint8_t * const linear = copy->linear;
+	pthread_mutex_unlock(&s_block_linear_lock);
+
+	return linear;
+}
+
+/*
+ *  Ends CPU access through the address returned by lock_cpu_address(). The
+ *  latest lock of the calling thread is ended, or the latest lock at all when
+ *  the thread holds none. Once no lock uses the linear copy any more, it is
+ *  written back to the buffer if it was locked for writing.
+ */
+static void unlock_cpu_address(private_handle_t * const hnd)
+{
+	if ((hnd->alloc_format & MALI_GRALLOC_INTFMT_BLOCK_LINEAR) == 0)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&s_block_linear_lock);
+
+	std::map<const private_handle_t *, block_linear_copy_t>::iterator it = s_block_linear_copies.find(hnd);
+	if (it == s_block_linear_copies.end() || it->second.locks.empty())
+	{
+		pthread_mutex_unlock(&s_block_linear_lock);
+		return;
+	}
+
+	block_linear_copy_t * const copy = &it->second;
+	const pthread_t self = pthread_self();
+	size_t index = copy->locks.size() - 1;
+
+	for (size_t i = copy->locks.size(); i-- > 0;)
+	{
+		if (pthread_equal(copy->locks[i].thread, self))
+		{
+			index = i;
+			break;
+		}
+	}
+
+	const bool copied = copy->locks[index].copied;
+	copy->locks.erase(copy->locks.begin() + index);
+
+	bool copy_used = false;
+	for (size_t i = 0; i < copy->locks.size(); i++)
+	{
+		copy_used = copy_used || copy->locks[i].copied;
+	}
+
+	if (copied && !copy_used && copy->linear != NULL)
+	{
+		if (copy->write)
+		{
+			block_linear_copy_region(hnd, (uint8_t *)hnd->base, copy->linear, &copy->region, NULL, false);
+		}
+
+		free(copy->linear);
+		copy->linear = NULL;
+		copy->write = false;
+	}
+
+	if (copy->locks.empty())
+	{
+		s_block_linear_copies.erase(it);
+	}
+
+	pthread_mutex_unlock(&s_block_linear_lock);
+}
+
 #if GRALLOC_USE_LEGACY_LOCK != 1
 /*
  *  Validates input parameters of lock request.
@@ -91,12 +649,14 @@ int validate_lock_input_parameters(const buffer_handle_t buffer, const int l,
 	 * will have a valid buffer virtual address if it is the allocating
 	 * process or it retained / registered a cloned buffer handle
 	 */
-	if ((hnd->allocating_pid == lock_pid) || (hnd->remote_pid == lock_pid))
+	const private_handle_t * const local = mali_gralloc_reference_get(buffer);
+
+	if (local != NULL && ((local->allocating_pid == lock_pid) || (local->remote_pid == lock_pid)))
 	{
 		is_registered_process = true;
 	}
 
-	if ((is_registered_process == false) || (hnd->base == NULL))
+	if ((is_registered_process == false) || (local->base == NULL))
 	{
 #if GRALLOC_USE_GRALLOC1_API != 1
 		AERR("The buffer must be registered before lock request");
@@ -107,7 +667,7 @@ int validate_lock_input_parameters(const buffer_handle_t buffer, const int l,
 	}
 
 	/* Reject lock requests for AFBC (compressed format) enabled buffers */
-	if ((hnd->alloc_format & MALI_GRALLOC_INTFMT_EXT_MASK) != 0)
+	if ((hnd->alloc_format & MALI_GRALLOC_INTFMT_AFBCENABLE_MASK) != 0)
 	{
 		AERR("Lock is not supported for AFBC enabled buffers."
 		     "Internal Format:0x%" PRIx64, hnd->alloc_format);
@@ -161,8 +721,8 @@ int validate_lock_input_parameters(const buffer_handle_t buffer, const int l,
  * @Note:  Locking a buffer simultaneously for write or read/write leaves the
  *         buffer's content in an indeterminate state.
  */
-int mali_gralloc_lock(const mali_gralloc_module * const m, buffer_handle_t buffer,
-                      uint64_t usage, int l, int t, int w, int h, void **vaddr)
+static int lock_buffer(const mali_gralloc_module * const m, buffer_handle_t buffer,
+                       uint64_t usage, int l, int t, int w, int h, void **vaddr)
 {
 	/* Legacy support for old buffer size/stride calculations. */
 #if GRALLOC_USE_LEGACY_LOCK == 1
@@ -192,7 +752,7 @@ int mali_gralloc_lock(const mali_gralloc_module * const m, buffer_handle_t buffe
 	GRALLOC_UNUSED(h);
 #endif
 
-	private_handle_t *hnd = (private_handle_t *)buffer;
+	private_handle_t *hnd = mali_gralloc_reference_get(buffer);
 
 #if GRALLOC_USE_LEGACY_LOCK != 1
 	/* HAL_PIXEL_FORMAT_YCbCr_*_888 buffers 'must' be locked with lock_ycbcr() */
@@ -227,9 +787,10 @@ int mali_gralloc_lock(const mali_gralloc_module * const m, buffer_handle_t buffe
 #endif
 	}
 
-	if (hnd->flags & private_handle_t::PRIV_FLAGS_USES_ION)
+	if (hnd->flags & (private_handle_t::PRIV_FLAGS_USES_ION | private_handle_t::PRIV_FLAGS_IMPORTED))
 	{
 		hnd->writeOwner = usage & GRALLOC_USAGE_SW_WRITE_MASK;
+		mali_gralloc_backend_sync_begin(m, hnd);
 	}
 
 	/* Populate CPU-accessible pointer when requested for CPU usage */
@@ -240,12 +801,35 @@ int mali_gralloc_lock(const mali_gralloc_module * const m, buffer_handle_t buffe
 			hnd->writeOwner = 0;
 			return -EINVAL;
 		}
-		*vaddr = (void *)hnd->base;
+
+		*vaddr = (void *)lock_cpu_address(hnd, usage, l, t, w, h);
+		if (*vaddr == NULL)
+		{
+			hnd->writeOwner = 0;
+			return -ENOMEM;
+		}
+	}
+	else
+	{
+		/* No copy is taken, but the lock is recorded for the unlock. */
+		lock_cpu_address(hnd, usage, l, t, w, h);
 	}
 
 	return 0;
 }
 
+int mali_gralloc_lock(const mali_gralloc_module * const m, buffer_handle_t buffer,
+                      uint64_t usage, int l, int t, int w, int h, void **vaddr)
+{
+	const int ret = lock_buffer(m, buffer, usage, l, t, w, h, vaddr);
+
+#if GRALLOC_ALLOC_TRACE == 1
+	mali_gralloc_trace_lock((const private_handle_t *)buffer, usage, l, t, w, h, false, ret);
+#endif
+
+	return ret;
+}
+
 /*
  *  Locks the given ycbcr buffer for the specified CPU usage. This function can
  *  only be used for buffers with "8 bit sample depth"
@@ -270,10 +854,10 @@ int mali_gralloc_lock(const mali_gralloc_module * const m, buffer_handle_t buffe
  *         buffer's content in an indeterminate state.
  *
  */
-int mali_gralloc_lock_ycbcr(const mali_gralloc_module *m,
-                            const buffer_handle_t buffer,
-                            const uint64_t usage, const int l, const int t,
-                            const int w, const int h, android_ycbcr *ycbcr)
+static int lock_buffer_ycbcr(const mali_gralloc_module *m,
+                             const buffer_handle_t buffer,
+                             const uint64_t usage, const int l, const int t,
+                             const int w, const int h, android_ycbcr *ycbcr)
 {
 	/* Legacy support for old buffer size/stride calculations. */
 #if GRALLOC_USE_LEGACY_LOCK == 1
@@ -289,8 +873,7 @@ int mali_gralloc_lock_ycbcr(const mali_gralloc_module *m,
 		return -EINVAL;
 	}
 
-	private_handle_t * const hnd = (private_handle_t *)buffer;
-	const uint64_t base_format = hnd->alloc_format & MALI_GRALLOC_INTFMT_FMT_MASK;
+	private_handle_t * const hnd = mali_gralloc_reference_get(buffer);
 
 #if GRALLOC_USE_LEGACY_LOCK != 1
 	/* Validate input parameters for lock request */
@@ -300,7 +883,7 @@ int mali_gralloc_lock_ycbcr(const mali_gralloc_module *m,
 		return status;
 	}
 
-	const int32_t format_idx = get_format_index(base_format);
+	const int32_t format_idx = get_format_index(hnd->alloc_format & MALI_GRALLOC_INTFMT_FMT_MASK);
 	if (format_idx == -1)
 	{
 		AERR("Corrupted buffer format 0x%" PRIx64 " of buffer %p", hnd->alloc_format, hnd);
@@ -319,9 +902,10 @@ int mali_gralloc_lock_ycbcr(const mali_gralloc_module *m,
 	GRALLOC_UNUSED(h);
 #endif
 
-	if (hnd->flags & private_handle_t::PRIV_FLAGS_USES_ION)
+	if (hnd->flags & (private_handle_t::PRIV_FLAGS_USES_ION | private_handle_t::PRIV_FLAGS_IMPORTED))
 	{
 		hnd->writeOwner = usage & GRALLOC_USAGE_SW_WRITE_MASK;
+		mali_gralloc_backend_sync_begin(m, hnd);
 	}
 
 	if (usage & (GRALLOC_USAGE_SW_READ_MASK | GRALLOC_USAGE_SW_WRITE_MASK))
@@ -331,53 +915,46 @@ int mali_gralloc_lock_ycbcr(const mali_gralloc_module *m,
 			return -EINVAL;
 		}
 
-		ycbcr->y = (char *)hnd->base;
-		ycbcr->ystride = hnd->plane_info[0].byte_stride;
+		cpu_access_info_t scratch;
+		const cpu_access_info_t * const info = get_cpu_access_info(hnd, &scratch);
+		if (!info->ycbcr)
+		{
+			AERR("Buffer:%p of format %" PRIx64 "can't be represented in"
+			     " android_ycbcr format", hnd, hnd->alloc_format);
+			return -EINVAL;
+		}
+
+		char * const base = (char *)lock_cpu_address(hnd, usage, l, t, w, h);
+		if (base == NULL)
+		{
+			hnd->writeOwner = 0;
+			return -ENOMEM;
+		}
+
+		ycbcr->y = base + info->planes[0].offset;
+		ycbcr->ystride = hnd->plane_info[info->planes[0].plane].byte_stride;
 
-		switch (base_format)
+		if (info->num_planes > 1)
+		{
+			ycbcr->cb = base + info->planes[1].offset;
+			ycbcr->cr = base + info->planes[2].offset;
+			ycbcr->cstride = hnd->plane_info[info->planes[1].plane].byte_stride;
+			ycbcr->chroma_step = info->planes[1].h_increment;
+		}
+		else
 		{
-		case MALI_GRALLOC_FORMAT_INTERNAL_Y8:
-		case MALI_GRALLOC_FORMAT_INTERNAL_Y16:
 			/* No UV plane */
 			ycbcr->cstride = 0;
 			ycbcr->cb = NULL;
 			ycbcr->cr = NULL;
 			ycbcr->chroma_step = 0;
-		break;
-
-		case MALI_GRALLOC_FORMAT_INTERNAL_NV12:
-			/* UV plane */
-			ycbcr->cstride = hnd->plane_info[1].byte_stride;
-			ycbcr->cb = (char *)hnd->base + hnd->plane_info[1].offset;
-			ycbcr->cr = (char *)ycbcr->cb + 1;
-			ycbcr->chroma_step = 2;
-			break;
-
-		case HAL_PIXEL_FORMAT_YCrCb_420_SP:
-		case MALI_GRALLOC_FORMAT_INTERNAL_NV21:
-			/* VU plane */
-			ycbcr->cstride = hnd->plane_info[1].byte_stride;
-			ycbcr->cr = (char *)hnd->base + hnd->plane_info[1].offset;
-			ycbcr->cb = (char *)ycbcr->cr + 1;
-			ycbcr->chroma_step = 2;
-			break;
-
-		case MALI_GRALLOC_FORMAT_INTERNAL_YV12:
-			/* V plane, U plane */
-			ycbcr->cstride = hnd->plane_info[1].byte_stride;
-			ycbcr->cr = (char *)hnd->base + hnd->plane_info[1].offset;
-			ycbcr->cb = (char *)hnd->base + hnd->plane_info[2].offset;
-			ycbcr->chroma_step = 1;
-			break;
-
-		default:
-			AERR("Buffer:%p of format %" PRIx64 "can't be represented in"
-			     " android_ycbcr format", hnd, hnd->alloc_format);
-			return -EINVAL;
 		}
 	}
 	else
 	{
+		/* No copy is taken, but the lock is recorded for the unlock. */
+		lock_cpu_address(hnd, usage, l, t, w, h);
+
 		ycbcr->y = NULL;
 		ycbcr->cb = NULL;
 		ycbcr->cr = NULL;
@@ -392,6 +969,20 @@ int mali_gralloc_lock_ycbcr(const mali_gralloc_module *m,
 	return 0;
 }
 
+int mali_gralloc_lock_ycbcr(const mali_gralloc_module *m,
+                            const buffer_handle_t buffer,
+                            const uint64_t usage, const int l, const int t,
+                            const int w, const int h, android_ycbcr *ycbcr)
+{
+	const int ret = lock_buffer_ycbcr(m, buffer, usage, l, t, w, h, ycbcr);
+
+#if GRALLOC_ALLOC_TRACE == 1
+	mali_gralloc_trace_lock((const private_handle_t *)buffer, usage, l, t, w, h, true, ret);
+#endif
+
+	return ret;
+}
+
 /*
  *  Unlocks the given buffer.
  *
@@ -408,6 +999,10 @@ int mali_gralloc_lock_ycbcr(const mali_gralloc_module *m,
  */
 int mali_gralloc_unlock(const mali_gralloc_module *m, buffer_handle_t buffer)
 {
+#if GRALLOC_ALLOC_TRACE == 1
+	mali_gralloc_trace_unlock((const private_handle_t *)buffer);
+#endif
+
 	/* Legacy support for old buffer size/stride calculations. */
 #if GRALLOC_USE_LEGACY_LOCK == 1
 	return legacy::mali_gralloc_unlock(m, buffer);
@@ -419,11 +1014,19 @@ int mali_gralloc_unlock(const mali_gralloc_module *m, buffer_handle_t buffer)
 		return -EINVAL;
 	}
 
-	private_handle_t *hnd = (private_handle_t *)buffer;
+	private_handle_t *hnd = mali_gralloc_reference_get(buffer);
 
-	if (hnd->flags & private_handle_t::PRIV_FLAGS_USES_ION && hnd->writeOwner)
+	if (hnd == NULL)
 	{
-		mali_gralloc_ion_sync(m, hnd);
+		AERR("Unlocking buffer %p which isn't retained, returning error", buffer);
+		return -EINVAL;
+	}
+
+	unlock_cpu_address(hnd);
+
+	if ((hnd->flags & (private_handle_t::PRIV_FLAGS_USES_ION | private_handle_t::PRIV_FLAGS_IMPORTED)) && hnd->writeOwner)
+	{
+		mali_gralloc_backend_sync_end(m, hnd);
 	}
 
 	return 0;
@@ -456,7 +1059,7 @@ int mali_gralloc_get_num_flex_planes(const mali_gralloc_module *const m,
 	const uint64_t base_format = hnd->alloc_format & MALI_GRALLOC_INTFMT_FMT_MASK;
 
 #if GRALLOC_USE_LEGACY_LOCK != 1
-	if ((hnd->alloc_format & MALI_GRALLOC_INTFMT_EXT_MASK) != 0)
+	if ((hnd->alloc_format & MALI_GRALLOC_INTFMT_AFBCENABLE_MASK) != 0)
 	{
 		AERR("AFBC enabled buffers can't be represented in flex layout."
 		     "Internal Format:%" PRIx64, hnd->alloc_format);
@@ -615,12 +1218,12 @@ static void set_flex_plane_params(uint8_t * const top_left,
  * @return 0, when the locking is successful;
  *         Appropriate error, otherwise
  */
-int mali_gralloc_lock_flex_async(const mali_gralloc_module *m,
-                                 const buffer_handle_t buffer,
-                                 const uint64_t usage, const int l, const int t,
-                                 const int w, const  int h,
-                                 struct android_flex_layout * const flex_layout,
-                                 const int32_t fence_fd)
+static int lock_buffer_flex_async(const mali_gralloc_module *m,
+                                  const buffer_handle_t buffer,
+                                  const uint64_t usage, const int l, const int t,
+                                  const int w, const  int h,
+                                  struct android_flex_layout * const flex_layout,
+                                  const int32_t fence_fd)
 {
 	/* Legacy support for old buffer size/stride calculations. */
 #if GRALLOC_USE_LEGACY_LOCK == 1
@@ -635,8 +1238,7 @@ int mali_gralloc_lock_flex_async(const mali_gralloc_module *m,
 		close(fence_fd);
 	}
 
-	private_handle_t * const hnd = (private_handle_t *)buffer;
-	const uint64_t base_format = hnd->alloc_format & MALI_GRALLOC_INTFMT_FMT_MASK;
+	private_handle_t * const hnd = mali_gralloc_reference_get(buffer);
 
 #if GRALLOC_USE_LEGACY_LOCK != 1
 	/* Validate input parameters for lock request */
@@ -652,277 +1254,60 @@ int mali_gralloc_lock_flex_async(const mali_gralloc_module *m,
 	GRALLOC_UNUSED(h);
 #endif
 
-	if (hnd->flags & private_handle_t::PRIV_FLAGS_USES_ION)
+	if (hnd->flags & (private_handle_t::PRIV_FLAGS_USES_ION | private_handle_t::PRIV_FLAGS_IMPORTED))
 	{
 		hnd->writeOwner = usage & GRALLOC_USAGE_SW_WRITE_MASK;
+		mali_gralloc_backend_sync_begin(m, hnd);
 	}
 
-	const int32_t format_idx = get_format_index(base_format);
-	if (format_idx == -1)
-	{
-		AERR("Corrupted buffer format 0x%" PRIx64 " of buffer %p", hnd->alloc_format, hnd);
-		return -EINVAL;
-	}
-
-	if (formats[format_idx].flex != true)
+	cpu_access_info_t scratch;
+	const cpu_access_info_t * const info = get_cpu_access_info(hnd, &scratch);
+	if (info->num_planes == 0)
 	{
 		AERR("Format %" PRIx64 " of %p can't be represented in flex", hnd->alloc_format, hnd);
 		return GRALLOC1_ERROR_UNSUPPORTED;
 	}
 
-	flex_layout->num_planes = formats[format_idx].ncmp;
-	switch (base_format)
-	{
-	case MALI_GRALLOC_FORMAT_INTERNAL_Y8:
-		flex_layout->format = FLEX_FORMAT_Y;
-		set_flex_plane_params((uint8_t *)hnd->base, FLEX_COMPONENT_Y, 8, 8, 1,
-		                      hnd->plane_info[0].byte_stride, 1, 1,
-		                      &flex_layout->planes[0]);
-		break;
-
-	case MALI_GRALLOC_FORMAT_INTERNAL_Y16:
-		flex_layout->format = FLEX_FORMAT_Y;
-		set_flex_plane_params((uint8_t *)hnd->base, FLEX_COMPONENT_Y, 16, 16, 2,
-		                      hnd->plane_info[0].byte_stride, 1, 1,
-		                      &flex_layout->planes[0]);
-		break;
-
-	case MALI_GRALLOC_FORMAT_INTERNAL_NV12:
-		/* Y:UV 4:2:0 */
-		flex_layout->format = FLEX_FORMAT_YCbCr;
-
-		set_flex_plane_params((uint8_t *)hnd->base, FLEX_COMPONENT_Y, 8, 8, 1,
-		                      hnd->plane_info[0].byte_stride, 1, 1,
-		                      &flex_layout->planes[0]);
-		set_flex_plane_params((uint8_t *)hnd->base + hnd->plane_info[1].offset,
-		                      FLEX_COMPONENT_Cb, 8, 8, 2,
-		                      hnd->plane_info[1].byte_stride, 2, 2,
-		                      &flex_layout->planes[1]);
-		set_flex_plane_params((uint8_t *)hnd->base + hnd->plane_info[1].offset + 1,
-		                      FLEX_COMPONENT_Cr, 8, 8, 2,
-		                      hnd->plane_info[1].byte_stride, 2, 2,
-		                      &flex_layout->planes[2]);
-		break;
-
-	case HAL_PIXEL_FORMAT_YCrCb_420_SP:
-	case MALI_GRALLOC_FORMAT_INTERNAL_NV21:
-		/* Y:VU 4:2:0 ordering. The flex format plane order must still
-		 * follow YCbCr order (as defined by 'android_flex_component_t').
-		 */
-		flex_layout->format = FLEX_FORMAT_YCbCr;
-
-		set_flex_plane_params((uint8_t *)hnd->base, FLEX_COMPONENT_Y, 8, 8, 1,
-		                      hnd->plane_info[0].byte_stride, 1, 1,
-		                      &flex_layout->planes[0]);
-		set_flex_plane_params((uint8_t *)hnd->base + hnd->plane_info[1].offset + 1,
-		                      FLEX_COMPONENT_Cb, 8, 8, 2,
-		                      hnd->plane_info[1].byte_stride, 2, 2,
-		                      &flex_layout->planes[1]);
-		set_flex_plane_params((uint8_t *)hnd->base + hnd->plane_info[1].offset,
-		                      FLEX_COMPONENT_Cr, 8, 8, 2,
-		                      hnd->plane_info[1].byte_stride, 2, 2,
-		                      &flex_layout->planes[2]);
-		break;
-
-	case MALI_GRALLOC_FORMAT_INTERNAL_YV12:
-		/* Y:V:U 4:2:0 . The flex format plane order must still follow YCbCr
-		 * order (as defined by 'android_flex_component_t').
-		 */
-		flex_layout->format = FLEX_FORMAT_YCbCr;
-
-		set_flex_plane_params((uint8_t *)hnd->base, FLEX_COMPONENT_Y, 8, 8, 1,
-		                      hnd->plane_info[0].byte_stride, 1, 1,
-		                      &flex_layout->planes[0]);
-		set_flex_plane_params((uint8_t *)hnd->base + hnd->plane_info[2].offset,
-		                      FLEX_COMPONENT_Cb, 8, 8, 1,
-		                      hnd->plane_info[2].byte_stride, 2, 2,
-		                      &flex_layout->planes[1]);
-		set_flex_plane_params((uint8_t *)hnd->base + hnd->plane_info[1].offset,
-		                      FLEX_COMPONENT_Cr, 8, 8, 1,
-		                      hnd->plane_info[1].byte_stride, 2, 2,
-		                      &flex_layout->planes[2]);
-		break;
-
-	case MALI_GRALLOC_FORMAT_INTERNAL_P010:
-		/* Y:UV 4:2:0 */
-		flex_layout->format = FLEX_FORMAT_YCbCr;
-
-		set_flex_plane_params((uint8_t *)hnd->base, FLEX_COMPONENT_Y, 16, 10, 2,
-		                      hnd->plane_info[0].byte_stride, 1, 1,
-		                      &flex_layout->planes[0]);
-		set_flex_plane_params((uint8_t *)hnd->base + hnd->plane_info[1].offset,
-		                      FLEX_COMPONENT_Cb, 16, 10, 4,
-		                      hnd->plane_info[1].byte_stride, 2, 2,
-		                      &flex_layout->planes[1]);
-		set_flex_plane_params((uint8_t *)hnd->base + hnd->plane_info[1].offset + 2,
-		                      FLEX_COMPONENT_Cr, 16, 10, 4,
-		                      hnd->plane_info[1].byte_stride, 2, 2,
-		                      &flex_layout->planes[2]);
-		break;
-
-	case MALI_GRALLOC_FORMAT_INTERNAL_P210:
-		/* Y:UV 4:2:2 */
-		flex_layout->format = FLEX_FORMAT_YCbCr;
-
-		set_flex_plane_params((uint8_t *)hnd->base, FLEX_COMPONENT_Y, 16, 10, 2,
-		                      hnd->plane_info[0].byte_stride, 1, 1,
-		                      &flex_layout->planes[0]);
-		set_flex_plane_params((uint8_t *)hnd->base + hnd->plane_info[1].offset,
-		                      FLEX_COMPONENT_Cb, 16, 10, 4,
-		                      hnd->plane_info[1].byte_stride, 2, 1,
-		                      &flex_layout->planes[1]);
-		set_flex_plane_params((uint8_t *)hnd->base + hnd->plane_info[1].offset + 2,
-		                      FLEX_COMPONENT_Cr, 16, 10, 4,
-		                      hnd->plane_info[1].byte_stride, 2, 1,
-		                      &flex_layout->planes[2]);
-		break;
-
-	case HAL_PIXEL_FORMAT_YCbCr_422_I:
-		/* YUYV 4:2:2 */
-		flex_layout->format = FLEX_FORMAT_YCbCr;
-
-		set_flex_plane_params((uint8_t *)hnd->base, FLEX_COMPONENT_Y, 8, 8, 2,
-		                      hnd->plane_info[0].byte_stride, 1, 1,
-		                      &flex_layout->planes[0]);
-		set_flex_plane_params((uint8_t *)hnd->base + 1, FLEX_COMPONENT_Cb, 8, 8, 4,
-		                      hnd->plane_info[0].byte_stride, 2, 1,
-		                      &flex_layout->planes[1]);
-		set_flex_plane_params((uint8_t *)hnd->base + 3, FLEX_COMPONENT_Cr, 8, 8, 4,
-		                      hnd->plane_info[0].byte_stride, 2, 1,
-		                      &flex_layout->planes[2]);
-
-		break;
-
-	case HAL_PIXEL_FORMAT_YCbCr_422_SP:
-		/* Y:UV 4:2:2 */
-		flex_layout->format = FLEX_FORMAT_YCbCr;
-
-		set_flex_plane_params((uint8_t *)hnd->base, FLEX_COMPONENT_Y, 8, 8, 1,
-		                      hnd->plane_info[0].byte_stride, 1, 1,
-		                      &flex_layout->planes[0]);
-		set_flex_plane_params((uint8_t *)hnd->base + hnd->plane_info[1].offset,
-		                      FLEX_COMPONENT_Cb, 8, 8, 2,
-		                      hnd->plane_info[1].byte_stride, 2, 1,
-		                      &flex_layout->planes[1]);
-		set_flex_plane_params((uint8_t *)hnd->base + hnd->plane_info[1].offset + 1,
-		                      FLEX_COMPONENT_Cr, 8, 8, 2,
-		                      hnd->plane_info[1].byte_stride, 2, 1,
-		                      &flex_layout->planes[2]);
-
-		break;
-
-	case MALI_GRALLOC_FORMAT_INTERNAL_Y210:
-		/* YUYV 4:2:2 */
-		flex_layout->format = FLEX_FORMAT_YCbCr;
-
-		set_flex_plane_params((uint8_t *)hnd->base, FLEX_COMPONENT_Y, 16, 10, 4,
-		                      hnd->plane_info[0].byte_stride, 1, 1,
-		                      &flex_layout->planes[0]);
-		set_flex_plane_params((uint8_t *)hnd->base + 2, FLEX_COMPONENT_Cb, 16, 10, 8,
-		                      hnd->plane_info[0].byte_stride, 2, 1,
-		                      &flex_layout->planes[1]);
-		set_flex_plane_params((uint8_t *)hnd->base + 6, FLEX_COMPONENT_Cr, 16, 10, 8,
-		                      hnd->plane_info[0].byte_stride, 2, 1,
-		                      &flex_layout->planes[2]);
-
-		break;
-
-#if PLATFORM_SDK_VERSION >= 26
-	/* 64-bit format that has 16-bit R, G, B, and A components, in that order */
-	case MALI_GRALLOC_FORMAT_INTERNAL_RGBA_16161616:
-		flex_layout->format = FLEX_FORMAT_RGBA;
-
-		set_flex_plane_params((uint8_t *)hnd->base, FLEX_COMPONENT_R, 16, 16, 8,
-		                      hnd->plane_info[0].byte_stride, 1, 1,
-		                      &flex_layout->planes[0]);
-		set_flex_plane_params((uint8_t *)hnd->base + 2, FLEX_COMPONENT_G, 16, 16, 8,
-		                      hnd->plane_info[0].byte_stride, 1, 1,
-		                      &flex_layout->planes[1]);
-		set_flex_plane_params((uint8_t *)hnd->base + 4, FLEX_COMPONENT_B, 16, 16, 8,
-		                      hnd->plane_info[0].byte_stride, 1, 1,
-		                      &flex_layout->planes[2]);
-		set_flex_plane_params((uint8_t *)hnd->base + 6, FLEX_COMPONENT_A, 16, 16, 8,
-		                      hnd->plane_info[0].byte_stride, 1, 1,
-		                      &flex_layout->planes[3]);
-		break;
-#endif
+	uint8_t * const base = lock_cpu_address(hnd, usage, l, t, w, h);
+	if (base == NULL)
+	{
+		hnd->writeOwner = 0;
+		return GRALLOC1_ERROR_NO_RESOURCES;
+	}
 
-	case MALI_GRALLOC_FORMAT_INTERNAL_RGBA_8888:
-		/* 32-bit format that has 8-bit R, G, B, and A components, in that order */
-		flex_layout->format = FLEX_FORMAT_RGBA;
-
-		set_flex_plane_params((uint8_t *)hnd->base, FLEX_COMPONENT_R, 8, 8, 4,
-		                      hnd->plane_info[0].byte_stride, 1, 1,
-		                      &flex_layout->planes[0]);
-		set_flex_plane_params((uint8_t *)hnd->base + 1, FLEX_COMPONENT_G, 8, 8, 4,
-		                      hnd->plane_info[0].byte_stride, 1, 1,
-		                      &flex_layout->planes[1]);
-		set_flex_plane_params((uint8_t *)hnd->base + 2, FLEX_COMPONENT_B, 8, 8, 4,
-		                      hnd->plane_info[0].byte_stride, 1, 1,
-		                      &flex_layout->planes[2]);
-		set_flex_plane_params((uint8_t *)hnd->base + 3, FLEX_COMPONENT_A, 8, 8, 4,
-		                      hnd->plane_info[0].byte_stride, 1, 1,
-		                      &flex_layout->planes[3]);
-		break;
-
-	case MALI_GRALLOC_FORMAT_INTERNAL_RGBX_8888:
-		/* 32-bit format that has 8-bit R, G, B, and unused components, in that order */
-		flex_layout->format = FLEX_FORMAT_RGB;
-
-		set_flex_plane_params((uint8_t *)hnd->base, FLEX_COMPONENT_R, 8, 8, 4,
-		                      hnd->plane_info[0].byte_stride, 1, 1,
-		                      &flex_layout->planes[0]);
-		set_flex_plane_params((uint8_t *)hnd->base + 1, FLEX_COMPONENT_G, 8, 8, 4,
-		                      hnd->plane_info[0].byte_stride, 1, 1,
-		                      &flex_layout->planes[1]);
-		set_flex_plane_params((uint8_t *)hnd->base + 2, FLEX_COMPONENT_B, 8, 8, 4,
-		                      hnd->plane_info[0].byte_stride, 1, 1,
-		                      &flex_layout->planes[2]);
-		break;
-
-	case MALI_GRALLOC_FORMAT_INTERNAL_RGB_888:
-		/* 24-bit format that has 8-bit R, G, and B components, in that order */
-		flex_layout->format = FLEX_FORMAT_RGB;
-
-		set_flex_plane_params((uint8_t *)hnd->base, FLEX_COMPONENT_R, 8, 8, 3,
-		                      hnd->plane_info[0].byte_stride, 1, 1,
-		                      &flex_layout->planes[0]);
-		set_flex_plane_params((uint8_t *)hnd->base + 1, FLEX_COMPONENT_G, 8, 8, 3,
-		                      hnd->plane_info[0].byte_stride, 1, 1,
-		                      &flex_layout->planes[1]);
-		set_flex_plane_params((uint8_t *)hnd->base + 2, FLEX_COMPONENT_B, 8, 8, 3,
-		                      hnd->plane_info[0].byte_stride, 1, 1,
-		                      &flex_layout->planes[2]);
-		break;
-
-	case MALI_GRALLOC_FORMAT_INTERNAL_BGRA_8888:
-		/* 32-bit format that has 8-bit B, G, R, and A components, in that order.
-		 * The flex format plane order must still follow FLEX_FORMAT_RGBA
-		 * order (as defined by 'android_flex_component_t').
-		 */
-		flex_layout->format = FLEX_FORMAT_RGBA;
-
-		set_flex_plane_params((uint8_t *)hnd->base, FLEX_COMPONENT_B, 8, 8, 4,
-		                      hnd->plane_info[0].byte_stride, 1, 1,
-		                      &flex_layout->planes[2]);
-		set_flex_plane_params((uint8_t *)hnd->base + 1, FLEX_COMPONENT_G, 8, 8, 4,
-		                      hnd->plane_info[0].byte_stride, 1, 1,
-		                      &flex_layout->planes[1]);
-		set_flex_plane_params((uint8_t *)hnd->base + 2, FLEX_COMPONENT_R, 8, 8, 4,
-		                      hnd->plane_info[0].byte_stride, 1, 1,
-		                      &flex_layout->planes[0]);
-		set_flex_plane_params((uint8_t *)hnd->base + 3, FLEX_COMPONENT_A, 8, 8, 4,
-		                      hnd->plane_info[0].byte_stride, 1, 1,
-		                      &flex_layout->planes[3]);
-		break;
-
-	default:
-		AERR("Can't lock buffer %p: format %" PRIx64 " not handled", hnd, hnd->alloc_format);
-		return GRALLOC1_ERROR_UNSUPPORTED;
+	flex_layout->format = (android_flex_format_t)info->flex_format;
+	flex_layout->num_planes = info->num_planes;
+	for (uint32_t i = 0; i < info->num_planes; i++)
+	{
+		const cpu_access_plane_t * const plane = &info->planes[i];
+
+		set_flex_plane_params(base + plane->offset,
+		                      (android_flex_component_t)plane->component,
+		                      plane->bits_per_component, plane->bits_used,
+		                      plane->h_increment,
+		                      hnd->plane_info[plane->plane].byte_stride,
+		                      plane->h_subsampling, plane->v_subsampling,
+		                      &flex_layout->planes[i]);
 	}
 
 	return GRALLOC1_ERROR_NONE;
 }
+
+int mali_gralloc_lock_flex_async(const mali_gralloc_module *m,
+                                 const buffer_handle_t buffer,
+                                 const uint64_t usage, const int l, const int t,
+                                 const int w, const  int h,
+                                 struct android_flex_layout * const flex_layout,
+                                 const int32_t fence_fd)
+{
+	const int ret = lock_buffer_flex_async(m, buffer, usage, l, t, w, h, flex_layout, fence_fd);
+
+#if GRALLOC_ALLOC_TRACE == 1
+	mali_gralloc_trace_lock((const private_handle_t *)buffer, usage, l, t, w, h, true, ret);
+#endif
+
+	return ret;
+}
 #endif
 
 /*
@@ -37,4 +37,6 @@ int mali_gralloc_lock_flex_async(const mali_gralloc_module *m, buffer_handle_t b
                                  int w, int h, struct android_flex_layout *flex_layout, int32_t fence_fd);
 int mali_gralloc_unlock_async(const mali_gralloc_module *m, buffer_handle_t buffer, int32_t *fence_fd);
 
+void mali_gralloc_cpu_access_init(private_handle_t *hnd);
+
 #endif /* MALI_GRALLOC_BUFFERACCESS_H_ */
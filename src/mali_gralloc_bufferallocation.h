@@ -23,13 +23,41 @@
 #include "mali_gralloc_private_interface_types.h"
 #include "mali_gralloc_buffer.h"
 #include "mali_gralloc_bufferdescriptor.h"
+#include "mali_gralloc_bufferlayout.h"
 
 int mali_gralloc_buffer_allocate(mali_gralloc_module *m, const gralloc_buffer_descriptor_t *descriptors,
                                  uint32_t numDescriptors, buffer_handle_t *pHandle, bool *shared_backend);
+
+/* Allocates buffers for descriptors already laid out by mali_gralloc_buffer_layout(). */
+int mali_gralloc_buffer_allocate_prepared(mali_gralloc_module *m, const gralloc_buffer_descriptor_t *descriptors,
+                                          uint32_t numDescriptors, buffer_handle_t *pHandle, bool *shared_backend);
+
 int mali_gralloc_buffer_free(buffer_handle_t pHandle);
 
-void init_afbc(uint8_t *buf, uint64_t internal_format, const bool is_multi_plane, int w, int h);
+/*
+ * Wraps an existing dma-buf in a new private handle without copying it. The
+ * buffer must be linear. Its layout is the one gralloc would allocate for the
+ * descriptor unless 'layout' is given. 'fd' is duplicated, the caller keeps
+ * ownership of it.
+ */
+int mali_gralloc_buffer_import_dmabuf(int fd, gralloc_buffer_descriptor_t descriptor,
+                                      const mali_gralloc_dmabuf_layout *layout, buffer_handle_t *pHandle);
 
-uint32_t lcm(uint32_t a, uint32_t b);
+/*
+ * Allocates a buffer with a layout one of the DRM format 'modifiers'
+ * describes, preferring the one gralloc would pick for the usage and then
+ * the order of the list. Returns the modifier used in 'modifier'.
+ */
+int mali_gralloc_buffer_allocate_with_modifiers(mali_gralloc_module *m, gralloc_buffer_descriptor_t descriptor,
+                                                const uint64_t *modifiers, uint32_t num_modifiers,
+                                                buffer_handle_t *pHandle, uint64_t *modifier);
+
+/*
+ * Creates a handle for one layer, or a rectangle of one layer, of a buffer.
+ * The view has its own fds for the buffer memory and the shared attribute
+ * region, so the memory stays alive until both handles are freed.
+ */
+int mali_gralloc_buffer_create_view(buffer_handle_t buffer, const mali_gralloc_buffer_view *view,
+                                    buffer_handle_t *pHandle);
 
 #endif /* MALI_GRALLOC_BUFFERALLOCATION_H_ */
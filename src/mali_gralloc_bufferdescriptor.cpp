@@ -30,6 +30,7 @@
 #include "mali_gralloc_bufferdescriptor.h"
 #include "mali_gralloc_private_interface_types.h"
 #include "mali_gralloc_buffer.h"
+#include "mali_gralloc_slab.h"
 
 /*
  * Validate descriptor to ensure that it originated from this version
@@ -62,7 +63,12 @@ int mali_gralloc_create_descriptor_internal(gralloc1_buffer_descriptor_t *outDes
 		return GRALLOC1_ERROR_BAD_VALUE;
 	}
 
+#if GRALLOC_OBJECT_SLAB == 1
+	buffer_descriptor = reinterpret_cast<buffer_descriptor_t *>(
+	    mali_gralloc_slab_alloc(MALI_GRALLOC_SLAB_DESCRIPTOR, sizeof(buffer_descriptor_t)));
+#else
 	buffer_descriptor = reinterpret_cast<buffer_descriptor_t *>(malloc(sizeof(buffer_descriptor_t)));
+#endif
 
 	if (NULL == buffer_descriptor)
 	{
@@ -94,7 +100,13 @@ int mali_gralloc_destroy_descriptor_internal(gralloc1_buffer_descriptor_t descri
 		return GRALLOC1_ERROR_BAD_DESCRIPTOR;
 	}
 
+#if GRALLOC_OBJECT_SLAB == 1
+	/* Slab memory is reused as it is, so a second destroy must fail the signature check. */
+	buffer_descriptor->signature = 0;
+	mali_gralloc_slab_free(buffer_descriptor);
+#else
 	free(buffer_descriptor);
+#endif
 	return GRALLOC1_ERROR_NONE;
 }
 
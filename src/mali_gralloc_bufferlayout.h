@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2016-2017 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MALI_GRALLOC_BUFFERLAYOUT_H_
+#define MALI_GRALLOC_BUFFERLAYOUT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mali_gralloc_bufferdescriptor.h"
+
+/*
+ * Selects the allocation format of a descriptor and calculates its size and
+ * plane layout. This has no side effects beyond the descriptor and the
+ * format selection counters, so tools can use it to model allocations.
+ *
+ * 'header_size', when not NULL, returns the part of the size taken by AFBC
+ * headers, over all planes and layers.
+ */
+int mali_gralloc_buffer_layout(buffer_descriptor_t * const bufDescriptor, size_t * const header_size);
+
+void init_afbc(uint8_t *buf, uint64_t internal_format, const bool is_multi_plane, int w, int h);
+
+uint32_t lcm(uint32_t a, uint32_t b);
+
+#endif /* MALI_GRALLOC_BUFFERLAYOUT_H_ */
@@ -0,0 +1,447 @@
+/*
+ * Copyright (C) 2018 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unordered_map>
+
+#include <log/log.h>
+
+#if GRALLOC_USE_GRALLOC1_API == 1
+#include <hardware/gralloc1.h>
+#else
+#include <hardware/gralloc.h>
+#endif
+
+#include "mali_gralloc_module.h"
+#include "mali_gralloc_buffer.h"
+#include "mali_gralloc_backend.h"
+#include "mali_gralloc_usages.h"
+#include "gralloc_buffer_priv.h"
+#include "mali_gralloc_debug.h"
+#include "mali_gralloc_cache_policy.h"
+
+/* Signatures with a profile, and buffers whose counters are still followed. */
+#define CACHE_POLICY_MAX_PROFILES 32
+#define CACHE_POLICY_MAX_TRACKED 64
+
+/* A signature needs this much history before its usage is overridden. */
+#define CACHE_POLICY_MIN_BUFFERS 2
+#define CACHE_POLICY_MIN_LOCKS_PER_BUFFER 4
+
+/* Overrides the allow-list can permit. */
+#define CACHE_POLICY_ALLOW_CACHED (1U << 0)
+#define CACHE_POLICY_ALLOW_UNCACHED (1U << 1)
+
+struct cache_profile
+{
+	uint32_t width;
+	uint32_t height;
+	uint64_t format;
+	uint64_t usage;
+	size_t size;
+
+	/* Counters of buffers no longer followed. */
+	uint64_t buffers;
+	uint64_t locks;
+	uint64_t read_locks;
+	uint64_t write_locks;
+	uint64_t bytes;
+
+	uint64_t to_cached;
+	uint64_t to_uncached;
+};
+
+struct cache_tracked_buffer
+{
+	int profile;
+	void *attr;
+};
+
+static pthread_mutex_t s_cache_policy_lock = PTHREAD_MUTEX_INITIALIZER;
+static cache_profile s_profiles[CACHE_POLICY_MAX_PROFILES];
+static uint32_t s_num_profiles;
+static cache_tracked_buffer s_tracked[CACHE_POLICY_MAX_TRACKED];
+
+/*
+ * Counters of the handles locked in this process, through mappings of their
+ * own: attr_base is mapped and unmapped by attribute accesses at any time.
+ */
+static std::unordered_map<const private_handle_t *, attr_cpu_access *> s_counters;
+static uint32_t s_next_tracked;
+static uint32_t s_allowed;
+static bool s_allowed_read;
+
+/*
+ * GRALLOC_CACHE_OVERRIDES is a comma separated list of "cached" and
+ * "uncached", or "none". Both are allowed when it is unset. On ION,
+ * uncached memory is mapped write-combined.
+ */
+static uint32_t allowed_overrides(void)
+{
+	if (s_allowed_read)
+	{
+		return s_allowed;
+	}
+
+	const char *list = getenv("GRALLOC_CACHE_OVERRIDES");
+
+	if (list == NULL)
+	{
+		s_allowed = CACHE_POLICY_ALLOW_CACHED | CACHE_POLICY_ALLOW_UNCACHED;
+	}
+	else
+	{
+		s_allowed = 0;
+
+		for (const char *item = list; *item != '\0';)
+		{
+			const size_t len = strcspn(item, ",");
+
+			if (len == strlen("cached") && strncmp(item, "cached", len) == 0)
+			{
+				s_allowed |= CACHE_POLICY_ALLOW_CACHED;
+			}
+			else if (len == strlen("uncached") && strncmp(item, "uncached", len) == 0)
+			{
+				s_allowed |= CACHE_POLICY_ALLOW_UNCACHED;
+			}
+			else if (!(len == strlen("none") && strncmp(item, "none", len) == 0))
+			{
+				AWAR("Unknown cache override '%.*s' in GRALLOC_CACHE_OVERRIDES", (int)len, item);
+			}
+
+			item += (item[len] == ',') ? len + 1 : len;
+		}
+	}
+
+	s_allowed_read = true;
+
+	return s_allowed;
+}
+
+static int find_profile(const buffer_descriptor_t *desc, bool create)
+{
+	const uint64_t usage = desc->producer_usage | desc->consumer_usage;
+
+	for (uint32_t i = 0; i < s_num_profiles; i++)
+	{
+		const cache_profile * const profile = &s_profiles[i];
+
+		if (profile->width == desc->width && profile->height == desc->height && profile->format == desc->hal_format &&
+		    profile->usage == usage)
+		{
+			return i;
+		}
+	}
+
+	if (!create || s_num_profiles == CACHE_POLICY_MAX_PROFILES)
+	{
+		return -1;
+	}
+
+	cache_profile * const profile = &s_profiles[s_num_profiles];
+
+	memset(profile, 0, sizeof(*profile));
+	profile->width = desc->width;
+	profile->height = desc->height;
+	profile->format = desc->hal_format;
+	profile->usage = usage;
+	profile->size = desc->size;
+
+	return s_num_profiles++;
+}
+
+static void load_counters(void *attr, attr_cpu_access *counters)
+{
+	const attr_cpu_access * const shared = gralloc_buffer_attr_cpu_access(attr);
+
+	counters->locks = __atomic_load_n(&shared->locks, __ATOMIC_RELAXED);
+	counters->read_locks = __atomic_load_n(&shared->read_locks, __ATOMIC_RELAXED);
+	counters->write_locks = __atomic_load_n(&shared->write_locks, __ATOMIC_RELAXED);
+	counters->bytes = __atomic_load_n(&shared->bytes, __ATOMIC_RELAXED);
+}
+
+/* Adds the final counters of a followed buffer to its profile and stops following it. */
+static void retire_tracked(cache_tracked_buffer *tracked)
+{
+	if (tracked->attr == NULL)
+	{
+		return;
+	}
+
+	cache_profile * const profile = &s_profiles[tracked->profile];
+	attr_cpu_access counters;
+
+	load_counters(tracked->attr, &counters);
+
+	profile->buffers++;
+	profile->locks += counters.locks;
+	profile->read_locks += counters.read_locks;
+	profile->write_locks += counters.write_locks;
+	profile->bytes += counters.bytes;
+
+	munmap(tracked->attr, PAGE_SIZE);
+	tracked->attr = NULL;
+}
+
+uint32_t mali_gralloc_cache_policy_flags(const buffer_descriptor_t *desc, uint32_t usage_flags)
+{
+	const uint64_t usage = desc->producer_usage | desc->consumer_usage;
+
+	/* Buffers without CPU usage are never locked, so there is nothing to learn. */
+	if ((usage & (GRALLOC_USAGE_SW_READ_MASK | GRALLOC_USAGE_SW_WRITE_MASK)) == 0 ||
+	    (usage & GRALLOC_USAGE_PROTECTED))
+	{
+		return usage_flags;
+	}
+
+	const uint32_t allowed = allowed_overrides();
+	if (allowed == 0)
+	{
+		return usage_flags;
+	}
+
+	pthread_mutex_lock(&s_cache_policy_lock);
+
+	const int index = find_profile(desc, false);
+	if (index < 0)
+	{
+		pthread_mutex_unlock(&s_cache_policy_lock);
+		return usage_flags;
+	}
+
+	/* Buffers still followed count with what they have seen so far. */
+	const cache_profile * const profile = &s_profiles[index];
+	uint64_t buffers = profile->buffers;
+	uint64_t locks = profile->locks;
+	uint64_t read_locks = profile->read_locks;
+	uint64_t bytes = profile->bytes;
+
+	for (uint32_t i = 0; i < CACHE_POLICY_MAX_TRACKED; i++)
+	{
+		if (s_tracked[i].attr != NULL && s_tracked[i].profile == index)
+		{
+			attr_cpu_access counters;
+
+			load_counters(s_tracked[i].attr, &counters);
+			buffers++;
+			locks += counters.locks;
+			read_locks += counters.read_locks;
+			bytes += counters.bytes;
+		}
+	}
+
+	const size_t size = profile->size;
+
+	pthread_mutex_unlock(&s_cache_policy_lock);
+
+	if (buffers < CACHE_POLICY_MIN_BUFFERS || locks < buffers * CACHE_POLICY_MIN_LOCKS_PER_BUFFER)
+	{
+		return usage_flags;
+	}
+
+	uint32_t flags = usage_flags;
+
+	if (read_locks == 0)
+	{
+		/* Written only: caching buys nothing but the flushes. */
+		if (allowed & CACHE_POLICY_ALLOW_UNCACHED)
+		{
+			flags &= ~MALI_GRALLOC_HEAP_FLAG_CACHED;
+		}
+	}
+	else if (read_locks * 2 >= locks && bytes / locks >= size / 4)
+	{
+		/* Mostly read, a good part of the buffer each time: uncached reads cost more than invalidating. */
+		if (allowed & CACHE_POLICY_ALLOW_CACHED)
+		{
+			flags |= MALI_GRALLOC_HEAP_FLAG_CACHED;
+		}
+	}
+
+	return flags;
+}
+
+void mali_gralloc_cache_policy_override(const buffer_descriptor_t *desc, uint32_t usage_flags, uint32_t flags)
+{
+	if (flags == usage_flags)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&s_cache_policy_lock);
+
+	const int index = find_profile(desc, false);
+	if (index >= 0)
+	{
+		if (flags & MALI_GRALLOC_HEAP_FLAG_CACHED)
+		{
+			s_profiles[index].to_cached++;
+		}
+		else
+		{
+			s_profiles[index].to_uncached++;
+		}
+	}
+
+	pthread_mutex_unlock(&s_cache_policy_lock);
+
+	ALOGV("Allocating %ux%u format 0x%" PRIx64 " buffer %s instead of %s", desc->width, desc->height,
+	      desc->hal_format, (flags & MALI_GRALLOC_HEAP_FLAG_CACHED) ? "cached" : "uncached",
+	      (usage_flags & MALI_GRALLOC_HEAP_FLAG_CACHED) ? "cached" : "uncached");
+}
+
+void mali_gralloc_cache_policy_track(const private_handle_t *hnd, const buffer_descriptor_t *desc)
+{
+	const uint64_t usage = desc->producer_usage | desc->consumer_usage;
+
+	if ((usage & (GRALLOC_USAGE_SW_READ_MASK | GRALLOC_USAGE_SW_WRITE_MASK)) == 0 || hnd->share_attr_fd < 0 ||
+	    (hnd->flags & private_handle_t::PRIV_FLAGS_USES_SHMEM))
+	{
+		return;
+	}
+
+	/* A mapping of our own keeps the counters readable after the buffer is freed. */
+	void *attr = mmap(NULL, PAGE_SIZE, PROT_READ, MAP_SHARED, hnd->share_attr_fd, 0);
+	if (attr == MAP_FAILED)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&s_cache_policy_lock);
+
+	const int index = find_profile(desc, true);
+	if (index < 0)
+	{
+		pthread_mutex_unlock(&s_cache_policy_lock);
+		munmap(attr, PAGE_SIZE);
+		return;
+	}
+
+	/* The oldest buffer makes room, its counters being as complete as they will get. */
+	cache_tracked_buffer * const tracked = &s_tracked[s_next_tracked];
+	s_next_tracked = (s_next_tracked + 1) % CACHE_POLICY_MAX_TRACKED;
+
+	retire_tracked(tracked);
+	tracked->profile = index;
+	tracked->attr = attr;
+
+	pthread_mutex_unlock(&s_cache_policy_lock);
+}
+
+void mali_gralloc_cache_policy_lock(private_handle_t *hnd, uint64_t usage, int w, int h)
+{
+	/* Locks for hardware access, such as posting to the framebuffer, are not CPU access. */
+	if ((usage & (GRALLOC_USAGE_SW_READ_MASK | GRALLOC_USAGE_SW_WRITE_MASK)) == 0 || hnd->share_attr_fd < 0 ||
+	    hnd->width <= 0 || hnd->height <= 0)
+	{
+		return;
+	}
+
+	if (w == 0 || h == 0)
+	{
+		w = hnd->width;
+		h = hnd->height;
+	}
+
+	/* The region stays mapped until the handle is released. */
+	pthread_mutex_lock(&s_cache_policy_lock);
+
+	attr_cpu_access *counters;
+	std::unordered_map<const private_handle_t *, attr_cpu_access *>::const_iterator it = s_counters.find(hnd);
+
+	if (it != s_counters.end())
+	{
+		counters = it->second;
+	}
+	else
+	{
+		void * const attr = mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, hnd->share_attr_fd, 0);
+		if (attr == MAP_FAILED)
+		{
+			pthread_mutex_unlock(&s_cache_policy_lock);
+			return;
+		}
+
+		counters = gralloc_buffer_attr_cpu_access(attr);
+		s_counters[hnd] = counters;
+	}
+
+	__atomic_fetch_add(&counters->locks, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&counters->bytes, (uint64_t)hnd->size * w * h / ((uint64_t)hnd->width * hnd->height),
+	                   __ATOMIC_RELAXED);
+
+	if (usage & GRALLOC_USAGE_SW_READ_MASK)
+	{
+		__atomic_fetch_add(&counters->read_locks, 1, __ATOMIC_RELAXED);
+	}
+
+	if (usage & GRALLOC_USAGE_SW_WRITE_MASK)
+	{
+		__atomic_fetch_add(&counters->write_locks, 1, __ATOMIC_RELAXED);
+	}
+
+	pthread_mutex_unlock(&s_cache_policy_lock);
+}
+
+void mali_gralloc_cache_policy_release(const private_handle_t *hnd)
+{
+	pthread_mutex_lock(&s_cache_policy_lock);
+
+	std::unordered_map<const private_handle_t *, attr_cpu_access *>::iterator it = s_counters.find(hnd);
+	if (it != s_counters.end())
+	{
+		munmap((char *)it->second - GRALLOC_ATTR_CPU_ACCESS_OFFSET, PAGE_SIZE);
+		s_counters.erase(it);
+	}
+
+	pthread_mutex_unlock(&s_cache_policy_lock);
+}
+
+void mali_gralloc_cache_policy_dump(android::String8 &buf)
+{
+	pthread_mutex_lock(&s_cache_policy_lock);
+
+	if (s_num_profiles == 0)
+	{
+		pthread_mutex_unlock(&s_cache_policy_lock);
+		return;
+	}
+
+	mali_gralloc_dump_string(buf, "-------------------------CPU cache policy------------------------\n");
+	mali_gralloc_dump_string(buf, "  width | height |   format   |      usage       | buffers | locks (r/w) | avg bytes"
+	                              " | ->cached | ->uncached\n");
+
+	for (uint32_t i = 0; i < s_num_profiles; i++)
+	{
+		const cache_profile * const profile = &s_profiles[i];
+
+		mali_gralloc_dump_string(buf, " %6u | %6u | 0x%08" PRIx64 " | 0x%014" PRIx64 " | %7" PRIu64 " | %" PRIu64
+		                              " (%" PRIu64 "/%" PRIu64 ") | %9" PRIu64 " | %8" PRIu64 " | %10" PRIu64 "\n",
+		                         profile->width, profile->height, profile->format, profile->usage, profile->buffers,
+		                         profile->locks, profile->read_locks, profile->write_locks,
+		                         profile->locks ? profile->bytes / profile->locks : 0, profile->to_cached,
+		                         profile->to_uncached);
+	}
+
+	pthread_mutex_unlock(&s_cache_policy_lock);
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2018 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MALI_GRALLOC_CACHE_POLICY_H_
+#define MALI_GRALLOC_CACHE_POLICY_H_
+
+#include <stdint.h>
+#include <utils/String8.h>
+
+#include "mali_gralloc_bufferdescriptor.h"
+
+struct private_handle_t;
+
+/*
+ * Adaptive choice between cached and uncached memory.
+ *
+ * Usage flags only say how often the CPU means to read a buffer. Locks count
+ * how it really does in the buffer's shared attribute region, whichever
+ * process they come from. The allocating process keeps the attribute regions
+ * of recent buffers mapped and folds them into a profile per descriptor
+ * signature (dimensions, format and usage). Later allocations of the same
+ * signature are made cached or uncached by what the profile shows, if the
+ * GRALLOC_CACHE_OVERRIDES allow-list permits.
+ */
+
+/* Returns the heap flags for an allocation, given the flags its usage asks for. */
+uint32_t mali_gralloc_cache_policy_flags(const buffer_descriptor_t *desc, uint32_t usage_flags);
+
+/* Counts an allocation whose flags differ from those its usage asks for. */
+void mali_gralloc_cache_policy_override(const buffer_descriptor_t *desc, uint32_t usage_flags, uint32_t flags);
+
+/* Starts following CPU access to a new buffer. */
+void mali_gralloc_cache_policy_track(const private_handle_t *hnd, const buffer_descriptor_t *desc);
+
+/* Counts a CPU lock of a 'w' x 'h' region, 0 x 0 meaning the whole buffer. Locks without SW usage are ignored. */
+void mali_gralloc_cache_policy_lock(private_handle_t *hnd, uint64_t usage, int w, int h);
+
+/* Stops counting CPU access through a handle whose attribute region is being freed. */
+void mali_gralloc_cache_policy_release(const private_handle_t *hnd);
+
+/* Appends the profiles and override counts to a dump. */
+void mali_gralloc_cache_policy_dump(android::String8 &buf);
+
+#endif /* MALI_GRALLOC_CACHE_POLICY_H_ */
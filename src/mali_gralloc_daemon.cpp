@@ -0,0 +1,810 @@
+/*
+ * Copyright (C) 2018 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <list>
+#include <map>
+#include <set>
+#include <vector>
+
+#include <log/log.h>
+
+#if GRALLOC_USE_GRALLOC1_API == 1
+#include <hardware/gralloc1.h>
+#else
+#include <hardware/gralloc.h>
+#endif
+
+#include "mali_gralloc_module.h"
+#include "mali_gralloc_buffer.h"
+#include "mali_gralloc_bufferallocation.h"
+#include "mali_gralloc_bufferaccess.h"
+#include "mali_gralloc_backend.h"
+#include "mali_gralloc_reference.h"
+#include "mali_gralloc_usages.h"
+#include "gralloc_helper.h"
+#include "mali_gralloc_daemon.h"
+
+#ifndef GRALLOC_ALLOC_DAEMON_SOCKET
+#define GRALLOC_ALLOC_DAEMON_SOCKET "/dev/socket/gralloc_allocd"
+#endif
+
+/* A daemon which doesn't answer in time is left alone, and retried later. */
+#define DAEMON_TIMEOUT_MS 2000
+#define DAEMON_RETRY_NS 1000000000LL
+
+/* A client which doesn't take its reply in time is dropped, so it can't hold up the others. */
+#define DAEMON_CLIENT_TIMEOUT_MS 100
+
+#define DAEMON_MAX_FDS (MALI_GRALLOC_DAEMON_MAX_DESCRIPTORS * GRALLOC_ARM_NUM_FDS)
+
+/* Connections kept open between calls; threads calling at once each take their own. */
+#define DAEMON_MAX_IDLE_CONNECTIONS 4
+
+/*
+ * Guards the idle connections and the retry time only: a call takes a
+ * connection to itself and does its round trip without the lock, so a slow
+ * reply doesn't hold up the other threads.
+ */
+static pthread_mutex_t s_daemon_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<int> s_daemon_idle;
+static int64_t s_daemon_retry_ns = 0;
+static bool s_daemon_caps_set = false;
+
+/* Reply and payload, aligned for the handles in it. */
+union daemon_reply_buffer
+{
+	mali_gralloc_daemon_reply reply;
+	uint64_t data[(sizeof(mali_gralloc_daemon_reply) +
+	               MALI_GRALLOC_DAEMON_MAX_DESCRIPTORS * sizeof(private_handle_t) + sizeof(mali_gralloc_daemon_caps) +
+	               sizeof(uint64_t) - 1) / sizeof(uint64_t)];
+};
+
+static int64_t daemon_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Closes a connection which failed, and leaves the daemon alone for a while. */
+static void daemon_disconnect(int fd)
+{
+	close(fd);
+
+	pthread_mutex_lock(&s_daemon_lock);
+
+	s_daemon_retry_ns = daemon_now_ns() + DAEMON_RETRY_NS;
+
+	/* The others are most likely broken too. */
+	for (size_t i = 0; i < s_daemon_idle.size(); i++)
+	{
+		close(s_daemon_idle[i]);
+	}
+	s_daemon_idle.clear();
+
+	pthread_mutex_unlock(&s_daemon_lock);
+}
+
+/*
+ * Sends a request on a connection no other thread is using, and waits for its
+ * reply. Returns the reply length, or -1 after closing the connection.
+ */
+static ssize_t daemon_transact(int fd, mali_gralloc_daemon_request *request, daemon_reply_buffer *reply, int *fds,
+                               int *num_fds)
+{
+	const size_t request_size = offsetof(mali_gralloc_daemon_request, descriptors) +
+	                            request->num_descriptors * sizeof(mali_gralloc_daemon_descriptor);
+
+	request->magic = MALI_GRALLOC_DAEMON_MAGIC;
+	request->version = MALI_GRALLOC_DAEMON_VERSION;
+	request->handle_size = sizeof(private_handle_t);
+
+	if (send(fd, request, request_size, MSG_NOSIGNAL) != (ssize_t)request_size)
+	{
+		AWAR("Allocator daemon request failed: %s", strerror(errno));
+		daemon_disconnect(fd);
+		return -1;
+	}
+
+	char control[CMSG_SPACE(DAEMON_MAX_FDS * sizeof(int))];
+	struct iovec iov = { reply, sizeof(*reply) };
+	struct msghdr msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	ssize_t len;
+	do
+	{
+		len = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+	} while (len < 0 && errno == EINTR);
+
+	*num_fds = 0;
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+	{
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+		{
+			const int n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+			memcpy(fds + *num_fds, CMSG_DATA(cmsg), n * sizeof(int));
+			*num_fds += n;
+		}
+	}
+
+	if (len < (ssize_t)sizeof(mali_gralloc_daemon_reply) || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) ||
+	    reply->reply.magic != MALI_GRALLOC_DAEMON_MAGIC || reply->reply.op != request->op)
+	{
+		AWAR("Allocator daemon reply failed: %s", (len < 0) ? strerror(errno) : "bad reply");
+
+		for (int i = 0; i < *num_fds; i++)
+		{
+			close(fds[i]);
+		}
+
+		*num_fds = 0;
+		daemon_disconnect(fd);
+		return -1;
+	}
+
+	return len;
+}
+
+/* Connects to the daemon and checks it was built like this process. Returns the connection, or -1. */
+static int daemon_connect(void)
+{
+	const char *path = getenv("GRALLOC_ALLOC_DAEMON_SOCKET");
+	if (path == NULL)
+	{
+		path = GRALLOC_ALLOC_DAEMON_SOCKET;
+	}
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+
+	if (path[0] == '\0' || strlen(path) >= sizeof(addr.sun_path))
+	{
+		pthread_mutex_lock(&s_daemon_lock);
+		s_daemon_retry_ns = INT64_MAX;
+		pthread_mutex_unlock(&s_daemon_lock);
+		return -1;
+	}
+
+	strcpy(addr.sun_path, path);
+
+	const int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+	{
+		/* Not running is the usual case, so it is not worth a warning. */
+		ALOGV("Allocator daemon not available at %s: %s", path, strerror(errno));
+
+		if (fd >= 0)
+		{
+			daemon_disconnect(fd);
+		}
+		else
+		{
+			pthread_mutex_lock(&s_daemon_lock);
+			s_daemon_retry_ns = daemon_now_ns() + DAEMON_RETRY_NS;
+			pthread_mutex_unlock(&s_daemon_lock);
+		}
+
+		return -1;
+	}
+
+	const struct timeval timeout = { DAEMON_TIMEOUT_MS / 1000, (DAEMON_TIMEOUT_MS % 1000) * 1000 };
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	mali_gralloc_daemon_request request;
+	daemon_reply_buffer reply;
+	int fds[DAEMON_MAX_FDS];
+	int num_fds;
+
+	memset(&request, 0, sizeof(request));
+	request.op = MALI_GRALLOC_DAEMON_HELLO;
+
+	const ssize_t len = daemon_transact(fd, &request, &reply, fds, &num_fds);
+	if (len < 0)
+	{
+		return -1;
+	}
+
+	if (reply.reply.result != 0 || len != sizeof(reply.reply) + sizeof(mali_gralloc_daemon_caps) || num_fds != 0)
+	{
+		AWAR("Allocator daemon at %s refused the connection (%d)", path, reply.reply.result);
+
+		for (int i = 0; i < num_fds; i++)
+		{
+			close(fds[i]);
+		}
+
+		daemon_disconnect(fd);
+		return -1;
+	}
+
+	pthread_mutex_lock(&s_daemon_lock);
+
+	if (!s_daemon_caps_set)
+	{
+		/* The daemon runs on the same hardware, so its capabilities stand for this process too. */
+		const mali_gralloc_daemon_caps *caps = (const mali_gralloc_daemon_caps *)(&reply.reply + 1);
+		mali_gralloc_set_caps(&caps->gpu, &caps->vpu, &caps->dpu, &caps->cam);
+		s_daemon_caps_set = true;
+
+		AINF("Allocating through the allocator daemon at %s", path);
+	}
+
+	pthread_mutex_unlock(&s_daemon_lock);
+
+	return fd;
+}
+
+/* Takes an idle connection, or makes a new one. Returns -1 while the daemon is unavailable. */
+static int daemon_get_connection(void)
+{
+	pthread_mutex_lock(&s_daemon_lock);
+
+	if (!s_daemon_idle.empty())
+	{
+		const int fd = s_daemon_idle.back();
+		s_daemon_idle.pop_back();
+		pthread_mutex_unlock(&s_daemon_lock);
+		return fd;
+	}
+
+	const bool retry = daemon_now_ns() >= s_daemon_retry_ns;
+
+	pthread_mutex_unlock(&s_daemon_lock);
+
+	return retry ? daemon_connect() : -1;
+}
+
+/* Keeps a connection which completed its call for the next one. */
+static void daemon_put_connection(int fd)
+{
+	pthread_mutex_lock(&s_daemon_lock);
+
+	if (s_daemon_idle.size() < DAEMON_MAX_IDLE_CONNECTIONS)
+	{
+		s_daemon_idle.push_back(fd);
+		fd = -1;
+	}
+
+	pthread_mutex_unlock(&s_daemon_lock);
+
+	if (fd >= 0)
+	{
+		close(fd);
+	}
+}
+
+void mali_gralloc_daemon_connect(void)
+{
+	const int fd = daemon_get_connection();
+
+	if (fd >= 0)
+	{
+		daemon_put_connection(fd);
+	}
+}
+
+/*
+ * Makes a handle sent by the daemon one this process allocated, so it is
+ * mapped here and freed here on its last release.
+ */
+static int daemon_adopt_handle(private_handle_t *hnd)
+{
+	hnd->allocating_pid = getpid();
+	hnd->remote_pid = -1;
+	hnd->ref_count = 1;
+	hnd->writeOwner = 0;
+	hnd->base = NULL;
+	hnd->attr_base = MAP_FAILED;
+	mali_gralloc_cpu_access_init(hnd);
+#if GRALLOC_COMPACT_HANDLE == 1
+	mali_gralloc_reference_add_local(hnd);
+#endif
+
+	if ((hnd->producer_usage | hnd->consumer_usage) & GRALLOC_USAGE_PROTECTED)
+	{
+		return 0;
+	}
+
+	return mali_gralloc_backend_map(hnd);
+}
+
+int mali_gralloc_daemon_allocate(const gralloc_buffer_descriptor_t *descriptors, uint32_t numDescriptors,
+                                 buffer_handle_t *pHandle, bool *shared_backend)
+{
+	mali_gralloc_daemon_request request;
+	daemon_reply_buffer reply;
+	int fds[DAEMON_MAX_FDS];
+	int num_fds;
+
+	if (numDescriptors == 0 || numDescriptors > MALI_GRALLOC_DAEMON_MAX_DESCRIPTORS)
+	{
+		return -ENOTCONN;
+	}
+
+	memset(&request, 0, sizeof(request));
+	request.op = MALI_GRALLOC_DAEMON_ALLOCATE;
+	request.num_descriptors = numDescriptors;
+
+	for (uint32_t i = 0; i < numDescriptors; i++)
+	{
+		const buffer_descriptor_t * const bufDescriptor = (const buffer_descriptor_t *)descriptors[i];
+		mali_gralloc_daemon_descriptor * const desc = &request.descriptors[i];
+
+		desc->width = bufDescriptor->width;
+		desc->height = bufDescriptor->height;
+		desc->producer_usage = bufDescriptor->producer_usage;
+		desc->consumer_usage = bufDescriptor->consumer_usage;
+		desc->hal_format = bufDescriptor->hal_format;
+		desc->layer_count = bufDescriptor->layer_count;
+		desc->format_type = (uint32_t)bufDescriptor->format_type;
+	}
+
+	const int fd = daemon_get_connection();
+	if (fd < 0)
+	{
+		return -ENOTCONN;
+	}
+
+	const ssize_t len = daemon_transact(fd, &request, &reply, fds, &num_fds);
+	if (len < 0)
+	{
+		return -ENOTCONN;
+	}
+
+	daemon_put_connection(fd);
+
+	if (reply.reply.result < 0)
+	{
+		return reply.reply.result;
+	}
+
+	const uint8_t *payload = (const uint8_t *)(&reply.reply + 1);
+	uint32_t i = 0;
+	int err = 0;
+
+	if (reply.reply.num_handles != numDescriptors ||
+	    len != (ssize_t)(sizeof(reply.reply) + numDescriptors * sizeof(private_handle_t)) ||
+	    num_fds != (int)(numDescriptors * GRALLOC_ARM_NUM_FDS))
+	{
+		AERR("Allocator daemon sent %u handles and %d fds for %u buffers", reply.reply.num_handles, num_fds,
+		     numDescriptors);
+		err = -EPROTO;
+	}
+
+	for (; i < numDescriptors && err == 0; i++)
+	{
+		const private_handle_t *sent = (const private_handle_t *)(payload + i * sizeof(private_handle_t));
+		private_handle_t *hnd = new private_handle_t(*sent);
+
+		hnd->share_fd = fds[i * GRALLOC_ARM_NUM_FDS];
+		hnd->share_attr_fd = fds[i * GRALLOC_ARM_NUM_FDS + 1];
+		pHandle[i] = hnd;
+
+		if (private_handle_t::validate(hnd) < 0)
+		{
+			AERR("Allocator daemon sent an invalid handle");
+			err = -EPROTO;
+		}
+		else
+		{
+			err = daemon_adopt_handle(hnd);
+		}
+	}
+
+	if (err < 0)
+	{
+		/* The fds of the handles created so far are closed with them. */
+		for (uint32_t j = 0; j < i; j++)
+		{
+			mali_gralloc_buffer_free(pHandle[j]);
+			delete (private_handle_t *)pHandle[j];
+			pHandle[j] = NULL;
+		}
+
+		for (int j = i * GRALLOC_ARM_NUM_FDS; j < num_fds; j++)
+		{
+			close(fds[j]);
+		}
+
+		return err;
+	}
+
+	if (shared_backend != NULL)
+	{
+		*shared_backend = (reply.reply.shared != 0);
+	}
+
+	return 0;
+}
+
+/*
+ * Daemon side. One thread serves every client, a request at a time, and
+ * fills the pool while no request is waiting. A reply which can't be sent
+ * within DAEMON_CLIENT_TIMEOUT_MS drops its client.
+ */
+
+/* Layouts only depend on the descriptor, the capabilities don't change while the daemon runs. */
+#define DAEMON_MAX_LAYOUTS 256
+#define DAEMON_MAX_REQUEST_COUNTS 1024
+
+struct daemon_layout_key
+{
+	mali_gralloc_daemon_descriptor desc;
+
+	bool operator<(const daemon_layout_key &other) const
+	{
+		return memcmp(&desc, &other.desc, sizeof(desc)) < 0;
+	}
+};
+
+/* A buffer allocated ahead, which no process has seen yet. */
+struct daemon_pool_entry
+{
+	daemon_layout_key key;
+	buffer_handle_t handle;
+	bool shared;
+};
+
+static std::map<daemon_layout_key, buffer_descriptor_t> s_layouts;
+static std::map<daemon_layout_key, uint32_t> s_request_counts;
+static std::set<daemon_layout_key> s_pool_refill;
+static std::list<daemon_pool_entry> s_pool;
+static size_t s_pool_bytes = 0;
+
+static int daemon_layout(const mali_gralloc_daemon_descriptor *desc, buffer_descriptor_t *bufDescriptor)
+{
+	daemon_layout_key key;
+	key.desc = *desc;
+
+	std::map<daemon_layout_key, buffer_descriptor_t>::const_iterator it = s_layouts.find(key);
+	if (it != s_layouts.end())
+	{
+		*bufDescriptor = it->second;
+		return 0;
+	}
+
+	if (desc->format_type != MALI_GRALLOC_FORMAT_TYPE_USAGE && desc->format_type != MALI_GRALLOC_FORMAT_TYPE_INTERNAL)
+	{
+		return -EINVAL;
+	}
+
+	memset(bufDescriptor, 0, sizeof(*bufDescriptor));
+	bufDescriptor->signature = sizeof(buffer_descriptor_t);
+	bufDescriptor->width = desc->width;
+	bufDescriptor->height = desc->height;
+	bufDescriptor->producer_usage = desc->producer_usage;
+	bufDescriptor->consumer_usage = desc->consumer_usage;
+	bufDescriptor->hal_format = desc->hal_format;
+	bufDescriptor->layer_count = desc->layer_count;
+	bufDescriptor->format_type = (mali_gralloc_format_type)desc->format_type;
+
+	const int err = mali_gralloc_buffer_layout(bufDescriptor, NULL);
+	if (err < 0)
+	{
+		return err;
+	}
+
+	if (s_layouts.size() >= DAEMON_MAX_LAYOUTS)
+	{
+		s_layouts.clear();
+	}
+
+	s_layouts[key] = *bufDescriptor;
+
+	return 0;
+}
+
+static void daemon_pool_remove(mali_gralloc_module *m, std::list<daemon_pool_entry>::iterator it)
+{
+	s_pool_bytes -= ((const private_handle_t *)it->handle)->size;
+	mali_gralloc_reference_release(m, it->handle, true);
+	s_pool.erase(it);
+}
+
+/* Allocates one spare buffer for a layout asked for more than once. */
+static void daemon_pool_refill(mali_gralloc_module *m, size_t pool_size)
+{
+	const daemon_layout_key key = *s_pool_refill.begin();
+	s_pool_refill.erase(s_pool_refill.begin());
+
+	for (std::list<daemon_pool_entry>::const_iterator it = s_pool.begin(); it != s_pool.end(); ++it)
+	{
+		if (!(it->key < key) && !(key < it->key))
+		{
+			return;
+		}
+	}
+
+	buffer_descriptor_t bufDescriptor;
+	if (daemon_layout(&key.desc, &bufDescriptor) < 0 || bufDescriptor.size > pool_size)
+	{
+		return;
+	}
+
+	gralloc_buffer_descriptor_t descriptor = (gralloc_buffer_descriptor_t)&bufDescriptor;
+	daemon_pool_entry entry;
+
+	entry.key = key;
+	if (mali_gralloc_buffer_allocate_prepared(m, &descriptor, 1, &entry.handle, &entry.shared) < 0)
+	{
+		return;
+	}
+
+	s_pool.push_back(entry);
+	s_pool_bytes += ((const private_handle_t *)entry.handle)->size;
+
+	/* The oldest spares make room: their layouts are the least likely to be asked for again. */
+	while (s_pool_bytes > pool_size)
+	{
+		daemon_pool_remove(m, s_pool.begin());
+	}
+}
+
+static bool daemon_pool_take(const daemon_layout_key &key, buffer_handle_t *pHandle, bool *shared)
+{
+	for (std::list<daemon_pool_entry>::iterator it = s_pool.begin(); it != s_pool.end(); ++it)
+	{
+		if (!(it->key < key) && !(key < it->key))
+		{
+			*pHandle = it->handle;
+			*shared = it->shared;
+			s_pool_bytes -= ((const private_handle_t *)it->handle)->size;
+			s_pool.erase(it);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static int daemon_allocate(mali_gralloc_module *m, const mali_gralloc_daemon_request *request, size_t pool_size,
+                           buffer_handle_t *pHandle, bool *shared)
+{
+	buffer_descriptor_t bufDescriptors[MALI_GRALLOC_DAEMON_MAX_DESCRIPTORS];
+	gralloc_buffer_descriptor_t descriptors[MALI_GRALLOC_DAEMON_MAX_DESCRIPTORS];
+	const uint32_t num = request->num_descriptors;
+
+	for (uint32_t i = 0; i < num; i++)
+	{
+		const int err = daemon_layout(&request->descriptors[i], &bufDescriptors[i]);
+		if (err < 0)
+		{
+			return err;
+		}
+
+		descriptors[i] = (gralloc_buffer_descriptor_t)&bufDescriptors[i];
+	}
+
+	if (num == 1 && pool_size > 0)
+	{
+		daemon_layout_key key;
+		key.desc = request->descriptors[0];
+
+		if (s_request_counts.size() >= DAEMON_MAX_REQUEST_COUNTS)
+		{
+			s_request_counts.clear();
+		}
+
+		if (++s_request_counts[key] > 1)
+		{
+			s_pool_refill.insert(key);
+		}
+
+		if (daemon_pool_take(key, pHandle, shared))
+		{
+			return 0;
+		}
+	}
+
+	return mali_gralloc_buffer_allocate_prepared(m, descriptors, num, pHandle, shared);
+}
+
+static bool daemon_send(int fd, const mali_gralloc_daemon_reply *reply, const void *payload, size_t payload_size,
+                        const int *fds, int num_fds)
+{
+	char control[CMSG_SPACE(DAEMON_MAX_FDS * sizeof(int))];
+	struct iovec iov[2] = { { (void *)reply, sizeof(*reply) }, { (void *)payload, payload_size } };
+	struct msghdr msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = (payload_size > 0) ? 2 : 1;
+
+	if (num_fds > 0)
+	{
+		memset(control, 0, sizeof(control));
+		msg.msg_control = control;
+		msg.msg_controllen = CMSG_SPACE(num_fds * sizeof(int));
+
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(num_fds * sizeof(int));
+		memcpy(CMSG_DATA(cmsg), fds, num_fds * sizeof(int));
+	}
+
+	return sendmsg(fd, &msg, MSG_NOSIGNAL) == (ssize_t)(sizeof(*reply) + payload_size);
+}
+
+/* Returns false when the client is gone or must be dropped. */
+static bool daemon_serve_request(mali_gralloc_module *m, int fd, size_t pool_size)
+{
+	mali_gralloc_daemon_request request;
+	mali_gralloc_daemon_reply reply;
+
+	const ssize_t len = recv(fd, &request, sizeof(request), 0);
+	if (len <= 0)
+	{
+		return false;
+	}
+
+	memset(&reply, 0, sizeof(reply));
+	reply.magic = MALI_GRALLOC_DAEMON_MAGIC;
+	reply.version = MALI_GRALLOC_DAEMON_VERSION;
+	reply.op = request.op;
+
+	if (len < (ssize_t)offsetof(mali_gralloc_daemon_request, descriptors) ||
+	    request.magic != MALI_GRALLOC_DAEMON_MAGIC || request.version != MALI_GRALLOC_DAEMON_VERSION ||
+	    request.handle_size != sizeof(private_handle_t))
+	{
+		AWAR("Allocator daemon client built differently, refusing it");
+		reply.result = -EPROTO;
+		daemon_send(fd, &reply, NULL, 0, NULL, 0);
+		return false;
+	}
+
+	if (request.op == MALI_GRALLOC_DAEMON_HELLO)
+	{
+		mali_gralloc_daemon_caps caps;
+
+		mali_gralloc_get_caps(&caps.gpu, &caps.vpu, &caps.dpu, &caps.cam);
+
+		return daemon_send(fd, &reply, &caps, sizeof(caps), NULL, 0);
+	}
+
+	const uint32_t num = request.num_descriptors;
+
+	if (request.op != MALI_GRALLOC_DAEMON_ALLOCATE || num == 0 || num > MALI_GRALLOC_DAEMON_MAX_DESCRIPTORS ||
+	    len < (ssize_t)(offsetof(mali_gralloc_daemon_request, descriptors) + num * sizeof(request.descriptors[0])))
+	{
+		reply.result = -EINVAL;
+		return daemon_send(fd, &reply, NULL, 0, NULL, 0);
+	}
+
+	buffer_handle_t handles[MALI_GRALLOC_DAEMON_MAX_DESCRIPTORS];
+	bool shared = false;
+
+	reply.result = daemon_allocate(m, &request, pool_size, handles, &shared);
+	if (reply.result < 0)
+	{
+		return daemon_send(fd, &reply, NULL, 0, NULL, 0);
+	}
+
+	std::vector<uint8_t> payload(num * sizeof(private_handle_t));
+	int fds[DAEMON_MAX_FDS];
+
+	for (uint32_t i = 0; i < num; i++)
+	{
+		const private_handle_t * const hnd = (const private_handle_t *)handles[i];
+
+		memcpy(&payload[i * sizeof(private_handle_t)], hnd, sizeof(private_handle_t));
+		fds[i * GRALLOC_ARM_NUM_FDS] = hnd->share_fd;
+		fds[i * GRALLOC_ARM_NUM_FDS + 1] = hnd->share_attr_fd;
+	}
+
+	reply.num_handles = num;
+	reply.shared = shared ? 1 : 0;
+
+	const bool sent = daemon_send(fd, &reply, &payload[0], payload.size(), fds, num * GRALLOC_ARM_NUM_FDS);
+
+	/* The client has its own fds now, which keep the memory. */
+	for (uint32_t i = 0; i < num; i++)
+	{
+		mali_gralloc_reference_release(m, handles[i], true);
+	}
+
+	return sent;
+}
+
+extern "C" int mali_gralloc_daemon_serve(const hw_module_t *module, int listen_fd, size_t pool_size)
+{
+	mali_gralloc_module * const m = reinterpret_cast<mali_gralloc_module *>(const_cast<hw_module_t *>(module));
+	std::vector<struct pollfd> fds;
+	struct pollfd pfd;
+
+	/* The daemon allocates for itself. */
+	pthread_mutex_lock(&s_daemon_lock);
+	for (size_t i = 0; i < s_daemon_idle.size(); i++)
+	{
+		close(s_daemon_idle[i]);
+	}
+	s_daemon_idle.clear();
+	s_daemon_retry_ns = INT64_MAX;
+	pthread_mutex_unlock(&s_daemon_lock);
+
+	pfd.fd = listen_fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	fds.push_back(pfd);
+
+	AINF("Allocator daemon serving, pool of %zu KB", pool_size / 1024);
+
+	for (;;)
+	{
+		const int ready = poll(&fds[0], fds.size(), s_pool_refill.empty() ? -1 : 0);
+
+		if (ready < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		else if (ready < 0)
+		{
+			AERR("Allocator daemon poll failed: %s", strerror(errno));
+			return -errno;
+		}
+		else if (ready == 0)
+		{
+			daemon_pool_refill(m, pool_size);
+			continue;
+		}
+
+		for (size_t i = fds.size() - 1; i > 0; i--)
+		{
+			if ((fds[i].revents & (POLLIN | POLLHUP | POLLERR)) && !daemon_serve_request(m, fds[i].fd, pool_size))
+			{
+				close(fds[i].fd);
+				fds.erase(fds.begin() + i);
+			}
+		}
+
+		if (fds[0].revents & POLLIN)
+		{
+			pfd.fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+
+			if (pfd.fd >= 0)
+			{
+				/* Replies are sent from this one thread, so a client that stops reading must not block it. */
+				const struct timeval timeout = { 0, DAEMON_CLIENT_TIMEOUT_MS * 1000 };
+				setsockopt(pfd.fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+				fds.push_back(pfd);
+			}
+		}
+	}
+}
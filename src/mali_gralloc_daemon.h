@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2018 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MALI_GRALLOC_DAEMON_H_
+#define MALI_GRALLOC_DAEMON_H_
+
+#include <stdint.h>
+
+#include <hardware/hardware.h>
+
+#include "mali_gralloc_bufferdescriptor.h"
+#include "mali_gralloc_formats.h"
+
+/*
+ * Allocator daemon.
+ *
+ * With GRALLOC_ALLOC_DAEMON=1 processes forward allocations to gralloc_allocd
+ * over a SOCK_SEQPACKET Unix socket. The daemon lays the buffers out, picks
+ * the heap and allocates them, then passes the fds back with SCM_RIGHTS. It
+ * probes the format capabilities once for every process, and keeps a cache
+ * of layouts and a pool of buffers allocated ahead for layouts which are
+ * asked for repeatedly. Processes allocate themselves while it isn't running.
+ */
+#define MALI_GRALLOC_DAEMON_MAGIC 0x47524144 /* "GRAD" */
+#define MALI_GRALLOC_DAEMON_VERSION 1
+#define MALI_GRALLOC_DAEMON_MAX_DESCRIPTORS 8
+
+typedef enum
+{
+	MALI_GRALLOC_DAEMON_HELLO = 1, /* Replies with mali_gralloc_daemon_caps. */
+	MALI_GRALLOC_DAEMON_ALLOCATE,  /* Replies with a private_handle_t and its fds for each descriptor. */
+} mali_gralloc_daemon_op;
+
+/* Descriptor as passed in, the daemon does the rest. */
+typedef struct
+{
+	uint32_t width;
+	uint32_t height;
+	uint64_t producer_usage;
+	uint64_t consumer_usage;
+	uint64_t hal_format;
+	uint32_t layer_count;
+	uint32_t format_type;
+} mali_gralloc_daemon_descriptor;
+
+typedef struct
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t op;
+	uint32_t handle_size; /* sizeof(private_handle_t): handles are passed as they are, so builds must match. */
+	uint32_t num_descriptors;
+	mali_gralloc_daemon_descriptor descriptors[MALI_GRALLOC_DAEMON_MAX_DESCRIPTORS];
+} mali_gralloc_daemon_request;
+
+/* Followed by the payload of the operation. */
+typedef struct
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t op;
+	int32_t result;
+	uint32_t num_handles;
+	uint32_t shared;
+	uint32_t reserved;
+} mali_gralloc_daemon_reply;
+
+typedef struct
+{
+	mali_gralloc_format_caps gpu;
+	mali_gralloc_format_caps vpu;
+	mali_gralloc_format_caps dpu;
+	mali_gralloc_format_caps cam;
+} mali_gralloc_daemon_caps;
+
+/*
+ * Connects to the daemon unless already connected, and takes the format
+ * capabilities it found. Retried at most once a second when it fails.
+ */
+void mali_gralloc_daemon_connect(void);
+
+/*
+ * Allocates the buffers through the daemon. Returns 0, the error of the
+ * allocation, or -ENOTCONN when there is no daemon or it can't be used.
+ */
+int mali_gralloc_daemon_allocate(const gralloc_buffer_descriptor_t *descriptors, uint32_t numDescriptors,
+                                 buffer_handle_t *pHandle, bool *shared_backend);
+
+/*
+ * Serves the clients connecting to 'listen_fd' until it fails, keeping up
+ * to 'pool_size' bytes of buffers allocated ahead. Looked up by
+ * gralloc_allocd in the module it loaded, so it runs against that module.
+ */
+extern "C" int mali_gralloc_daemon_serve(const hw_module_t *module, int listen_fd, size_t pool_size);
+
+#endif /* MALI_GRALLOC_DAEMON_H_ */
@@ -31,6 +31,9 @@
 #include "mali_gralloc_module.h"
 #include "gralloc_priv.h"
 #include "mali_gralloc_debug.h"
+#include "framebuffer_stats.h"
+#include "format_stats.h"
+#include "mali_gralloc_cache_policy.h"
 
 static pthread_mutex_t dump_lock = PTHREAD_MUTEX_INITIALIZER;
 static std::vector<private_handle_t *> dump_buffers;
@@ -105,6 +108,10 @@ void mali_gralloc_dump_buffers(android::String8 &dumpStrings, uint32_t *outSize)
 	mali_gralloc_dump_string(
 	    dumpStrings, "---------------------End dump Gralloc buffers info with num %zu----------------------\n", num);
 
+	fb_stats_dump(dumpStrings);
+	format_stats_dump(dumpStrings);
+	mali_gralloc_cache_policy_dump(dumpStrings);
+
 	*outSize = dumpStrings.size();
 }
 
@@ -0,0 +1,300 @@
+/*
+ * Copyright (C) 2018 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include <drm/drm_fourcc.h>
+
+#include <log/log.h>
+#include <hardware/hardware.h>
+
+#if GRALLOC_USE_GRALLOC1_API == 1
+#include <hardware/gralloc1.h>
+#else
+#include <hardware/gralloc.h>
+#endif
+
+#include "mali_gralloc_module.h"
+#include "mali_gralloc_private_interface_types.h"
+#include "mali_gralloc_buffer.h"
+#include "mali_gralloc_formats.h"
+#include "gralloc_helper.h"
+#include "format_info.h"
+#include "mali_gralloc_drm_format.h"
+
+/* Bits of an ARM modifier below the vendor and modifier type fields. */
+#define ARM_MODIFIER_VALUE_MASK 0x000fffffffffffffULL
+
+struct drm_format_map
+{
+	uint32_t base_format;
+	uint32_t fourcc;
+};
+
+/*
+ * Plane order matches: YV12 is Y, Cr, Cb like DRM_FORMAT_YVU420. Formats
+ * which newer kernels added are only mapped when the headers have them.
+ */
+static const drm_format_map s_drm_formats[] = {
+	{ MALI_GRALLOC_FORMAT_INTERNAL_RGBA_8888, DRM_FORMAT_ABGR8888 },
+	{ MALI_GRALLOC_FORMAT_INTERNAL_RGBX_8888, DRM_FORMAT_XBGR8888 },
+	{ MALI_GRALLOC_FORMAT_INTERNAL_BGRA_8888, DRM_FORMAT_ARGB8888 },
+	{ MALI_GRALLOC_FORMAT_INTERNAL_RGB_888, DRM_FORMAT_BGR888 },
+	{ MALI_GRALLOC_FORMAT_INTERNAL_RGB_565, DRM_FORMAT_RGB565 },
+#if PLATFORM_SDK_VERSION >= 26
+	{ MALI_GRALLOC_FORMAT_INTERNAL_RGBA_1010102, DRM_FORMAT_ABGR2101010 },
+#ifdef DRM_FORMAT_ABGR16161616F
+	{ MALI_GRALLOC_FORMAT_INTERNAL_RGBA_16161616, DRM_FORMAT_ABGR16161616F },
+#endif
+#endif
+	{ MALI_GRALLOC_FORMAT_INTERNAL_YV12, DRM_FORMAT_YVU420 },
+	{ MALI_GRALLOC_FORMAT_INTERNAL_Y8, DRM_FORMAT_R8 },
+#ifdef DRM_FORMAT_R16
+	{ MALI_GRALLOC_FORMAT_INTERNAL_Y16, DRM_FORMAT_R16 },
+#endif
+	{ MALI_GRALLOC_FORMAT_INTERNAL_NV12, DRM_FORMAT_NV12 },
+	{ MALI_GRALLOC_FORMAT_INTERNAL_NV21, DRM_FORMAT_NV21 },
+	{ MALI_GRALLOC_FORMAT_INTERNAL_YUV422_8BIT, DRM_FORMAT_YUYV },
+#ifdef DRM_FORMAT_P010
+	{ MALI_GRALLOC_FORMAT_INTERNAL_P010, DRM_FORMAT_P010 },
+#endif
+#ifdef DRM_FORMAT_P210
+	{ MALI_GRALLOC_FORMAT_INTERNAL_P210, DRM_FORMAT_P210 },
+#endif
+#ifdef DRM_FORMAT_Y210
+	{ MALI_GRALLOC_FORMAT_INTERNAL_Y210, DRM_FORMAT_Y210 },
+#endif
+#ifdef DRM_FORMAT_Y410
+	{ MALI_GRALLOC_FORMAT_INTERNAL_Y410, DRM_FORMAT_Y410 },
+#endif
+#ifdef DRM_FORMAT_Y0L2
+	{ MALI_GRALLOC_FORMAT_INTERNAL_Y0L2, DRM_FORMAT_Y0L2 },
+#endif
+#ifdef DRM_FORMAT_YUV420_8BIT
+	{ MALI_GRALLOC_FORMAT_INTERNAL_YUV420_8BIT_I, DRM_FORMAT_YUV420_8BIT },
+#endif
+#ifdef DRM_FORMAT_YUV420_10BIT
+	{ MALI_GRALLOC_FORMAT_INTERNAL_YUV420_10BIT_I, DRM_FORMAT_YUV420_10BIT },
+#endif
+};
+
+static const size_t s_num_drm_formats = sizeof(s_drm_formats) / sizeof(s_drm_formats[0]);
+
+uint32_t mali_gralloc_drm_fourcc(uint64_t format)
+{
+	const uint32_t base_format = (uint32_t)(format & MALI_GRALLOC_INTFMT_FMT_MASK);
+
+	for (size_t i = 0; i < s_num_drm_formats; i++)
+	{
+		if (s_drm_formats[i].base_format == base_format)
+		{
+			return s_drm_formats[i].fourcc;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Gralloc lays out AFBC buffers sparsely, and RGB formats with the YUV
+ * transform, which is what the GPU and display processors expect.
+ */
+uint64_t mali_gralloc_drm_modifier(uint64_t format)
+{
+	/* No DRM modifier describes gralloc's block-linear layout. */
+	if (format & MALI_GRALLOC_INTFMT_BLOCK_LINEAR)
+	{
+		return DRM_FORMAT_MOD_INVALID;
+	}
+
+	if ((format & MALI_GRALLOC_INTFMT_AFBCENABLE_MASK) == 0)
+	{
+		return DRM_FORMAT_MOD_LINEAR;
+	}
+
+#ifdef DRM_FORMAT_MOD_ARM_AFBC
+	const int32_t format_idx = get_format_index(format & MALI_GRALLOC_INTFMT_FMT_MASK);
+
+	if (format_idx < 0 || (format & MALI_GRALLOC_INTFMT_AFBC_DOUBLE_BODY))
+	{
+		return DRM_FORMAT_MOD_INVALID;
+	}
+
+	uint64_t afbc = AFBC_FORMAT_MOD_SPARSE;
+
+	if (!formats[format_idx].is_yuv)
+	{
+		afbc |= AFBC_FORMAT_MOD_YTR;
+	}
+
+	if (format & MALI_GRALLOC_INTFMT_AFBC_EXTRAWIDEBLK)
+	{
+		/* Multi-plane AFBC has 32x8 luma and 64x4 chroma superblocks. */
+		if (formats[format_idx].npln > 1)
+		{
+#ifdef AFBC_FORMAT_MOD_BLOCK_SIZE_32x8_64x4
+			afbc |= AFBC_FORMAT_MOD_BLOCK_SIZE_32x8_64x4;
+#else
+			return DRM_FORMAT_MOD_INVALID;
+#endif
+		}
+		else
+		{
+#ifdef AFBC_FORMAT_MOD_BLOCK_SIZE_64x4
+			afbc |= AFBC_FORMAT_MOD_BLOCK_SIZE_64x4;
+#else
+			return DRM_FORMAT_MOD_INVALID;
+#endif
+		}
+	}
+	else if (format & MALI_GRALLOC_INTFMT_AFBC_WIDEBLK)
+	{
+		afbc |= AFBC_FORMAT_MOD_BLOCK_SIZE_32x8;
+	}
+	else
+	{
+		afbc |= AFBC_FORMAT_MOD_BLOCK_SIZE_16x16;
+	}
+
+	if (format & MALI_GRALLOC_INTFMT_AFBC_SPLITBLK)
+	{
+		afbc |= AFBC_FORMAT_MOD_SPLIT;
+	}
+
+	if (format & MALI_GRALLOC_INTFMT_AFBC_TILED_HEADERS)
+	{
+#ifdef AFBC_FORMAT_MOD_TILED
+		afbc |= AFBC_FORMAT_MOD_TILED;
+#else
+		return DRM_FORMAT_MOD_INVALID;
+#endif
+	}
+
+	return DRM_FORMAT_MOD_ARM_AFBC(afbc);
+#else
+	return DRM_FORMAT_MOD_INVALID;
+#endif
+}
+
+uint64_t mali_gralloc_drm_apply_modifier(uint64_t base_format, uint64_t modifier)
+{
+	base_format &= MALI_GRALLOC_INTFMT_FMT_MASK;
+
+	if (modifier == DRM_FORMAT_MOD_LINEAR)
+	{
+		return base_format;
+	}
+
+#ifdef DRM_FORMAT_MOD_ARM_AFBC
+	if ((modifier & ~ARM_MODIFIER_VALUE_MASK) != DRM_FORMAT_MOD_ARM_AFBC(0))
+	{
+		return 0;
+	}
+
+	const uint64_t afbc = modifier & ARM_MODIFIER_VALUE_MASK;
+	uint64_t format = base_format | MALI_GRALLOC_INTFMT_AFBC_BASIC;
+
+	switch (afbc & AFBC_FORMAT_MOD_BLOCK_SIZE_MASK)
+	{
+	case AFBC_FORMAT_MOD_BLOCK_SIZE_16x16:
+		break;
+	case AFBC_FORMAT_MOD_BLOCK_SIZE_32x8:
+		format |= MALI_GRALLOC_INTFMT_AFBC_WIDEBLK;
+		break;
+#ifdef AFBC_FORMAT_MOD_BLOCK_SIZE_64x4
+	case AFBC_FORMAT_MOD_BLOCK_SIZE_64x4:
+		format |= MALI_GRALLOC_INTFMT_AFBC_EXTRAWIDEBLK;
+		break;
+#endif
+#ifdef AFBC_FORMAT_MOD_BLOCK_SIZE_32x8_64x4
+	case AFBC_FORMAT_MOD_BLOCK_SIZE_32x8_64x4:
+		format |= MALI_GRALLOC_INTFMT_AFBC_EXTRAWIDEBLK;
+		break;
+#endif
+	default:
+		return 0;
+	}
+
+	if (afbc & AFBC_FORMAT_MOD_SPLIT)
+	{
+		format |= MALI_GRALLOC_INTFMT_AFBC_SPLITBLK;
+	}
+
+#ifdef AFBC_FORMAT_MOD_TILED
+	if (afbc & AFBC_FORMAT_MOD_TILED)
+	{
+		format |= MALI_GRALLOC_INTFMT_AFBC_TILED_HEADERS;
+	}
+#endif
+
+	/*
+	 * Gralloc has a single layout for each set of modifier bits, so the
+	 * modifier is only supported if it is the one of that layout. This
+	 * rejects dense buffers, YUV transform mismatches and unknown flags.
+	 */
+	if (mali_gralloc_drm_modifier(format) != modifier)
+	{
+		return 0;
+	}
+
+	return format;
+#else
+	return 0;
+#endif
+}
+
+uint64_t mali_gralloc_drm_to_format(uint32_t fourcc, uint64_t modifier)
+{
+	for (size_t i = 0; i < s_num_drm_formats; i++)
+	{
+		if (s_drm_formats[i].fourcc == fourcc)
+		{
+			return mali_gralloc_drm_apply_modifier(s_drm_formats[i].base_format, modifier);
+		}
+	}
+
+	return 0;
+}
+
+int mali_gralloc_drm_buffer_info(const private_handle_t *hnd, mali_gralloc_drm_info *info)
+{
+	const uint32_t fourcc = mali_gralloc_drm_fourcc(hnd->alloc_format);
+	const uint64_t modifier = mali_gralloc_drm_modifier(hnd->alloc_format);
+
+	if (fourcc == 0 || modifier == DRM_FORMAT_MOD_INVALID)
+	{
+		return -EINVAL;
+	}
+
+	memset(info, 0, sizeof(*info));
+	info->fourcc = fourcc;
+	info->modifier = modifier;
+
+	/* Planes after the first are only used when they have a stride. */
+	for (uint32_t p = 0; p < MALI_GRALLOC_DRM_MAX_PLANES && (p == 0 || hnd->plane_info[p].byte_stride != 0); p++)
+	{
+		info->fds[p] = hnd->share_fd;
+		info->offsets[p] = (uint32_t)(hnd->offset + hnd->plane_info[p].offset);
+		info->pitches[p] = hnd->plane_info[p].byte_stride;
+		info->num_planes++;
+	}
+
+	return 0;
+}
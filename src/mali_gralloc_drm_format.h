@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2018 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MALI_GRALLOC_DRM_FORMAT_H_
+#define MALI_GRALLOC_DRM_FORMAT_H_
+
+#include <stdint.h>
+
+#include "mali_gralloc_private_interface_types.h"
+
+struct private_handle_t;
+
+/*
+ * Translation between gralloc formats (base format + AFBC modifier bits) and
+ * DRM fourccs and format modifiers, for sharing buffers with EGL, Vulkan,
+ * KMS and V4L2 through dma-buf import.
+ */
+
+/* Returns the DRM fourcc of the base format of 'format', or 0 if there is none. */
+uint32_t mali_gralloc_drm_fourcc(uint64_t format);
+
+/*
+ * Returns the DRM format modifier of the layout of 'format': linear or an
+ * AFBC variant. Returns DRM_FORMAT_MOD_INVALID when DRM can't describe it.
+ */
+uint64_t mali_gralloc_drm_modifier(uint64_t format);
+
+/*
+ * Returns 'base_format' with the modifier bits describing the DRM 'modifier',
+ * or 0 if gralloc can't lay the format out that way.
+ */
+uint64_t mali_gralloc_drm_apply_modifier(uint64_t base_format, uint64_t modifier);
+
+/* Returns the gralloc format of a DRM fourcc and modifier, or 0 if there is none. */
+uint64_t mali_gralloc_drm_to_format(uint32_t fourcc, uint64_t modifier);
+
+/* Describes a buffer for dma-buf import. Returns 0, or -EINVAL if DRM can't describe it. */
+int mali_gralloc_drm_buffer_info(const private_handle_t *hnd, mali_gralloc_drm_info *info);
+
+#endif /* MALI_GRALLOC_DRM_FORMAT_H_ */
@@ -31,6 +31,7 @@
 #include "gralloc_priv.h"
 #include "mali_gralloc_bufferallocation.h"
 #include "format_info.h"
+#include "format_stats.h"
 
 #if GRALLOC_USE_LEGACY_CALCS == 1
 #include "legacy/buffer_alloc.h"
@@ -47,16 +48,19 @@ static bool runtime_caps_read = false;
 #define MALI_GRALLOC_GPU_LIB_NAME "libGLES_mali.so"
 #define MALI_GRALLOC_VPU_LIB_NAME "libstagefrighthw.so"
 #define MALI_GRALLOC_DPU_LIB_NAME "hwcomposer.default.so"
+#define MALI_GRALLOC_CAM_LIB_NAME "camera.default.so"
 /* VPU library path is the same for 32-bit and 64-bit. */
 #define MALI_GRALLOC_VPU_LIBRARY_PATH "/system/lib/"
 #if defined(__LP64__)
 #define MALI_GRALLOC_GPU_LIBRARY_PATH1 "/vendor/lib64/egl/"
 #define MALI_GRALLOC_GPU_LIBRARY_PATH2 "/system/lib64/egl/"
 #define MALI_GRALLOC_DPU_LIBRARY_PATH "/vendor/lib64/hw/"
+#define MALI_GRALLOC_CAM_LIBRARY_PATH "/vendor/lib64/hw/"
 #else
 #define MALI_GRALLOC_GPU_LIBRARY_PATH1 "/vendor/lib/egl/"
 #define MALI_GRALLOC_GPU_LIBRARY_PATH2 "/system/lib/egl/"
 #define MALI_GRALLOC_DPU_LIBRARY_PATH "/vendor/lib/hw/"
+#define MALI_GRALLOC_CAM_LIBRARY_PATH "/vendor/lib/hw/"
 #endif
 #define GRALLOC_AFBC_MIN_SIZE 75
 
@@ -267,6 +271,23 @@ static void apply_gpu_producer_limitations(uint64_t req_format_mapped, uint64_t
 	}
 }
 
+static void apply_camera_producer_limitations(uint64_t req_format_mapped, uint64_t *producer_runtime_mask)
+{
+	if (is_android_yuv_format(req_format_mapped))
+	{
+		if (cam_runtime_caps.caps_mask & MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_YUV_NOWRITE)
+		{
+			*producer_runtime_mask &= ~MALI_GRALLOC_FORMAT_CAPABILITY_AFBCENABLE_MASK;
+		}
+		else
+		{
+			/* As for the GPU, ISPs writing YUV AFBC only use 16x16 superblocks. */
+			*producer_runtime_mask &=
+				~(MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_SPLITBLK | MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_WIDEBLK);
+		}
+	}
+}
+
 static void apply_video_consumer_limitations(uint64_t req_format_mapped, uint64_t *consumer_runtime_mask)
 {
 	if (is_android_yuv_format(req_format_mapped))
@@ -578,18 +599,117 @@ static uint64_t determine_best_format(int req_format, mali_gralloc_producer_type
 	else if (producer == MALI_GRALLOC_PRODUCER_CAMERA &&
 	         cam_runtime_caps.caps_mask & MALI_GRALLOC_FORMAT_CAPABILITY_OPTIONS_PRESENT)
 	{
+		/*
+		 * AFBC is only enabled when every consumer can read what the ISP
+		 * writes. Split and wide block are not used: camera streams are
+		 * read unrotated and most ISPs only write 16x16 superblocks.
+		 */
+		cam_mask &= producer_runtime_mask;
+
 		if (consumer == MALI_GRALLOC_CONSUMER_GPU_OR_DISPLAY)
 		{
-			/* Fall-through. To be decided.*/
+			gpu_mask &= consumer_runtime_mask;
+			dpu_mask &= consumer_runtime_mask;
+
+			if (cam_mask & MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_BASIC &&
+			    gpu_mask & MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_BASIC &&
+			    dpu_mask & MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_BASIC)
+			{
+				internal_format |= MALI_GRALLOC_INTFMT_AFBC_BASIC;
+			}
+
+			if (cam_mask & MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_TILED_HEADERS &&
+			    gpu_mask & MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_TILED_HEADERS &&
+			    dpu_mask & MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_TILED_HEADERS)
+			{
+				internal_format |= MALI_GRALLOC_INTFMT_AFBC_TILED_HEADERS;
+			}
+
+#if PLATFORM_SDK_VERSION >= 26
+			/*
+			 * Ensure requested format is supported by producer/consumer.
+			 * GPU composition must always be supported in case of fallback from DPU.
+			 * It is therefore not necessary to enforce DPU support.
+			 */
+			if (req_format == MALI_GRALLOC_FORMAT_INTERNAL_RGBA_1010102 &&
+			    ((cam_mask & MALI_GRALLOC_FORMAT_CAPABILITY_PIXFMT_RGBA1010102) == 0 ||
+			     (gpu_mask & MALI_GRALLOC_FORMAT_CAPABILITY_PIXFMT_RGBA1010102) == 0))
+			{
+				internal_format = 0;
+			}
+			else if (req_format == MALI_GRALLOC_FORMAT_INTERNAL_RGBA_16161616 &&
+			         ((cam_mask & MALI_GRALLOC_FORMAT_CAPABILITY_PIXFMT_RGBA16161616) == 0 ||
+			          (gpu_mask & MALI_GRALLOC_FORMAT_CAPABILITY_PIXFMT_RGBA16161616) == 0))
+			{
+				internal_format = 0;
+			}
+#endif
 		}
 		else if (consumer == MALI_GRALLOC_CONSUMER_GPU_EXCL)
 		{
-			/* Fall-through. To be decided.*/
+			gpu_mask &= consumer_runtime_mask;
+
+			if (cam_mask & MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_BASIC &&
+			    gpu_mask & MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_BASIC)
+			{
+				internal_format |= MALI_GRALLOC_INTFMT_AFBC_BASIC;
+			}
+
+			if (cam_mask & MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_TILED_HEADERS &&
+			    gpu_mask & MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_TILED_HEADERS)
+			{
+				internal_format |= MALI_GRALLOC_INTFMT_AFBC_TILED_HEADERS;
+			}
+
+#if PLATFORM_SDK_VERSION >= 26
+			/* Reject unsupported formats */
+			if (req_format == MALI_GRALLOC_FORMAT_INTERNAL_RGBA_1010102 &&
+			    ((cam_mask & MALI_GRALLOC_FORMAT_CAPABILITY_PIXFMT_RGBA1010102) == 0 ||
+			     (gpu_mask & MALI_GRALLOC_FORMAT_CAPABILITY_PIXFMT_RGBA1010102) == 0))
+			{
+				internal_format = 0;
+			}
+			else if (req_format == MALI_GRALLOC_FORMAT_INTERNAL_RGBA_16161616 &&
+			         ((cam_mask & MALI_GRALLOC_FORMAT_CAPABILITY_PIXFMT_RGBA16161616) == 0 ||
+			          (gpu_mask & MALI_GRALLOC_FORMAT_CAPABILITY_PIXFMT_RGBA16161616) == 0))
+			{
+				internal_format = 0;
+			}
+#endif
 		}
 		else if (consumer == MALI_GRALLOC_CONSUMER_VIDEO_ENCODER)
 		{
-			/* Fall-through. To be decided.*/
+			vpu_mask &= consumer_runtime_mask;
+
+			if (cam_mask & MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_BASIC &&
+			    vpu_mask & MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_BASIC)
+			{
+				internal_format |= MALI_GRALLOC_INTFMT_AFBC_BASIC;
+			}
+
+			if (cam_mask & MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_TILED_HEADERS &&
+			    vpu_mask & MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_TILED_HEADERS)
+			{
+				internal_format |= MALI_GRALLOC_INTFMT_AFBC_TILED_HEADERS;
+			}
+
+#if PLATFORM_SDK_VERSION >= 26
+			/* Reject unsupported formats */
+			if (req_format == MALI_GRALLOC_FORMAT_INTERNAL_RGBA_1010102 &&
+			    ((cam_mask & MALI_GRALLOC_FORMAT_CAPABILITY_PIXFMT_RGBA1010102) == 0 ||
+			     (vpu_mask & MALI_GRALLOC_FORMAT_CAPABILITY_PIXFMT_RGBA1010102) == 0))
+			{
+				internal_format = 0;
+			}
+			else if (req_format == MALI_GRALLOC_FORMAT_INTERNAL_RGBA_16161616 &&
+			         ((cam_mask & MALI_GRALLOC_FORMAT_CAPABILITY_PIXFMT_RGBA16161616) == 0 ||
+			          (vpu_mask & MALI_GRALLOC_FORMAT_CAPABILITY_PIXFMT_RGBA16161616) == 0))
+			{
+				internal_format = 0;
+			}
+#endif
 		}
+		/* Unknown consumers, such as a second ISP pass, get the requested format without AFBC. */
 	}
 	else if (producer == MALI_GRALLOC_PRODUCER_DISPLAY_AEU &&
 			 consumer == MALI_GRALLOC_CONSUMER_DISPLAY_EXCL &&
@@ -614,6 +734,88 @@ static uint64_t determine_best_format(int req_format, mali_gralloc_producer_type
 	return internal_format;
 }
 
+/*
+ * Returns the capabilities shared by every IP that may access a buffer as
+ * 'producer' or 'consumer', or 0 when any of them is not a hardware IP.
+ */
+static uint64_t get_ip_caps(mali_gralloc_producer_type producer, mali_gralloc_consumer_type consumer)
+{
+	uint64_t producer_caps = 0;
+	uint64_t consumer_caps = 0;
+
+	switch (producer)
+	{
+	case MALI_GRALLOC_PRODUCER_GPU:
+		producer_caps = gpu_runtime_caps.caps_mask;
+		break;
+	case MALI_GRALLOC_PRODUCER_VIDEO_DECODER:
+		producer_caps = vpu_runtime_caps.caps_mask;
+		break;
+	case MALI_GRALLOC_PRODUCER_CAMERA:
+		producer_caps = cam_runtime_caps.caps_mask;
+		break;
+	default:
+		return 0;
+	}
+
+	switch (consumer)
+	{
+	case MALI_GRALLOC_CONSUMER_GPU_EXCL:
+		consumer_caps = gpu_runtime_caps.caps_mask;
+		break;
+	case MALI_GRALLOC_CONSUMER_GPU_OR_DISPLAY:
+		consumer_caps = gpu_runtime_caps.caps_mask & dpu_runtime_caps.caps_mask;
+		break;
+	case MALI_GRALLOC_CONSUMER_DISPLAY_EXCL:
+		consumer_caps = dpu_runtime_caps.caps_mask;
+		break;
+	case MALI_GRALLOC_CONSUMER_VIDEO_ENCODER:
+		consumer_caps = vpu_runtime_caps.caps_mask;
+		break;
+	default:
+		return 0;
+	}
+
+	return producer_caps & consumer_caps;
+}
+
+/*
+ * Uncompressed formats are laid out in blocks, rather than lines, when the
+ * producer and consumer can both access that layout. It keeps column-wise
+ * and rotated access within a few cache lines. CPU access goes through a
+ * linear copy (see mali_gralloc_bufferaccess.cpp).
+ */
+static void apply_block_linear(uint64_t *internal_format, mali_gralloc_producer_type producer,
+                               mali_gralloc_consumer_type consumer, uint64_t producer_runtime_mask,
+                               uint64_t consumer_runtime_mask)
+{
+#if GRALLOC_USE_LEGACY_LOCK == 1
+	/* Legacy lock hands out the mapping as it is, without a linear copy. */
+	return;
+#endif
+
+	if (*internal_format == 0 || (*internal_format & MALI_GRALLOC_INTFMT_AFBCENABLE_MASK))
+	{
+		return;
+	}
+
+	const uint64_t caps = get_ip_caps(producer, consumer) & producer_runtime_mask & consumer_runtime_mask;
+	if ((caps & MALI_GRALLOC_FORMAT_CAPABILITY_BLOCK_LINEAR) == 0)
+	{
+		return;
+	}
+
+	/* Formats with their own tiling and byte streams stay as they are. */
+	const int32_t format_idx = get_format_index(*internal_format & MALI_GRALLOC_INTFMT_FMT_MASK);
+	if (format_idx < 0 || !formats[format_idx].linear || formats[format_idx].tile_size != 1 ||
+	    formats[format_idx].id == MALI_GRALLOC_FORMAT_INTERNAL_BLOB)
+	{
+		return;
+	}
+
+	*internal_format |= MALI_GRALLOC_INTFMT_BLOCK_LINEAR;
+}
+
 static uint64_t decode_internal_format(uint64_t req_format, mali_gralloc_format_type type)
 {
 	uint64_t internal_format, me_mask, base_format, mapped_base_format;
@@ -874,6 +1076,10 @@ static void determine_format_capabilities()
 		gpu_runtime_caps.caps_mask |= MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_TILED_HEADERS;
 #endif
 #endif /* MALI_GPU_SUPPORT_AFBC_BASIC == 1 */
+
+#if MALI_GPU_SUPPORT_BLOCK_LINEAR == 1
+		gpu_runtime_caps.caps_mask |= MALI_GRALLOC_FORMAT_CAPABILITY_BLOCK_LINEAR;
+#endif
 	}
 
 	if (!get_block_capabilities(MALI_GRALLOC_VPU_LIBRARY_PATH MALI_GRALLOC_VPU_LIB_NAME, &vpu_runtime_caps))
@@ -890,6 +1096,27 @@ static void determine_format_capabilities()
 		vpu_runtime_caps.caps_mask |= MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_BASIC;
 		vpu_runtime_caps.caps_mask |= MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_TILED_HEADERS;
 #endif
+
+#if MALI_VIDEO_SUPPORT_BLOCK_LINEAR == 1
+		vpu_runtime_caps.caps_mask |= MALI_GRALLOC_FORMAT_CAPABILITY_BLOCK_LINEAR;
+#endif
+	}
+
+	/* Determine camera (ISP) format capabilities */
+	if (!get_block_capabilities(MALI_GRALLOC_CAM_LIBRARY_PATH MALI_GRALLOC_CAM_LIB_NAME, &cam_runtime_caps))
+	{
+#if MALI_CAMERA_SUPPORT_AFBC_BASIC == 1
+		cam_runtime_caps.caps_mask |= MALI_GRALLOC_FORMAT_CAPABILITY_OPTIONS_PRESENT;
+		cam_runtime_caps.caps_mask |= MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_BASIC;
+
+#if MALI_CAMERA_SUPPORT_AFBC_YUV != 1
+		cam_runtime_caps.caps_mask |= MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_YUV_NOWRITE;
+#endif
+
+#if MALI_CAMERA_SUPPORT_AFBC_TILED_HEADERS == 1
+		cam_runtime_caps.caps_mask |= MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_TILED_HEADERS;
+#endif
+#endif /* MALI_CAMERA_SUPPORT_AFBC_BASIC == 1 */
 	}
 
 /* Build specific capability changes */
@@ -1053,6 +1280,20 @@ bool mali_gralloc_adjust_dimensions(const uint64_t internal_format,
 		}
 	}
 
+	if (producer == MALI_GRALLOC_PRODUCER_CAMERA)
+	{
+		/*
+		 * ISPs write whole superblock rows, and some add rows of their own
+		 * below the image. Pad to the superblock and then by the extra rows
+		 * so the last write stays inside the buffer.
+		 */
+		if (internal_format & MALI_GRALLOC_INTFMT_AFBC_BASIC)
+		{
+			*width = GRALLOC_ALIGN(*width, 16);
+			*height = GRALLOC_ALIGN(*height, 16) + MALI_CAMERA_AFBC_EXTRA_ROWS;
+		}
+	}
+
 out:
 	ALOGV("%s: internal_format=0x%" PRIx64 " usage=0x%" PRIx64
 	      " alloc_width=%u, alloc_height=%u",
@@ -1210,6 +1451,8 @@ bool afbc_format_fallback(uint32_t * const format_idx, const uint64_t usage, boo
 				/* Single-plane format found. */
 				if (*format_idx != orig_idx)
 				{
+					format_stats_record(producer, consumer, formats[orig_idx].id, MALI_GRALLOC_FORMAT_OUTCOME_AFBC,
+					                    MALI_GRALLOC_FORMAT_REASON_AFBC_SINGLE_PLANE);
 					ALOGW("%s: base format conversion (%s): 0x%" PRIx32 " --> 0x%" PRIx32,
 					      __func__, (force) ? "forced" : "unsupported",
 					      formats[orig_idx].id, formats[*format_idx].id);
@@ -1250,8 +1493,50 @@ static void validate_depth_stencil_usage(uint64_t *internal_format,
 }
 #endif
 
-uint64_t mali_gralloc_select_format(uint64_t req_format, mali_gralloc_format_type type, uint64_t usage, int buffer_size)
+/*
+ * Reasons given by the steps of one format selection, in order. They are
+ * logged in verbose mode as they are taken and counted against the outcome
+ * once it is known (see format_stats.cpp).
+ */
+struct format_trace
+{
+	uint32_t num_reasons;
+	mali_gralloc_format_reason reasons[MALI_GRALLOC_FORMAT_REASON_LAST];
+};
+
+static void trace_reason(format_trace *trace, mali_gralloc_format_reason reason)
 {
+	ALOGV("mali_gralloc_select_format: step %" PRIu32 ": %s", trace->num_reasons, format_stats_reason_name(reason));
+
+	if (trace->num_reasons < MALI_GRALLOC_FORMAT_REASON_LAST)
+	{
+		trace->reasons[trace->num_reasons++] = reason;
+	}
+}
+
+static mali_gralloc_format_outcome format_outcome(uint64_t internal_format)
+{
+	if (internal_format == 0)
+	{
+		return MALI_GRALLOC_FORMAT_OUTCOME_REJECTED;
+	}
+	else if (internal_format & MALI_GRALLOC_INTFMT_AFBCENABLE_MASK)
+	{
+		return MALI_GRALLOC_FORMAT_OUTCOME_AFBC;
+	}
+	else if (internal_format & MALI_GRALLOC_INTFMT_BLOCK_LINEAR)
+	{
+		return MALI_GRALLOC_FORMAT_OUTCOME_BLOCK_LINEAR;
+	}
+
+	return MALI_GRALLOC_FORMAT_OUTCOME_LINEAR;
+}
+
+uint64_t mali_gralloc_select_format(uint64_t req_format, mali_gralloc_format_type type, uint64_t usage, int buffer_size,
+                                    bool record_stats)
+{
+	format_trace trace;
+	trace.num_reasons = 0;
 	uint64_t internal_format = 0;
 	mali_gralloc_consumer_type consumer = MALI_GRALLOC_CONSUMER_UNKNOWN;
 	mali_gralloc_producer_type producer = MALI_GRALLOC_PRODUCER_UNKNOWN;
@@ -1272,6 +1557,7 @@ uint64_t mali_gralloc_select_format(uint64_t req_format, mali_gralloc_format_typ
 	if (usage & MALI_GRALLOC_USAGE_PRIVATE_FORMAT || type == MALI_GRALLOC_FORMAT_TYPE_INTERNAL)
 	{
 		internal_format = decode_internal_format(req_format, type);
+		trace_reason(&trace, MALI_GRALLOC_FORMAT_REASON_PRIVATE_FORMAT);
 		goto out;
 	}
 
@@ -1287,6 +1573,7 @@ uint64_t mali_gralloc_select_format(uint64_t req_format, mali_gralloc_format_typ
 		 * In this case depth and stencil formats are allowed.
 		 */
 		internal_format = req_format_mapped;
+		trace_reason(&trace, MALI_GRALLOC_FORMAT_REASON_CPU_USAGE);
 		goto out;
 	}
 
@@ -1303,16 +1590,19 @@ uint64_t mali_gralloc_select_format(uint64_t req_format, mali_gralloc_format_typ
                    Requested fmt: 0x%" PRIx64 " Re-Mapped fmt: 0x%" PRIx64,
 			      req_format, req_format_mapped);
 			internal_format = 0;
+			trace_reason(&trace, MALI_GRALLOC_FORMAT_REASON_NO_AFBC_USAGE_YUV);
 			goto out;
 		}
 
 		producer_runtime_mask &= ~MALI_GRALLOC_FORMAT_CAPABILITY_AFBCENABLE_MASK;
 		consumer_runtime_mask &= ~MALI_GRALLOC_FORMAT_CAPABILITY_AFBCENABLE_MASK;
+		trace_reason(&trace, MALI_GRALLOC_FORMAT_REASON_NO_AFBC_USAGE);
 	}
 	else if (!is_afbc_supported(req_format_mapped))
 	{
 		producer_runtime_mask &= ~MALI_GRALLOC_FORMAT_CAPABILITY_AFBCENABLE_MASK;
 		consumer_runtime_mask &= ~MALI_GRALLOC_FORMAT_CAPABILITY_AFBCENABLE_MASK;
+		trace_reason(&trace, MALI_GRALLOC_FORMAT_REASON_FORMAT_NO_AFBC);
 	}
 	else
 	{
@@ -1320,17 +1610,42 @@ uint64_t mali_gralloc_select_format(uint64_t req_format, mali_gralloc_format_typ
 		if (producer == MALI_GRALLOC_PRODUCER_GPU || producer == MALI_GRALLOC_PRODUCER_GPU_OR_DISPLAY)
 		{
 			apply_gpu_producer_limitations(req_format_mapped, &producer_runtime_mask);
+
+			if (producer_runtime_mask != ~(0ULL))
+			{
+				trace_reason(&trace, MALI_GRALLOC_FORMAT_REASON_GPU_PRODUCER_LIMIT);
+			}
+		}
+
+		else if (producer == MALI_GRALLOC_PRODUCER_CAMERA)
+		{
+			apply_camera_producer_limitations(req_format_mapped, &producer_runtime_mask);
+
+			if (producer_runtime_mask != ~(0ULL))
+			{
+				trace_reason(&trace, MALI_GRALLOC_FORMAT_REASON_CAMERA_PRODUCER_LIMIT);
+			}
 		}
 
 		/* Check consumer limitations and modify runtime mask. */
 		if (consumer == MALI_GRALLOC_CONSUMER_VIDEO_ENCODER)
 		{
 			apply_video_consumer_limitations(req_format_mapped, &consumer_runtime_mask);
+
+			if (consumer_runtime_mask != ~(0ULL))
+			{
+				trace_reason(&trace, MALI_GRALLOC_FORMAT_REASON_VIDEO_CONSUMER_LIMIT);
+			}
 		}
 		else if (consumer == MALI_GRALLOC_CONSUMER_GPU_OR_DISPLAY ||
 		         consumer == MALI_GRALLOC_CONSUMER_DISPLAY_EXCL)
 		{
 			apply_display_consumer_limitations(req_format_mapped, buffer_size, &consumer_runtime_mask);
+
+			if (consumer_runtime_mask != ~(0ULL))
+			{
+				trace_reason(&trace, MALI_GRALLOC_FORMAT_REASON_DISPLAY_CONSUMER_LIMIT);
+			}
 		}
 	}
 
@@ -1338,6 +1653,24 @@ uint64_t mali_gralloc_select_format(uint64_t req_format, mali_gralloc_format_typ
 	internal_format =
 	    determine_best_format(req_format_mapped, producer, consumer, producer_runtime_mask, consumer_runtime_mask);
 
+	if (producer == MALI_GRALLOC_PRODUCER_UNKNOWN && consumer == MALI_GRALLOC_CONSUMER_UNKNOWN)
+	{
+		trace_reason(&trace, MALI_GRALLOC_FORMAT_REASON_UNKNOWN_IP);
+	}
+	else if (internal_format == 0)
+	{
+		trace_reason(&trace, MALI_GRALLOC_FORMAT_REASON_PIXFMT_UNSUPPORTED);
+	}
+	else if (internal_format & MALI_GRALLOC_INTFMT_AFBCENABLE_MASK)
+	{
+		trace_reason(&trace, MALI_GRALLOC_FORMAT_REASON_AFBC_CAPS);
+	}
+	else if (trace.num_reasons == 0)
+	{
+		/* Nothing ruled AFBC out, the IPs just have no AFBC in common. */
+		trace_reason(&trace, MALI_GRALLOC_FORMAT_REASON_NO_SHARED_AFBC);
+	}
+
 	/*
 	 * Reject RAW/Y8/Y16 formats when not produced/consumed
 	 * by CPU or CAMERA.
@@ -1355,6 +1688,7 @@ uint64_t mali_gralloc_select_format(uint64_t req_format, mali_gralloc_format_typ
 		     consumer != MALI_GRALLOC_CONSUMER_UNKNOWN))
 		{
 			internal_format = 0;
+			trace_reason(&trace, MALI_GRALLOC_FORMAT_REASON_RAW_IP);
 		}
 	}
 
@@ -1365,7 +1699,14 @@ uint64_t mali_gralloc_select_format(uint64_t req_format, mali_gralloc_format_typ
 #if PLATFORM_SDK_VERSION >= 28
 	if (is_depth_or_stencil_format(req_format_mapped))
 	{
+		const uint64_t selected_format = internal_format;
+
 		validate_depth_stencil_usage(&internal_format, producer, consumer);
+
+		if (selected_format != 0 && internal_format == 0)
+		{
+			trace_reason(&trace, MALI_GRALLOC_FORMAT_REASON_DEPTH_STENCIL_IP);
+		}
 	}
 #endif
 
@@ -1400,18 +1741,40 @@ uint64_t mali_gralloc_select_format(uint64_t req_format, mali_gralloc_format_typ
 			}
 		}
 
-		if ((internal_format & MALI_GRALLOC_INTFMT_AFBC_DOUBLE_BODY) == 0)
+		if (internal_format & MALI_GRALLOC_INTFMT_AFBC_DOUBLE_BODY)
+		{
+			trace_reason(&trace, MALI_GRALLOC_FORMAT_REASON_FRONTBUFFER_AFBC);
+		}
+		else
 		{
+			if (internal_format & MALI_GRALLOC_INTFMT_AFBCENABLE_MASK)
+			{
+				trace_reason(&trace, MALI_GRALLOC_FORMAT_REASON_FRONTBUFFER_LINEAR);
+			}
+
 			/* Producer/consumer does not support front-buffer safe allocations with AFBC. */
 			internal_format &= MALI_GRALLOC_INTFMT_FMT_MASK;
 		}
 	}
 
+	apply_block_linear(&internal_format, producer, consumer, producer_runtime_mask, consumer_runtime_mask);
+
+	if (internal_format & MALI_GRALLOC_INTFMT_BLOCK_LINEAR)
+	{
+		trace_reason(&trace, MALI_GRALLOC_FORMAT_REASON_BLOCK_LINEAR);
+	}
+
 out:
 	ALOGV("mali_gralloc_select_format: req_format=0x%08" PRIx64 " req_fmt_mapped=0x%" PRIx64
 	      " internal_format=0x%" PRIx64 " usage=0x%" PRIx64,
 	      req_format, req_format_mapped, internal_format, usage);
 
+	for (uint32_t i = 0; record_stats && i < trace.num_reasons; i++)
+	{
+		format_stats_record(producer, consumer, (uint32_t)req_format, format_outcome(internal_format),
+		                    trace.reasons[i]);
+	}
+
 	return internal_format;
 }
 
@@ -1432,5 +1795,22 @@ extern "C" {
 		memcpy(dpu_caps, (void *)&dpu_runtime_caps, sizeof(*dpu_caps));
 		memcpy(cam_caps, (void *)&cam_runtime_caps, sizeof(*cam_caps));
 	}
+
+	/* Replaces the capabilities of each IP, for offline tools which model other configurations. */
+	void mali_gralloc_set_caps(const struct mali_gralloc_format_caps *gpu_caps,
+	                           const struct mali_gralloc_format_caps *vpu_caps,
+	                           const struct mali_gralloc_format_caps *dpu_caps,
+	                           const struct mali_gralloc_format_caps *cam_caps)
+	{
+		pthread_mutex_lock(&caps_init_mutex);
+
+		memcpy((void *)&gpu_runtime_caps, gpu_caps, sizeof(*gpu_caps));
+		memcpy((void *)&vpu_runtime_caps, vpu_caps, sizeof(*vpu_caps));
+		memcpy((void *)&dpu_runtime_caps, dpu_caps, sizeof(*dpu_caps));
+		memcpy((void *)&cam_runtime_caps, cam_caps, sizeof(*cam_caps));
+		runtime_caps_read = true;
+
+		pthread_mutex_unlock(&caps_init_mutex);
+	}
 }
 
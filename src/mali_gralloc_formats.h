@@ -138,6 +138,15 @@ typedef enum
 /* This format is AFBC with double body buffer (used as a frontbuffer) */
 #define MALI_GRALLOC_INTFMT_AFBC_DOUBLE_BODY (1ULL << (MALI_GRALLOC_INTFMT_EXTENSION_BIT_START + 5))
 
+/*
+ * This format is uncompressed and block-linear: each plane is stored as rows of
+ * MALI_GRALLOC_BLOCK_LINEAR_SIZE square blocks of samples, each block contiguous
+ * with its rows in order. The blocks in a row are byte_stride * BLOCK_SIZE bytes
+ * apart from those of the next. Never combined with AFBC.
+ */
+#define MALI_GRALLOC_INTFMT_BLOCK_LINEAR (1ULL << (MALI_GRALLOC_INTFMT_EXTENSION_BIT_START + 6))
+#define MALI_GRALLOC_BLOCK_LINEAR_SIZE 16
+
 /* This mask should be used to check or clear support for AFBC for an internal format.
  */
 #define MALI_GRALLOC_INTFMT_AFBCENABLE_MASK (uint64_t)(MALI_GRALLOC_INTFMT_AFBC_BASIC)
@@ -297,6 +306,7 @@ static inline uint64_t mali_gralloc_format_unwrap(int x)
 #define MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_EXTRAWIDEBLK ((uint64_t)1 << 8)
 #define MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_MULTIPLANE_READ ((uint64_t)1 << 9)
 #define MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_DOUBLE_BODY ((uint64_t)1 << 10)
+#define MALI_GRALLOC_FORMAT_CAPABILITY_BLOCK_LINEAR ((uint64_t)1 << 11)
 
 #define MALI_GRALLOC_FORMAT_CAPABILITY_PIXFMT_RGBA1010102 ((uint64_t)1 << 32)
 #define MALI_GRALLOC_FORMAT_CAPABILITY_PIXFMT_RGBA16161616 ((uint64_t)1 << 33)
@@ -372,8 +382,9 @@ bool mali_gralloc_adjust_dimensions(const uint64_t internal_format,
                                     int* const width,
                                     int* const height);
 
+/* record_stats is false for selections which are only a hint for the one made by the allocation. */
 uint64_t mali_gralloc_select_format(uint64_t req_format, mali_gralloc_format_type type, uint64_t usage,
-                                    int buffer_size);
+                                    int buffer_size, bool record_stats);
 
 bool is_subsampled_yuv(uint64_t req_format);
 bool is_yuv_format(uint64_t base_format);
@@ -387,6 +398,11 @@ void mali_gralloc_get_caps(struct mali_gralloc_format_caps *gpu_caps,
 							   struct mali_gralloc_format_caps *vpu_caps,
 							   struct mali_gralloc_format_caps *dpu_caps,
 							   struct mali_gralloc_format_caps *cam_caps);
+
+void mali_gralloc_set_caps(const struct mali_gralloc_format_caps *gpu_caps,
+                           const struct mali_gralloc_format_caps *vpu_caps,
+                           const struct mali_gralloc_format_caps *dpu_caps,
+                           const struct mali_gralloc_format_caps *cam_caps);
 #ifdef __cplusplus
 }
 #endif
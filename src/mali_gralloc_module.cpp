@@ -42,6 +42,8 @@
 #include "mali_gralloc_usages.h"
 #include "mali_gralloc_bufferaccess.h"
 #include "mali_gralloc_reference.h"
+#include "mali_gralloc_backend.h"
+#include "mali_gralloc_daemon.h"
 
 #if GRALLOC_USE_GRALLOC1_API == 1
 #include "mali_gralloc_public_interface.h"
@@ -53,6 +55,10 @@ static int mali_gralloc_module_device_open(const hw_module_t *module, const char
 {
 	int status = -EINVAL;
 
+#if GRALLOC_ALLOC_DAEMON == 1
+	mali_gralloc_daemon_connect();
+#endif
+
 #if GRALLOC_USE_GRALLOC1_API == 1
 
 	if (!strncmp(name, GRALLOC_HARDWARE_MODULE_ID, MALI_GRALLOC_HARDWARE_MAX_STR_LEN))
@@ -68,7 +74,7 @@ static int mali_gralloc_module_device_open(const hw_module_t *module, const char
 	}
 
 #endif
-	else if (!strncmp(name, GRALLOC_HARDWARE_FB0, MALI_GRALLOC_HARDWARE_MAX_STR_LEN))
+	else if (framebuffer_device_index(name) >= 0)
 	{
 		status = framebuffer_device_open(module, name, device);
 	}
@@ -172,22 +178,36 @@ private_module_t::private_module_t()
 	INIT_ZERO(base.reserved_proc);
 #endif
 
-	framebuffer = NULL;
-	flags = 0;
-	numBuffers = 0;
-	bufferMask = 0;
 	pthread_mutex_init(&(lock), NULL);
-	currentBuffer = NULL;
-	INIT_ZERO(info);
-	INIT_ZERO(finfo);
-	xdpi = 0.0f;
-	ydpi = 0.0f;
-	fps = 0.0f;
-	swapInterval = 1;
+
+	for (uint32_t i = 0; i < MALI_GRALLOC_MAX_DISPLAYS; i++)
+	{
+		mali_gralloc_display *dpy = &displays[i];
+
+		dpy->module = this;
+		dpy->index = i;
+		dpy->framebuffer = NULL;
+		dpy->flags = 0;
+		dpy->numBuffers = 0;
+		dpy->bufferMask = 0;
+		pthread_mutex_init(&(dpy->lock), NULL);
+		dpy->currentBuffer = NULL;
+		dpy->dpy_type = MALI_DPY_TYPE_UNKNOWN;
+		dpy->fbdev_format = 0;
+		INIT_ZERO(dpy->info);
+		INIT_ZERO(dpy->finfo);
+		dpy->xdpi = 0.0f;
+		dpy->ydpi = 0.0f;
+		dpy->fps = 0.0f;
+		dpy->swapInterval = 1;
+	}
+
+	backend = mali_gralloc_backend_select();
 	ion_client = -1;
 	use_legacy_ion = true;
+	secure_heap_exists = false;
 
-#if GRALLOC_USE_LEGACY_ION_API != 1
+#if GRALLOC_ION_BACKEND == 1 && GRALLOC_USE_LEGACY_ION_API != 1
 	heap_cnt = 0;
 	INIT_ZERO(heap_info);
 #endif
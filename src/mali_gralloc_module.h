@@ -21,7 +21,7 @@
 #include <linux/fb.h>
 #include <pthread.h>
 
-#if GRALLOC_USE_LEGACY_ION_API != 1
+#if GRALLOC_ION_BACKEND == 1 && GRALLOC_USE_LEGACY_ION_API != 1
 #include <ion_4.12.h>
 #endif
 
@@ -42,9 +42,24 @@ typedef struct
 
 #endif
 
-struct private_module_t
+/* Number of framebuffer devices (fb0..fbN) the framebuffer HAL can drive. */
+#if defined(GRALLOC_FB_NUM_DISPLAYS) && GRALLOC_FB_NUM_DISPLAYS >= 1 && GRALLOC_FB_NUM_DISPLAYS <= 4
+#define MALI_GRALLOC_MAX_DISPLAYS GRALLOC_FB_NUM_DISPLAYS
+#else
+#define MALI_GRALLOC_MAX_DISPLAYS 1
+#endif
+
+struct private_module_t;
+struct mali_gralloc_backend;
+
+/*
+ * State of one display driven by the framebuffer HAL. Each display has its
+ * own lock, so allocations and posts for different displays don't contend.
+ */
+struct mali_gralloc_display
 {
-	gralloc_module_t base;
+	struct private_module_t *module;
+	uint32_t index;
 
 	struct private_handle_t *framebuffer;
 	uint32_t flags;
@@ -52,20 +67,35 @@ struct private_module_t
 	uint32_t bufferMask;
 	pthread_mutex_t lock;
 	buffer_handle_t currentBuffer;
-	int ion_client;
 	mali_dpy_type dpy_type;
 
+	/* Pixel format the display scans out. */
+	uint64_t fbdev_format;
+
 	struct fb_var_screeninfo info;
 	struct fb_fix_screeninfo finfo;
 	float xdpi;
 	float ydpi;
 	float fps;
 	int swapInterval;
+};
+
+struct private_module_t
+{
+	gralloc_module_t base;
+
+	pthread_mutex_t lock;
+
+	/* Backing store allocator, see mali_gralloc_backend.h */
+	const struct mali_gralloc_backend *backend;
+	int ion_client;
+
+	struct mali_gralloc_display displays[MALI_GRALLOC_MAX_DISPLAYS];
+
 	bool use_legacy_ion;
-	uint64_t fbdev_format;
 	bool secure_heap_exists;
 
-#if GRALLOC_USE_LEGACY_ION_API != 1
+#if GRALLOC_ION_BACKEND == 1 && GRALLOC_USE_LEGACY_ION_API != 1
 	/* Cache the heap types / IDs information to avoid repeated IOCTL calls
 	 * Assumption: Heap types / IDs would not change after boot up. */
 	int heap_cnt;
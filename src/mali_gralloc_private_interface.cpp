@@ -24,6 +24,11 @@
 #include "gralloc_helper.h"
 #include "gralloc_buffer_priv.h"
 #include "mali_gralloc_bufferdescriptor.h"
+#include "mali_gralloc_bufferallocation.h"
+#include "mali_gralloc_reference.h"
+#include "mali_gralloc_drm_format.h"
+#include "framebuffer_stats.h"
+#include "format_stats.h"
 
 #define CHECK_FUNCTION(A, B, C)                    \
 	do                                             \
@@ -47,7 +52,12 @@ static int32_t mali_gralloc_private_get_buff_int_fmt(gralloc1_device_t *device,
 		return GRALLOC1_ERROR_BAD_VALUE;
 	}
 
-	const private_handle_t *hnd = static_cast<const private_handle_t *>(handle);
+	const private_handle_t *hnd = mali_gralloc_reference_get(handle);
+	if (hnd == NULL)
+	{
+		return GRALLOC1_ERROR_BAD_HANDLE;
+	}
+
 	*internal_format = hnd->internal_format;
 
 	return GRALLOC1_ERROR_NONE;
@@ -88,7 +98,12 @@ static int32_t mali_gralloc_private_get_buff_int_dims(gralloc1_device_t *device,
 		return GRALLOC1_ERROR_BAD_VALUE;
 	}
 
-	const private_handle_t *hnd = static_cast<const private_handle_t *>(handle);
+	const private_handle_t *hnd = mali_gralloc_reference_get(handle);
+	if (hnd == NULL)
+	{
+		return GRALLOC1_ERROR_BAD_HANDLE;
+	}
+
 	*internalWidth = hnd->internalWidth;
 	*internalHeight = hnd->internalHeight;
 
@@ -130,7 +145,12 @@ static int32_t mali_gralloc_private_get_buff_bytestride(gralloc1_device_t *devic
 		return GRALLOC1_ERROR_BAD_VALUE;
 	}
 
-	const private_handle_t *hnd = static_cast<const private_handle_t *>(handle);
+	const private_handle_t *hnd = mali_gralloc_reference_get(handle);
+	if (hnd == NULL)
+	{
+		return GRALLOC1_ERROR_BAD_HANDLE;
+	}
+
 	*bytestride = hnd->byte_stride;
 
 	return GRALLOC1_ERROR_NONE;
@@ -228,8 +248,11 @@ static int32_t mali_gralloc_private_get_attr_param(gralloc1_device_t *device, bu
 		return GRALLOC1_ERROR_BAD_HANDLE;
 	}
 
-	const private_handle_t *const_hnd = static_cast<const private_handle_t *>(handle);
-	private_handle_t *hnd = const_cast<private_handle_t *>(const_hnd);
+	private_handle_t *hnd = mali_gralloc_reference_get(handle);
+	if (hnd == NULL)
+	{
+		return GRALLOC1_ERROR_BAD_HANDLE;
+	}
 
 	if (hnd->attr_base == MAP_FAILED)
 	{
@@ -263,8 +286,11 @@ static int32_t mali_gralloc_private_set_attr_param(gralloc1_device_t *device, bu
 		return GRALLOC1_ERROR_BAD_HANDLE;
 	}
 
-	const private_handle_t *const_hnd = static_cast<const private_handle_t *>(handle);
-	private_handle_t *hnd = const_cast<private_handle_t *>(const_hnd);
+	private_handle_t *hnd = mali_gralloc_reference_get(handle);
+	if (hnd == NULL)
+	{
+		return GRALLOC1_ERROR_BAD_HANDLE;
+	}
 
 	if (hnd->attr_base == MAP_FAILED)
 	{
@@ -306,6 +332,152 @@ static int32_t mali_gralloc_private_set_priv_fmt(gralloc1_device_t *device, gral
 	return GRALLOC1_ERROR_NONE;
 }
 
+static int32_t mali_gralloc_private_get_fb_stats(gralloc1_device_t *device, uint32_t display,
+                                                 mali_gralloc_fb_stats *stats)
+{
+	GRALLOC_UNUSED(device);
+
+	if (stats == NULL || fb_stats_get(display, stats) != 0)
+	{
+		return GRALLOC1_ERROR_BAD_VALUE;
+	}
+
+	return GRALLOC1_ERROR_NONE;
+}
+
+/*
+ * The fd is duplicated; the caller keeps its own. 'layout' is optional, see
+ * mali_gralloc_buffer_import_dmabuf(). The handle is released like an
+ * allocated one.
+ */
+static int32_t mali_gralloc_private_import_dmabuf(gralloc1_device_t *device, int fd,
+                                                  gralloc1_buffer_descriptor_t desc,
+                                                  const mali_gralloc_dmabuf_layout *layout,
+                                                  buffer_handle_t *outBuffer)
+{
+	GRALLOC_UNUSED(device);
+
+	if (desc == 0)
+	{
+		return GRALLOC1_ERROR_BAD_DESCRIPTOR;
+	}
+
+	if (fd < 0 || outBuffer == NULL)
+	{
+		return GRALLOC1_ERROR_BAD_VALUE;
+	}
+
+	if (mali_gralloc_buffer_import_dmabuf(fd, (gralloc_buffer_descriptor_t)desc, layout, outBuffer) < 0)
+	{
+		return GRALLOC1_ERROR_BAD_VALUE;
+	}
+
+	return GRALLOC1_ERROR_NONE;
+}
+
+/* Views are released like any other buffer. */
+static int32_t mali_gralloc_private_create_view(gralloc1_device_t *device, buffer_handle_t buffer,
+                                                const mali_gralloc_buffer_view *view, buffer_handle_t *outView)
+{
+	GRALLOC_UNUSED(device);
+
+	if (private_handle_t::validate(buffer) < 0)
+	{
+		return GRALLOC1_ERROR_BAD_HANDLE;
+	}
+
+	if (view == NULL || outView == NULL)
+	{
+		return GRALLOC1_ERROR_BAD_VALUE;
+	}
+
+	const int err = mali_gralloc_buffer_create_view(buffer, view, outView);
+
+	if (err == -EINVAL)
+	{
+		return GRALLOC1_ERROR_BAD_VALUE;
+	}
+	else if (err < 0)
+	{
+		return GRALLOC1_ERROR_NO_RESOURCES;
+	}
+
+	return GRALLOC1_ERROR_NONE;
+}
+
+static int32_t mali_gralloc_private_get_buff_drm_info(gralloc1_device_t *device, buffer_handle_t handle,
+                                                      mali_gralloc_drm_info *info)
+{
+	GRALLOC_UNUSED(device);
+
+	if (private_handle_t::validate(handle) < 0)
+	{
+		return GRALLOC1_ERROR_BAD_HANDLE;
+	}
+
+	if (info == NULL)
+	{
+		return GRALLOC1_ERROR_BAD_VALUE;
+	}
+
+	if (mali_gralloc_drm_buffer_info((const private_handle_t *)handle, info) != 0)
+	{
+		return GRALLOC1_ERROR_UNSUPPORTED;
+	}
+
+	return GRALLOC1_ERROR_NONE;
+}
+
+/*
+ * Modifiers are in the caller's order of preference. The layout gralloc
+ * would pick for the usage wins when it is in the list.
+ */
+static int32_t mali_gralloc_private_allocate_with_modifiers(gralloc1_device_t *device,
+                                                            gralloc1_buffer_descriptor_t desc,
+                                                            const uint64_t *modifiers, uint32_t numModifiers,
+                                                            buffer_handle_t *outBuffer, uint64_t *outModifier)
+{
+	mali_gralloc_module *m = reinterpret_cast<private_module_t *>(device->common.module);
+
+	if (desc == 0)
+	{
+		return GRALLOC1_ERROR_BAD_DESCRIPTOR;
+	}
+
+	if (modifiers == NULL || numModifiers == 0 || outBuffer == NULL)
+	{
+		return GRALLOC1_ERROR_BAD_VALUE;
+	}
+
+	const int err = mali_gralloc_buffer_allocate_with_modifiers(m, (gralloc_buffer_descriptor_t)desc, modifiers,
+	                                                            numModifiers, outBuffer, outModifier);
+
+	if (err == -EINVAL)
+	{
+		return GRALLOC1_ERROR_UNSUPPORTED;
+	}
+	else if (err < 0)
+	{
+		return GRALLOC1_ERROR_NO_RESOURCES;
+	}
+
+	return GRALLOC1_ERROR_NONE;
+}
+
+static int32_t mali_gralloc_private_get_format_stats(gralloc1_device_t *device, mali_gralloc_format_stats *stats)
+{
+	GRALLOC_UNUSED(device);
+
+	if (stats == NULL)
+	{
+		return GRALLOC1_ERROR_BAD_VALUE;
+	}
+
+	format_stats_get(stats);
+
+	return GRALLOC1_ERROR_NONE;
+}
+
 gralloc1_function_pointer_t mali_gralloc_private_interface_getFunction(int32_t descriptor)
 {
 	CHECK_FUNCTION(descriptor, MALI_GRALLOC1_FUNCTION_GET_BUFF_INT_FMT, mali_gralloc_private_get_buff_int_fmt);
@@ -321,6 +493,13 @@ gralloc1_function_pointer_t mali_gralloc_private_interface_getFunction(int32_t d
 	CHECK_FUNCTION(descriptor, MALI_GRALLOC1_FUNCTION_GET_ATTR_PARAM, mali_gralloc_private_get_attr_param);
 	CHECK_FUNCTION(descriptor, MALI_GRALLOC1_FUNCTION_SET_ATTR_PARAM, mali_gralloc_private_set_attr_param);
 	CHECK_FUNCTION(descriptor, MALI_GRALLOC1_FUNCTION_SET_PRIV_FMT, mali_gralloc_private_set_priv_fmt);
+	CHECK_FUNCTION(descriptor, MALI_GRALLOC1_FUNCTION_GET_FB_STATS, mali_gralloc_private_get_fb_stats);
+	CHECK_FUNCTION(descriptor, MALI_GRALLOC1_FUNCTION_IMPORT_DMABUF, mali_gralloc_private_import_dmabuf);
+	CHECK_FUNCTION(descriptor, MALI_GRALLOC1_FUNCTION_CREATE_VIEW, mali_gralloc_private_create_view);
+	CHECK_FUNCTION(descriptor, MALI_GRALLOC1_FUNCTION_GET_BUFF_DRM_INFO, mali_gralloc_private_get_buff_drm_info);
+	CHECK_FUNCTION(descriptor, MALI_GRALLOC1_FUNCTION_ALLOCATE_WITH_MODIFIERS,
+	               mali_gralloc_private_allocate_with_modifiers);
+	CHECK_FUNCTION(descriptor, MALI_GRALLOC1_FUNCTION_GET_FORMAT_STATS, mali_gralloc_private_get_format_stats);
 
 	return NULL;
 }
@@ -41,6 +41,22 @@ typedef enum
 	MALI_GRALLOC1_FUNCTION_GET_ATTR_PARAM,
 	MALI_GRALLOC1_FUNCTION_SET_ATTR_PARAM,
 
+	/* Framebuffer frame pacing statistics */
+	MALI_GRALLOC1_FUNCTION_GET_FB_STATS,
+
+	/* Wrap a dma-buf allocated elsewhere in a buffer handle */
+	MALI_GRALLOC1_FUNCTION_IMPORT_DMABUF,
+
+	/* Handle for a layer or rectangle of a buffer */
+	MALI_GRALLOC1_FUNCTION_CREATE_VIEW,
+
+	/* DRM fourcc and format modifier interop */
+	MALI_GRALLOC1_FUNCTION_GET_BUFF_DRM_INFO,
+	MALI_GRALLOC1_FUNCTION_ALLOCATE_WITH_MODIFIERS,
+
+	/* Format selection decision counters */
+	MALI_GRALLOC1_FUNCTION_GET_FORMAT_STATS,
+
 	MALI_GRALLOC1_LAST_PRIVATE_FUNCTION
 } mali_gralloc1_function_descriptor_t;
 
@@ -65,6 +81,21 @@ typedef int32_t (*GRALLOC1_PFN_PRIVATE_SET_ATTR_PARAM)(gralloc1_device_t *device
                                                        int32_t *val, int32_t last_call);
 typedef int32_t (*GRALLOC1_PFN_PRIVATE_SET_PRIV_FMT)(gralloc1_device_t *device, gralloc1_buffer_descriptor_t desc,
                                                      uint64_t internal_format);
+typedef int32_t (*GRALLOC1_PFN_PRIVATE_GET_FB_STATS)(gralloc1_device_t *device, uint32_t display,
+                                                    mali_gralloc_fb_stats *stats);
+typedef int32_t (*GRALLOC1_PFN_PRIVATE_IMPORT_DMABUF)(gralloc1_device_t *device, int fd,
+                                                      gralloc1_buffer_descriptor_t desc,
+                                                      const mali_gralloc_dmabuf_layout *layout,
+                                                      buffer_handle_t *outBuffer);
+typedef int32_t (*GRALLOC1_PFN_PRIVATE_CREATE_VIEW)(gralloc1_device_t *device, buffer_handle_t buffer,
+                                                    const mali_gralloc_buffer_view *view, buffer_handle_t *outView);
+typedef int32_t (*GRALLOC1_PFN_PRIVATE_GET_BUFF_DRM_INFO)(gralloc1_device_t *device, buffer_handle_t handle,
+                                                          mali_gralloc_drm_info *info);
+typedef int32_t (*GRALLOC1_PFN_PRIVATE_ALLOCATE_WITH_MODIFIERS)(gralloc1_device_t *device,
+                                                                gralloc1_buffer_descriptor_t desc,
+                                                                const uint64_t *modifiers, uint32_t numModifiers,
+                                                                buffer_handle_t *outBuffer, uint64_t *outModifier);
+typedef int32_t (*GRALLOC1_PFN_PRIVATE_GET_FORMAT_STATS)(gralloc1_device_t *device, mali_gralloc_format_stats *stats);
 
 #if defined(GRALLOC_LIBRARY_BUILD)
 gralloc1_function_pointer_t mali_gralloc_private_interface_getFunction(int32_t descriptor);
@@ -83,4 +83,275 @@ typedef enum
 	MALI_YUV_BT709_WIDE
 } mali_gralloc_yuv_info;
 
+/*
+ * Framebuffer frame pacing statistics.
+ *
+ * Durations are accumulated in log2 histograms of microseconds:
+ * bucket n holds samples in [2^n - 1, 2^(n+1) - 1) us, with the last
+ * bucket also holding all larger samples.
+ */
+#define MALI_GRALLOC_FB_STATS_BUCKETS 16
+
+typedef enum
+{
+	MALI_GRALLOC_FB_STAT_POST_TO_FLIP,  /* fb_post() entry until the frame is on screen. */
+	MALI_GRALLOC_FB_STAT_VSYNC_WAIT,    /* Time blocked waiting for vsync. */
+	MALI_GRALLOC_FB_STAT_FLIP_INTERVAL, /* Time between consecutive flips. */
+	MALI_GRALLOC_FB_STAT_LAST
+} mali_gralloc_fb_stat;
+
+typedef struct
+{
+	uint64_t count;
+	uint64_t sum_us;
+	uint64_t max_us;
+	uint64_t buckets[MALI_GRALLOC_FB_STATS_BUCKETS];
+} mali_gralloc_fb_histogram;
+
+typedef struct
+{
+	mali_gralloc_fb_histogram hist[MALI_GRALLOC_FB_STAT_LAST];
+	uint64_t posts;
+	uint64_t missed_vsyncs;
+	uint64_t copy_fallbacks;
+} mali_gralloc_fb_stats;
+
+#define MALI_GRALLOC_DMABUF_MAX_PLANES 3
+
+/*
+ * Explicit layout of an imported dma-buf. Planes are in the order of the
+ * format's planes; offsets are from the start of the dma-buf.
+ */
+typedef struct
+{
+	uint32_t num_planes;
+	struct
+	{
+		uint32_t offset;
+		uint32_t byte_stride;
+	} planes[MALI_GRALLOC_DMABUF_MAX_PLANES];
+} mali_gralloc_dmabuf_layout;
+
+/*
+ * Part of a buffer to create a view of. The rectangle is in pixels of the
+ * layer; a zero width or height selects the whole layer.
+ */
+typedef struct
+{
+	uint32_t layer;
+	uint32_t left;
+	uint32_t top;
+	uint32_t width;
+	uint32_t height;
+} mali_gralloc_buffer_view;
+
+#define MALI_GRALLOC_DRM_MAX_PLANES 3
+
+/*
+ * A buffer as DRM describes it, for importing it into EGL, Vulkan, KMS or
+ * V4L2. The fds belong to the buffer handle, they are not duplicated.
+ */
+typedef struct
+{
+	uint32_t fourcc;
+	uint64_t modifier;
+	uint32_t num_planes;
+	int fds[MALI_GRALLOC_DRM_MAX_PLANES];
+	uint32_t offsets[MALI_GRALLOC_DRM_MAX_PLANES];
+	uint32_t pitches[MALI_GRALLOC_DRM_MAX_PLANES];
+} mali_gralloc_drm_info;
+
+/*
+ * Format selection statistics.
+ *
+ * Each step of format selection which decides the layout of a buffer
+ * records a reason. Counters are kept per producer, consumer, requested
+ * format, outcome and reason, with producer and consumer as the
+ * mali_gralloc_producer_type/mali_gralloc_consumer_type values.
+ */
+typedef enum
+{
+	MALI_GRALLOC_FORMAT_REASON_PRIVATE_FORMAT,        /* Internal format given by the client, no selection. */
+	MALI_GRALLOC_FORMAT_REASON_CPU_USAGE,             /* CPU usage: requested format, linear. */
+	MALI_GRALLOC_FORMAT_REASON_UNKNOWN_IP,            /* Neither producer nor consumer identified. */
+	MALI_GRALLOC_FORMAT_REASON_NO_AFBC_USAGE,         /* MALI_GRALLOC_USAGE_NO_AFBC. */
+	MALI_GRALLOC_FORMAT_REASON_NO_AFBC_USAGE_YUV,     /* NO_AFBC usage on a YUV format is rejected. */
+	MALI_GRALLOC_FORMAT_REASON_FORMAT_NO_AFBC,        /* Base format has no AFBC variant. */
+	MALI_GRALLOC_FORMAT_REASON_GPU_PRODUCER_LIMIT,    /* GPU producer limitations removed AFBC features. */
+	MALI_GRALLOC_FORMAT_REASON_VIDEO_CONSUMER_LIMIT,  /* Video encoder limitations removed AFBC features. */
+	MALI_GRALLOC_FORMAT_REASON_DISPLAY_CONSUMER_LIMIT,/* Display limitations (size, format) removed AFBC features. */
+	MALI_GRALLOC_FORMAT_REASON_AFBC_CAPS,             /* Producer and consumer share AFBC support. */
+	MALI_GRALLOC_FORMAT_REASON_NO_SHARED_AFBC,        /* AFBC allowed, but producer and consumer don't share it. */
+	MALI_GRALLOC_FORMAT_REASON_PIXFMT_UNSUPPORTED,    /* Producer or consumer can't use the pixel format. */
+	MALI_GRALLOC_FORMAT_REASON_RAW_IP,                /* RAW/Y8/Y16 used by other than CPU or camera. */
+	MALI_GRALLOC_FORMAT_REASON_DEPTH_STENCIL_IP,      /* Depth/stencil used by other than GPU or CPU. */
+	MALI_GRALLOC_FORMAT_REASON_FRONTBUFFER_AFBC,      /* Front buffer made AFBC double body. */
+	MALI_GRALLOC_FORMAT_REASON_FRONTBUFFER_LINEAR,    /* Front buffer can't be AFBC, made uncompressed. */
+	MALI_GRALLOC_FORMAT_REASON_BLOCK_LINEAR,          /* Uncompressed and laid out in blocks. */
+	MALI_GRALLOC_FORMAT_REASON_AFBC_SINGLE_PLANE,     /* Multi-plane AFBC fell back to a single-plane format. */
+	MALI_GRALLOC_FORMAT_REASON_CAMERA_PRODUCER_LIMIT, /* Camera (ISP) limitations removed AFBC features. */
+	MALI_GRALLOC_FORMAT_REASON_LAST
+} mali_gralloc_format_reason;
+
+typedef enum
+{
+	MALI_GRALLOC_FORMAT_OUTCOME_AFBC,
+	MALI_GRALLOC_FORMAT_OUTCOME_BLOCK_LINEAR,
+	MALI_GRALLOC_FORMAT_OUTCOME_LINEAR,
+	MALI_GRALLOC_FORMAT_OUTCOME_REJECTED,
+	MALI_GRALLOC_FORMAT_OUTCOME_LAST
+} mali_gralloc_format_outcome;
+
+#define MALI_GRALLOC_FORMAT_STATS_MAX_ENTRIES 128
+
+typedef struct
+{
+	int32_t producer;
+	int32_t consumer;
+	uint32_t req_format;
+	uint32_t outcome;
+	uint32_t reason;
+	uint64_t count;
+} mali_gralloc_format_stat;
+
+/* 'dropped' counts decisions not recorded because all entries were in use. */
+typedef struct
+{
+	uint32_t num_entries;
+	uint64_t dropped;
+	mali_gralloc_format_stat entries[MALI_GRALLOC_FORMAT_STATS_MAX_ENTRIES];
+} mali_gralloc_format_stats;
+
+/*
+ * Buffer registry.
+ *
+ * With GRALLOC_BUFFER_REGISTRY=1 each process publishes the buffers it
+ * allocated or imported in a file named after its pid, in
+ * GRALLOC_BUFFER_REGISTRY_DIR. The gralloc_buffers tool reads them all to
+ * show who holds each backing store.
+ */
+#define MALI_GRALLOC_REGISTRY_MAGIC 0x47524752 /* "GRGR" */
+#define MALI_GRALLOC_REGISTRY_VERSION 2
+#define MALI_GRALLOC_REGISTRY_MAX_ENTRIES 1024
+
+typedef enum
+{
+	MALI_GRALLOC_REGISTRY_ENTRY_FREE = 0,
+	MALI_GRALLOC_REGISTRY_ENTRY_ALLOCATED, /* Created by this process: allocated, imported dma-buf or view. */
+	MALI_GRALLOC_REGISTRY_ENTRY_IMPORTED,  /* Handle received from another process and retained. */
+} mali_gralloc_registry_entry_state;
+
+/*
+ * 'state' is written last when an entry is published and first when it is
+ * dropped. 'sequence' is odd while the entry is being written: readers copy
+ * an entry between two reads of an even, unchanged sequence.
+ */
+typedef struct
+{
+	uint32_t sequence;
+	uint32_t state;
+	uint32_t ref_count;
+	uint32_t reserved;
+	uint64_t backing_store_id;
+	uint64_t size;
+	uint64_t alloc_format;
+	uint64_t usage;
+	int64_t first_retain_ns; /* CLOCK_REALTIME */
+	int32_t allocating_pid;
+	uint32_t flags; /* private_handle_t::PRIV_FLAGS_*, which say where the memory comes from. */
+} mali_gralloc_registry_entry;
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	int32_t pid;
+	uint32_t num_entries;
+	int64_t start_ns; /* CLOCK_REALTIME, to tell a reused pid from the publisher. */
+	char name[64];
+	mali_gralloc_registry_entry entries[MALI_GRALLOC_REGISTRY_MAX_ENTRIES];
+} mali_gralloc_registry_file;
+
+/*
+ * Allocation trace.
+ *
+ * With GRALLOC_ALLOC_TRACE=1 each process appends its allocations, frees,
+ * references and CPU accesses to <pid>.trace in GRALLOC_ALLOC_TRACE_DIR.
+ * The file is a mali_gralloc_trace_header followed by records, each a
+ * mali_gralloc_trace_record and 'size' - sizeof(record) bytes of payload.
+ * gralloc_replay runs a trace again to measure allocator changes.
+ */
+#define MALI_GRALLOC_TRACE_MAGIC 0x47525452 /* "GRTR" */
+#define MALI_GRALLOC_TRACE_VERSION 1
+
+typedef enum
+{
+	MALI_GRALLOC_TRACE_ALLOCATE = 1, /* mali_gralloc_trace_allocate_info payload, one record per handle. */
+	MALI_GRALLOC_TRACE_FREE,
+	MALI_GRALLOC_TRACE_RETAIN,       /* mali_gralloc_trace_retain_info payload. */
+	MALI_GRALLOC_TRACE_RELEASE,
+	MALI_GRALLOC_TRACE_LOCK,         /* mali_gralloc_trace_lock_info payload. */
+	MALI_GRALLOC_TRACE_UNLOCK,
+} mali_gralloc_trace_op;
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	int32_t pid;
+	uint32_t reserved;
+	int64_t start_ns; /* CLOCK_MONOTONIC */
+} mali_gralloc_trace_header;
+
+typedef struct
+{
+	uint16_t op;
+	uint16_t size;    /* Including the payload. */
+	int32_t result;   /* 0, or the error the call returned. */
+	uint64_t time_ns; /* Since start_ns. */
+	uint64_t handle;  /* Identifies a handle within the trace; handles are only valid in the tracing process. */
+} mali_gralloc_trace_record;
+
+/* Descriptor as passed in, before the layout is worked out. */
+typedef struct
+{
+	uint32_t width;
+	uint32_t height;
+	uint64_t producer_usage;
+	uint64_t consumer_usage;
+	uint64_t hal_format;
+	uint32_t layer_count;
+	uint32_t format_type;
+	uint32_t index;           /* Of the handle among those allocated together. */
+	uint32_t num_descriptors;
+	uint64_t size;
+	uint64_t alloc_format;
+} mali_gralloc_trace_allocate_info;
+
+/* A handle allocated by another process, to allocate its like on replay. */
+typedef struct
+{
+	uint32_t width;
+	uint32_t height;
+	uint64_t producer_usage;
+	uint64_t consumer_usage;
+	uint64_t req_format;
+	uint32_t layer_count;
+	uint32_t imported;        /* Non-zero for the first retain of the handle in this process. */
+	uint64_t size;
+	uint64_t alloc_format;
+	uint64_t backing_store_id;
+} mali_gralloc_trace_retain_info;
+
+typedef struct
+{
+	uint64_t usage;
+	int32_t l;
+	int32_t t;
+	int32_t w;
+	int32_t h;
+	uint32_t ycbcr;    /* Non-zero when locked for a YUV layout: lock_ycbcr or lock_flex. */
+	uint32_t reserved;
+} mali_gralloc_trace_lock_info;
+
 #endif /* MALI_GRALLOC_PRIVATE_INTERFACE_TYPES_H_ */
@@ -23,7 +23,7 @@
 
 #include "mali_gralloc_private_interface.h"
 #include "mali_gralloc_buffer.h"
-#include "mali_gralloc_ion.h"
+#include "mali_gralloc_backend.h"
 #include "mali_gralloc_bufferdescriptor.h"
 #include "mali_gralloc_bufferallocation.h"
 #include "mali_gralloc_reference.h"
@@ -190,18 +190,8 @@ static int32_t mali_gralloc_allocate(gralloc1_device_t *device, uint32_t numDesc
 		width = bufDescriptor->width;
 		height = bufDescriptor->height;
 
-#if GRALLOC_FB_SWAP_RED_BLUE == 1
-#if GRALLOC_FB_BPP == 16
-		format = HAL_PIXEL_FORMAT_RGB_565;
-#elif GRALLOC_FB_BPP == 32
-		format = HAL_PIXEL_FORMAT_BGRA_8888;
-#else
-#error "Invalid framebuffer bit depth"
-#endif
-#endif
-
-		if (fb_alloc_framebuffer(m, bufDescriptor->consumer_usage, bufDescriptor->producer_usage, outBuffers,
-		                         &pixel_stride, &byte_stride) < 0)
+		if (fb_alloc_framebuffer(m, bufDescriptor->consumer_usage, bufDescriptor->producer_usage, format,
+		                         outBuffers, &pixel_stride, &byte_stride) < 0)
 		{
 			return GRALLOC1_ERROR_NO_RESOURCES;
 		}
@@ -218,8 +208,7 @@ static int32_t mali_gralloc_allocate(gralloc1_device_t *device, uint32_t numDesc
 
 			hnd->req_format = format;
 			hnd->yuv_info = MALI_YUV_BT601_NARROW;
-			hnd->internal_format = format;
-			hnd->alloc_format = format;
+			hnd->internal_format = hnd->alloc_format;
 			hnd->byte_stride = byte_stride;
 			hnd->width = width;
 			hnd->height = height;
@@ -663,7 +652,7 @@ int mali_gralloc_device_open(hw_module_t const *module, const char *name, hw_dev
 	dev->common.tag = HARDWARE_DEVICE_TAG;
 	dev->common.version = 0;
 	dev->common.module = const_cast<hw_module_t *>(module);
-	dev->common.close = mali_gralloc_ion_device_close;
+	dev->common.close = mali_gralloc_backend_device_close;
 
 	dev->getCapabilities = mali_gralloc_getCapabilities;
 	dev->getFunction = mali_gralloc_getFunction;
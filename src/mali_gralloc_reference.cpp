@@ -16,6 +16,9 @@
  * limitations under the License.
  */
 
+#include <string.h>
+#include <unordered_map>
+
 #include <hardware/hardware.h>
 
 #if GRALLOC_USE_GRALLOC1_API == 1
@@ -27,13 +30,90 @@
 #include "mali_gralloc_module.h"
 #include "mali_gralloc_private_interface_types.h"
 #include "mali_gralloc_buffer.h"
-#include "mali_gralloc_ion.h"
+#include "mali_gralloc_backend.h"
 #include "gralloc_buffer_priv.h"
 #include "mali_gralloc_bufferallocation.h"
+#include "mali_gralloc_bufferaccess.h"
 #include "mali_gralloc_debug.h"
+#include "framebuffer_device.h"
+#include "mali_gralloc_registry.h"
+#include "mali_gralloc_trace.h"
+#include "mali_gralloc_reference.h"
 
 static pthread_mutex_t s_map_lock = PTHREAD_MUTEX_INITIALIZER;
 
+#if GRALLOC_COMPACT_HANDLE == 1
+/*
+ * Compact handles of this process to the private_handle_t with their
+ * process-local members: the handle itself when this process created it,
+ * or a copy made when retaining a handle from another process. Taken after
+ * s_map_lock when both are held.
+ */
+static pthread_mutex_t s_handles_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::unordered_map<const native_handle *, private_handle_t *> s_handles;
+
+void mali_gralloc_reference_add_local(private_handle_t *hnd)
+{
+	pthread_mutex_lock(&s_handles_lock);
+	s_handles[hnd] = hnd;
+	pthread_mutex_unlock(&s_handles_lock);
+}
+
+void mali_gralloc_reference_remove_local(const private_handle_t *hnd)
+{
+	pthread_mutex_lock(&s_handles_lock);
+	s_handles.erase(hnd);
+	pthread_mutex_unlock(&s_handles_lock);
+}
+
+/* Makes the local copy of a compact handle from another process. Called with s_map_lock held. */
+static private_handle_t *compact_handle_import(buffer_handle_t handle)
+{
+	/* The constructor sets the process-local members, which the copy doesn't reach. */
+	private_handle_t *hnd = new private_handle_t(0, 0, NULL, 0, 0, -1, 0, 0, 0, 0, 0);
+
+	memcpy(hnd->data, handle->data, (handle->numFds + handle->numInts) * sizeof(int));
+
+	hnd->internal_format = hnd->alloc_format;
+	hnd->byte_stride = hnd->plane_info[0].byte_stride;
+	hnd->internalWidth = hnd->plane_info[0].alloc_width;
+	hnd->internalHeight = hnd->plane_info[0].alloc_height;
+
+	pthread_mutex_lock(&s_handles_lock);
+	s_handles[handle] = hnd;
+	pthread_mutex_unlock(&s_handles_lock);
+
+	return hnd;
+}
+
+/* Called with s_map_lock held. */
+static void compact_handle_forget(buffer_handle_t handle, private_handle_t *hnd)
+{
+	pthread_mutex_lock(&s_handles_lock);
+	s_handles.erase(handle);
+	pthread_mutex_unlock(&s_handles_lock);
+
+	delete hnd;
+}
+#endif
+
+private_handle_t *mali_gralloc_reference_get(buffer_handle_t handle)
+{
+	private_handle_t *hnd = (private_handle_t *)handle;
+
+#if GRALLOC_COMPACT_HANDLE == 1
+	if (hnd->numInts == NUM_INTS_IN_PRIVATE_HANDLE_COMPACT)
+	{
+		pthread_mutex_lock(&s_handles_lock);
+		std::unordered_map<const native_handle *, private_handle_t *>::const_iterator it = s_handles.find(handle);
+		hnd = (it != s_handles.end()) ? it->second : NULL;
+		pthread_mutex_unlock(&s_handles_lock);
+	}
+#endif
+
+	return hnd;
+}
+
 int mali_gralloc_reference_retain(mali_gralloc_module const *module, buffer_handle_t handle)
 {
 	GRALLOC_UNUSED(module);
@@ -44,19 +124,38 @@ int mali_gralloc_reference_retain(mali_gralloc_module const *module, buffer_hand
 		return -EINVAL;
 	}
 
-	private_handle_t *hnd = (private_handle_t *)handle;
 	pthread_mutex_lock(&s_map_lock);
 
-	if (hnd->allocating_pid == getpid() || hnd->remote_pid == getpid())
+	private_handle_t *hnd = mali_gralloc_reference_get(handle);
+	bool local_copy = false;
+
+#if GRALLOC_COMPACT_HANDLE == 1
+	if (hnd == NULL)
+	{
+		hnd = compact_handle_import(handle);
+		local_copy = true;
+	}
+#endif
+
+	if (!local_copy && (hnd->allocating_pid == getpid() || hnd->remote_pid == getpid()))
 	{
 		hnd->ref_count++;
+#if GRALLOC_BUFFER_REGISTRY == 1
+		mali_gralloc_registry_update(hnd);
+#endif
 		pthread_mutex_unlock(&s_map_lock);
+#if GRALLOC_ALLOC_TRACE == 1
+		mali_gralloc_trace_retain((const private_handle_t *)handle, false, 0);
+#endif
 		return 0;
 	}
 	else
 	{
 		hnd->remote_pid = getpid();
 		hnd->ref_count = 1;
+
+		/* Whatever layout came with the handle is the other process's. */
+		mali_gralloc_cpu_access_init(hnd);
 	}
 
 	int retval = -EINVAL;
@@ -65,22 +164,64 @@ int mali_gralloc_reference_retain(mali_gralloc_module const *module, buffer_hand
 	{
 		retval = 0;
 	}
-	else if (hnd->flags & (private_handle_t::PRIV_FLAGS_USES_ION))
+	else if (hnd->flags & (private_handle_t::PRIV_FLAGS_USES_ION | private_handle_t::PRIV_FLAGS_USES_SHMEM |
+	                       private_handle_t::PRIV_FLAGS_IMPORTED))
 	{
-		retval = mali_gralloc_ion_map(hnd);
+		retval = mali_gralloc_backend_map(hnd);
 	}
 	else
 	{
 		AERR("unkown buffer flags not supported. flags = %d", hnd->flags);
 	}
 
+#if GRALLOC_BUFFER_REGISTRY == 1
+	if (retval == 0)
+	{
+		mali_gralloc_registry_add(hnd, MALI_GRALLOC_REGISTRY_ENTRY_IMPORTED);
+	}
+#endif
+
+#if GRALLOC_COMPACT_HANDLE == 1
+	if (retval != 0 && local_copy)
+	{
+		compact_handle_forget(handle, hnd);
+	}
+#endif
+
 	pthread_mutex_unlock(&s_map_lock);
+#if GRALLOC_ALLOC_TRACE == 1
+	mali_gralloc_trace_retain((const private_handle_t *)handle, true, retval);
+#endif
 	return retval;
 }
 
-int mali_gralloc_reference_release(mali_gralloc_module const *module, buffer_handle_t handle, bool canFree)
+/*
+ * Waits for the displays to let go of a buffer whose last reference was just
+ * dropped. A pending flip can take a vsync, so s_map_lock is released meanwhile
+ * and retains/releases of other buffers don't stall behind the display.
+ * Returns false if the buffer was retained again in the meantime, in which
+ * case it must not be freed. Called with s_map_lock held.
+ */
+static bool reference_release_displays(mali_gralloc_module const *module, buffer_handle_t handle,
+                                       const private_handle_t *hnd)
 {
+#if DISABLE_FRAMEBUFFER_HAL != 1
+	pthread_mutex_unlock(&s_map_lock);
+	fb_release_buffer(const_cast<mali_gralloc_module *>(module), handle);
+	pthread_mutex_lock(&s_map_lock);
+
+	return hnd->ref_count == 0;
+#else
 	GRALLOC_UNUSED(module);
+	GRALLOC_UNUSED(handle);
+	GRALLOC_UNUSED(hnd);
+
+	return true;
+#endif
+}
+
+int mali_gralloc_reference_release(mali_gralloc_module const *module, buffer_handle_t handle, bool canFree)
+{
 
 	if (private_handle_t::validate(handle) < 0)
 	{
@@ -88,46 +229,69 @@ int mali_gralloc_reference_release(mali_gralloc_module const *module, buffer_han
 		return -EINVAL;
 	}
 
-	private_handle_t *hnd = (private_handle_t *)handle;
+#if GRALLOC_ALLOC_TRACE == 1
+	mali_gralloc_trace_release((const private_handle_t *)handle);
+#endif
+
 	pthread_mutex_lock(&s_map_lock);
 
-	if (hnd->ref_count == 0)
+	private_handle_t *hnd = mali_gralloc_reference_get(handle);
+
+	if (hnd == NULL || hnd->ref_count == 0)
 	{
 		AERR("Buffer %p should have already been released", handle);
 		pthread_mutex_unlock(&s_map_lock);
 		return -EINVAL;
 	}
 
-	if (hnd->allocating_pid == getpid())
+	/* A local copy is always of an imported handle, even one this process allocated. */
+	if (hnd->allocating_pid == getpid() && hnd == (const private_handle_t *)handle)
 	{
 		hnd->ref_count--;
+#if GRALLOC_BUFFER_REGISTRY == 1
+		mali_gralloc_registry_update(hnd);
+#endif
 
-		if (hnd->ref_count == 0 && canFree)
+		if (hnd->ref_count == 0 && canFree && reference_release_displays(module, handle, hnd))
 		{
-
 			if (hnd->flags & private_handle_t::PRIV_FLAGS_FRAMEBUFFER)
 			{
 				close(hnd->fd);
+
+				if (hnd->share_fd >= 0)
+				{
+					close(hnd->share_fd);
+				}
 			}
 			else
 			{
 				mali_gralloc_dump_buffer_erase(hnd);
 			}
+#if GRALLOC_BUFFER_REGISTRY == 1
+			mali_gralloc_registry_remove(hnd);
+#endif
 			mali_gralloc_buffer_free(handle);
-			delete handle;
+			delete hnd;
 
 		}
 	}
 	else if (hnd->remote_pid == getpid()) // never unmap buffers that were not imported into this process
 	{
 		hnd->ref_count--;
+#if GRALLOC_BUFFER_REGISTRY == 1
+		mali_gralloc_registry_update(hnd);
+#endif
 
-		if (hnd->ref_count == 0)
+		if (hnd->ref_count == 0 && reference_release_displays(module, handle, hnd))
 		{
+#if GRALLOC_BUFFER_REGISTRY == 1
+			mali_gralloc_registry_remove(hnd);
+#endif
 
-			if (hnd->flags & (private_handle_t::PRIV_FLAGS_USES_ION))
+			if (hnd->flags & (private_handle_t::PRIV_FLAGS_USES_ION | private_handle_t::PRIV_FLAGS_USES_SHMEM |
+			                  private_handle_t::PRIV_FLAGS_IMPORTED))
 			{
-				mali_gralloc_ion_unmap(hnd);
+				mali_gralloc_backend_unmap(hnd);
 			}
 			else
 			{
@@ -145,6 +309,13 @@ int mali_gralloc_reference_release(mali_gralloc_module const *module, buffer_han
 
 			hnd->base = 0;
 			hnd->writeOwner = 0;
+
+#if GRALLOC_COMPACT_HANDLE == 1
+			if (hnd != (const private_handle_t *)handle)
+			{
+				compact_handle_forget(handle, hnd);
+			}
+#endif
 		}
 	}
 	else
@@ -24,4 +24,11 @@
 int mali_gralloc_reference_retain(mali_gralloc_module const *module, buffer_handle_t handle);
 int mali_gralloc_reference_release(mali_gralloc_module const *module, buffer_handle_t handle, bool canFree);
 
+/*
+ * Returns the handle gralloc works on for a valid 'handle': 'handle' itself,
+ * or the local copy of a compact handle retained from another process.
+ * Returns NULL for a compact handle this process neither created nor retained.
+ */
+private_handle_t *mali_gralloc_reference_get(buffer_handle_t handle);
+
 #endif /* MALI_GRALLOC_REFERENCE_H_ */
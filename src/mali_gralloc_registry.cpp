@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2018 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <map>
+
+#include <log/log.h>
+
+#if GRALLOC_USE_GRALLOC1_API == 1
+#include <hardware/gralloc1.h>
+#else
+#include <hardware/gralloc.h>
+#endif
+
+#include "mali_gralloc_module.h"
+#include "mali_gralloc_buffer.h"
+#include "gralloc_helper.h"
+#include "mali_gralloc_registry.h"
+
+#ifndef GRALLOC_BUFFER_REGISTRY_DIR
+#define GRALLOC_BUFFER_REGISTRY_DIR "/data/vendor/gralloc/buffers"
+#endif
+
+/*
+ * The registry file is mapped shared and written in place, so readers see
+ * changes without the process doing any I/O. It is left behind when the
+ * process dies; the tool tells that from the pid and start time.
+ */
+static pthread_mutex_t s_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static mali_gralloc_registry_file *s_registry = NULL;
+static bool s_registry_opened = false;
+/*
+ * Slots by backing store and handle. The backing store ID tells a handle from
+ * an earlier one at the same (reused) address; the handle tells apart views,
+ * which share the backing store of their parent.
+ */
+typedef std::pair<uint64_t, const private_handle_t *> registry_key;
+static std::map<registry_key, uint32_t> s_registry_slots;
+
+static int64_t registry_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void registry_process_name(char *name, size_t size)
+{
+	const int fd = open("/proc/self/cmdline", O_RDONLY | O_CLOEXEC);
+	ssize_t len = -1;
+
+	if (fd >= 0)
+	{
+		len = read(fd, name, size - 1);
+		close(fd);
+	}
+
+	name[(len > 0) ? len : 0] = '\0';
+}
+
+static registry_key registry_key_of(const private_handle_t *hnd)
+{
+	return registry_key(hnd->backing_store_id, hnd);
+}
+
+/* Makes readers retry an entry until registry_entry_end(). Called with s_registry_lock held. */
+static void registry_entry_begin(mali_gralloc_registry_entry *entry)
+{
+	__atomic_store_n(&entry->sequence, entry->sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/* Called with s_registry_lock held. */
+static void registry_entry_end(mali_gralloc_registry_entry *entry)
+{
+	__atomic_store_n(&entry->sequence, entry->sequence + 1, __ATOMIC_RELEASE);
+}
+
+/* Called with s_registry_lock held. */
+static mali_gralloc_registry_file *registry_open(void)
+{
+	if (s_registry_opened)
+	{
+		return s_registry;
+	}
+
+	s_registry_opened = true;
+
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%d", GRALLOC_BUFFER_REGISTRY_DIR, getpid());
+
+	/* A file left by an earlier process with the same pid is replaced. */
+	const int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+	{
+		AWAR("Buffer registry disabled, can't create %s: %s", path, strerror(errno));
+		return NULL;
+	}
+
+	void *map = MAP_FAILED;
+	if (ftruncate(fd, sizeof(mali_gralloc_registry_file)) == 0)
+	{
+		map = mmap(NULL, sizeof(mali_gralloc_registry_file), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+
+	close(fd);
+
+	if (map == MAP_FAILED)
+	{
+		AWAR("Buffer registry disabled, can't map %s: %s", path, strerror(errno));
+		unlink(path);
+		return NULL;
+	}
+
+	mali_gralloc_registry_file * const registry = (mali_gralloc_registry_file *)map;
+
+	registry->version = MALI_GRALLOC_REGISTRY_VERSION;
+	registry->pid = getpid();
+	registry->num_entries = MALI_GRALLOC_REGISTRY_MAX_ENTRIES;
+	registry->start_ns = registry_now_ns();
+	registry_process_name(registry->name, sizeof(registry->name));
+	__atomic_store_n(&registry->magic, MALI_GRALLOC_REGISTRY_MAGIC, __ATOMIC_RELEASE);
+
+	s_registry = registry;
+
+	return s_registry;
+}
+
+void mali_gralloc_registry_add(const private_handle_t *hnd, mali_gralloc_registry_entry_state state)
+{
+	pthread_mutex_lock(&s_registry_lock);
+
+	mali_gralloc_registry_file * const registry = registry_open();
+	if (registry == NULL || s_registry_slots.count(registry_key_of(hnd)) != 0)
+	{
+		pthread_mutex_unlock(&s_registry_lock);
+		return;
+	}
+
+	for (uint32_t i = 0; i < MALI_GRALLOC_REGISTRY_MAX_ENTRIES; i++)
+	{
+		mali_gralloc_registry_entry * const entry = &registry->entries[i];
+
+		if (entry->state != MALI_GRALLOC_REGISTRY_ENTRY_FREE)
+		{
+			continue;
+		}
+
+		registry_entry_begin(entry);
+		entry->ref_count = hnd->ref_count;
+		entry->backing_store_id = hnd->backing_store_id;
+		entry->size = hnd->size;
+		entry->alloc_format = hnd->alloc_format;
+		entry->usage = hnd->producer_usage | hnd->consumer_usage;
+		entry->first_retain_ns = registry_now_ns();
+		entry->allocating_pid = hnd->allocating_pid;
+		entry->flags = hnd->flags;
+		__atomic_store_n(&entry->state, (uint32_t)state, __ATOMIC_RELEASE);
+		registry_entry_end(entry);
+
+		s_registry_slots[registry_key_of(hnd)] = i;
+		pthread_mutex_unlock(&s_registry_lock);
+		return;
+	}
+
+	pthread_mutex_unlock(&s_registry_lock);
+
+	ALOGV("Buffer registry full, buffer 0x%" PRIx64 " not published", hnd->backing_store_id);
+}
+
+void mali_gralloc_registry_update(const private_handle_t *hnd)
+{
+	pthread_mutex_lock(&s_registry_lock);
+
+	std::map<registry_key, uint32_t>::iterator it = s_registry_slots.find(registry_key_of(hnd));
+	if (it != s_registry_slots.end())
+	{
+		mali_gralloc_registry_entry * const entry = &s_registry->entries[it->second];
+
+		registry_entry_begin(entry);
+		__atomic_store_n(&entry->ref_count, (uint32_t)hnd->ref_count, __ATOMIC_RELAXED);
+		registry_entry_end(entry);
+	}
+
+	pthread_mutex_unlock(&s_registry_lock);
+}
+
+void mali_gralloc_registry_remove(const private_handle_t *hnd)
+{
+	pthread_mutex_lock(&s_registry_lock);
+
+	std::map<registry_key, uint32_t>::iterator it = s_registry_slots.find(registry_key_of(hnd));
+	if (it != s_registry_slots.end())
+	{
+		mali_gralloc_registry_entry * const entry = &s_registry->entries[it->second];
+
+		registry_entry_begin(entry);
+		__atomic_store_n(&entry->state, (uint32_t)MALI_GRALLOC_REGISTRY_ENTRY_FREE, __ATOMIC_RELEASE);
+		registry_entry_end(entry);
+		s_registry_slots.erase(it);
+	}
+
+	pthread_mutex_unlock(&s_registry_lock);
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2018 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MALI_GRALLOC_REGISTRY_H_
+#define MALI_GRALLOC_REGISTRY_H_
+
+#include "mali_gralloc_private_interface_types.h"
+
+struct private_handle_t;
+
+/*
+ * Publishes a handle this process holds, as created here or retained from
+ * another process. Does nothing if the registry file can't be created.
+ */
+void mali_gralloc_registry_add(const private_handle_t *hnd, mali_gralloc_registry_entry_state state);
+
+/* Updates the reference count of a published handle. */
+void mali_gralloc_registry_update(const private_handle_t *hnd);
+
+/* Withdraws a handle when its last reference in this process goes. */
+void mali_gralloc_registry_remove(const private_handle_t *hnd);
+
+#endif /* MALI_GRALLOC_REGISTRY_H_ */
@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2018 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <log/log.h>
+#include <cutils/atomic.h>
+#include <hardware/hardware.h>
+
+#if GRALLOC_USE_GRALLOC1_API == 1
+#include <hardware/gralloc1.h>
+#else
+#include <hardware/gralloc.h>
+#endif
+
+#include "mali_gralloc_module.h"
+#include "mali_gralloc_buffer.h"
+#include "gralloc_helper.h"
+#include "mali_gralloc_usages.h"
+#include "mali_gralloc_shmem.h"
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifndef MFD_HUGETLB
+#define MFD_HUGETLB 0x0004U
+#endif
+#ifndef MFD_HUGE_2MB
+#define MFD_HUGE_2MB (21U << 26)
+#endif
+
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS 1033
+#define F_SEAL_SEAL 0x0001
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW 0x0004
+#endif
+
+/* Usage which involves nothing but the CPU. Private usages only describe the layout. */
+#if GRALLOC_USE_GRALLOC1_API == 1
+#define SHMEM_USAGE_MASK \
+	(GRALLOC_USAGE_SW_READ_MASK | GRALLOC_USAGE_SW_WRITE_MASK | GRALLOC_USAGE_PRIVATE_MASK | \
+	 GRALLOC_USAGE_SENSOR_DIRECT_DATA)
+#else
+#define SHMEM_USAGE_MASK (GRALLOC_USAGE_SW_READ_MASK | GRALLOC_USAGE_SW_WRITE_MASK | GRALLOC_USAGE_PRIVATE_MASK)
+#endif
+
+bool mali_gralloc_shmem_usage(uint64_t usage)
+{
+#if GRALLOC_CPU_BUFFERS_SHMEM == 1
+	return (usage & (GRALLOC_USAGE_SW_READ_MASK | GRALLOC_USAGE_SW_WRITE_MASK)) != 0 &&
+	       (usage & ~(uint64_t)SHMEM_USAGE_MASK) == 0;
+#else
+	GRALLOC_UNUSED(usage);
+	return false;
+#endif
+}
+
+static int shmem_create(size_t size, unsigned int flags)
+{
+	int fd = syscall(__NR_memfd_create, "gralloc-shmem", MFD_CLOEXEC | MFD_ALLOW_SEALING | flags);
+
+	if (fd < 0)
+	{
+		return -1;
+	}
+
+	if (ftruncate(fd, size) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+
+	/* Fix the size, so a client can't pull memory from under another's mapping. */
+	if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0)
+	{
+		AWAR("Could not seal shared memory buffer: %s", strerror(errno));
+	}
+
+	return fd;
+}
+
+int mali_gralloc_shmem_allocate(size_t size, size_t *alloc_size, int *min_pgsz)
+{
+	int fd = -1;
+
+	if (size == 0)
+	{
+		return -1;
+	}
+
+#if GRALLOC_SHMEM_HUGE_PAGES == 1
+	/*
+	 * Rounding up to 2MB costs up to 2MB per buffer, so only do it when
+	 * that wastes no more than an eighth of the buffer: a 1080p RGBA
+	 * buffer (7.9MB) wastes about 1%, while one just over 2MB would
+	 * nearly double in size.
+	 */
+	if (size >= SZ_2M && GRALLOC_ALIGN(size, SZ_2M) - size <= size / 8)
+	{
+		/*
+		 * Prefer reserved huge pages. Otherwise a 2MB multiple lets the
+		 * kernel back the buffer with transparent huge pages, when shmem
+		 * THP is enabled.
+		 */
+		*alloc_size = GRALLOC_ALIGN(size, SZ_2M);
+
+		fd = shmem_create(*alloc_size, MFD_HUGETLB | MFD_HUGE_2MB);
+		if (fd >= 0)
+		{
+			/* hugetlbfs only fails at fault time when the pool is empty, so claim the pages now. */
+			if (fallocate(fd, 0, 0, *alloc_size) == 0)
+			{
+				*min_pgsz = SZ_2M;
+				return fd;
+			}
+
+			close(fd);
+		}
+	}
+	else
+#endif
+	{
+		*alloc_size = GRALLOC_ALIGN(size, SZ_4K);
+	}
+
+	fd = shmem_create(*alloc_size, 0);
+	if (fd < 0)
+	{
+		AERR("Could not create %zu byte shared memory buffer: %s", *alloc_size, strerror(errno));
+		return -1;
+	}
+
+	*min_pgsz = SZ_4K;
+
+	return fd;
+}
+
+void *mali_gralloc_shmem_map(int fd, size_t size)
+{
+	void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+#if GRALLOC_SHMEM_HUGE_PAGES == 1 && defined(MADV_HUGEPAGE)
+	if (addr != MAP_FAILED && size >= SZ_2M)
+	{
+		/* Only a hint; fails harmlessly for hugetlb memory or without THP. */
+		madvise(addr, size, MADV_HUGEPAGE);
+	}
+#endif
+
+	return addr;
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2018 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MALI_GRALLOC_SHMEM_H_
+#define MALI_GRALLOC_SHMEM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Buffers only ever touched by the CPU don't need device memory or cache
+ * maintenance. They are backed by sealed memfds instead of the allocation
+ * backend, and carry PRIV_FLAGS_USES_SHMEM.
+ */
+
+/* Returns true if a buffer with this usage should be backed by shared memory. */
+bool mali_gralloc_shmem_usage(uint64_t usage);
+
+/*
+ * Creates a sealed memfd of at least 'size' bytes. Large buffers are
+ * rounded up to whole huge pages.
+ *
+ * @param size        [in]    Requested buffer size (in bytes).
+ * @param alloc_size  [out]   Size of the memfd (in bytes).
+ * @param min_pgsz    [out]   Minimum page size (in bytes).
+ *
+ * @return File descriptor of the memfd, on success
+ *         -1, otherwise.
+ */
+int mali_gralloc_shmem_allocate(size_t size, size_t *alloc_size, int *min_pgsz);
+
+/* Maps a memfd from mali_gralloc_shmem_allocate(). Returns MAP_FAILED on failure. */
+void *mali_gralloc_shmem_map(int fd, size_t size);
+
+#endif /* MALI_GRALLOC_SHMEM_H_ */
@@ -0,0 +1,334 @@
+/*
+ * Copyright (C) 2018 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <log/log.h>
+
+#if GRALLOC_USE_GRALLOC1_API == 1
+#include <hardware/gralloc1.h>
+#else
+#include <hardware/gralloc.h>
+#endif
+
+#include "mali_gralloc_module.h"
+#include "mali_gralloc_buffer.h"
+#include "mali_gralloc_bufferdescriptor.h"
+#include "gralloc_helper.h"
+#include "mali_gralloc_slab.h"
+
+/* States of an object, in its header. */
+#define SLAB_OBJECT_LIVE 0x534c4142   /* "SLAB" */
+#define SLAB_OBJECT_FREE 0x46524545   /* "FREE" */
+#define SLAB_OBJECT_MALLOC 0x4d414c43 /* "MALC", from malloc() */
+
+/* Objects carved from each chunk. */
+#define SLAB_CHUNK_OBJECTS 32
+
+/*
+ * A thread takes this many objects from the shared list at once, and gives
+ * this many back when it has twice as many free.
+ */
+#define SLAB_THREAD_BATCH 16
+
+/* Precedes every object, keeping it aligned for any member. */
+struct slab_header
+{
+	uint32_t state;
+	uint32_t type;
+	slab_header *next; /* In a free list. */
+} __attribute__((aligned(16)));
+
+struct slab_pool
+{
+	pthread_mutex_t lock;
+	size_t object_size;
+	slab_header *free_list;
+};
+
+struct slab_thread_cache
+{
+	slab_header *free_list[MALI_GRALLOC_SLAB_COUNT];
+	uint32_t free_count[MALI_GRALLOC_SLAB_COUNT];
+};
+
+static slab_pool s_pools[MALI_GRALLOC_SLAB_COUNT] = {
+	{ PTHREAD_MUTEX_INITIALIZER, sizeof(buffer_descriptor_t), NULL },
+	{ PTHREAD_MUTEX_INITIALIZER, sizeof(private_handle_t), NULL },
+};
+
+static pthread_once_t s_slab_once = PTHREAD_ONCE_INIT;
+static pthread_key_t s_slab_key;
+static bool s_slab_key_valid = false;
+static bool s_slab_enabled = true;
+
+/* The key only returns a thread's objects when it exits; lookups use the TLS pointer. */
+static __thread slab_thread_cache *s_slab_thread_cache = NULL;
+
+/* Returns the free objects from 'head' to 'tail' to the shared list. */
+static void slab_pool_give(mali_gralloc_slab_type type, slab_header *head, slab_header *tail)
+{
+	slab_pool * const pool = &s_pools[type];
+
+	pthread_mutex_lock(&pool->lock);
+	tail->next = pool->free_list;
+	pool->free_list = head;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/* Takes up to 'n' objects from the shared list, carving a chunk when it is empty. */
+static slab_header *slab_pool_take(mali_gralloc_slab_type type, uint32_t n, uint32_t *taken)
+{
+	slab_pool * const pool = &s_pools[type];
+
+	pthread_mutex_lock(&pool->lock);
+
+	if (pool->free_list == NULL)
+	{
+		const size_t stride = sizeof(slab_header) + GRALLOC_ALIGN(pool->object_size, sizeof(slab_header));
+		uint8_t *chunk = (uint8_t *)malloc(stride * SLAB_CHUNK_OBJECTS);
+
+		if (chunk == NULL)
+		{
+			pthread_mutex_unlock(&pool->lock);
+			*taken = 0;
+			return NULL;
+		}
+
+		for (int i = SLAB_CHUNK_OBJECTS - 1; i >= 0; i--)
+		{
+			slab_header *obj = (slab_header *)(chunk + i * stride);
+
+			obj->state = SLAB_OBJECT_FREE;
+			obj->type = type;
+			obj->next = pool->free_list;
+			pool->free_list = obj;
+		}
+	}
+
+	slab_header *head = pool->free_list;
+	slab_header *tail = head;
+	uint32_t count = 1;
+
+	while (count < n && tail->next != NULL)
+	{
+		tail = tail->next;
+		count++;
+	}
+
+	pool->free_list = tail->next;
+	tail->next = NULL;
+
+	pthread_mutex_unlock(&pool->lock);
+
+	*taken = count;
+	return head;
+}
+
+static void slab_thread_exit(void *arg)
+{
+	slab_thread_cache *cache = (slab_thread_cache *)arg;
+
+	/* A call from another key's destructor after this starts a new cache, returned the same way. */
+	s_slab_thread_cache = NULL;
+
+	for (int type = 0; type < MALI_GRALLOC_SLAB_COUNT; type++)
+	{
+		slab_header *head = cache->free_list[type];
+
+		if (head != NULL)
+		{
+			slab_header *tail = head;
+
+			while (tail->next != NULL)
+			{
+				tail = tail->next;
+			}
+
+			slab_pool_give((mali_gralloc_slab_type)type, head, tail);
+		}
+	}
+
+	free(cache);
+}
+
+static void slab_init(void)
+{
+	const char *value = getenv("GRALLOC_OBJECT_SLAB");
+
+	if (value != NULL && strcmp(value, "0") == 0)
+	{
+		s_slab_enabled = false;
+		return;
+	}
+
+	s_slab_key_valid = pthread_key_create(&s_slab_key, slab_thread_exit) == 0;
+	if (!s_slab_key_valid)
+	{
+		AWAR("No thread cache for gralloc objects, every allocation takes a lock");
+	}
+}
+
+/* Returns the calling thread's cache, or NULL when it has none and can't have one. */
+static slab_thread_cache *slab_thread_cache_get(void)
+{
+	if (!s_slab_key_valid)
+	{
+		return NULL;
+	}
+
+	slab_thread_cache *cache = s_slab_thread_cache;
+
+	if (cache == NULL)
+	{
+		cache = (slab_thread_cache *)calloc(1, sizeof(*cache));
+
+		if (cache != NULL && pthread_setspecific(s_slab_key, cache) != 0)
+		{
+			free(cache);
+			cache = NULL;
+		}
+
+		s_slab_thread_cache = cache;
+	}
+
+	return cache;
+}
+
+void *mali_gralloc_slab_alloc(mali_gralloc_slab_type type, size_t size)
+{
+	pthread_once(&s_slab_once, slab_init);
+
+	slab_header *obj;
+
+	if (!s_slab_enabled || size > s_pools[type].object_size)
+	{
+		obj = (slab_header *)malloc(sizeof(slab_header) + size);
+
+		if (obj == NULL)
+		{
+			return NULL;
+		}
+
+		obj->state = SLAB_OBJECT_MALLOC;
+		obj->type = type;
+		obj->next = NULL;
+
+		return obj + 1;
+	}
+
+	slab_thread_cache *cache = slab_thread_cache_get();
+
+	if (cache == NULL)
+	{
+		uint32_t taken;
+		obj = slab_pool_take(type, 1, &taken);
+	}
+	else
+	{
+		if (cache->free_list[type] == NULL)
+		{
+			cache->free_list[type] = slab_pool_take(type, SLAB_THREAD_BATCH, &cache->free_count[type]);
+		}
+
+		obj = cache->free_list[type];
+
+		if (obj != NULL)
+		{
+			cache->free_list[type] = obj->next;
+			cache->free_count[type]--;
+		}
+	}
+
+	if (obj == NULL)
+	{
+		AERR("Out of memory for a gralloc object of %zu bytes", size);
+		return NULL;
+	}
+
+	obj->state = SLAB_OBJECT_LIVE;
+	obj->next = NULL;
+
+	return obj + 1;
+}
+
+void mali_gralloc_slab_free(void *ptr)
+{
+	if (ptr == NULL)
+	{
+		return;
+	}
+
+	slab_header *obj = (slab_header *)ptr - 1;
+
+	if (obj->state == SLAB_OBJECT_MALLOC)
+	{
+		obj->state = SLAB_OBJECT_FREE;
+		free(obj);
+		return;
+	}
+
+	if (obj->state != SLAB_OBJECT_LIVE || obj->type >= MALI_GRALLOC_SLAB_COUNT)
+	{
+		AERR("Gralloc object %p %s", ptr, obj->state == SLAB_OBJECT_FREE ? "freed twice" : "wasn't allocated by gralloc");
+		return;
+	}
+
+	const mali_gralloc_slab_type type = (mali_gralloc_slab_type)obj->type;
+	slab_thread_cache *cache = slab_thread_cache_get();
+
+	obj->state = SLAB_OBJECT_FREE;
+
+	if (cache == NULL)
+	{
+		slab_pool_give(type, obj, obj);
+		return;
+	}
+
+	obj->next = cache->free_list[type];
+	cache->free_list[type] = obj;
+
+	if (++cache->free_count[type] < 2 * SLAB_THREAD_BATCH)
+	{
+		return;
+	}
+
+	/* Keeps the most recently freed objects, which are the likeliest to still be in the CPU caches. */
+	slab_header *keep = obj;
+
+	for (int i = 1; i < SLAB_THREAD_BATCH; i++)
+	{
+		keep = keep->next;
+	}
+
+	slab_header *head = keep->next;
+	slab_header *tail = head;
+
+	while (tail->next != NULL)
+	{
+		tail = tail->next;
+	}
+
+	keep->next = NULL;
+	cache->free_count[type] = SLAB_THREAD_BATCH;
+
+	slab_pool_give(type, head, tail);
+}
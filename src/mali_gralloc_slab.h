@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2018 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MALI_GRALLOC_SLAB_H_
+#define MALI_GRALLOC_SLAB_H_
+
+#include <stddef.h>
+
+/*
+ * Allocator for the small objects gralloc creates for every descriptor and
+ * buffer. Objects of each type are carved from chunks and recycled through
+ * a free list per thread, so most allocations and frees take no lock and
+ * reuse recently used memory. A thread's free objects go back to a shared
+ * list when it exits. Chunks are kept until the process exits.
+ *
+ * GRALLOC_OBJECT_SLAB=0 in the environment makes both functions use malloc
+ * and free instead, for comparison.
+ */
+typedef enum
+{
+	MALI_GRALLOC_SLAB_DESCRIPTOR, /* buffer_descriptor_t */
+	MALI_GRALLOC_SLAB_HANDLE,     /* private_handle_t */
+	MALI_GRALLOC_SLAB_COUNT
+} mali_gralloc_slab_type;
+
+/* Returns memory for an object of 'type' that is 'size' bytes, or NULL. */
+void *mali_gralloc_slab_alloc(mali_gralloc_slab_type type, size_t size);
+
+/*
+ * Frees an object returned by mali_gralloc_slab_alloc(). Slab objects which
+ * are freed twice, and pointers it didn't return, are logged and left alone.
+ */
+void mali_gralloc_slab_free(void *ptr);
+
+#endif /* MALI_GRALLOC_SLAB_H_ */
@@ -0,0 +1,249 @@
+/*
+ * Copyright (C) 2018 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <log/log.h>
+
+#if GRALLOC_USE_GRALLOC1_API == 1
+#include <hardware/gralloc1.h>
+#else
+#include <hardware/gralloc.h>
+#endif
+
+#include "mali_gralloc_module.h"
+#include "mali_gralloc_buffer.h"
+#include "gralloc_helper.h"
+#include "mali_gralloc_trace.h"
+
+#ifndef GRALLOC_ALLOC_TRACE_DIR
+#define GRALLOC_ALLOC_TRACE_DIR "/data/vendor/gralloc/trace"
+#endif
+
+/*
+ * Records are small, so each is written straight to the file: a process
+ * which crashes leaves a trace up to its last call.
+ */
+static pthread_mutex_t s_trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static int s_trace_fd = -1;
+static bool s_trace_opened = false;
+static int64_t s_trace_start_ns = 0;
+
+static int64_t trace_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static bool trace_write(const void *data, size_t size)
+{
+	const char *p = (const char *)data;
+
+	while (size > 0)
+	{
+		const ssize_t written = write(s_trace_fd, p, size);
+
+		if (written < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		else if (written <= 0)
+		{
+			return false;
+		}
+
+		p += written;
+		size -= written;
+	}
+
+	return true;
+}
+
+/* Called with s_trace_lock held. */
+static bool trace_open(void)
+{
+	if (s_trace_opened)
+	{
+		return s_trace_fd >= 0;
+	}
+
+	s_trace_opened = true;
+
+	const char *dir = getenv("GRALLOC_ALLOC_TRACE_DIR");
+	if (dir == NULL)
+	{
+		dir = GRALLOC_ALLOC_TRACE_DIR;
+	}
+	else if (dir[0] == '\0')
+	{
+		return false;
+	}
+
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%d.trace", dir, getpid());
+
+	s_trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (s_trace_fd < 0)
+	{
+		AWAR("Allocation trace disabled, can't create %s: %s", path, strerror(errno));
+		return false;
+	}
+
+	s_trace_start_ns = trace_now_ns();
+
+	mali_gralloc_trace_header header;
+	memset(&header, 0, sizeof(header));
+	header.magic = MALI_GRALLOC_TRACE_MAGIC;
+	header.version = MALI_GRALLOC_TRACE_VERSION;
+	header.pid = getpid();
+	header.start_ns = s_trace_start_ns;
+
+	if (!trace_write(&header, sizeof(header)))
+	{
+		AWAR("Allocation trace disabled, can't write %s: %s", path, strerror(errno));
+		close(s_trace_fd);
+		s_trace_fd = -1;
+		return false;
+	}
+
+	return true;
+}
+
+static void trace_record(mali_gralloc_trace_op op, const private_handle_t *hnd, int result, const void *payload,
+                         size_t payload_size)
+{
+	struct
+	{
+		mali_gralloc_trace_record record;
+		uint8_t payload[sizeof(mali_gralloc_trace_allocate_info)];
+	} buf;
+
+	pthread_mutex_lock(&s_trace_lock);
+
+	if (!trace_open())
+	{
+		pthread_mutex_unlock(&s_trace_lock);
+		return;
+	}
+
+	buf.record.op = (uint16_t)op;
+	buf.record.size = (uint16_t)(sizeof(buf.record) + payload_size);
+	buf.record.result = result;
+	buf.record.time_ns = (uint64_t)(trace_now_ns() - s_trace_start_ns);
+	buf.record.handle = (uint64_t)(uintptr_t)hnd;
+
+	if (payload_size > 0)
+	{
+		memcpy(buf.payload, payload, payload_size);
+	}
+
+	if (!trace_write(&buf, buf.record.size))
+	{
+		AWAR("Allocation trace stopped: %s", strerror(errno));
+		close(s_trace_fd);
+		s_trace_fd = -1;
+	}
+
+	pthread_mutex_unlock(&s_trace_lock);
+}
+
+void mali_gralloc_trace_allocate(const buffer_descriptor_t *bufDescriptor, const private_handle_t *hnd,
+                                 uint32_t index, uint32_t num_descriptors, int result)
+{
+	mali_gralloc_trace_allocate_info payload;
+
+	memset(&payload, 0, sizeof(payload));
+	payload.width = bufDescriptor->width;
+	payload.height = bufDescriptor->height;
+	payload.producer_usage = bufDescriptor->producer_usage;
+	payload.consumer_usage = bufDescriptor->consumer_usage;
+	payload.hal_format = bufDescriptor->hal_format;
+	payload.layer_count = bufDescriptor->layer_count;
+	payload.format_type = (uint32_t)bufDescriptor->format_type;
+	payload.index = index;
+	payload.num_descriptors = num_descriptors;
+
+	if (hnd != NULL)
+	{
+		payload.size = hnd->size;
+		payload.alloc_format = hnd->alloc_format;
+	}
+
+	trace_record(MALI_GRALLOC_TRACE_ALLOCATE, hnd, result, &payload, sizeof(payload));
+}
+
+void mali_gralloc_trace_free(const private_handle_t *hnd)
+{
+	trace_record(MALI_GRALLOC_TRACE_FREE, hnd, 0, NULL, 0);
+}
+
+void mali_gralloc_trace_retain(const private_handle_t *hnd, bool imported, int result)
+{
+	mali_gralloc_trace_retain_info payload;
+
+	memset(&payload, 0, sizeof(payload));
+	payload.width = hnd->width;
+	payload.height = hnd->height;
+	payload.producer_usage = hnd->producer_usage;
+	payload.consumer_usage = hnd->consumer_usage;
+	payload.req_format = (uint32_t)hnd->req_format;
+	payload.layer_count = hnd->layer_count;
+	payload.imported = imported ? 1 : 0;
+	payload.size = hnd->size;
+	payload.alloc_format = hnd->alloc_format;
+	payload.backing_store_id = hnd->backing_store_id;
+
+	trace_record(MALI_GRALLOC_TRACE_RETAIN, hnd, result, &payload, sizeof(payload));
+}
+
+void mali_gralloc_trace_release(const private_handle_t *hnd)
+{
+	trace_record(MALI_GRALLOC_TRACE_RELEASE, hnd, 0, NULL, 0);
+}
+
+void mali_gralloc_trace_lock(const private_handle_t *hnd, uint64_t usage, int l, int t, int w, int h, bool ycbcr,
+                             int result)
+{
+	mali_gralloc_trace_lock_info payload;
+
+	memset(&payload, 0, sizeof(payload));
+	payload.usage = usage;
+	payload.l = l;
+	payload.t = t;
+	payload.w = w;
+	payload.h = h;
+	payload.ycbcr = ycbcr ? 1 : 0;
+
+	trace_record(MALI_GRALLOC_TRACE_LOCK, hnd, result, &payload, sizeof(payload));
+}
+
+void mali_gralloc_trace_unlock(const private_handle_t *hnd)
+{
+	trace_record(MALI_GRALLOC_TRACE_UNLOCK, hnd, 0, NULL, 0);
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2018 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MALI_GRALLOC_TRACE_H_
+#define MALI_GRALLOC_TRACE_H_
+
+#include <stdint.h>
+
+#include "mali_gralloc_bufferdescriptor.h"
+
+struct private_handle_t;
+
+/*
+ * Appends records to the allocation trace of this process. Tracing stops
+ * if the trace file can't be created or written. The directory can be
+ * overridden at run time with the GRALLOC_ALLOC_TRACE_DIR environment
+ * variable; setting it empty disables tracing.
+ */
+
+/* Allocation of handle 'index' of 'num_descriptors'. 'hnd' is NULL when the allocation failed with 'result'. */
+void mali_gralloc_trace_allocate(const buffer_descriptor_t *bufDescriptor, const private_handle_t *hnd,
+                                 uint32_t index, uint32_t num_descriptors, int result);
+void mali_gralloc_trace_retain(const private_handle_t *hnd, bool imported, int result);
+
+/* Recorded before the call does its work, without dereferencing the handle. */
+void mali_gralloc_trace_free(const private_handle_t *hnd);
+void mali_gralloc_trace_release(const private_handle_t *hnd);
+void mali_gralloc_trace_lock(const private_handle_t *hnd, uint64_t usage, int l, int t, int w, int h, bool ycbcr,
+                             int result);
+void mali_gralloc_trace_unlock(const private_handle_t *hnd);
+
+#endif /* MALI_GRALLOC_TRACE_H_ */
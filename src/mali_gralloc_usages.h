@@ -124,6 +124,16 @@ typedef enum
 	MALI_GRALLOC_USAGE_YUV_CONF_3 = (GRALLOC1_PRODUCER_USAGE_PRIVATE_18 | GRALLOC1_PRODUCER_USAGE_PRIVATE_19),
 	MALI_GRALLOC_USAGE_YUV_CONF_MASK = MALI_GRALLOC_USAGE_YUV_CONF_3,
 
+	/*
+	 * Framebuffer display a GRALLOC_USAGE_HW_FB allocation is for (fb0..fb3).
+	 * Display 0 is used when no display is given.
+	 */
+	MALI_GRALLOC_USAGE_FB_DISPLAY_0 = 0,
+	MALI_GRALLOC_USAGE_FB_DISPLAY_1 = GRALLOC1_PRODUCER_USAGE_PRIVATE_4,
+	MALI_GRALLOC_USAGE_FB_DISPLAY_2 = GRALLOC1_PRODUCER_USAGE_PRIVATE_5,
+	MALI_GRALLOC_USAGE_FB_DISPLAY_3 = (GRALLOC1_PRODUCER_USAGE_PRIVATE_4 | GRALLOC1_PRODUCER_USAGE_PRIVATE_5),
+	MALI_GRALLOC_USAGE_FB_DISPLAY_MASK = MALI_GRALLOC_USAGE_FB_DISPLAY_3,
+
 } mali_gralloc_usage_type;
 
 
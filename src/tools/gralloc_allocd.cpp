@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2018 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * gralloc_allocd: allocates buffers for the processes using the gralloc
+ * module, when it is built with GRALLOC_ALLOC_DAEMON=1.
+ *
+ *   gralloc_allocd [-s socket] [-p pool_kb]
+ *
+ *   -s  socket to listen on (default the module's GRALLOC_ALLOC_DAEMON_SOCKET)
+ *   -p  memory kept in buffers allocated ahead, in KB (default 16384, 0 for none)
+ *
+ * The daemon runs in the module it loads, see mali_gralloc_daemon.h.
+ */
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <hardware/hardware.h>
+#if GRALLOC_USE_GRALLOC1_API == 1
+#include <hardware/gralloc1.h>
+#else
+#include <hardware/gralloc.h>
+#endif
+
+typedef int (*serve_func)(const hw_module_t *module, int listen_fd, size_t pool_size);
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-s socket] [-p pool_kb]\n", name);
+}
+
+static int listen_on(const char *path)
+{
+	struct sockaddr_un addr;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		fprintf(stderr, "socket path %s is too long\n", path);
+		return -1;
+	}
+
+	const int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+	{
+		fprintf(stderr, "socket: %s\n", strerror(errno));
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	/* A socket left by an earlier run would make bind() fail. */
+	unlink(path);
+
+	if (bind(fd, (const struct sockaddr *)&addr, sizeof(addr)) != 0 || chmod(path, 0666) != 0 || listen(fd, 64) != 0)
+	{
+		fprintf(stderr, "listening on %s: %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = GRALLOC_ALLOC_DAEMON_SOCKET;
+	size_t pool_kb = 16384;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:p:")) != -1)
+	{
+		switch (opt)
+		{
+		case 's':
+			path = optarg;
+			break;
+		case 'p':
+			pool_kb = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind != argc)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	/* Clients going away mid-reply must not kill the daemon. */
+	signal(SIGPIPE, SIG_IGN);
+
+	const hw_module_t *module = NULL;
+	if (hw_get_module(GRALLOC_HARDWARE_MODULE_ID, &module) != 0)
+	{
+		fprintf(stderr, "no gralloc module\n");
+		return 1;
+	}
+
+	const serve_func serve = (serve_func)dlsym(module->dso, "mali_gralloc_daemon_serve");
+	if (serve == NULL)
+	{
+		fprintf(stderr, "the gralloc module isn't built with GRALLOC_ALLOC_DAEMON=1\n");
+		return 1;
+	}
+
+	const int fd = listen_on(path);
+	if (fd < 0)
+	{
+		return 1;
+	}
+
+	const int err = serve(module, fd, pool_kb * 1024);
+
+	fprintf(stderr, "stopped: %s\n", strerror(-err));
+	close(fd);
+
+	return 1;
+}
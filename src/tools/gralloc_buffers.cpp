@@ -0,0 +1,463 @@
+/*
+ * Copyright (C) 2018 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * gralloc_buffers: shows which processes hold which gralloc buffers, from
+ * the files gralloc publishes in GRALLOC_BUFFER_REGISTRY_DIR.
+ *
+ *   gralloc_buffers [-c] [-d dir]
+ *
+ *   -c  remove the files of processes which have exited
+ *   -d  read the registry files from 'dir'
+ *
+ * Buffers are grouped by backing store. A buffer still held after the
+ * process which allocated it released it or exited is marked "orphaned":
+ * the memory is only freed once every holder lets go.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <map>
+#include <vector>
+
+#include "../mali_gralloc_private_interface_types.h"
+
+#ifndef GRALLOC_BUFFER_REGISTRY_DIR
+#define GRALLOC_BUFFER_REGISTRY_DIR "/data/vendor/gralloc/buffers"
+#endif
+
+/* Attempts to read an entry which keeps being rewritten, before it is skipped. */
+#define ENTRY_READ_ATTEMPTS 100
+
+/* A process may open its registry file this long before /proc says it started, due to rounding. */
+#define START_TIME_SLACK_NS 1000000000LL
+
+struct registry_process
+{
+	char path[PATH_MAX];
+	int32_t pid;
+	char name[64];
+	bool alive;
+};
+
+struct buffer_holder
+{
+	size_t process;
+	uint32_t state;
+	uint32_t ref_count;
+	int64_t first_retain_ns;
+};
+
+struct buffer_info
+{
+	uint64_t size;
+	uint64_t alloc_format;
+	uint64_t usage;
+	uint32_t flags;
+	int32_t allocating_pid;
+	std::vector<buffer_holder> holders;
+};
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Returns the CLOCK_REALTIME start time of 'pid', or -1 if it can't be read. */
+static int64_t process_start_ns(int32_t pid)
+{
+	static int64_t boot_s = -1;
+	char path[64];
+	char buf[1024];
+
+	if (boot_s < 0)
+	{
+		FILE *stat = fopen("/proc/stat", "r");
+
+		if (stat == NULL)
+		{
+			return -1;
+		}
+
+		long long btime;
+		while (fgets(buf, sizeof(buf), stat) != NULL)
+		{
+			if (sscanf(buf, "btime %lld", &btime) == 1)
+			{
+				boot_s = btime;
+				break;
+			}
+		}
+
+		fclose(stat);
+
+		if (boot_s < 0)
+		{
+			return -1;
+		}
+	}
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+
+	const int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		return -1;
+	}
+
+	const ssize_t len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+
+	if (len <= 0)
+	{
+		return -1;
+	}
+
+	buf[len] = '\0';
+
+	/* Field 22 is the start time in clock ticks; the name in field 2 may hold spaces. */
+	const char *p = strrchr(buf, ')');
+	unsigned long long start_ticks;
+
+	if (p == NULL || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %*d %*d %llu",
+	                        &start_ticks) != 1)
+	{
+		return -1;
+	}
+
+	const long hz = sysconf(_SC_CLK_TCK);
+
+	return boot_s * 1000000000LL + (int64_t)(start_ticks * (1000000000ULL / hz));
+}
+
+/*
+ * The publisher is alive if its pid exists and did not start after the file
+ * was created; otherwise the pid was reused by another process.
+ */
+static bool publisher_alive(const mali_gralloc_registry_file *registry)
+{
+	if (kill(registry->pid, 0) != 0 && errno == ESRCH)
+	{
+		return false;
+	}
+
+	const int64_t start_ns = process_start_ns(registry->pid);
+
+	return start_ns < 0 || start_ns <= registry->start_ns + START_TIME_SLACK_NS;
+}
+
+/*
+ * Copies an entry the publisher may be rewriting. An entry which doesn't
+ * stay still long enough to be read is given as free.
+ */
+static void read_entry(const mali_gralloc_registry_entry *shared, mali_gralloc_registry_entry *entry)
+{
+	for (int attempt = 0; attempt < ENTRY_READ_ATTEMPTS; attempt++)
+	{
+		const uint32_t begin = __atomic_load_n(&shared->sequence, __ATOMIC_ACQUIRE);
+
+		if ((begin & 1) == 0)
+		{
+			memcpy(entry, (const void *)shared, sizeof(*entry));
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+			if (__atomic_load_n(&shared->sequence, __ATOMIC_RELAXED) == begin)
+			{
+				return;
+			}
+		}
+
+		sched_yield();
+	}
+
+	memset(entry, 0, sizeof(*entry));
+	entry->state = MALI_GRALLOC_REGISTRY_ENTRY_FREE;
+}
+
+static bool read_registry(const char *path, mali_gralloc_registry_file *registry)
+{
+	const int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		fprintf(stderr, "can't open %s: %s\n", path, strerror(errno));
+		return false;
+	}
+
+	/* Mapped rather than read, so that each entry can be read consistently. */
+	struct stat st;
+	void *map = MAP_FAILED;
+
+	if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(*registry))
+	{
+		map = mmap(NULL, sizeof(*registry), PROT_READ, MAP_SHARED, fd, 0);
+	}
+
+	close(fd);
+
+	if (map == MAP_FAILED)
+	{
+		/* Also the case while the publisher is still setting the file up. */
+		return false;
+	}
+
+	const mali_gralloc_registry_file * const shared = (const mali_gralloc_registry_file *)map;
+
+	if (__atomic_load_n(&shared->magic, __ATOMIC_ACQUIRE) != MALI_GRALLOC_REGISTRY_MAGIC)
+	{
+		munmap(map, sizeof(*registry));
+		return false;
+	}
+
+	if (shared->version != MALI_GRALLOC_REGISTRY_VERSION)
+	{
+		fprintf(stderr, "%s: unsupported version %u\n", path, shared->version);
+		munmap(map, sizeof(*registry));
+		return false;
+	}
+
+	registry->magic = shared->magic;
+	registry->version = shared->version;
+	registry->pid = shared->pid;
+	registry->num_entries = shared->num_entries;
+
+	if (registry->num_entries > MALI_GRALLOC_REGISTRY_MAX_ENTRIES)
+	{
+		registry->num_entries = MALI_GRALLOC_REGISTRY_MAX_ENTRIES;
+	}
+	registry->start_ns = shared->start_ns;
+	memcpy(registry->name, shared->name, sizeof(registry->name));
+	registry->name[sizeof(registry->name) - 1] = '\0';
+
+	for (uint32_t i = 0; i < registry->num_entries; i++)
+	{
+		read_entry(&shared->entries[i], &registry->entries[i]);
+	}
+
+	munmap(map, sizeof(*registry));
+
+	return true;
+}
+
+/* Mirrors private_handle_t::PRIV_FLAGS_*. */
+static void print_memory(uint32_t flags)
+{
+	static const struct
+	{
+		uint32_t flag;
+		const char *name;
+	} names[] = {
+		{ 0x01, "framebuffer" }, { 0x02, "compound" }, { 0x04, "ion" }, { 0x08, "dma" },
+		{ 0x10, "shmem" },       { 0x20, "imported" }, { 0x40, "view" },
+	};
+	const char *sep = "";
+
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+	{
+		if (flags & names[i].flag)
+		{
+			printf("%s%s", sep, names[i].name);
+			sep = ",";
+		}
+	}
+
+	if (*sep == '\0')
+	{
+		printf("system");
+	}
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "usage: %s [-c] [-d dir]\n", argv0);
+}
+
+int main(int argc, char **argv)
+{
+	const char *dir_path = GRALLOC_BUFFER_REGISTRY_DIR;
+	bool clean = false;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "cd:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'c':
+			clean = true;
+			break;
+		case 'd':
+			dir_path = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	DIR *dir = opendir(dir_path);
+	if (dir == NULL)
+	{
+		fprintf(stderr, "can't open %s: %s\n", dir_path, strerror(errno));
+		return 1;
+	}
+
+	static mali_gralloc_registry_file registry;
+	std::vector<registry_process> processes;
+	std::map<uint64_t, buffer_info> buffers;
+	unsigned removed = 0;
+	struct dirent *de;
+
+	while ((de = readdir(dir)) != NULL)
+	{
+		if (de->d_name[0] == '.')
+		{
+			continue;
+		}
+
+		registry_process process;
+		snprintf(process.path, sizeof(process.path), "%s/%s", dir_path, de->d_name);
+
+		if (!read_registry(process.path, &registry))
+		{
+			continue;
+		}
+
+		process.pid = registry.pid;
+		process.alive = publisher_alive(&registry);
+		memcpy(process.name, registry.name, sizeof(process.name));
+
+		if (!process.alive && clean)
+		{
+			if (unlink(process.path) == 0)
+			{
+				removed++;
+			}
+			continue;
+		}
+
+		const size_t index = processes.size();
+		processes.push_back(process);
+
+		for (uint32_t i = 0; i < registry.num_entries; i++)
+		{
+			const mali_gralloc_registry_entry *entry = &registry.entries[i];
+
+			if (entry->state == MALI_GRALLOC_REGISTRY_ENTRY_FREE)
+			{
+				continue;
+			}
+
+			buffer_info &buffer = buffers[entry->backing_store_id];
+			if (buffer.holders.empty())
+			{
+				buffer.size = entry->size;
+				buffer.alloc_format = entry->alloc_format;
+				buffer.usage = entry->usage;
+				buffer.flags = entry->flags;
+				buffer.allocating_pid = entry->allocating_pid;
+			}
+
+			buffer_holder holder;
+			holder.process = index;
+			holder.state = entry->state;
+			holder.ref_count = entry->ref_count;
+			holder.first_retain_ns = entry->first_retain_ns;
+			buffer.holders.push_back(holder);
+		}
+	}
+
+	closedir(dir);
+
+	const int64_t now = now_ns();
+	uint64_t total_size = 0;
+	uint64_t orphaned_size = 0;
+	unsigned orphaned = 0;
+
+	for (std::map<uint64_t, buffer_info>::const_iterator it = buffers.begin(); it != buffers.end(); ++it)
+	{
+		const buffer_info &buffer = it->second;
+		const char *allocator = "exited";
+
+		for (size_t h = 0; h < buffer.holders.size(); h++)
+		{
+			const registry_process &process = processes[buffer.holders[h].process];
+
+			if (process.pid == buffer.allocating_pid && process.alive)
+			{
+				allocator = "holding";
+				break;
+			}
+		}
+
+		/* An allocator which is alive but holds no entry has released the buffer. */
+		if (strcmp(allocator, "exited") == 0 && kill(buffer.allocating_pid, 0) == 0)
+		{
+			allocator = "released";
+		}
+
+		const bool is_orphaned = strcmp(allocator, "holding") != 0;
+
+		printf("buffer 0x%016" PRIx64 " size %" PRIu64 " format 0x%" PRIx64 " usage 0x%" PRIx64 " memory ", it->first,
+		       buffer.size, buffer.alloc_format, buffer.usage);
+		print_memory(buffer.flags);
+		printf(" allocator %d (%s)%s\n", buffer.allocating_pid, allocator, is_orphaned ? " orphaned" : "");
+
+		for (size_t h = 0; h < buffer.holders.size(); h++)
+		{
+			const buffer_holder &holder = buffer.holders[h];
+			const registry_process &process = processes[holder.process];
+
+			printf("    pid %-6d %-32s refs %-3u %s held %" PRId64 "s%s\n", process.pid, process.name, holder.ref_count,
+			       holder.state == MALI_GRALLOC_REGISTRY_ENTRY_ALLOCATED ? "allocated" : "imported ",
+			       (int64_t)((now - holder.first_retain_ns) / 1000000000LL), process.alive ? "" : " (exited)");
+		}
+
+		total_size += buffer.size;
+		if (is_orphaned)
+		{
+			orphaned++;
+			orphaned_size += buffer.size;
+		}
+	}
+
+	printf("%zu buffers, %" PRIu64 " bytes; %u orphaned, %" PRIu64 " bytes; %zu processes\n", buffers.size(),
+	       total_size, orphaned, orphaned_size, processes.size());
+
+	if (clean)
+	{
+		printf("removed %u stale registry files\n", removed);
+	}
+
+	return 0;
+}
@@ -0,0 +1,546 @@
+/*
+ * Copyright (C) 2018 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * gralloc_bwsim: models the DRAM traffic of a composition scene under
+ * different format capabilities, with gralloc's own format selection and
+ * size calculation.
+ *
+ *   gralloc_bwsim [-p policy]... [-z ratio] scene
+ *
+ *   -p  policy to model, may be repeated. Default: all built-in policies.
+ *         device        capabilities of this build (probed IP libraries or build flags)
+ *         linear        no AFBC
+ *         afbc          AFBC 16x16 with split block
+ *         afbc-wide     AFBC with wide blocks
+ *         afbc-tiled    AFBC with wide blocks, tiled headers and multi-plane YUV
+ *         block-linear  uncompressed, block-linear where the producer writes it
+ *         caps:GPU,VPU,DPU,CAM  explicit MALI_GRALLOC_FORMAT_CAPABILITY_* masks
+ *   -z  AFBC compression ratio of the content, 0 < ratio <= 1. Default: 1,
+ *       that is the worst case which the allocation is sized for.
+ *
+ * The scene has one layer per line, as key=value pairs:
+ *
+ *   name=wallpaper size=1920x1080 format=RGBA_8888 producer=gpu consumer=display fps=60 damage=0.1
+ *
+ *   format    a name below or a number (HAL or MALI_GRALLOC_FORMAT_INTERNAL_*)
+ *   producer  gpu, cpu, camera or video_decoder
+ *   consumer  comma separated: display, display_only, framebuffer, gpu, video_encoder or cpu
+ *   usage     extra usage bits, optional
+ *   fps       frames produced and consumed per second
+ *   damage    fraction of each frame the producer rewrites, default 1
+ *
+ * Each frame the producer writes 'damage' of the buffer and the consumer
+ * reads all of it. AFBC moves whole superblocks, so traffic is the header
+ * plus the body scaled by the compression ratio; block-linear layouts move
+ * whole blocks; linear layouts move the pixels only.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <vector>
+
+#include <hardware/hardware.h>
+
+#if GRALLOC_USE_GRALLOC1_API == 1
+#include <hardware/gralloc1.h>
+#else
+#include <hardware/gralloc.h>
+#endif
+
+#include "mali_gralloc_formats.h"
+#include "mali_gralloc_usages.h"
+#include "mali_gralloc_bufferdescriptor.h"
+#include "mali_gralloc_bufferlayout.h"
+#include "format_info.h"
+
+#define PIXFMT_CAPS \
+	(MALI_GRALLOC_FORMAT_CAPABILITY_PIXFMT_RGBA1010102 | MALI_GRALLOC_FORMAT_CAPABILITY_PIXFMT_RGBA16161616)
+
+#define AFBC_CAPS (MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_BASIC | MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_SPLITBLK)
+
+struct policy
+{
+	char name[64];
+	mali_gralloc_format_caps gpu;
+	mali_gralloc_format_caps vpu;
+	mali_gralloc_format_caps dpu;
+	mali_gralloc_format_caps cam;
+};
+
+struct layer
+{
+	char name[32];
+	uint32_t width;
+	uint32_t height;
+	uint64_t format;
+	uint64_t producer_usage;
+	uint64_t consumer_usage;
+	double fps;
+	double damage;
+};
+
+struct name_value
+{
+	const char *name;
+	uint64_t value;
+};
+
+static const name_value format_names[] = {
+	{ "RGBA_8888", MALI_GRALLOC_FORMAT_INTERNAL_RGBA_8888 },
+	{ "RGBX_8888", MALI_GRALLOC_FORMAT_INTERNAL_RGBX_8888 },
+	{ "RGB_888", MALI_GRALLOC_FORMAT_INTERNAL_RGB_888 },
+	{ "RGB_565", MALI_GRALLOC_FORMAT_INTERNAL_RGB_565 },
+	{ "BGRA_8888", MALI_GRALLOC_FORMAT_INTERNAL_BGRA_8888 },
+#if PLATFORM_SDK_VERSION >= 26
+	{ "RGBA_1010102", MALI_GRALLOC_FORMAT_INTERNAL_RGBA_1010102 },
+	{ "RGBA_FP16", MALI_GRALLOC_FORMAT_INTERNAL_RGBA_16161616 },
+#endif
+	{ "YV12", MALI_GRALLOC_FORMAT_INTERNAL_YV12 },
+	{ "Y8", MALI_GRALLOC_FORMAT_INTERNAL_Y8 },
+	{ "Y16", MALI_GRALLOC_FORMAT_INTERNAL_Y16 },
+	{ "YCbCr_420_888", MALI_GRALLOC_FORMAT_INTERNAL_YUV420_888 },
+	{ "RAW16", MALI_GRALLOC_FORMAT_INTERNAL_RAW16 },
+	{ "BLOB", MALI_GRALLOC_FORMAT_INTERNAL_BLOB },
+	{ "NV12", MALI_GRALLOC_FORMAT_INTERNAL_NV12 },
+	{ "NV21", MALI_GRALLOC_FORMAT_INTERNAL_NV21 },
+	{ "YUV422_8BIT", MALI_GRALLOC_FORMAT_INTERNAL_YUV422_8BIT },
+	{ "P010", MALI_GRALLOC_FORMAT_INTERNAL_P010 },
+	{ "Y0L2", MALI_GRALLOC_FORMAT_INTERNAL_Y0L2 },
+	{ "Y210", MALI_GRALLOC_FORMAT_INTERNAL_Y210 },
+	{ "Y410", MALI_GRALLOC_FORMAT_INTERNAL_Y410 },
+};
+
+/* Usage sets as the Android frameworks request them, see determine_producer() and determine_consumer(). */
+static const name_value producer_names[] = {
+	{ "gpu", GRALLOC_USAGE_HW_RENDER },
+	{ "cpu", GRALLOC_USAGE_SW_WRITE_OFTEN },
+	{ "camera", GRALLOC_USAGE_HW_CAMERA_MASK },
+	{ "video_decoder", GRALLOC_USAGE_HW_TEXTURE | GRALLOC_USAGE_HW_COMPOSER | GRALLOC_USAGE_EXTERNAL_DISP },
+};
+
+static const name_value consumer_names[] = {
+	{ "display", GRALLOC_USAGE_HW_COMPOSER | GRALLOC_USAGE_HW_TEXTURE },
+	{ "display_only", GRALLOC_USAGE_HW_COMPOSER },
+	{ "framebuffer", GRALLOC_USAGE_HW_FB },
+	{ "gpu", GRALLOC_USAGE_HW_TEXTURE },
+	{ "video_encoder", GRALLOC_USAGE_HW_VIDEO_ENCODER },
+	{ "cpu", GRALLOC_USAGE_SW_READ_OFTEN },
+};
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+static bool lookup(const name_value *names, size_t num_names, const char *name, uint64_t *value)
+{
+	for (size_t i = 0; i < num_names; i++)
+	{
+		if (strcasecmp(names[i].name, name) == 0)
+		{
+			*value = names[i].value;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void uniform_policy(policy *p, const char *name, uint64_t caps_mask)
+{
+	snprintf(p->name, sizeof(p->name), "%s", name);
+	p->gpu.caps_mask = caps_mask;
+	p->vpu.caps_mask = caps_mask;
+	p->dpu.caps_mask = caps_mask;
+	p->cam.caps_mask = caps_mask;
+}
+
+static bool parse_policy(const char *arg, policy *p)
+{
+	const uint64_t base = MALI_GRALLOC_FORMAT_CAPABILITY_OPTIONS_PRESENT | PIXFMT_CAPS;
+
+	if (strcmp(arg, "device") == 0)
+	{
+		/* The capabilities are read before any policy replaces them. */
+		snprintf(p->name, sizeof(p->name), "%s", arg);
+		mali_gralloc_get_caps(&p->gpu, &p->vpu, &p->dpu, &p->cam);
+	}
+	else if (strcmp(arg, "linear") == 0)
+	{
+		uniform_policy(p, arg, base);
+	}
+	else if (strcmp(arg, "afbc") == 0)
+	{
+		uniform_policy(p, arg, base | AFBC_CAPS);
+	}
+	else if (strcmp(arg, "afbc-wide") == 0)
+	{
+		uniform_policy(p, arg, base | AFBC_CAPS | MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_WIDEBLK);
+	}
+	else if (strcmp(arg, "afbc-tiled") == 0)
+	{
+		uniform_policy(p, arg, base | AFBC_CAPS | MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_WIDEBLK |
+		                           MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_TILED_HEADERS |
+		                           MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_EXTRAWIDEBLK |
+		                           MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_MULTIPLANE_READ);
+	}
+	else if (strcmp(arg, "block-linear") == 0)
+	{
+		uniform_policy(p, arg, base | MALI_GRALLOC_FORMAT_CAPABILITY_BLOCK_LINEAR);
+	}
+	else if (strncmp(arg, "caps:", 5) == 0)
+	{
+		unsigned long long gpu, vpu, dpu, cam;
+
+		if (sscanf(arg + 5, "%llx,%llx,%llx,%llx", &gpu, &vpu, &dpu, &cam) != 4)
+		{
+			return false;
+		}
+
+		snprintf(p->name, sizeof(p->name), "%s", arg);
+		p->gpu.caps_mask = gpu;
+		p->vpu.caps_mask = vpu;
+		p->dpu.caps_mask = dpu;
+		p->cam.caps_mask = cam;
+	}
+	else
+	{
+		return false;
+	}
+
+	return true;
+}
+
+static bool parse_usage_list(const name_value *names, size_t num_names, char *list, uint64_t *usage)
+{
+	char *save = NULL;
+
+	for (char *name = strtok_r(list, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save))
+	{
+		uint64_t value;
+
+		if (!lookup(names, num_names, name, &value))
+		{
+			return false;
+		}
+
+		*usage |= value;
+	}
+
+	return true;
+}
+
+static bool parse_layer(char *line, layer *l)
+{
+	char *save = NULL;
+
+	memset(l, 0, sizeof(*l));
+	l->damage = 1.0;
+
+	for (char *token = strtok_r(line, " \t\r\n", &save); token != NULL; token = strtok_r(NULL, " \t\r\n", &save))
+	{
+		char *value = strchr(token, '=');
+		if (value == NULL)
+		{
+			fprintf(stderr, "expected key=value, got '%s'\n", token);
+			return false;
+		}
+
+		*value++ = '\0';
+
+		bool ok = true;
+		if (strcmp(token, "name") == 0)
+		{
+			snprintf(l->name, sizeof(l->name), "%s", value);
+		}
+		else if (strcmp(token, "size") == 0)
+		{
+			ok = sscanf(value, "%ux%u", &l->width, &l->height) == 2;
+		}
+		else if (strcmp(token, "format") == 0)
+		{
+			char *end;
+			l->format = strtoull(value, &end, 0);
+			ok = (*end == '\0' && end != value) || lookup(format_names, ARRAY_SIZE(format_names), value, &l->format);
+		}
+		else if (strcmp(token, "producer") == 0)
+		{
+			ok = parse_usage_list(producer_names, ARRAY_SIZE(producer_names), value, &l->producer_usage);
+		}
+		else if (strcmp(token, "consumer") == 0)
+		{
+			ok = parse_usage_list(consumer_names, ARRAY_SIZE(consumer_names), value, &l->consumer_usage);
+		}
+		else if (strcmp(token, "usage") == 0)
+		{
+			l->consumer_usage |= strtoull(value, NULL, 0);
+		}
+		else if (strcmp(token, "fps") == 0)
+		{
+			l->fps = atof(value);
+		}
+		else if (strcmp(token, "damage") == 0)
+		{
+			l->damage = atof(value);
+			ok = l->damage >= 0.0 && l->damage <= 1.0;
+		}
+		else
+		{
+			ok = false;
+		}
+
+		if (!ok)
+		{
+			fprintf(stderr, "invalid %s '%s'\n", token, value);
+			return false;
+		}
+	}
+
+	if (l->width == 0 || l->height == 0 || l->format == 0)
+	{
+		fprintf(stderr, "layer '%s' needs a size and a format\n", l->name);
+		return false;
+	}
+
+	return true;
+}
+
+static bool read_scene(const char *path, std::vector<layer> *layers)
+{
+	FILE *file = fopen(path, "r");
+	if (file == NULL)
+	{
+		fprintf(stderr, "can't open %s: %s\n", path, strerror(errno));
+		return false;
+	}
+
+	char line[512];
+	unsigned line_num = 0;
+	bool ok = true;
+
+	while (ok && fgets(line, sizeof(line), file) != NULL)
+	{
+		line_num++;
+
+		const char *p = line + strspn(line, " \t\r\n");
+		if (*p == '\0' || *p == '#')
+		{
+			continue;
+		}
+
+		layer l;
+		ok = parse_layer(line, &l);
+		if (!ok)
+		{
+			fprintf(stderr, "%s:%u: invalid layer\n", path, line_num);
+			break;
+		}
+
+		if (l.name[0] == '\0')
+		{
+			snprintf(l.name, sizeof(l.name), "layer%zu", layers->size());
+		}
+
+		layers->push_back(l);
+	}
+
+	fclose(file);
+
+	return ok && !layers->empty();
+}
+
+/* Bytes of pixel data in a frame, without any padding or metadata. */
+static uint64_t payload_size(const format_info_t *format, uint32_t width, uint32_t height, bool afbc)
+{
+	uint64_t size = 0;
+
+	for (uint8_t plane = 0; plane < format->npln; plane++)
+	{
+		const uint64_t w = (plane == 0) ? width : (width + format->hsub - 1) / format->hsub;
+		const uint64_t h = (plane == 0) ? height : (height + format->vsub - 1) / format->vsub;
+		const uint8_t bpp = afbc ? format->bpp_afbc[plane] : format->bpp[plane];
+
+		size += (w * h * bpp) / 8;
+	}
+
+	return size;
+}
+
+static const char *layout_name(uint64_t alloc_format)
+{
+	if (alloc_format & MALI_GRALLOC_INTFMT_AFBCENABLE_MASK)
+	{
+		return "afbc";
+	}
+	else if (alloc_format & MALI_GRALLOC_INTFMT_BLOCK_LINEAR)
+	{
+		return "block";
+	}
+
+	return "linear";
+}
+
+static double model_policy(const policy *p, const std::vector<layer> &layers, double ratio)
+{
+	double total_write = 0.0;
+	double total_read = 0.0;
+	uint64_t total_size = 0;
+
+	mali_gralloc_set_caps(&p->gpu, &p->vpu, &p->dpu, &p->cam);
+
+	printf("policy %s (gpu 0x%" PRIx64 " vpu 0x%" PRIx64 " dpu 0x%" PRIx64 " cam 0x%" PRIx64 ")\n", p->name,
+	       p->gpu.caps_mask, p->vpu.caps_mask, p->dpu.caps_mask, p->cam.caps_mask);
+	printf("  %-16s %-18s %-6s %10s %9s %9s %10s %10s\n", "layer", "alloc_format", "layout", "size", "padding",
+	       "header", "write MB/s", "read MB/s");
+
+	for (size_t i = 0; i < layers.size(); i++)
+	{
+		const layer &l = layers[i];
+		buffer_descriptor_t desc;
+		size_t header_size = 0;
+
+		memset(&desc, 0, sizeof(desc));
+		desc.width = l.width;
+		desc.height = l.height;
+		desc.producer_usage = l.producer_usage;
+		desc.consumer_usage = l.consumer_usage;
+		desc.hal_format = l.format;
+		desc.layer_count = 1;
+		desc.format_type = MALI_GRALLOC_FORMAT_TYPE_USAGE;
+
+		const int32_t format_idx = (mali_gralloc_buffer_layout(&desc, &header_size) == 0)
+		                               ? get_format_index(desc.alloc_format & MALI_GRALLOC_INTFMT_FMT_MASK)
+		                               : -1;
+		if (format_idx < 0)
+		{
+			printf("  %-16s unsupported\n", l.name);
+			continue;
+		}
+
+		const bool is_afbc = (desc.alloc_format & MALI_GRALLOC_INTFMT_AFBCENABLE_MASK) != 0;
+		const uint64_t body_size = desc.size - header_size;
+		const uint64_t payload = payload_size(&formats[format_idx], l.width, l.height, is_afbc);
+
+		double frame_bytes = (double)payload;
+		if (is_afbc)
+		{
+			frame_bytes = header_size + body_size * ratio;
+		}
+		else if (desc.alloc_format & MALI_GRALLOC_INTFMT_BLOCK_LINEAR)
+		{
+			frame_bytes = (double)body_size;
+		}
+
+		const double write_bps = frame_bytes * l.damage * l.fps;
+		const double read_bps = frame_bytes * l.fps;
+
+		printf("  %-16s 0x%016" PRIx64 " %-6s %10zu %9" PRIu64 " %9zu %10.1f %10.1f\n", l.name, desc.alloc_format,
+		       layout_name(desc.alloc_format), desc.size, body_size > payload ? body_size - payload : 0, header_size,
+		       write_bps / 1e6, read_bps / 1e6);
+
+		total_size += desc.size;
+		total_write += write_bps;
+		total_read += read_bps;
+	}
+
+	printf("  %-16s %-18s %-6s %10" PRIu64 " %9s %9s %10.1f %10.1f\n\n", "total", "", "", total_size, "", "",
+	       total_write / 1e6, total_read / 1e6);
+
+	return total_write + total_read;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "usage: %s [-p policy]... [-z ratio] scene\n", argv0);
+}
+
+int main(int argc, char **argv)
+{
+	static const char *const default_policies[] = { "device", "linear", "afbc", "afbc-wide", "afbc-tiled",
+		                                            "block-linear" };
+	std::vector<policy> policies;
+	std::vector<layer> layers;
+	double ratio = 1.0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "p:z:")) != -1)
+	{
+		policy p;
+
+		switch (opt)
+		{
+		case 'p':
+			if (!parse_policy(optarg, &p))
+			{
+				fprintf(stderr, "unknown policy '%s'\n", optarg);
+				return 1;
+			}
+			policies.push_back(p);
+			break;
+		case 'z':
+			ratio = atof(optarg);
+			if (ratio <= 0.0 || ratio > 1.0)
+			{
+				fprintf(stderr, "compression ratio must be in (0, 1]\n");
+				return 1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind != argc - 1)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (!read_scene(argv[optind], &layers))
+	{
+		return 1;
+	}
+
+	if (policies.empty())
+	{
+		for (size_t i = 0; i < ARRAY_SIZE(default_policies); i++)
+		{
+			policy p;
+			parse_policy(default_policies[i], &p);
+			policies.push_back(p);
+		}
+	}
+
+	std::vector<double> totals;
+	for (size_t i = 0; i < policies.size(); i++)
+	{
+		totals.push_back(model_policy(&policies[i], layers, ratio));
+	}
+
+	printf("%-24s %12s\n", "policy", "total MB/s");
+	for (size_t i = 0; i < policies.size(); i++)
+	{
+		printf("%-24s %12.1f\n", policies[i].name, totals[i] / 1e6);
+	}
+
+	return 0;
+}
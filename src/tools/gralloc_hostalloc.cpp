@@ -0,0 +1,386 @@
+/*
+ * Copyright (C) 2018 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * gralloc_hostalloc: runs mali_gralloc_buffer_allocate() and the release of
+ * the buffers on a build host, with the module linked in, so the allocation
+ * path and its error handling can be exercised without a device.
+ *
+ *   gralloc_hostalloc [-n iterations] [-b backend] [-f N] [-F N]
+ *
+ *   -n  iterations (default 1000)
+ *   -b  allocation backend, as GRALLOC_ALLOC_BACKEND (default memfd). The
+ *       dma_heap backend, when built, needs /dev/dma_heap/system.
+ *   -f  fail every Nth memfd allocation (GRALLOC_MEMFD_FAIL_ALLOC)
+ *   -F  fail every Nth memfd mapping (GRALLOC_MEMFD_FAIL_MAP)
+ *
+ * Each iteration allocates every buffer below, alone and then together in
+ * one call, and releases them. Failed allocations are counted, not fatal,
+ * since failures may be injected. The exit status is non-zero when a
+ * buffer which was allocated isn't usable, or when file descriptors or
+ * mappings are left over at the end.
+ *
+ * Failures land on the same buffer every iteration when an interval
+ * divides the number of allocations or mappings an iteration makes, so
+ * use a few different intervals.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <poll.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <hardware/hardware.h>
+#include <sync/sync.h>
+
+#if GRALLOC_USE_GRALLOC1_API == 1
+#include <hardware/gralloc1.h>
+#else
+#include <hardware/gralloc.h>
+#endif
+
+#include "mali_gralloc_module.h"
+#include "mali_gralloc_private_interface_types.h"
+#include "mali_gralloc_buffer.h"
+#include "mali_gralloc_formats.h"
+#include "mali_gralloc_usages.h"
+#include "mali_gralloc_bufferdescriptor.h"
+#include "mali_gralloc_bufferallocation.h"
+#include "mali_gralloc_reference.h"
+#include "mali_gralloc_backend.h"
+
+#define HOSTALLOC_MAX_BUFFERS 8
+
+struct hostalloc_buffer
+{
+	const char *name;
+	uint32_t width;
+	uint32_t height;
+	uint64_t format;
+	uint64_t producer_usage;
+	uint64_t consumer_usage;
+};
+
+static const hostalloc_buffer s_buffers[] = {
+	{ "gpu RGBA_8888", 1920, 1080, HAL_PIXEL_FORMAT_RGBA_8888, GRALLOC_USAGE_HW_RENDER,
+	  GRALLOC_USAGE_HW_COMPOSER | GRALLOC_USAGE_HW_TEXTURE },
+	{ "gpu RGB_565", 640, 480, HAL_PIXEL_FORMAT_RGB_565, GRALLOC_USAGE_HW_RENDER, GRALLOC_USAGE_HW_TEXTURE },
+	{ "video NV12", 1280, 720, HAL_PIXEL_FORMAT_YCbCr_420_888,
+	  GRALLOC_USAGE_HW_TEXTURE | GRALLOC_USAGE_HW_COMPOSER, GRALLOC_USAGE_HW_VIDEO_ENCODER },
+	{ "cpu YV12", 352, 288, HAL_PIXEL_FORMAT_YV12, GRALLOC_USAGE_SW_WRITE_OFTEN, GRALLOC_USAGE_SW_READ_OFTEN },
+	{ "cpu+gpu RGBA_8888", 256, 256, HAL_PIXEL_FORMAT_RGBA_8888, GRALLOC_USAGE_SW_WRITE_OFTEN,
+	  GRALLOC_USAGE_HW_TEXTURE },
+};
+
+#define NUM_BUFFERS (sizeof(s_buffers) / sizeof(s_buffers[0]))
+
+/* The module is linked in, in place of being loaded by libhardware. */
+extern struct private_module_t HAL_MODULE_INFO_SYM;
+
+int hw_get_module(const char *id, const struct hw_module_t **module)
+{
+	if (strcmp(id, GRALLOC_HARDWARE_MODULE_ID) != 0)
+	{
+		return -ENOENT;
+	}
+
+	*module = &HAL_MODULE_INFO_SYM.base.common;
+
+	return 0;
+}
+
+/* libsync is device only. Waits for a fence as it does. */
+int sync_wait(int fd, int timeout)
+{
+	struct pollfd fds;
+	int ret;
+
+	if (fd < 0)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	fds.fd = fd;
+	fds.events = POLLIN;
+
+	do
+	{
+		ret = poll(&fds, 1, timeout);
+	} while (ret == -1 && (errno == EINTR || errno == EAGAIN));
+
+	if (ret == 0)
+	{
+		errno = ETIME;
+		return -1;
+	}
+
+	return (ret > 0) ? 0 : ret;
+}
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int count_fds(void)
+{
+	DIR *dir = opendir("/proc/self/fd");
+	int count = 0;
+
+	if (dir == NULL)
+	{
+		return -1;
+	}
+
+	while (readdir(dir) != NULL)
+	{
+		count++;
+	}
+
+	closedir(dir);
+
+	return count;
+}
+
+/* Mappings of memfd and dma-buf backed buffers. */
+static int count_buffer_mappings(void)
+{
+	FILE *maps = fopen("/proc/self/maps", "r");
+	char line[512];
+	int count = 0;
+
+	if (maps == NULL)
+	{
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), maps) != NULL)
+	{
+		if (strstr(line, "memfd:gralloc") != NULL || strstr(line, "dmabuf") != NULL)
+		{
+			count++;
+		}
+	}
+
+	fclose(maps);
+
+	return count;
+}
+
+struct hostalloc_stats
+{
+	uint64_t allocations;
+	uint64_t failed;
+	uint64_t bad_handles;
+	int64_t alloc_ns;
+	int64_t release_ns;
+};
+
+static void init_descriptor(const hostalloc_buffer *b, buffer_descriptor_t *desc)
+{
+	memset(desc, 0, sizeof(*desc));
+	desc->signature = sizeof(buffer_descriptor_t);
+	desc->width = b->width;
+	desc->height = b->height;
+	desc->producer_usage = b->producer_usage;
+	desc->consumer_usage = b->consumer_usage;
+	desc->hal_format = b->format;
+	desc->layer_count = 1;
+	desc->format_type = MALI_GRALLOC_FORMAT_TYPE_USAGE;
+}
+
+/* An allocated buffer must be valid, sized for its layout and mapped in full. */
+static bool check_buffer(const hostalloc_buffer *b, const buffer_descriptor_t *desc, buffer_handle_t handle)
+{
+	const private_handle_t *hnd = (const private_handle_t *)handle;
+
+	if (private_handle_t::validate(handle) < 0)
+	{
+		fprintf(stderr, "%s: invalid handle\n", b->name);
+		return false;
+	}
+
+	if ((size_t)hnd->size < desc->size || hnd->width != (int)b->width || hnd->height != (int)b->height)
+	{
+		fprintf(stderr, "%s: handle is %dx%d of %d bytes, expected %ux%u of %zu bytes\n", b->name, hnd->width,
+		        hnd->height, hnd->size, b->width, b->height, desc->size);
+		return false;
+	}
+
+	if (hnd->base == NULL)
+	{
+		fprintf(stderr, "%s: buffer isn't mapped\n", b->name);
+		return false;
+	}
+
+	volatile uint8_t *base = (volatile uint8_t *)hnd->base;
+	base[0] = 0x5a;
+	base[desc->size - 1] = 0xa5;
+
+	return base[0] == 0x5a && base[desc->size - 1] == 0xa5;
+}
+
+static void allocate_release(mali_gralloc_module *m, const hostalloc_buffer *const *buffers, uint32_t count,
+                             hostalloc_stats *stats)
+{
+	buffer_descriptor_t desc[HOSTALLOC_MAX_BUFFERS];
+	gralloc_buffer_descriptor_t descriptors[HOSTALLOC_MAX_BUFFERS];
+	buffer_handle_t handles[HOSTALLOC_MAX_BUFFERS];
+	bool shared = false;
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		init_descriptor(buffers[i], &desc[i]);
+		descriptors[i] = (gralloc_buffer_descriptor_t)&desc[i];
+	}
+
+	int64_t start = now_ns();
+	const int err = mali_gralloc_buffer_allocate(m, descriptors, count, handles, &shared);
+	stats->alloc_ns += now_ns() - start;
+	stats->allocations++;
+
+	if (err < 0)
+	{
+		stats->failed++;
+		return;
+	}
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (!check_buffer(buffers[i], &desc[i], handles[i]))
+		{
+			stats->bad_handles++;
+		}
+	}
+
+	start = now_ns();
+	for (uint32_t i = 0; i < count; i++)
+	{
+		mali_gralloc_reference_release(m, handles[i], true);
+	}
+	stats->release_ns += now_ns() - start;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-n iterations] [-b backend] [-f N] [-F N]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+	const char *backend = "memfd";
+	int iterations = 1000;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:b:f:F:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		case 'b':
+			backend = optarg;
+			break;
+		case 'f':
+			setenv("GRALLOC_MEMFD_FAIL_ALLOC", optarg, 1);
+			break;
+		case 'F':
+			setenv("GRALLOC_MEMFD_FAIL_MAP", optarg, 1);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind != argc || iterations <= 0)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	mali_gralloc_module *m = &HAL_MODULE_INFO_SYM;
+
+	/*
+	 * The module picked its backend when it was constructed, before the
+	 * options were read. The backend reads its own settings when opened.
+	 */
+	setenv("GRALLOC_ALLOC_BACKEND", backend, 1);
+	m->backend = mali_gralloc_backend_select();
+
+	if (strcmp(m->backend->name, backend) != 0)
+	{
+		fprintf(stderr, "The %s backend isn't built\n", backend);
+		return 1;
+	}
+
+	/* Other backends need devices this machine may not have. */
+	const int err = m->backend->open(m);
+	if (err < 0)
+	{
+		fprintf(stderr, "Can't open the %s backend: %s\n", backend, strerror(-err));
+		return 1;
+	}
+
+	const int fds = count_fds();
+	const int mappings = count_buffer_mappings();
+	hostalloc_stats single;
+	hostalloc_stats multi;
+
+	memset(&single, 0, sizeof(single));
+	memset(&multi, 0, sizeof(multi));
+
+	for (int n = 0; n < iterations; n++)
+	{
+		const hostalloc_buffer *all[NUM_BUFFERS];
+
+		for (uint32_t i = 0; i < NUM_BUFFERS; i++)
+		{
+			all[i] = &s_buffers[i];
+			allocate_release(m, &all[i], 1, &single);
+		}
+
+		allocate_release(m, all, NUM_BUFFERS, &multi);
+	}
+
+	const int leaked_fds = count_fds() - fds;
+	const int leaked_mappings = count_buffer_mappings() - mappings;
+
+	printf("%s backend, %d iterations\n", backend, iterations);
+	printf("  single: %" PRIu64 " allocations, %" PRIu64 " failed, %.1f us/alloc, %.1f us/release\n",
+	       single.allocations, single.failed, (double)single.alloc_ns / single.allocations / 1000.0,
+	       (double)single.release_ns / (single.allocations - single.failed) / 1000.0);
+	printf("  multi:  %" PRIu64 " allocations of %zu buffers, %" PRIu64 " failed, %.1f us/alloc\n",
+	       multi.allocations, NUM_BUFFERS, multi.failed, (double)multi.alloc_ns / multi.allocations / 1000.0);
+	printf("  bad handles %" PRIu64 ", leaked fds %d, leaked mappings %d\n", single.bad_handles + multi.bad_handles,
+	       leaked_fds, leaked_mappings);
+
+	return (single.bad_handles + multi.bad_handles == 0 && leaked_fds == 0 && leaked_mappings == 0) ? 0 : 1;
+}
@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2018 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * gralloc_lockbench: times lock_flex and unlock of small buffers of the
+ * YUV formats, to compare describing the buffer layout on every lock with
+ * using the layout stored when the buffer was created or retained.
+ *
+ *   gralloc_lockbench [-u] [-n iterations] [-b backend]
+ *
+ *   -u  describe the layout on every lock (GRALLOC_CPU_ACCESS_CACHE=0)
+ *   -n  lock/unlock pairs per format (default 100000)
+ *   -b  allocation backend to use, as GRALLOC_ALLOC_BACKEND (default memfd)
+ *
+ * Only the gralloc1 API is used, so the same binary also times a module
+ * built from before layouts were stored.
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <hardware/hardware.h>
+#include <hardware/gralloc1.h>
+
+#define BENCH_WIDTH 64
+#define BENCH_HEIGHT 64
+
+struct bench_format
+{
+	int32_t format;
+	const char *name;
+};
+
+static const bench_format s_formats[] = {
+	{ HAL_PIXEL_FORMAT_YCbCr_420_888, "YCbCr_420_888" },
+	{ HAL_PIXEL_FORMAT_YV12, "YV12" },
+	{ HAL_PIXEL_FORMAT_YCrCb_420_SP, "YCrCb_420_SP" },
+	{ HAL_PIXEL_FORMAT_YCbCr_422_SP, "YCbCr_422_SP" },
+};
+
+struct bench_functions
+{
+	GRALLOC1_PFN_CREATE_DESCRIPTOR create_descriptor;
+	GRALLOC1_PFN_DESTROY_DESCRIPTOR destroy_descriptor;
+	GRALLOC1_PFN_SET_DIMENSIONS set_dimensions;
+	GRALLOC1_PFN_SET_FORMAT set_format;
+	GRALLOC1_PFN_SET_PRODUCER_USAGE set_producer_usage;
+	GRALLOC1_PFN_SET_CONSUMER_USAGE set_consumer_usage;
+	GRALLOC1_PFN_ALLOCATE allocate;
+	GRALLOC1_PFN_RELEASE release;
+	GRALLOC1_PFN_LOCK_FLEX lock_flex;
+	GRALLOC1_PFN_UNLOCK unlock;
+};
+
+static gralloc1_device_t *s_device;
+static bench_functions s_fn;
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+template <typename T>
+static bool get_function(gralloc1_device_t *device, int32_t descriptor, T *fn)
+{
+	*fn = reinterpret_cast<T>(device->getFunction(device, descriptor));
+
+	if (*fn == NULL)
+	{
+		fprintf(stderr, "The gralloc1 device has no function %d\n", descriptor);
+		return false;
+	}
+
+	return true;
+}
+
+static bool open_device(void)
+{
+	const hw_module_t *module = NULL;
+
+	if (hw_get_module(GRALLOC_HARDWARE_MODULE_ID, &module) != 0 || gralloc1_open(module, &s_device) != 0)
+	{
+		fprintf(stderr, "Can't open the gralloc1 device\n");
+		return false;
+	}
+
+	return get_function(s_device, GRALLOC1_FUNCTION_CREATE_DESCRIPTOR, &s_fn.create_descriptor) &&
+	       get_function(s_device, GRALLOC1_FUNCTION_DESTROY_DESCRIPTOR, &s_fn.destroy_descriptor) &&
+	       get_function(s_device, GRALLOC1_FUNCTION_SET_DIMENSIONS, &s_fn.set_dimensions) &&
+	       get_function(s_device, GRALLOC1_FUNCTION_SET_FORMAT, &s_fn.set_format) &&
+	       get_function(s_device, GRALLOC1_FUNCTION_SET_PRODUCER_USAGE, &s_fn.set_producer_usage) &&
+	       get_function(s_device, GRALLOC1_FUNCTION_SET_CONSUMER_USAGE, &s_fn.set_consumer_usage) &&
+	       get_function(s_device, GRALLOC1_FUNCTION_ALLOCATE, &s_fn.allocate) &&
+	       get_function(s_device, GRALLOC1_FUNCTION_RELEASE, &s_fn.release) &&
+	       get_function(s_device, GRALLOC1_FUNCTION_LOCK_FLEX, &s_fn.lock_flex) &&
+	       get_function(s_device, GRALLOC1_FUNCTION_UNLOCK, &s_fn.unlock);
+}
+
+/* A small buffer the CPU writes and reads. */
+static int allocate_buffer(int32_t format, buffer_handle_t *handle)
+{
+	gralloc1_buffer_descriptor_t descriptor;
+
+	int err = s_fn.create_descriptor(s_device, &descriptor);
+	if (err != GRALLOC1_ERROR_NONE)
+	{
+		return err;
+	}
+
+	err = s_fn.set_dimensions(s_device, descriptor, BENCH_WIDTH, BENCH_HEIGHT);
+	if (err == GRALLOC1_ERROR_NONE)
+	{
+		err = s_fn.set_format(s_device, descriptor, format);
+	}
+	if (err == GRALLOC1_ERROR_NONE)
+	{
+		err = s_fn.set_producer_usage(s_device, descriptor, GRALLOC1_PRODUCER_USAGE_CPU_WRITE_OFTEN);
+	}
+	if (err == GRALLOC1_ERROR_NONE)
+	{
+		err = s_fn.set_consumer_usage(s_device, descriptor, GRALLOC1_CONSUMER_USAGE_CPU_READ_OFTEN);
+	}
+	if (err == GRALLOC1_ERROR_NONE)
+	{
+		err = s_fn.allocate(s_device, 1, &descriptor, handle);
+		if (err == GRALLOC1_ERROR_NOT_SHARED)
+		{
+			err = GRALLOC1_ERROR_NONE;
+		}
+	}
+
+	s_fn.destroy_descriptor(s_device, descriptor);
+
+	return err;
+}
+
+static int lock_unlock(buffer_handle_t handle)
+{
+	const gralloc1_rect_t region = { 0, 0, BENCH_WIDTH, BENCH_HEIGHT };
+	struct android_flex_layout layout;
+	int32_t fence_fd = -1;
+
+	const int err = s_fn.lock_flex(s_device, handle, GRALLOC1_PRODUCER_USAGE_CPU_WRITE_OFTEN,
+	                               GRALLOC1_CONSUMER_USAGE_CPU_READ_OFTEN, &region, &layout, -1);
+	if (err != GRALLOC1_ERROR_NONE)
+	{
+		return err;
+	}
+
+	s_fn.unlock(s_device, handle, &fence_fd);
+	if (fence_fd >= 0)
+	{
+		close(fence_fd);
+	}
+
+	return GRALLOC1_ERROR_NONE;
+}
+
+static void bench_format_locks(const bench_format *f, int iterations)
+{
+	buffer_handle_t handle;
+
+	if (allocate_buffer(f->format, &handle) != GRALLOC1_ERROR_NONE)
+	{
+		printf("  %-16s can't be allocated\n", f->name);
+		return;
+	}
+
+	/* The first lock maps the buffer, which isn't what is being timed. */
+	if (lock_unlock(handle) != GRALLOC1_ERROR_NONE)
+	{
+		printf("  %-16s can't be locked as flex\n", f->name);
+		s_fn.release(s_device, handle);
+		return;
+	}
+
+	int failed = 0;
+	const int64_t start = now_ns();
+
+	for (int i = 0; i < iterations; i++)
+	{
+		if (lock_unlock(handle) != GRALLOC1_ERROR_NONE)
+		{
+			failed++;
+		}
+	}
+
+	const int64_t ns = now_ns() - start;
+
+	printf("  %-16s %8.1f ns/lock+unlock, %d failed\n", f->name, (double)ns / iterations, failed);
+
+	s_fn.release(s_device, handle);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-u] [-n iterations] [-b backend]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+	const char *backend = "memfd";
+	int iterations = 100000;
+	bool uncached = false;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "un:b:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'u':
+			uncached = true;
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		case 'b':
+			backend = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind != argc || iterations <= 0)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	/* Read when the module is opened, or first locks a buffer. */
+	setenv("GRALLOC_ALLOC_BACKEND", backend, 1);
+	setenv("GRALLOC_ALLOC_TRACE_DIR", "", 1);
+	if (uncached)
+	{
+		setenv("GRALLOC_CPU_ACCESS_CACHE", "0", 1);
+	}
+
+	if (!open_device())
+	{
+		return 1;
+	}
+
+	printf("%s layouts, %d iterations, %s backend\n", uncached ? "per-lock" : "stored", iterations, backend);
+
+	for (size_t i = 0; i < sizeof(s_formats) / sizeof(s_formats[0]); i++)
+	{
+		bench_format_locks(&s_formats[i], iterations);
+	}
+
+	gralloc1_close(s_device);
+
+	return 0;
+}
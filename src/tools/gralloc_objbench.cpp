@@ -0,0 +1,383 @@
+/*
+ * Copyright (C) 2018 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * gralloc_objbench: times the calls which create and delete gralloc's
+ * small objects, to compare how they are allocated.
+ *
+ *   gralloc_objbench [-m] [-n iterations] [-t threads] [-b backend]
+ *
+ *   -m  allocate descriptors and handles with malloc (GRALLOC_OBJECT_SLAB=0)
+ *   -n  iterations of each test in each thread (default 100000)
+ *   -t  threads running the tests together (default 1)
+ *   -b  allocation backend to use, as GRALLOC_ALLOC_BACKEND (default memfd)
+ *
+ * The tests are descriptor create and destroy, allocate and release of a
+ * small buffer, and retain and release of a clone of a handle, which
+ * imports and drops it each time like a handle from another process.
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cutils/native_handle.h>
+#include <hardware/hardware.h>
+#include <hardware/gralloc1.h>
+
+#include "mali_gralloc_buffer.h"
+
+#define MAX_THREADS 64
+
+enum bench_test
+{
+	BENCH_DESCRIPTOR,
+	BENCH_ALLOCATE,
+	BENCH_IMPORT,
+	BENCH_TEST_COUNT
+};
+
+static const char *const s_test_names[BENCH_TEST_COUNT] = {
+	"descriptor create/destroy", "allocate/release", "retain/release import",
+};
+
+struct bench_functions
+{
+	GRALLOC1_PFN_CREATE_DESCRIPTOR create_descriptor;
+	GRALLOC1_PFN_DESTROY_DESCRIPTOR destroy_descriptor;
+	GRALLOC1_PFN_SET_DIMENSIONS set_dimensions;
+	GRALLOC1_PFN_SET_FORMAT set_format;
+	GRALLOC1_PFN_SET_PRODUCER_USAGE set_producer_usage;
+	GRALLOC1_PFN_SET_CONSUMER_USAGE set_consumer_usage;
+	GRALLOC1_PFN_ALLOCATE allocate;
+	GRALLOC1_PFN_RETAIN retain;
+	GRALLOC1_PFN_RELEASE release;
+};
+
+struct bench_thread
+{
+	pthread_t thread;
+	int iterations;
+	int64_t ns[BENCH_TEST_COUNT];
+	int failed[BENCH_TEST_COUNT];
+};
+
+static gralloc1_device_t *s_device;
+static bench_functions s_fn;
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+template <typename T>
+static bool get_function(gralloc1_device_t *device, int32_t descriptor, T *fn)
+{
+	*fn = reinterpret_cast<T>(device->getFunction(device, descriptor));
+
+	if (*fn == NULL)
+	{
+		fprintf(stderr, "The gralloc1 device has no function %d\n", descriptor);
+		return false;
+	}
+
+	return true;
+}
+
+static bool open_device(void)
+{
+	const hw_module_t *module = NULL;
+
+	if (hw_get_module(GRALLOC_HARDWARE_MODULE_ID, &module) != 0 || gralloc1_open(module, &s_device) != 0)
+	{
+		fprintf(stderr, "Can't open the gralloc1 device\n");
+		return false;
+	}
+
+	return get_function(s_device, GRALLOC1_FUNCTION_CREATE_DESCRIPTOR, &s_fn.create_descriptor) &&
+	       get_function(s_device, GRALLOC1_FUNCTION_DESTROY_DESCRIPTOR, &s_fn.destroy_descriptor) &&
+	       get_function(s_device, GRALLOC1_FUNCTION_SET_DIMENSIONS, &s_fn.set_dimensions) &&
+	       get_function(s_device, GRALLOC1_FUNCTION_SET_FORMAT, &s_fn.set_format) &&
+	       get_function(s_device, GRALLOC1_FUNCTION_SET_PRODUCER_USAGE, &s_fn.set_producer_usage) &&
+	       get_function(s_device, GRALLOC1_FUNCTION_SET_CONSUMER_USAGE, &s_fn.set_consumer_usage) &&
+	       get_function(s_device, GRALLOC1_FUNCTION_ALLOCATE, &s_fn.allocate) &&
+	       get_function(s_device, GRALLOC1_FUNCTION_RETAIN, &s_fn.retain) &&
+	       get_function(s_device, GRALLOC1_FUNCTION_RELEASE, &s_fn.release);
+}
+
+/* A 64x64 RGBA buffer the CPU writes and reads, which every backend can allocate. */
+static int create_descriptor(gralloc1_buffer_descriptor_t *descriptor)
+{
+	int err = s_fn.create_descriptor(s_device, descriptor);
+	if (err != GRALLOC1_ERROR_NONE)
+	{
+		return err;
+	}
+
+	err = s_fn.set_dimensions(s_device, *descriptor, 64, 64);
+	if (err == GRALLOC1_ERROR_NONE)
+	{
+		err = s_fn.set_format(s_device, *descriptor, HAL_PIXEL_FORMAT_RGBA_8888);
+	}
+	if (err == GRALLOC1_ERROR_NONE)
+	{
+		err = s_fn.set_producer_usage(s_device, *descriptor, GRALLOC1_PRODUCER_USAGE_CPU_WRITE_OFTEN);
+	}
+	if (err == GRALLOC1_ERROR_NONE)
+	{
+		err = s_fn.set_consumer_usage(s_device, *descriptor, GRALLOC1_CONSUMER_USAGE_CPU_READ_OFTEN);
+	}
+
+	if (err != GRALLOC1_ERROR_NONE)
+	{
+		s_fn.destroy_descriptor(s_device, *descriptor);
+	}
+
+	return err;
+}
+
+static void bench_descriptor(bench_thread *t)
+{
+	const int64_t start = now_ns();
+
+	for (int i = 0; i < t->iterations; i++)
+	{
+		gralloc1_buffer_descriptor_t descriptor;
+
+		if (s_fn.create_descriptor(s_device, &descriptor) != GRALLOC1_ERROR_NONE)
+		{
+			t->failed[BENCH_DESCRIPTOR]++;
+			continue;
+		}
+
+		s_fn.destroy_descriptor(s_device, descriptor);
+	}
+
+	t->ns[BENCH_DESCRIPTOR] = now_ns() - start;
+}
+
+static void bench_allocate(bench_thread *t, gralloc1_buffer_descriptor_t descriptor)
+{
+	const int64_t start = now_ns();
+
+	for (int i = 0; i < t->iterations; i++)
+	{
+		buffer_handle_t handle;
+		const int err = s_fn.allocate(s_device, 1, &descriptor, &handle);
+
+		if (err != GRALLOC1_ERROR_NONE && err != GRALLOC1_ERROR_NOT_SHARED)
+		{
+			t->failed[BENCH_ALLOCATE]++;
+			continue;
+		}
+
+		s_fn.release(s_device, handle);
+	}
+
+	t->ns[BENCH_ALLOCATE] = now_ns() - start;
+}
+
+/* Clones a handle as another process would receive it, see import_buffer() in gralloc_replay. */
+static native_handle_t *clone_handle(gralloc1_buffer_descriptor_t descriptor)
+{
+	buffer_handle_t handle;
+	const int err = s_fn.allocate(s_device, 1, &descriptor, &handle);
+
+	if (err != GRALLOC1_ERROR_NONE && err != GRALLOC1_ERROR_NOT_SHARED)
+	{
+		return NULL;
+	}
+
+	native_handle_t * const clone = native_handle_clone(handle);
+	s_fn.release(s_device, handle);
+
+	if (clone == NULL)
+	{
+		return NULL;
+	}
+
+	private_handle_t * const hnd = (private_handle_t *)clone;
+	hnd->allocating_pid = 0;
+#if GRALLOC_COMPACT_HANDLE == 0
+	hnd->remote_pid = 0;
+	hnd->ref_count = 0;
+	hnd->base = NULL;
+	hnd->attr_base = MAP_FAILED;
+#endif
+
+	return clone;
+}
+
+static void bench_import(bench_thread *t, gralloc1_buffer_descriptor_t descriptor)
+{
+	native_handle_t * const clone = clone_handle(descriptor);
+
+	if (clone == NULL)
+	{
+		t->failed[BENCH_IMPORT] = t->iterations;
+		return;
+	}
+
+	const int64_t start = now_ns();
+
+	for (int i = 0; i < t->iterations; i++)
+	{
+		if (s_fn.retain(s_device, clone) != GRALLOC1_ERROR_NONE)
+		{
+			t->failed[BENCH_IMPORT]++;
+			continue;
+		}
+
+		s_fn.release(s_device, clone);
+	}
+
+	t->ns[BENCH_IMPORT] = now_ns() - start;
+
+	native_handle_close(clone);
+	native_handle_delete(clone);
+}
+
+static void *bench_thread_main(void *arg)
+{
+	bench_thread * const t = (bench_thread *)arg;
+	gralloc1_buffer_descriptor_t descriptor;
+
+	bench_descriptor(t);
+
+	if (create_descriptor(&descriptor) != GRALLOC1_ERROR_NONE)
+	{
+		t->failed[BENCH_ALLOCATE] = t->iterations;
+		t->failed[BENCH_IMPORT] = t->iterations;
+		return NULL;
+	}
+
+	bench_allocate(t, descriptor);
+	bench_import(t, descriptor);
+
+	s_fn.destroy_descriptor(s_device, descriptor);
+
+	return NULL;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-m] [-n iterations] [-t threads] [-b backend]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+	const char *backend = "memfd";
+	int iterations = 100000;
+	int threads = 1;
+	bool use_malloc = false;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "mn:t:b:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'm':
+			use_malloc = true;
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case 'b':
+			backend = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind != argc || iterations <= 0 || threads <= 0 || threads > MAX_THREADS)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	/* All are read when the module is opened, or first allocates an object. */
+	setenv("GRALLOC_ALLOC_BACKEND", backend, 1);
+	setenv("GRALLOC_ALLOC_TRACE_DIR", "", 1);
+	if (use_malloc)
+	{
+		setenv("GRALLOC_OBJECT_SLAB", "0", 1);
+	}
+
+	if (!open_device())
+	{
+		return 1;
+	}
+
+	bench_thread *t = (bench_thread *)calloc(threads, sizeof(*t));
+	if (t == NULL)
+	{
+		return 1;
+	}
+
+	for (int i = 0; i < threads; i++)
+	{
+		t[i].iterations = iterations;
+
+		if (pthread_create(&t[i].thread, NULL, bench_thread_main, &t[i]) != 0)
+		{
+			fprintf(stderr, "Can't start thread %d\n", i);
+			return 1;
+		}
+	}
+
+	for (int i = 0; i < threads; i++)
+	{
+		pthread_join(t[i].thread, NULL);
+	}
+
+	printf("%s objects, %d thread(s) x %d iterations, %s backend\n", use_malloc ? "malloc" : "slab", threads,
+	       iterations, backend);
+
+	for (int test = 0; test < BENCH_TEST_COUNT; test++)
+	{
+		int64_t ns = 0;
+		int64_t failed = 0;
+
+		for (int i = 0; i < threads; i++)
+		{
+			ns += t[i].ns[test];
+			failed += t[i].failed[test];
+		}
+
+		printf("  %-26s %8.1f ns/iteration, %" PRId64 " failed\n", s_test_names[test],
+		       (double)ns / ((int64_t)threads * iterations), failed);
+	}
+
+	free(t);
+	gralloc1_close(s_device);
+
+	return 0;
+}
@@ -0,0 +1,752 @@
+/*
+ * Copyright (C) 2018 ARM Limited. All rights reserved.
+ *
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * gralloc_replay: runs an allocation trace again through the gralloc1
+ * device, to measure allocator changes on a repeatable workload.
+ *
+ *   gralloc_replay [-t] [-b backend] trace
+ *
+ *   -t  keep the timing of the trace; by default calls run back to back
+ *   -b  allocation backend to use, as GRALLOC_ALLOC_BACKEND (default memfd)
+ *
+ * Calls run one at a time in trace order, so every run does the same
+ * work. Buffers the traced process retained from another process are
+ * allocated untimed and imported as a clone of their handle, so the timed
+ * retain maps them like the original did. The tool reports the latency of
+ * each kind of call and the peak memory of the buffers held.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include <cutils/native_handle.h>
+#include <hardware/hardware.h>
+#include <hardware/gralloc1.h>
+
+#include "mali_gralloc_buffer.h"
+#include "mali_gralloc_private_interface.h"
+#include "mali_gralloc_private_interface_types.h"
+#include "mali_gralloc_formats.h"
+
+/* Largest number of handles allocated together. */
+#define MAX_DESCRIPTORS 8
+
+/* Flex planes of the formats gralloc can lock for YUV access. */
+#define MAX_FLEX_PLANES 4
+
+enum replay_op
+{
+	REPLAY_ALLOCATE,
+	REPLAY_IMPORT,
+	REPLAY_RETAIN,
+	REPLAY_RELEASE,
+	REPLAY_LOCK,
+	REPLAY_UNLOCK,
+	REPLAY_OP_COUNT
+};
+
+static const char *const s_op_names[REPLAY_OP_COUNT] = {
+	"allocate", "import", "retain", "release", "lock", "unlock",
+};
+
+struct replay_functions
+{
+	GRALLOC1_PFN_CREATE_DESCRIPTOR create_descriptor;
+	GRALLOC1_PFN_DESTROY_DESCRIPTOR destroy_descriptor;
+	GRALLOC1_PFN_SET_DIMENSIONS set_dimensions;
+	GRALLOC1_PFN_SET_FORMAT set_format;
+	GRALLOC1_PFN_SET_PRODUCER_USAGE set_producer_usage;
+	GRALLOC1_PFN_SET_CONSUMER_USAGE set_consumer_usage;
+#if PLATFORM_SDK_VERSION >= 26
+	GRALLOC1_PFN_SET_LAYER_COUNT set_layer_count;
+#endif
+	GRALLOC1_PFN_PRIVATE_SET_PRIV_FMT set_priv_fmt;
+	GRALLOC1_PFN_ALLOCATE allocate;
+	GRALLOC1_PFN_RETAIN retain;
+	GRALLOC1_PFN_RELEASE release;
+	GRALLOC1_PFN_LOCK lock;
+	GRALLOC1_PFN_LOCK_FLEX lock_flex;
+	GRALLOC1_PFN_UNLOCK unlock;
+};
+
+/* A handle of the trace and the one standing in for it. */
+struct replay_buffer
+{
+	buffer_handle_t handle;
+	bool imported;  /* A clone the replay must close and delete after the last release. */
+	int ref_count;
+	uint64_t store; /* Backing store id of the replayed buffer. */
+};
+
+struct replay_store
+{
+	uint64_t size;
+	uint32_t handles;
+};
+
+struct replay_state
+{
+	gralloc1_device_t *device;
+	replay_functions fn;
+
+	std::map<uint64_t, replay_buffer> buffers;
+	std::map<uint64_t, replay_store> stores;
+	uint64_t memory;
+	uint64_t peak_memory;
+
+	std::vector<uint64_t> latency[REPLAY_OP_COUNT];
+	uint32_t failed[REPLAY_OP_COUNT];
+	uint32_t mismatched; /* Calls which failed in the trace but not on replay, or the other way around. */
+	uint32_t skipped;    /* Records for handles the trace doesn't show being created. */
+};
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+template <typename T>
+static bool get_function(gralloc1_device_t *device, int32_t descriptor, T *fn)
+{
+	*fn = reinterpret_cast<T>(device->getFunction(device, descriptor));
+
+	if (*fn == NULL)
+	{
+		fprintf(stderr, "gralloc1 function %d missing\n", descriptor);
+		return false;
+	}
+
+	return true;
+}
+
+static bool open_device(replay_state *state)
+{
+	const hw_module_t *module = NULL;
+
+	if (hw_get_module(GRALLOC_HARDWARE_MODULE_ID, &module) != 0 || gralloc1_open(module, &state->device) != 0)
+	{
+		fprintf(stderr, "Can't open the gralloc1 device\n");
+		return false;
+	}
+
+	gralloc1_device_t * const device = state->device;
+	replay_functions * const fn = &state->fn;
+
+	return get_function(device, GRALLOC1_FUNCTION_CREATE_DESCRIPTOR, &fn->create_descriptor) &&
+	       get_function(device, GRALLOC1_FUNCTION_DESTROY_DESCRIPTOR, &fn->destroy_descriptor) &&
+	       get_function(device, GRALLOC1_FUNCTION_SET_DIMENSIONS, &fn->set_dimensions) &&
+	       get_function(device, GRALLOC1_FUNCTION_SET_FORMAT, &fn->set_format) &&
+	       get_function(device, GRALLOC1_FUNCTION_SET_PRODUCER_USAGE, &fn->set_producer_usage) &&
+	       get_function(device, GRALLOC1_FUNCTION_SET_CONSUMER_USAGE, &fn->set_consumer_usage) &&
+#if PLATFORM_SDK_VERSION >= 26
+	       get_function(device, GRALLOC1_FUNCTION_SET_LAYER_COUNT, &fn->set_layer_count) &&
+#endif
+	       get_function(device, MALI_GRALLOC1_FUNCTION_SET_PRIV_FMT, &fn->set_priv_fmt) &&
+	       get_function(device, GRALLOC1_FUNCTION_ALLOCATE, &fn->allocate) &&
+	       get_function(device, GRALLOC1_FUNCTION_RETAIN, &fn->retain) &&
+	       get_function(device, GRALLOC1_FUNCTION_RELEASE, &fn->release) &&
+	       get_function(device, GRALLOC1_FUNCTION_LOCK, &fn->lock) &&
+	       get_function(device, GRALLOC1_FUNCTION_LOCK_FLEX, &fn->lock_flex) &&
+	       get_function(device, GRALLOC1_FUNCTION_UNLOCK, &fn->unlock);
+}
+
+static int create_descriptor(replay_state *state, uint32_t width, uint32_t height, uint64_t producer_usage,
+                             uint64_t consumer_usage, uint64_t format, bool internal_format, uint32_t layer_count,
+                             gralloc1_buffer_descriptor_t *descriptor)
+{
+	const replay_functions * const fn = &state->fn;
+	gralloc1_device_t * const device = state->device;
+
+	int err = fn->create_descriptor(device, descriptor);
+	if (err != GRALLOC1_ERROR_NONE)
+	{
+		return err;
+	}
+
+	err = fn->set_dimensions(device, *descriptor, width, height);
+	if (err == GRALLOC1_ERROR_NONE)
+	{
+		err = internal_format ? fn->set_priv_fmt(device, *descriptor, format)
+		                      : fn->set_format(device, *descriptor, (int32_t)format);
+	}
+	if (err == GRALLOC1_ERROR_NONE)
+	{
+		err = fn->set_producer_usage(device, *descriptor, producer_usage);
+	}
+	if (err == GRALLOC1_ERROR_NONE)
+	{
+		err = fn->set_consumer_usage(device, *descriptor, consumer_usage);
+	}
+#if PLATFORM_SDK_VERSION >= 26
+	if (err == GRALLOC1_ERROR_NONE)
+	{
+		err = fn->set_layer_count(device, *descriptor, layer_count);
+	}
+#else
+	(void)layer_count;
+#endif
+
+	if (err != GRALLOC1_ERROR_NONE)
+	{
+		fn->destroy_descriptor(device, *descriptor);
+	}
+
+	return err;
+}
+
+static void add_buffer(replay_state *state, uint64_t key, buffer_handle_t handle, bool imported)
+{
+	const private_handle_t * const hnd = (const private_handle_t *)handle;
+	replay_buffer buffer;
+
+	buffer.handle = handle;
+	buffer.imported = imported;
+	buffer.ref_count = 1;
+	buffer.store = hnd->backing_store_id;
+	state->buffers[key] = buffer;
+
+	replay_store &store = state->stores[buffer.store];
+	if (store.handles++ == 0)
+	{
+		store.size = hnd->size;
+		state->memory += store.size;
+		state->peak_memory = std::max(state->peak_memory, state->memory);
+	}
+}
+
+/* Called after the last release of a buffer, when its handle may have been deleted. */
+static void remove_buffer(replay_state *state, std::map<uint64_t, replay_buffer>::iterator it)
+{
+	if (it->second.imported)
+	{
+		native_handle_close(it->second.handle);
+		native_handle_delete(const_cast<native_handle_t *>(it->second.handle));
+	}
+
+	std::map<uint64_t, replay_store>::iterator store = state->stores.find(it->second.store);
+	if (--store->second.handles == 0)
+	{
+		state->memory -= store->second.size;
+		state->stores.erase(store);
+	}
+
+	state->buffers.erase(it);
+}
+
+static void record_call(replay_state *state, replay_op op, int64_t start_ns, bool failed, bool traced_failed)
+{
+	state->latency[op].push_back((uint64_t)(now_ns() - start_ns));
+
+	if (failed)
+	{
+		state->failed[op]++;
+	}
+
+	if (failed != traced_failed)
+	{
+		state->mismatched++;
+	}
+}
+
+static void replay_allocate(replay_state *state, const mali_gralloc_trace_record *const *records,
+                            const mali_gralloc_trace_allocate_info *const *payloads, uint32_t num)
+{
+	gralloc1_buffer_descriptor_t descriptors[MAX_DESCRIPTORS];
+	buffer_handle_t handles[MAX_DESCRIPTORS];
+	uint32_t created = 0;
+	int err = GRALLOC1_ERROR_NONE;
+
+	for (; created < num && err == GRALLOC1_ERROR_NONE; created++)
+	{
+		const mali_gralloc_trace_allocate_info * const p = payloads[created];
+
+		err = create_descriptor(state, p->width, p->height, p->producer_usage, p->consumer_usage, p->hal_format,
+		                        p->format_type == MALI_GRALLOC_FORMAT_TYPE_INTERNAL, p->layer_count,
+		                        &descriptors[created]);
+	}
+
+	if (err != GRALLOC1_ERROR_NONE)
+	{
+		created--;
+		state->failed[REPLAY_ALLOCATE]++;
+		if (records[0]->result == 0)
+		{
+			state->mismatched++;
+		}
+	}
+	else
+	{
+		const int64_t start = now_ns();
+		err = state->fn.allocate(state->device, num, descriptors, handles);
+		const bool failed = (err != GRALLOC1_ERROR_NONE && err != GRALLOC1_ERROR_NOT_SHARED);
+
+		record_call(state, REPLAY_ALLOCATE, start, failed, records[0]->result != 0);
+
+		for (uint32_t i = 0; i < num && !failed; i++)
+		{
+			/* An allocation which failed when traced is not used again. */
+			if (records[i]->handle == 0)
+			{
+				state->fn.release(state->device, handles[i]);
+				continue;
+			}
+
+			add_buffer(state, records[i]->handle, handles[i], false);
+		}
+	}
+
+	for (uint32_t i = 0; i < created; i++)
+	{
+		state->fn.destroy_descriptor(state->device, descriptors[i]);
+	}
+}
+
+/* Makes a handle that looks to gralloc like one received from another process. */
+static buffer_handle_t import_buffer(replay_state *state, const mali_gralloc_trace_retain_info *p)
+{
+	gralloc1_buffer_descriptor_t descriptor;
+	buffer_handle_t handle = NULL;
+
+	/*
+	 * The requested format may have been a flexible one, or the handle a private format that was never
+	 * requested through gralloc1, so ask for exactly the format and modifiers it was allocated with.
+	 */
+	if (create_descriptor(state, p->width, p->height, p->producer_usage, p->consumer_usage, p->alloc_format, true,
+	                      p->layer_count, &descriptor) != GRALLOC1_ERROR_NONE)
+	{
+		return NULL;
+	}
+
+	const int err = state->fn.allocate(state->device, 1, &descriptor, &handle);
+	state->fn.destroy_descriptor(state->device, descriptor);
+
+	if (err != GRALLOC1_ERROR_NONE && err != GRALLOC1_ERROR_NOT_SHARED)
+	{
+		return NULL;
+	}
+
+	native_handle_t * const clone = native_handle_clone(handle);
+
+	/* The clone holds its own fds, so the memory stays until it is closed. */
+	state->fn.release(state->device, handle);
+
+	if (clone == NULL)
+	{
+		return NULL;
+	}
+
+	private_handle_t * const hnd = (private_handle_t *)clone;
+	hnd->allocating_pid = 0;
+#if GRALLOC_COMPACT_HANDLE == 0
+	/* Compact clones end before these, and retaining them makes a local copy anyway. */
+	hnd->remote_pid = 0;
+	hnd->ref_count = 0;
+	hnd->base = NULL;
+	hnd->attr_base = MAP_FAILED;
+#endif
+
+	return clone;
+}
+
+static void replay_retain(replay_state *state, const mali_gralloc_trace_record *record,
+                          const mali_gralloc_trace_retain_info *p)
+{
+	std::map<uint64_t, replay_buffer>::iterator it = state->buffers.find(record->handle);
+
+	if (it != state->buffers.end())
+	{
+		const int64_t start = now_ns();
+		const int err = state->fn.retain(state->device, it->second.handle);
+
+		record_call(state, REPLAY_RETAIN, start, err != GRALLOC1_ERROR_NONE, record->result != 0);
+
+		if (err == GRALLOC1_ERROR_NONE)
+		{
+			it->second.ref_count++;
+		}
+
+		return;
+	}
+
+	if (!p->imported || record->result != 0)
+	{
+		state->skipped++;
+		return;
+	}
+
+	buffer_handle_t handle = import_buffer(state, p);
+	if (handle == NULL)
+	{
+		state->failed[REPLAY_IMPORT]++;
+		state->mismatched++;
+		return;
+	}
+
+	const int64_t start = now_ns();
+	const int err = state->fn.retain(state->device, handle);
+
+	record_call(state, REPLAY_IMPORT, start, err != GRALLOC1_ERROR_NONE, false);
+
+	if (err != GRALLOC1_ERROR_NONE)
+	{
+		native_handle_close(handle);
+		native_handle_delete(const_cast<native_handle_t *>(handle));
+		return;
+	}
+
+	add_buffer(state, record->handle, handle, true);
+}
+
+static void replay_release(replay_state *state, const mali_gralloc_trace_record *record)
+{
+	std::map<uint64_t, replay_buffer>::iterator it = state->buffers.find(record->handle);
+
+	if (it == state->buffers.end())
+	{
+		state->skipped++;
+		return;
+	}
+
+	const int64_t start = now_ns();
+	const int err = state->fn.release(state->device, it->second.handle);
+
+	record_call(state, REPLAY_RELEASE, start, err != GRALLOC1_ERROR_NONE, false);
+
+	if (err == GRALLOC1_ERROR_NONE && --it->second.ref_count == 0)
+	{
+		remove_buffer(state, it);
+	}
+}
+
+static void replay_lock(replay_state *state, const mali_gralloc_trace_record *record, const mali_gralloc_trace_lock_info *p)
+{
+	std::map<uint64_t, replay_buffer>::iterator it = state->buffers.find(record->handle);
+
+	if (it == state->buffers.end())
+	{
+		state->skipped++;
+		return;
+	}
+
+	/* gralloc1 takes CPU writes as producer usage and CPU reads as either. */
+	const uint64_t producer_usage = p->usage & (GRALLOC1_PRODUCER_USAGE_CPU_READ_OFTEN |
+	                                            GRALLOC1_PRODUCER_USAGE_CPU_WRITE_OFTEN);
+	const uint64_t consumer_usage = p->usage & GRALLOC1_CONSUMER_USAGE_CPU_READ_OFTEN;
+	const gralloc1_rect_t region = { p->l, p->t, p->w, p->h };
+	int err;
+
+	const int64_t start = now_ns();
+	if (p->ycbcr)
+	{
+		android_flex_plane_t planes[MAX_FLEX_PLANES];
+		android_flex_layout layout;
+
+		layout.num_planes = MAX_FLEX_PLANES;
+		layout.planes = planes;
+		err = state->fn.lock_flex(state->device, it->second.handle, producer_usage, consumer_usage, &region, &layout,
+		                          -1);
+	}
+	else
+	{
+		void *data = NULL;
+
+		err = state->fn.lock(state->device, it->second.handle, producer_usage, consumer_usage, &region, &data, -1);
+	}
+
+	record_call(state, REPLAY_LOCK, start, err != GRALLOC1_ERROR_NONE, record->result != 0);
+}
+
+static void replay_unlock(replay_state *state, const mali_gralloc_trace_record *record)
+{
+	std::map<uint64_t, replay_buffer>::iterator it = state->buffers.find(record->handle);
+
+	if (it == state->buffers.end())
+	{
+		state->skipped++;
+		return;
+	}
+
+	int32_t release_fence = -1;
+
+	const int64_t start = now_ns();
+	const int err = state->fn.unlock(state->device, it->second.handle, &release_fence);
+
+	record_call(state, REPLAY_UNLOCK, start, err != GRALLOC1_ERROR_NONE, false);
+
+	if (release_fence >= 0)
+	{
+		close(release_fence);
+	}
+}
+
+static bool read_trace(const char *path, std::vector<uint8_t> *data)
+{
+	const int fd = open(path, O_RDONLY | O_CLOEXEC);
+	struct stat st;
+
+	if (fd < 0 || fstat(fd, &st) != 0)
+	{
+		fprintf(stderr, "Can't open %s: %s\n", path, strerror(errno));
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+		return false;
+	}
+
+	data->resize(st.st_size);
+
+	size_t done = 0;
+	while (done < data->size())
+	{
+		const ssize_t len = read(fd, &(*data)[done], data->size() - done);
+
+		if (len <= 0)
+		{
+			break;
+		}
+
+		done += len;
+	}
+
+	close(fd);
+	data->resize(done);
+
+	const mali_gralloc_trace_header *header = (const mali_gralloc_trace_header *)&(*data)[0];
+
+	if (data->size() < sizeof(*header) || header->magic != MALI_GRALLOC_TRACE_MAGIC ||
+	    header->version != MALI_GRALLOC_TRACE_VERSION)
+	{
+		fprintf(stderr, "%s is not a gralloc allocation trace\n", path);
+		return false;
+	}
+
+	return true;
+}
+
+static bool replay(replay_state *state, const std::vector<uint8_t> &data, bool timed)
+{
+	const mali_gralloc_trace_record *group[MAX_DESCRIPTORS];
+	const mali_gralloc_trace_allocate_info *group_payloads[MAX_DESCRIPTORS];
+	uint32_t group_size = 0;
+	const int64_t start = now_ns();
+	size_t offset = sizeof(mali_gralloc_trace_header);
+
+	while (offset + sizeof(mali_gralloc_trace_record) <= data.size())
+	{
+		const mali_gralloc_trace_record *record = (const mali_gralloc_trace_record *)&data[offset];
+		const void *payload = record + 1;
+
+		if (record->size < sizeof(*record) || offset + record->size > data.size())
+		{
+			/* The traced process was killed while writing the record. */
+			break;
+		}
+
+		offset += record->size;
+
+		if (timed)
+		{
+			const int64_t wait = (int64_t)record->time_ns - (now_ns() - start);
+
+			if (wait > 0)
+			{
+				struct timespec ts = { (time_t)(wait / 1000000000LL), (long)(wait % 1000000000LL) };
+				nanosleep(&ts, NULL);
+			}
+		}
+
+		switch (record->op)
+		{
+		case MALI_GRALLOC_TRACE_ALLOCATE:
+		{
+			if (record->size < sizeof(*record) + sizeof(mali_gralloc_trace_allocate_info))
+			{
+				return false;
+			}
+
+			const mali_gralloc_trace_allocate_info *p = (const mali_gralloc_trace_allocate_info *)payload;
+
+			/* Handles allocated together are traced one by one and replayed in one call. */
+			if (p->num_descriptors == 0 || p->num_descriptors > MAX_DESCRIPTORS || p->index != group_size)
+			{
+				group_size = 0;
+				state->skipped++;
+				break;
+			}
+
+			group[group_size] = record;
+			group_payloads[group_size] = p;
+			group_size++;
+
+			/* A failed allocation is traced once, whatever the number of handles. */
+			if (group_size == p->num_descriptors || record->result != 0)
+			{
+				replay_allocate(state, group, group_payloads, group_size);
+				group_size = 0;
+			}
+			break;
+		}
+		case MALI_GRALLOC_TRACE_RETAIN:
+			if (record->size < sizeof(*record) + sizeof(mali_gralloc_trace_retain_info))
+			{
+				return false;
+			}
+
+			replay_retain(state, record, (const mali_gralloc_trace_retain_info *)payload);
+			break;
+		case MALI_GRALLOC_TRACE_FREE:
+		case MALI_GRALLOC_TRACE_RELEASE:
+			replay_release(state, record);
+			break;
+		case MALI_GRALLOC_TRACE_LOCK:
+			if (record->size < sizeof(*record) + sizeof(mali_gralloc_trace_lock_info))
+			{
+				return false;
+			}
+
+			replay_lock(state, record, (const mali_gralloc_trace_lock_info *)payload);
+			break;
+		case MALI_GRALLOC_TRACE_UNLOCK:
+			replay_unlock(state, record);
+			break;
+		default:
+			state->skipped++;
+			break;
+		}
+	}
+
+	return true;
+}
+
+static double percentile_us(const std::vector<uint64_t> &sorted, uint32_t percent)
+{
+	const size_t i = ((sorted.size() - 1) * percent + 50) / 100;
+
+	return sorted[i] / 1000.0;
+}
+
+static void report(replay_state *state)
+{
+	printf("%-9s %8s %8s %10s %10s %10s %10s %10s\n", "call", "count", "failed", "min us", "p50 us", "p90 us",
+	       "p99 us", "max us");
+
+	for (uint32_t op = 0; op < REPLAY_OP_COUNT; op++)
+	{
+		std::vector<uint64_t> &latency = state->latency[op];
+
+		if (latency.empty())
+		{
+			continue;
+		}
+
+		std::sort(latency.begin(), latency.end());
+
+		printf("%-9s %8zu %8u %10.1f %10.1f %10.1f %10.1f %10.1f\n", s_op_names[op], latency.size(),
+		       state->failed[op], latency.front() / 1000.0, percentile_us(latency, 50), percentile_us(latency, 90),
+		       percentile_us(latency, 99), latency.back() / 1000.0);
+	}
+
+	printf("\npeak memory: %" PRIu64 " KB, still held at the end: %zu buffers, %" PRIu64 " KB\n",
+	       state->peak_memory / 1024, state->buffers.size(), state->memory / 1024);
+
+	if (state->mismatched != 0 || state->skipped != 0)
+	{
+		printf("%u calls succeeded or failed unlike the trace, %u records skipped\n", state->mismatched,
+		       state->skipped);
+	}
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-t] [-b backend] trace\n", name);
+}
+
+int main(int argc, char **argv)
+{
+	const char *backend = "memfd";
+	bool timed = false;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "tb:")) != -1)
+	{
+		switch (opt)
+		{
+		case 't':
+			timed = true;
+			break;
+		case 'b':
+			backend = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind != argc - 1)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	std::vector<uint8_t> data;
+	if (!read_trace(argv[optind], &data))
+	{
+		return 1;
+	}
+
+	/* Both are read when the module is opened. The replay itself is not traced. */
+	setenv("GRALLOC_ALLOC_BACKEND", backend, 1);
+	setenv("GRALLOC_ALLOC_TRACE_DIR", "", 1);
+
+	replay_state *state = new replay_state();
+	if (!open_device(state))
+	{
+		return 1;
+	}
+
+	if (!replay(state, data, timed))
+	{
+		fprintf(stderr, "%s has a truncated record\n", argv[optind]);
+	}
+
+	report(state);
+
+	/* Buffers the trace didn't release are left to process exit. */
+	gralloc1_close(state->device);
+	delete state;
+
+	return 0;
+}